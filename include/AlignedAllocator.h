@@ -0,0 +1,60 @@
+/*
+    This file is part of Horst.
+
+    Horst is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Horst is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Horst.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef ALIGNEDALLOCATOR_H
+#define ALIGNEDALLOCATOR_H 1
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+// Allocator for std::vector whose storage begins at a multiple of ALIGNMENT bytes.
+// With the default of 64 bytes, the first element of a Spectrum or a ResponseMatrix starts
+// at a cache line and at the width of the widest vector registers (AVX-512), so the
+// vectorized loops over the bins need no peeling for a misaligned start.
+// posix_memalign is used instead of std::aligned_alloc, which requires C++17 and a size
+// that is a multiple of the alignment.
+template <typename T, std::size_t ALIGNMENT = 64>
+class AlignedAllocator{
+public:
+	typedef T value_type;
+
+	template <typename U>
+	struct rebind{
+		typedef AlignedAllocator<U, ALIGNMENT> other;
+	};
+
+	AlignedAllocator(){};
+	template <typename U>
+	AlignedAllocator(const AlignedAllocator<U, ALIGNMENT> &){};
+
+	T* allocate(const std::size_t n){
+		void *pointer = nullptr;
+		if(posix_memalign(&pointer, ALIGNMENT, n*sizeof(T)) != 0){
+			throw std::bad_alloc();
+		}
+		return (T*) pointer;
+	};
+	void deallocate(T *pointer, const std::size_t){ free(pointer); };
+};
+
+template <typename T, typename U, std::size_t ALIGNMENT>
+bool operator==(const AlignedAllocator<T, ALIGNMENT> &, const AlignedAllocator<U, ALIGNMENT> &){ return true; }
+template <typename T, typename U, std::size_t ALIGNMENT>
+bool operator!=(const AlignedAllocator<T, ALIGNMENT> &, const AlignedAllocator<U, ALIGNMENT> &){ return false; }
+
+#endif
@@ -0,0 +1,45 @@
+/*
+    This file is part of Horst.
+
+    Horst is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Horst is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Horst.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef BASISFITFUNCTION_H
+#define BASISFITFUNCTION_H 1
+
+#include <vector>
+
+#include <TROOT.h>
+
+using std::vector;
+
+// Fit function in terms of the coefficients of a SplineBasis: bin j of the spectrum is
+// sum_k D(j, k)*p[k] with the design matrix D. The coefficients of a bin are contiguous.
+class BasisFitFunction{
+	public:
+		BasisFitFunction(const UInt_t binning): inverse_BINNING(1./binning), n_functions(0){};
+		~BasisFitFunction(){};
+		Double_t operator()(Double_t *x, Double_t *p);
+		void setDesignMatrix(const vector<Double_t> &design_matrix, const size_t n_basis_functions){
+			design = design_matrix;
+			n_functions = n_basis_functions;
+		};
+
+	private:
+		const Double_t inverse_BINNING;
+		size_t n_functions;
+		vector<Double_t> design;
+};
+
+#endif
@@ -20,39 +20,52 @@
 
 #include <TH2.h>
 
+#include <vector>
+
+#include "ResponseMatrix.h"
+
+using std::vector;
+
+// Model of the spectrum for the fit. Only the energies in the fit range [binstart, binstop)
+// have a parameter: bin j of the model is sum_k p[k]*rema(binstart + k, j). The function
+// keeps only this block of the response matrix, with the contributions to each bin
+// contiguous, so the cost of an evaluation is proportional to the width of the fit range.
 class FitFunction{
 	public:
-		FitFunction(const TString name, const TH2F &rema, const UInt_t binning, Int_t binstart, Int_t binstop): 
-			response_matrix(TH2F(name, name, rema.GetNbinsX(), rema.GetXaxis()->GetXmin(), rema.GetXaxis()->GetXmax(), rema.GetNbinsY(), rema.GetYaxis()->GetXmin(), rema.GetYaxis()->GetXmax())),
+		FitFunction(const TH2F &rema, const UInt_t binning, Int_t binstart, Int_t binstop): 
 			BINNING(binning),
 			inverse_BINNING(1./binning),
 			bin_start(binstart),
-			bin_stop(binstop)
+			n_parameters(binstop > binstart ? binstop - binstart : 0),
+			n_rows(0),
+			upper_band(0)
 	{
-		for(Int_t i = 1; i <= rema.GetNbinsX(); ++i){
-			for(Int_t j = 1; j <= rema.GetNbinsX(); ++j){
-				response_matrix.SetBinContent(i, j, rema.GetBinContent(i, j));
-			}
-		}
+		setResponseMatrix(rema);
 	};
 		~FitFunction(){};
 		Double_t operator()(Double_t *x, Double_t *p);
-		Double_t getSimulationStatisticalUncertainty(const Int_t bin, const TH1F &params);
-		Double_t getSpectrumStatisticalUncertainty(const Int_t bin, const TH1F &params, const TH1F &spectrum);
+		Int_t getNParameters() const { return n_parameters; };
+		// A matrix into which the detector resolution was folded also has entries above the
+		// diagonal, i.e. an energy i contributes to bins j > i. The number of these
+		// diagonals is determined here, so that triangular matrices keep the fast sum.
 		void setResponseMatrix(const TH2F &rema){
-			for(Int_t i = 1; i <= rema.GetNbinsX(); ++i){
-				for(Int_t j = 1; j <= rema.GetNbinsX(); ++j){
-					response_matrix.SetBinContent(i, j, rema.GetBinContent(i, j));
-				}
-			}
+			setBlock(rema.GetArray(), (size_t) rema.GetNbinsX() + 2, rema.GetNbinsY());
+		};
+		void setResponseMatrix(const ResponseMatrix &rema){
+			setBlock(rema.getContributions(0), (size_t) rema.getNBins() + 2, rema.getNBins());
 		};
 
 	private:
-		TH2F response_matrix;
+		void setBlock(const Float_t *rema_array, const size_t row_length, const Int_t nbins);
+
+		// block[n_parameters*j + k] = rema(bin_start + k, j) for j = 0 ... nbins
+		vector<Float_t> block;
 		const UInt_t BINNING;
 		const Double_t inverse_BINNING;
 		const Int_t bin_start;
-		const Int_t bin_stop;
+		const Int_t n_parameters;
+		Int_t n_rows;
+		Int_t upper_band;
 };
 
 #endif
@@ -24,26 +24,61 @@
 #include <TMatrixDSym.h>
 #include <TROOT.h>
 
+#include <memory>
+
+#include "BasisFitFunction.h"
 #include "FitFunction.h"
+#include "ResponseMatrix.h"
+#include "Spectrum.h"
+#include "SplineBasis.h"
 
 class Fitter{
 public:
-	Fitter(const TH2F &rema, const UInt_t binning, Int_t binstart, Int_t binstop):BINNING(binning), fitFunction("rema_fit", rema, binning, binstart, binstop), chi2(-1.){ fitf = new TF1("fitf", fitFunction, 0., (Double_t) NBINS-1., (Int_t) NBINS/ (Int_t) BINNING); };
-	~Fitter(){};
+	Fitter(const TH2F &rema, const UInt_t binning, Int_t binstart, Int_t binstop);
+	~Fitter(){ delete fitf; delete basis_fitf; };
+	// The fit function refers to the member fitFunction
+	Fitter(const Fitter&) = delete;
+	Fitter& operator=(const Fitter&) = delete;
 
 	void topdown(const TH1F &spectrum, const TH2F &rema, TH1F &params, Int_t binstart, Int_t binstop);
 	void fit(TH1F &spectrum, const TH2F &rema, const TH1F &start_params, TH1F &params, Int_t binstart, Int_t binstop); // Version of Fitter::fit() which does not return uncertainty and does not print output
+	// Same for a matrix that is modified in each MC iteration, which saves the conversion to a TH2F
+	void fit(TH1F &spectrum, const ResponseMatrix &rema, const TH1F &start_params, TH1F &params, Int_t binstart, Int_t binstop);
 	void fit(TH1F &spectrum, const TH2F &rema, const TH1F &start_params, TH1F &params, TH1F &fit_uncertainty, Int_t binstart, Int_t binstop, const Bool_t verbose, const Bool_t correlation, TMatrixDSym &correlation_matrix);
 	void fittedFEP(const TH1F &params, const TH2F &rema, TH1F &fitted_FEP);
 	void fittedSpectrum(const TH1F &params, const TH2F &rema, TH1F &fitted_spectrum);
 	void remove_negative(TH1F &hist);
 	void print_fitresult() const;
 
+	// Fit the coefficients of the basis instead of one parameter per bin in all following
+	// fits. The fit range of the basis must be the same as in the fits. The fits still
+	// return one parameter per bin, and their uncertainties and correlations are obtained
+	// from the covariance matrix of the coefficients.
+	void setBasis(const SplineBasis &spline_basis);
+
 private:
+	// Kernel of topdown(). The response matrix is given by an array in the layout of a
+	// TH2F or a ResponseMatrix, with rows of row_length elements.
+	void solveTopDown(const Double_t *spectrum, const Float_t *rema, const size_t row_length, Double_t *params, const Int_t binstart, const Int_t binstop) const;
+
+	// Version of the fit() functions for a basis. The uncertainty and the correlation matrix
+	// are optional. The response matrix is given in the same way as for solveTopDown().
+	void fitBasis(TH1F &spectrum, const Float_t *rema_array, const size_t row_length, const TH1F &start_params, TH1F &params, TH1F *fit_uncertainty, Int_t binstart, Int_t binstop, const Bool_t verbose, TMatrixDSym *correlation_matrix);
+
+	// The parameters of the TF1 are the bins bin_start ... bin_stop - 1
+	void setStartParameters(const TH1F &start_params, const Int_t binstart, const Int_t binstop);
+	void getParameters(TH1F &params, TH1F *fit_uncertainty) const;
+
 	const UInt_t BINNING;
+	const Int_t bin_start;
+	const Int_t bin_stop;
 	FitFunction fitFunction;
 	Double_t chi2;
 	TF1 *fitf;
+
+	std::unique_ptr<SplineBasis> basis;
+	BasisFitFunction basisFitFunction;
+	TF1 *basis_fitf;
 };
 
 #endif
@@ -0,0 +1,62 @@
+/*
+    This file is part of Horst.
+
+    Horst is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Horst is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Horst.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef FOLDEDMATRIXCACHE_H
+#define FOLDEDMATRIXCACHE_H 1
+
+#include <vector>
+
+#include <TH2.h>
+#include <TROOT.h>
+
+using std::vector;
+
+// Caches response matrices into which the detector resolution was folded (see
+// Resolution::foldMatrix()), so that repeated runs with the same matrix and detector
+// setup fold it only once.
+// horst reads only the rows of the fit range from the matrix file, and each row is folded
+// independently of the others. A cache file therefore holds a range of folded rows of the
+// (rebinned) matrix, and a hash of each of the rows they were folded from. A run uses the
+// cache if it covers the rows of the run and their hashes agree, so the full matrix that
+// was folded by makematrix serves all fit ranges, and a changed matrix file never gives a
+// stale result. Otherwise, the rows of the run are folded and replace the cache file.
+// The cache files are stored next to the matrix file. Their names contain a hash of the
+// key, which consists of the binning and the resolution parameters. The full key is also
+// stored in the file and compared before a cached matrix is used.
+// Like the checkpoint files, cache files are written under a temporary name first and
+// then renamed.
+class FoldedMatrixCache{
+public:
+	FoldedMatrixCache(const TString matrixfilename): prefix(matrixfilename + ".folded_"){};
+	~FoldedMatrixCache(){};
+
+	// Read the folded matrix from the cache, or fold it and add it to the cache. Only the
+	// rows first_bin ... last_bin of rema are used, the others must be zero. The rows of
+	// folded_rema outside of this range are zero.
+	void get(const TH2F &rema, const Int_t first_bin, const Int_t last_bin, const UInt_t binning, const vector<Double_t> &resolution_params, TH2F &folded_rema);
+
+private:
+	vector<Double_t> getKey(const UInt_t binning, const vector<Double_t> &resolution_params) const;
+	// Hash of each row i, i.e. of the elements (i, 1) ... (i, nbins), in row_hashes[i]
+	void hashRows(const TH2F &rema, vector<ULong64_t> &row_hashes) const;
+	Bool_t read(const TString filename, const vector<Double_t> &key, const Int_t first_bin, const Int_t last_bin, const vector<ULong64_t> &row_hashes, TH2F &folded_rema) const;
+	void write(const TString filename, const vector<Double_t> &key, const Int_t first_bin, const Int_t last_bin, const vector<ULong64_t> &row_hashes, const TH2F &folded_rema) const;
+
+	const TString prefix;
+};
+
+#endif
@@ -35,12 +35,27 @@ public:
 	void readInputFile(const TString inputfilename, vector<TString> &filenames, vector<Double_t> &energies, vector<Double_t> &n_simulated_particles);
 
 	void fillMatrix(const vector<TString> &filenames, const vector<Double_t> &energies, const vector<Double_t> &n_particles, const TString histname, TH2F &response_matrix, TH1F &n_simulated_particles);
+	// Determine which simulation(s) are used to create the row of the matrix that corresponds to 'energy'.
+	// If only a single simulation is used, interp2_sim is negative.
+	void getInterpolation(const vector<Double_t> &energies, const vector<Double_t> &n_particles, const Double_t energy, Int_t &interp1_sim, Double_t &interp1_weight, Int_t &interp2_sim, Double_t &interp2_weight) const;
 	void fillMatrixWeighted(const vector<TString> &filenames, const vector<Double_t> &energies, const vector<Double_t> &n_particles, const TString histname, TH2F &response_matrix, TH1F &n_simulated_particles, Int_t i, Int_t simulation, Double_t weight);
+	// Read the bin contents (including underflow and overflow bins) and the axis limits of a set of simulations
+	void readSimulations(const vector<TString> &filenames, const TString histname, vector<vector<Double_t> > &simulations, vector<Double_t> &axis_minimum, vector<Double_t> &axis_maximum);
 	void updateMatrix(const vector<TString> &old_filenames, const vector<Double_t> &old_energies, const vector<Double_t> &old_n_particles, const TH2F &old_response_matrix, const vector<TString> &new_filenames, const vector<Double_t> &new_energies, const vector<Double_t> &new_n_particles, const TString histname, TH2F &response_matrix, TH1F &n_simulated_particles);
 
 	void writeCorrelationMatrix(TMatrixDSym &correlation_matrix, TString outputfilename) const;
-	void writeMatrix(TH2F &response_matrix, TH1F &n_simulated_particles, TString outputfilename) const;
+	// With write_rows, the matrix file contains a TTree 'rema_rows' besides the TH2F 'rema', with one entry per row
+	// (i.e. per simulated energy) of the matrix, which stores the columns up to the last nonzero one.
+	// It is written in chunks of ROWS_PER_CHUNK rows, so that a range of rows can be read without the rest of the matrix.
+	// The tree roughly doubles the size of the file.
+	void writeMatrix(TH2F &response_matrix, TH1F &n_simulated_particles, TString outputfilename, const Bool_t write_rows) const;
 	void readMatrix(TH2F &response_matrix, TH1F &n_simulated_particles, const TString matrixfile);
+	// Windowed version of readMatrix() which reads only the rows first_row to last_row of the matrix,
+	// and only their columns up to last_row. The other elements of response_matrix are zero.
+	// response_matrix may have NBINS/b bins on both axes, in which case b x b blocks of the matrix are summed
+	// while reading, without ever allocating the full matrix.
+	// Files without 'rema_rows' are read from the full TH2F 'rema'.
+	void readMatrix(TH2F &response_matrix, TH1F &n_simulated_particles, const TString matrixfile, const Int_t first_row, const Int_t last_row);
 	// Alternative version of readMatrix() which does not read n_simulated_particles
 	void readMatrix(TH2F &response_matrix, const TString matrixfile);
 
@@ -49,6 +64,11 @@ public:
 	void readROOTSpectrum(TH1F &spectrum, const TString spectrumfile, const TString spectrumname);
 
 	void readDoubleParameters(vector<Double_t> &params, const TString inputfilename);
+	// Read a table of whitespace-separated parameters with one row per line.
+	// Empty lines and lines that start with '#' are ignored.
+	void readDoubleTable(vector<vector<Double_t> > &table, const TString inputfilename);
+	// Read a list of file names, one per line. Empty lines and lines that start with '#' are ignored.
+	void readFileList(vector<TString> &filenames, const TString inputfilename);
 	void readUnsignedIntParameters(vector<UInt_t> &params, const TString inputfilename);
 
 	// Having a template function that can process either a UInt_t or a Double_t
@@ -59,6 +79,10 @@ public:
 
 private:
 	const UInt_t BINNING;
+	static const Int_t ROWS_PER_CHUNK = 100;
+	static const Long64_t CACHE_SIZE = 50000000;
+
+	void readNSimulatedParticles(TH1F &n_simulated_particles, const TString matrixfile);
 };
 
 #endif
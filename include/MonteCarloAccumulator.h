@@ -0,0 +1,118 @@
+/*
+    This file is part of Horst.
+
+    Horst is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Horst is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Horst.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef MONTECARLOACCUMULATOR_H
+#define MONTECARLOACCUMULATOR_H 1
+
+#include <vector>
+
+#include <TH1.h>
+#include <TROOT.h>
+
+#include "QuantileSketch.h"
+
+using std::vector;
+
+// Online statistics of the bins of a series of Monte-Carlo histograms.
+// Each histogram is added to the accumulator as soon as it is available and can be
+// discarded afterwards, so that the memory consumption does not depend on the number of
+// Monte-Carlo iterations.
+// The mean value and the variance of each bin are updated with Welford's algorithm,
+// which avoids the loss of precision of the naive sum-of-squares formula.
+// Quantiles are estimated using a QuantileSketch for each bin.
+// The third and fourth central moments are updated as well, because the standard error
+// of the standard deviation depends on the kurtosis of the distribution. This is used
+// to decide when enough Monte-Carlo iterations have been done.
+//
+// Two variance-reduction methods are supported:
+//	- Control variate: each sample is added together with a control variable X, whose
+//	  expectation value and variance are known exactly. The mean value and the variance
+//	  of the samples Y are corrected using the regression of Y on X:
+//		mean(Y) - beta*(mean(X) - E[X])
+//		var(Y) - beta^2*(var(X) - Var[X]),	beta = cov(X, Y)/var(X)
+//	  For normally distributed variables with a correlation rho, this reduces the variance
+//	  of the variance estimate by a factor of 1 - rho^4.
+//	- Antithetic pairs: consecutive samples 2k and 2k+1 are treated as pairs. The
+//	  correlation rho_z of the squared deviations z = (Y - reference)^2 within the pairs
+//	  increases the variance of the variance estimate by a factor of 1 + rho_z.
+// The effective sample size is the number of independent samples without variance
+// reduction that would give the same precision of the standard deviation. The quantiles
+// are not corrected.
+//
+// Accumulators for different sets of samples can be merged, using the pairwise update
+// formulas for the central moments (P. Pebay, Sandia Report SAND2008-6212 (2008)). The
+// result of a series of merges is reproducible as long as the order is the same.
+// serialize() and deserialize() convert the state of an accumulator to a buffer of
+// floating-point numbers and back without any loss of precision.
+class MonteCarloAccumulator{
+public:
+	MonteCarloAccumulator(const UInt_t binning, const Int_t binstart, const Int_t binstop);
+	~MonteCarloAccumulator(){};
+
+	void setControlVariate(const TH1F &expectation, const TH1F &variance);
+	void setAntitheticPairs(const TH1F &reference);
+
+	void add(const TH1F &histogram);
+	void add(const TH1F &histogram, const TH1F &control);
+	void merge(const MonteCarloAccumulator &accumulator);
+	void reset();
+
+	void serialize(vector<Double_t> &buffer) const;
+	void deserialize(const vector<Double_t> &buffer);
+
+	UInt_t getNSamples() const { return n_samples; };
+	void getMean(TH1F &mean) const;
+	void getStandardDeviation(TH1F &standard_deviation) const;
+	void getQuantile(TH1F &quantile, const Double_t q) const;
+	Double_t getMaximumRelativeStandardError() const;
+	Double_t getEffectiveSampleSize() const;
+
+private:
+	void addSample(const TH1F &histogram, const TH1F *control);
+	Double_t getVariance(const size_t index) const;
+	Double_t getVarianceReductionFactor(const size_t index) const;
+
+	const UInt_t BINNING;
+	const Int_t bin_start;
+	const Int_t bin_stop;
+
+	UInt_t n_samples;
+	vector<Double_t> mean;
+	vector<Double_t> m2;
+	vector<Double_t> m3;
+	vector<Double_t> m4;
+	vector<QuantileSketch> sketches;
+
+	Bool_t use_control_variate;
+	vector<Double_t> control_expectation;
+	vector<Double_t> control_variance;
+	vector<Double_t> control_mean;
+	vector<Double_t> control_m2;
+	vector<Double_t> control_comoment;
+
+	Bool_t use_antithetic_pairs;
+	UInt_t n_pairs;
+	vector<Double_t> pair_reference;
+	vector<Double_t> pair_first;
+	vector<Double_t> pair_mean_1;
+	vector<Double_t> pair_mean_2;
+	vector<Double_t> pair_m2_1;
+	vector<Double_t> pair_m2_2;
+	vector<Double_t> pair_comoment;
+};
+
+#endif
@@ -0,0 +1,61 @@
+/*
+    This file is part of Horst.
+
+    Horst is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Horst is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Horst.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef MONTECARLOCHECKPOINT_H
+#define MONTECARLOCHECKPOINT_H 1
+
+#include <time.h>
+#include <vector>
+
+#include <TH1.h>
+#include <TROOT.h>
+
+#include "MonteCarloAccumulator.h"
+
+using std::vector;
+
+// Saves the state of the Monte-Carlo (MC) iterations to a file next to the output file,
+// so that an interrupted run can be continued.
+// Since every MC iteration has its own random number sequence, the state consists of
+// the index of the next block of iterations and the accumulated results. No state of
+// the random number generator is needed.
+// The checkpoint also contains the nominal fit parameters and the options of the run,
+// which are compared to the current run before the checkpoint is used.
+// The file is written under a temporary name first and then renamed, so that an
+// interruption while writing never destroys the previous checkpoint.
+class MonteCarloCheckpoint{
+public:
+	MonteCarloCheckpoint(const TString outputfilename, const Double_t interval);
+	~MonteCarloCheckpoint(){};
+
+	Bool_t exists() const;
+	// True if at least 'interval' seconds have passed since the last write()
+	Bool_t due() const;
+
+	void write(const UInt_t next_block, const UInt_t mc_iterations, const Bool_t converged, const vector<Double_t> &run_info, const TH1F &fit_params, const MonteCarloAccumulator &accumulator);
+	void read(UInt_t &next_block, UInt_t &mc_iterations, Bool_t &converged, const vector<Double_t> &run_info, const TH1F &fit_params, MonteCarloAccumulator &accumulator);
+	void remove();
+
+	TString getFileName() const { return filename; };
+
+private:
+	const TString filename;
+	const Double_t INTERVAL;
+	time_t last_write;
+};
+
+#endif
@@ -0,0 +1,65 @@
+/*
+    This file is part of Horst.
+
+    Horst is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Horst is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Horst.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef MONTECARLORESULT_H
+#define MONTECARLORESULT_H 1
+
+#include <TH1.h>
+#include <TROOT.h>
+
+#include "MonteCarloAccumulator.h"
+#include "Reconstructor.h"
+#include "Uncertainty.h"
+
+// Final histograms of the Monte-Carlo (MC) uncertainty estimation, derived from the
+// accumulated fit parameters. The full-energy peak (FEP) only depends on the diagonal of
+// the response matrix, so that the evaluation also works without the full matrix, for
+// example when the partial results of several horst processes are merged by horst_merge.
+class MonteCarloResult{
+public:
+	MonteCarloResult(const UInt_t binning);
+	~MonteCarloResult(){};
+
+	void evaluate(const MonteCarloAccumulator &accumulator, TH1F &fit_algorithm_uncertainty, const TH1F &rema_diagonal, const TH1F &n_simulated_particles, const Double_t relative_standard_error, const TString sampling_scheme);
+	TH1F* getFitParamsUncertainty(){ return &mc_fit_params_uncertainty; };
+
+	// Write the results to the current directory
+	void write();
+
+private:
+	void fittedFEP(const TH1F &params, const TH1F &rema_diagonal, TH1F &fitted_FEP) const;
+
+	const UInt_t BINNING;
+	Uncertainty uncertainty;
+	Reconstructor reconstructor;
+
+	TH1F mc_fit_params_mean, mc_fit_params_uncertainty, mc_fit_total_uncertainty;
+	TH1F mc_fit_params_quantile_low, mc_fit_params_quantile_up;
+	TH1F mc_fit_FEP, mc_fit_FEP_uncertainty;
+	TH1F mc_FEP_uncertainty_low, mc_FEP_uncertainty_up;
+	TH1F mc_FEP_quantile_low, mc_FEP_quantile_up;
+	TH1F mc_spectrum_reconstructed, mc_reconstruction_uncertainty;
+	TH1F mc_reconstruction_uncertainty_low, mc_reconstruction_uncertainty_up;
+	TH1F mc_reconstruction_quantile_low, mc_reconstruction_quantile_up;
+
+	Int_t mc_iterations;
+	Double_t mc_relative_standard_error;
+	Double_t mc_effective_sample_size;
+	TString mc_sampling_scheme;
+};
+
+#endif
@@ -18,6 +18,7 @@
 #ifndef MONTECARLOUNCERTAINTY_H
 #define MONTECARLOUNCERTAINTY_H 1
 
+#include <climits>
 #include <vector>
 
 #include <TH1.h>
@@ -25,25 +26,80 @@
 #include <TROOT.h>
 #include <TRandom3.h>
 
+#include "PoissonSampler.h"
+#include "ResponseMatrix.h"
+#include "SobolSequence.h"
+
 using std::vector;
 
+// Sampling schemes for the fluctuations of the spectrum:
+//	- PLAIN_SAMPLING: Independent pseudo-random numbers in each iteration.
+//	- ANTITHETIC_SAMPLING: Iterations come in pairs. The second spectrum of a pair uses the
+//	  uniform random numbers 1-u instead of u, so its fluctuations are mirrored.
+//	- SOBOL_SAMPLING: The uniform random numbers of iteration n are the coordinates of the
+//	  n-th point of a randomized Sobol sequence, with one dimension per bin in the fit range.
+// The last two map the uniform random numbers to Poisson-distributed numbers with the
+// inverse CDF. The fluctuations of the response matrix are always pseudo-random.
+enum SamplingScheme{
+	PLAIN_SAMPLING,
+	ANTITHETIC_SAMPLING,
+	SOBOL_SAMPLING
+};
+
 class MonteCarloUncertainty{
 public:
-	MonteCarloUncertainty(const UInt_t binning, const UInt_t seed): BINNING(binning) { random_generator = new TRandom3(seed); };
-	~MonteCarloUncertainty(){ delete random_generator; };
+	MonteCarloUncertainty(const UInt_t binning, const UInt_t seed): sampling_scheme(PLAIN_SAMPLING), sobol_sequence(nullptr), n_spectrum_samples(0), antithetic_iteration(NO_ANTITHETIC_ITERATION), BINNING(binning), SEED(seed) { random_generator = new TRandom3(seed); };
+	~MonteCarloUncertainty(){ delete random_generator; delete sobol_sequence; };
+
+	void setSamplingScheme(const SamplingScheme scheme, const Int_t binstart, const Int_t binstop);
+	// Start the MC iteration with the given index. Each iteration uses its own sequence of
+	// random numbers, which only depends on the seed and the index.
+	void setIteration(const UInt_t iteration);
+	void getExpectedSpectrum(TH1F &expected_spectrum, const TH1F &spectrum, const Int_t binstart, const Int_t binstop) const;
 
 	void apply_fluctuations(TH1F &modified_spectrum, const TH1F &spectrum, const Int_t binstart, const Int_t binstop);
-	void apply_fluctuations(TH2F &modified_response_matrix, const TH2F &response_matrix, const Int_t binstart, const Int_t binstop);
-	void evaluateMeanAndStd(TH1F &mc_mean, TH1F &mc_standard_deviation, const vector<TH1F*> &mc_histograms, const Int_t binstart, const Int_t binstop);
+	void apply_fluctuations(ResponseMatrix &modified_response_matrix, const ResponseMatrix &response_matrix, const Int_t binstart, const Int_t binstop);
+
+	// Fluctuate the simulations from which the response matrix was created instead of the single
+	// matrix elements. setSimulations() has to be called once before apply_simulation_fluctuations().
+	void setSimulations(const vector<vector<Double_t> > &simulations, const vector<Double_t> &axis_minimum, const vector<Double_t> &axis_maximum, const vector<Double_t> &energies, const vector<Double_t> &n_particles, const TH2F &response_matrix, const Int_t binstart, const Int_t binstop);
+	void apply_simulation_fluctuations(ResponseMatrix &modified_response_matrix, const Int_t binstart, const Int_t binstop);
 
 private:
 	Double_t get_positive_random_normal(Double_t mu, Double_t sigma) const;	
-	Double_t get_random_poisson(Int_t mean) const;	
-	Double_t get_mean(vector<Double_t> &values) const;
-	Double_t get_stdev(vector<Double_t> &values, Double_t mean) const;
+	UInt_t getIterationSeed(const UInt_t iteration) const;
+	void fillMatrixFromSimulations(const vector<vector<Double_t> > &simulation_contents, ResponseMatrix &modified_response_matrix, const Int_t binstart, const Int_t binstop);
 
 	TRandom3 *random_generator;
+	PoissonSampler poisson_sampler;
+	vector<Double_t> mean_buffer;
+	vector<Double_t> sample_buffer;
+
+	SamplingScheme sampling_scheme;
+	SobolSequence *sobol_sequence;
+	vector<Double_t> uniform_buffer;
+	UInt_t n_spectrum_samples;
+	// Iteration whose uniform random numbers are in uniform_buffer, or NO_ANTITHETIC_ITERATION
+	// if the buffer does not hold the first spectrum of an antithetic pair.
+	UInt_t antithetic_iteration;
+	static const UInt_t NO_ANTITHETIC_ITERATION = UINT_MAX;
+
+	// Simulations and the cached map from the (not rebinned) rows of the response matrix
+	// to the simulations that were used to create them
+	vector<vector<Double_t> > simulations;
+	vector<vector<Double_t> > fluctuated_simulations;
+	vector<Double_t> simulation_axis_minimum;
+	vector<Double_t> simulation_axis_maximum;
+	vector<Double_t> simulation_energies;
+	vector<size_t> used_simulations;
+	vector<Int_t> row_simulation_1;
+	vector<Int_t> row_simulation_2;
+	vector<Double_t> row_weight_1;
+	vector<Double_t> row_weight_2;
+	Int_t first_row;
+	vector<Double_t> row_buffer;
 	const UInt_t BINNING;
+	const UInt_t SEED;
 };
 
 #endif
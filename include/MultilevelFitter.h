@@ -0,0 +1,55 @@
+/*
+    This file is part of Horst.
+
+    Horst is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Horst is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Horst.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef MULTILEVELFITTER_H
+#define MULTILEVELFITTER_H 1
+
+#include <TROOT.h>
+#include <TH1.h>
+#include <TH2.h>
+
+// Coarse-to-fine start parameters for Fitter::fit(), in the spirit of a multigrid method.
+// The rebinned spectrum and response matrix are summed over blocks of 2, 4, ..., 2^n_levels
+// bins, i.e. they are rebinned with the binning factors 2*binning, ..., 2^n_levels*binning.
+// The fit at the coarsest binning starts from the top-down parameters. Its result is
+// prolongated to the next finer binning, where it is the start point of the next fit, and
+// so on. Since a coarse matrix element (I, J) is the sum of the fine elements (i, j) with
+// i in I and j in J, fine parameters that are constant within each coarse bin I produce
+// the same coarse spectrum as the coarse parameters. So the prolongation copies each
+// coarse parameter to the fine bins of its block.
+// The fits at the coarse levels have only a fraction of the parameters, and the fit at the
+// requested binning starts close to its minimum.
+class MultilevelFitter{
+public:
+	MultilevelFitter(const UInt_t binning, const UInt_t levels);
+	~MultilevelFitter(){};
+
+	// spectrum and rema are rebinned with the binning factor of the constructor, and left and
+	// right are the limits of the fit range in units of the original bins, as for horst.
+	// start_params receives the prolongated parameters of the fit at 2*binning.
+	void getStartParameters(const TH1F &spectrum, const TH2F &rema, const UInt_t left, const UInt_t right, TH1F &start_params);
+
+private:
+	void coarsen(const TH1F &spectrum, TH1F &coarse_spectrum) const;
+	void coarsen(const TH2F &rema, TH2F &coarse_rema) const;
+	void prolongate(const TH1F &coarse_params, TH1F &params) const;
+
+	const UInt_t BINNING;
+	const UInt_t n_levels;
+};
+
+#endif
@@ -0,0 +1,101 @@
+/*
+    This file is part of Horst.
+
+    Horst is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Horst is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Horst.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef OUTPUTSESSION_H
+#define OUTPUTSESSION_H 1
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <TFile.h>
+#include <TH1.h>
+#include <TROOT.h>
+#include <TTree.h>
+
+using std::vector;
+
+// Keeps the output file open for the whole run of horst and writes the results of the
+// single Monte-Carlo (MC) iterations in a background thread, so that the fits never wait
+// for the disk.
+// write() and writeSample() copy the values into one of a fixed number of buffers and
+// return immediately. Only if all buffers are still waiting to be written, they block
+// until the writer thread has released one. The writer thread creates the ROOT objects
+// from the buffers and writes (and compresses) them.
+// The MC samples are stored in a single TTree 'mc_samples' with one entry per MC iteration,
+// which contains the index of the iteration and one fixed-size array branch for each
+// quantity, so that single bins can be read for all iterations without reading the
+// other quantities.
+// sync() waits until all buffers are written and saves the directory structure of the
+// file, so that the file is complete if the process is killed afterwards. Before the
+// file is used by the calling thread, for example to write the final results, sync()
+// must be called.
+class OutputSession{
+public:
+	OutputSession(const TString filename, const TString option);
+	~OutputSession();
+
+	TFile* getFile(){ return file; };
+
+	void write(const TString directory, const TString name, const vector<Double_t> &values);
+
+	// Create the TTree for the MC samples in the given directory, or continue an existing one
+	// that must contain n_samples entries.
+	void openSamples(const TString directory, const vector<TString> &quantities, const Int_t nbins, const Long64_t n_samples);
+	// Values of all quantities for a single iteration, in the order given to openSamples()
+	void writeSample(const UInt_t iteration, const vector<const Float_t*> &values);
+	void sync();
+	void close();
+
+private:
+	enum BufferType{VECTOR, SAMPLE};
+	struct Buffer{
+		BufferType type;
+		TString directory;
+		TString name;
+		UInt_t iteration;
+		vector<Double_t> values;
+	};
+
+	Buffer* acquire();
+	void queueBuffer(Buffer *buffer);
+	TDirectory* getDirectory(const TString directory);
+	void writeBuffers();
+	void writeBuffer(const Buffer &buffer);
+
+	TFile *file;
+
+	TTree *sample_tree;
+	UInt_t sample_iteration;
+	Int_t sample_nbins;
+	vector<vector<Float_t> > sample_values;
+
+	vector<Buffer> buffers;
+	vector<Buffer*> free_buffers;
+	std::deque<Buffer*> queue;
+	UInt_t n_writing;
+	Bool_t stop;
+
+	std::mutex mutex;
+	std::condition_variable buffer_released;
+	std::condition_variable buffer_queued;
+	std::thread writer;
+};
+
+#endif
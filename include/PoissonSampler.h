@@ -0,0 +1,81 @@
+/*
+    This file is part of Horst.
+
+    Horst is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Horst is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Horst.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef POISSONSAMPLER_H
+#define POISSONSAMPLER_H 1
+
+#include <vector>
+
+#include <TROOT.h>
+#include <TRandom3.h>
+
+using std::vector;
+
+// Draws Poisson-distributed random numbers for a whole array of mean values at once.
+// The cells are first sorted by their mean value:
+//	- Cells with a mean value of zero are skipped.
+//	- Small mean values are sampled by inversion of the cumulative distribution function
+//	  (CDF). For integer mean values, which is the usual case in horst, the CDF is
+//	  taken from a precomputed table.
+//	- Large mean values are sampled with the 'transformed rejection with squeeze' (PTRS)
+//	  method by W. Hoermann, Insurance: Mathematics and Economics 12, 39 (1993).
+// The uniform random numbers are taken from a buffer that is filled in large chunks.
+// Only the constants of the PTRS method are calculated in a loop without branches. The
+// inversion and the PTRS acceptance test still run cell by cell: the length of the search
+// in the CDF and the number of rejections depend on the random numbers. A version that
+// draws the first PTRS proposal and applies the squeeze for all cells without branches
+// was slower, because most of the time is spent in the random number generator.
+//
+// sampleInverse() is an alternative that maps given uniform random numbers to Poisson-
+// distributed numbers with the inverse CDF, so that the result is a monotonic function of
+// the input. This is needed for variance-reduction methods like antithetic or quasi-random
+// sampling, which work on the uniform random numbers.
+class PoissonSampler{
+public:
+	PoissonSampler();
+	~PoissonSampler(){};
+
+	void sample(TRandom3 &random_generator, const Double_t *mean, Double_t *result, const size_t n);
+	void sampleInverse(const Double_t *mean, const Double_t *uniform, Double_t *result, const size_t n) const;
+	// Discard the buffered uniform random numbers, for example after the random number
+	// generator was seeded again.
+	void clearBuffer(){ uniform_position = uniforms.size(); };
+
+private:
+	Double_t nextUniform(TRandom3 &random_generator);
+	Double_t invert(const Double_t mean, const Double_t uniform) const;
+	Double_t quantile(const Double_t mean, const Double_t uniform) const;
+	Double_t ptrs(TRandom3 &random_generator, const size_t cell);
+
+	vector<vector<Double_t> > cdf_table;
+
+	vector<Double_t> uniforms;
+	size_t uniform_position;
+
+	vector<size_t> small_cells;
+	vector<size_t> large_cells;
+
+	// Constants of the PTRS algorithm for each cell with a large mean value
+	vector<Double_t> ptrs_mean;
+	vector<Double_t> ptrs_a;
+	vector<Double_t> ptrs_b;
+	vector<Double_t> ptrs_log_inverse_alpha;
+	vector<Double_t> ptrs_vr;
+	vector<Double_t> ptrs_log_mean;
+};
+
+#endif
@@ -0,0 +1,72 @@
+/*
+    This file is part of Horst.
+
+    Horst is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Horst is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Horst.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef QUANTILESKETCH_H
+#define QUANTILESKETCH_H 1
+
+#include <vector>
+
+#include <TROOT.h>
+
+using std::vector;
+
+// Streaming estimator for quantiles of a set of values that never stores the values
+// themselves.
+// Each value is sorted into a logarithmically spaced bucket whose boundaries grow by a
+// factor of gamma = (1 + relative_accuracy)/(1 - relative_accuracy). Returning the center
+// of a bucket as the estimate of a quantile guarantees a relative error of at most
+// relative_accuracy, independent of the number of values.
+// The bucket boundaries do not depend on the data, so two sketches can be merged by simply
+// adding their bucket counts. If the number of buckets exceeds max_buckets, the buckets
+// closest to zero are collapsed, so that the memory consumption stays bounded.
+// serialize() appends the state of a sketch to a buffer of floating-point numbers, from
+// which deserialize() restores it exactly. All counts are far below 2^53.
+class QuantileSketch{
+public:
+	QuantileSketch(const Double_t relative_accuracy, const UInt_t max_buckets);
+	~QuantileSketch(){};
+
+	void add(const Double_t value);
+	void merge(const QuantileSketch &sketch);
+	void reset();
+
+	void serialize(vector<Double_t> &buffer) const;
+	void deserialize(const vector<Double_t> &buffer, size_t &position);
+
+	Double_t getQuantile(const Double_t quantile) const;
+	ULong64_t getCount() const { return count; };
+
+private:
+	Int_t getKey(const Double_t value) const;
+	Double_t getValue(const Int_t key) const;
+	void addToStore(vector<ULong64_t> &store, Int_t &min_key, const Int_t key, const ULong64_t n);
+
+	Double_t gamma;
+	Double_t inverse_log_gamma;
+	UInt_t max_buckets;
+
+	// Buckets for positive and (absolute values of) negative values. The i-th element
+	// of a store contains the number of values with the key min_key + i.
+	vector<ULong64_t> positive_store;
+	vector<ULong64_t> negative_store;
+	Int_t positive_min_key;
+	Int_t negative_min_key;
+	ULong64_t zero_count;
+	ULong64_t count;
+};
+
+#endif
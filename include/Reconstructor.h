@@ -21,22 +21,46 @@
 #include <TROOT.h>
 #include <TH1.h>
 #include <TH2.h>
+#include <TRandom3.h>
+
+#include <vector>
+
+using std::vector;
 
 class Reconstructor{
 public:
-	Reconstructor(const UInt_t binning): BINNING(binning){};
+	Reconstructor(const UInt_t binning): BINNING(binning), n_threads(1){};
 	~Reconstructor(){};
 
 	void reconstruct(const TH1F &params, const TH1F &n_simulated_particles, TH1F &reconstructed_spectrum);
 	void uncertainty(const TH1F &total_uncertainty, const TH2F &rema, const TH1F &n_simulated_particles, TH1F &reconstruction_uncertainty);
+	void uncertainty(const TH1F &total_uncertainty, const TH1F &rema_diagonal, const TH1F &n_simulated_particles, TH1F &reconstruction_uncertainty); // Version of Reconstructor::uncertainty() which only needs the diagonal of the response matrix
 
 	void addResponse(const TH1F &spectrum, const TH1F &inverse_n_simulated_particles, const TH2F &rema, TH1F &response_spectrum);
 	void addResponse(const TH1F &spectrum, const TH1F &inverse_n_simulated_particles, const TH2F &rema, TH1F &response_spectrum, TH1F &response_spectrum_FEP);
+	// Version of Reconstructor::addResponse() for many spectra, which reads the response matrix
+	// only once for a block of spectra. The spectra are distributed over the threads.
+	void addResponse(const vector<TH1F> &spectra, const TH1F &inverse_n_simulated_particles, const TH2F &rema, vector<TH1F> &response_spectra, vector<TH1F> &response_spectra_FEP);
 
-	void addRealisticResponse(const TH1F &spectrum, const TH1F &inverse_n_simulated_particles, const TH2F &rema, TH1F &response_spectrum, TH1F &response_spectrum_FEP);
+	// The Poisson-distributed random numbers are drawn from random_generator, so that
+	// spectra with differently seeded generators get independent fluctuations.
+	void addRealisticResponse(TRandom3 &random_generator, const TH1F &spectrum, const TH1F &inverse_n_simulated_particles, const TH2F &rema, TH1F &response_spectrum, TH1F &response_spectrum_FEP);
+
+	// Number of threads used to fold a spectrum with the response matrix in addResponse()
+	void setThreads(const UInt_t threads){ n_threads = threads > 0 ? threads : 1; };
 
 private:
+	// Lower-triangular matrix-vector products folded(j) = sum_{i >= j} factor(i)*rema(i, j)
+	void fold(const TH2F &rema, const vector<Double_t> &factor, vector<Double_t> &folded) const;
+	void fold(const TH2F &rema, const vector<Double_t> &factor_1, const vector<Double_t> &factor_2, vector<Double_t> &folded_1, vector<Double_t> &folded_2) const;
+	// Kernel of both fold() overloads, which reads each matrix element once for N_VECTORS vectors
+	template<size_t N_VECTORS>
+	void foldVectors(const TH2F &rema, const Double_t *const *factor, Double_t *const *folded) const;
+	// Same for a block of FOLD_VECTORS vectors at once, which are interleaved: factor[FOLD_VECTORS*i + k]
+	void foldBlock(const TH2F &rema, const vector<Double_t> &factor, vector<Double_t> &folded) const;
+
 	const UInt_t BINNING;
+	UInt_t n_threads;
 };
 
 #endif
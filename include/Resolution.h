@@ -18,23 +18,68 @@
 #ifndef RESOLUTION_H
 #define RESOLUTION_H 1
 
-#include<vector>
+#include <complex>
+#include <map>
+#include <vector>
 
 #include <TROOT.h>
 #include <TH1.h>
+#include <TH2.h>
 
+#include "ResponseMatrix.h"
+#include "Spectrum.h"
+
+using std::complex;
+using std::map;
 using std::vector;
 
+// Blurs a spectrum with a normal distribution whose width depends on the energy.
+// The width in units of bins is rounded to an integer, so it is constant over long ranges
+// of the spectrum. setParameters() splits the spectrum into segments of constant width
+// and precomputes one kernel for each distinct width. blur() applies the kernels either
+// directly as sliding dot products, or, for wide kernels and long segments, as a
+// convolution with a fast Fourier transform (FFT) of the whole segment.
+// blur() does not modify the object, so it can be called by several threads at once.
+// foldMatrix() applies the same blur to every row of a response matrix.
 class Resolution{
 public:
-	Resolution(const UInt_t binning): BINNING(binning){};
+	Resolution(const UInt_t binning): BINNING(binning), max_half_width(0){};
 	~Resolution(){};
 
+	void setParameters(const vector<Double_t> &params);
+	void blur(const TH1F &spectrum, TH1F &blurred_spectrum) const;
+	void blur(const Spectrum &spectrum, Spectrum &blurred_spectrum) const;
+	// Blur every row of the response matrix, i.e. the detector response to each energy.
+	// The folded matrix has entries above the diagonal.
+	void foldMatrix(const TH2F &rema, TH2F &folded_rema) const;
+	void foldMatrix(const ResponseMatrix &rema, ResponseMatrix &folded_rema) const;
+
+	// Same as setParameters() followed by blur()
 	void gaussianBlur(const TH1F &spectrum, const vector<Double_t> params, TH1F &blurred_spectrum); 
 
 private:
+	struct Segment{
+		Int_t first_bin;
+		Int_t last_bin;
+		Int_t resolution;
+		Int_t half_width;
+		// Size and transformed kernel of the FFT, or 0 if the kernel is applied directly
+		size_t fft_size;
+		vector<complex<Double_t> > fft_kernel;
+	};
+
 	Double_t sqrt_resolution_model(const Double_t energy, const Double_t p_constant, const Double_t p_square_root);
+	void blurPadded(const vector<Double_t> &padded_spectrum, vector<Double_t> &result) const;
+	void blurDirect(const Segment &segment, const vector<Double_t> &padded_spectrum, vector<Double_t> &result) const;
+	void blurFFT(const Segment &segment, const vector<Double_t> &padded_spectrum, vector<Double_t> &result) const;
+
 	const UInt_t BINNING;
+
+	// Kernels for each resolution, with the weights for the distances -h ... h, where h is
+	// the half width of the window
+	map<Int_t, vector<Double_t> > kernels;
+	vector<Segment> segments;
+	Int_t max_half_width;
 };
 
 #endif
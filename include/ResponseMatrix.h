@@ -0,0 +1,61 @@
+/*
+    This file is part of Horst.
+
+    Horst is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Horst is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Horst.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef RESPONSEMATRIX_H
+#define RESPONSEMATRIX_H 1
+
+#include <vector>
+
+#include <TROOT.h>
+#include <TH2.h>
+
+#include "AlignedAllocator.h"
+
+using std::vector;
+
+// Square response matrix in contiguous memory, in the same layout as the array of a TH2F:
+// the element (i, j), i.e. the contribution of the energy i to the detected bin j, is
+// stored at i + (nbins + 2)*j, and the bins 0 and nbins + 1 are the underflow and overflow
+// bins. The contributions of all energies to a detected bin are contiguous, which is the
+// order in which the fit function, the top-down algorithm and the folding read them.
+// As for Spectrum, the access is neither virtual nor bounds-checked, and the storage is
+// aligned to 64 bytes.
+class ResponseMatrix{
+public:
+	ResponseMatrix(): nbins(0), row_length(2), elements(4, 0.f){};
+	ResponseMatrix(const Int_t n_bins): nbins(n_bins), row_length((size_t) n_bins + 2), elements(row_length*row_length, 0.f){};
+	explicit ResponseMatrix(const TH2F &histogram): ResponseMatrix(){ fromHistogram(histogram); };
+	~ResponseMatrix(){};
+
+	Float_t operator()(const Int_t i, const Int_t j) const { return elements[(size_t) i + row_length*(size_t) j]; };
+	Float_t& operator()(const Int_t i, const Int_t j){ return elements[(size_t) i + row_length*(size_t) j]; };
+	// Elements (0, j) ... (nbins + 1, j)
+	const Float_t* getContributions(const Int_t j) const { return &elements[row_length*(size_t) j]; };
+	Float_t* getContributions(const Int_t j){ return &elements[row_length*(size_t) j]; };
+	Int_t getNBins() const { return nbins; };
+
+	void fromHistogram(const TH2F &histogram);
+	// The histogram must have the same number of bins
+	void toHistogram(TH2F &histogram) const;
+
+private:
+	Int_t nbins;
+	size_t row_length;
+	vector<Float_t, AlignedAllocator<Float_t>> elements;
+};
+
+#endif
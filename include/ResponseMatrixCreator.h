@@ -36,6 +36,10 @@ public:
 	void createResponseMatrixWithEscapePeaks(TH2F &response_matrix, TH1F & n_simulated_particles, const vector<Double_t> params);
 
 	void createResponseMatrixWithEfficiency(TH2F &response_matrix, TH1F &n_simulated_particles, vector<Double_t> params);
+
+	// Simulation from which makematrix creates the matrix of createResponseMatrixWithEscapePeaks(),
+	// and the input file of makematrix
+	void writeEscapeSimulation(const vector<Double_t> params, const string outputfile_prefix);
 };
 
 #endif
@@ -0,0 +1,76 @@
+/*
+    This file is part of Horst.
+
+    Horst is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Horst is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Horst.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef RESPONSESAMPLER_H
+#define RESPONSESAMPLER_H 1
+
+#include <vector>
+
+#include <TROOT.h>
+#include <TH1.h>
+#include <TH2.h>
+#include <TRandom3.h>
+
+#include "PoissonSampler.h"
+
+using std::vector;
+
+// Adds a 'realistic' response to a spectrum by sampling single events, as an alternative
+// to Reconstructor::addRealisticResponse(), which draws a Poisson-distributed random
+// number for every cell of the response matrix.
+// A sum of independent Poisson-distributed numbers with mean values rema(i, j) is
+// equivalent to a single Poisson-distributed number of events with the mean value
+// sum_j rema(i, j), which are distributed over the bins j with the probabilities
+// rema(i, j) / sum_j rema(i, j). The events are distributed with Walker alias tables
+// (A. J. Walker, ACM Transactions on Mathematical Software 3, 253 (1977)) for each row
+// i of the response matrix, so the time per event is constant, and the total time
+// scales with the number of counts instead of the number of matrix cells.
+// The alias tables are calculated once for the rebinned matrix in the constructor and
+// can be reused for many spectra.
+class ResponseSampler{
+public:
+	ResponseSampler(const TH2F &rema, const UInt_t binning);
+	~ResponseSampler(){};
+
+	void addRealisticResponse(TRandom3 &random_generator, const TH1F &spectrum, const TH1F &inverse_n_simulated_particles, TH1F &response_spectrum, TH1F &response_spectrum_FEP);
+
+private:
+	void buildAliasTable(const Int_t row, const vector<Double_t> &weight);
+	void distributeEvents(TRandom3 &random_generator, const Int_t row, const Double_t n_events, vector<Double_t> &result);
+	Double_t nextUniform(TRandom3 &random_generator);
+
+	const Int_t nbins;
+
+	// Row i of the alias tables covers the bins first_bin[i] ... i and starts at
+	// row_offset[i] in the arrays alias_probability and alias.
+	vector<Int_t> first_bin;
+	vector<size_t> row_offset;
+	vector<Float_t> alias_probability;
+	vector<UInt_t> alias;
+
+	vector<Double_t> row_sum;
+	vector<Double_t> rema_diagonal;
+
+	PoissonSampler poissonSampler;
+	vector<Double_t> mean;
+	vector<Double_t> n_events;
+
+	vector<Double_t> uniforms;
+	size_t uniform_position;
+};
+
+#endif
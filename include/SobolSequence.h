@@ -0,0 +1,58 @@
+/*
+    This file is part of Horst.
+
+    Horst is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Horst is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Horst.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef SOBOLSEQUENCE_H
+#define SOBOLSEQUENCE_H 1
+
+#include <vector>
+
+#include <TROOT.h>
+#include <TRandom3.h>
+
+using std::vector;
+
+// Randomized Sobol sequence of quasi-random points in the unit hypercube.
+// The primitive polynomials over GF(2) that define the dimensions are generated in the
+// constructor, ordered by their degree. Since horst may need thousands of dimensions (one
+// per bin in the fit range), the initial direction numbers are not taken from a table, but
+// drawn at random. A random digital shift, i.e. a bitwise XOR of all coordinates with a
+// random number, makes each point uniformly distributed, so that Monte-Carlo estimates
+// stay unbiased.
+// The points are generated in Gray-code order (Antonov and Saleev), which costs a single
+// XOR per coordinate.
+class SobolSequence{
+public:
+	SobolSequence(const size_t dimension, TRandom3 &random_generator);
+	~SobolSequence(){};
+
+	void next(Double_t *point);
+	void setIndex(const ULong64_t new_index);
+
+private:
+	void findPrimitivePolynomials(const size_t n_polynomials, vector<UInt_t> &polynomials) const;
+	Bool_t isPrimitive(const UInt_t polynomial, const UInt_t degree) const;
+	UInt_t powerOfX(const ULong64_t exponent, const UInt_t polynomial, const UInt_t degree) const;
+	UInt_t getDegree(const UInt_t polynomial) const;
+
+	const size_t DIMENSION;
+	ULong64_t index;
+	vector<UInt_t> direction_numbers; // DIMENSION x SOBOL_BITS
+	vector<UInt_t> shift;
+	vector<UInt_t> state;
+};
+
+#endif
@@ -0,0 +1,62 @@
+/*
+    This file is part of Horst.
+
+    Horst is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Horst is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Horst.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef SPECTRUM_H
+#define SPECTRUM_H 1
+
+#include <vector>
+
+#include <TROOT.h>
+#include <TH1.h>
+
+#include "AlignedAllocator.h"
+
+using std::vector;
+
+// Bin contents of a spectrum in contiguous memory, with the same bin numbers as a TH1:
+// bin 0 is the underflow bin and bin nbins + 1 the overflow bin. In contrast to
+// TH1::GetBinContent() and TH1::SetBinContent(), the access is not virtual and not
+// bounds-checked, so that loops over the bins can be inlined and vectorized. The storage
+// is aligned to 64 bytes (see AlignedAllocator.h).
+// The kernels work on this type. Histograms of ROOT are only needed for input and output,
+// and fromHistogram() and toHistogram() convert between both.
+class Spectrum{
+public:
+	Spectrum(): nbins(0), bin_contents(2, 0.){};
+	Spectrum(const Int_t n_bins): nbins(n_bins), bin_contents((size_t) n_bins + 2, 0.){};
+	explicit Spectrum(const TH1 &histogram): Spectrum(){ fromHistogram(histogram); };
+	~Spectrum(){};
+
+	Double_t operator[](const Int_t bin) const { return bin_contents[(size_t) bin]; };
+	Double_t& operator[](const Int_t bin){ return bin_contents[(size_t) bin]; };
+	const Double_t* data() const { return bin_contents.data(); };
+	Double_t* data(){ return bin_contents.data(); };
+	Int_t getNBins() const { return nbins; };
+
+	void reset();
+	Double_t getMaximum() const;
+
+	void fromHistogram(const TH1 &histogram);
+	// The histogram must have the same number of bins
+	void toHistogram(TH1 &histogram) const;
+
+private:
+	Int_t nbins;
+	vector<Double_t, AlignedAllocator<Double_t>> bin_contents;
+};
+
+#endif
@@ -0,0 +1,79 @@
+/*
+    This file is part of Horst.
+
+    Horst is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Horst is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Horst.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef SPLINEBASIS_H
+#define SPLINEBASIS_H 1
+
+#include <utility>
+#include <vector>
+
+#include <TROOT.h>
+#include <TH1.h>
+#include <TH2.h>
+#include <TMatrixDSym.h>
+
+using std::pair;
+using std::vector;
+
+// Basis of smooth functions for the fit parameters in the fit range [binstart, binstop) of
+// the rebinned spectrum: params(i) = sum_k B(i, k)*c(k) with K << binstop - binstart
+// coefficients c(k).
+// The basis consists of uniform cubic B-splines with a knot spacing given in units of the
+// original bins, which sum to 1 in every bin of the fit range, and optionally of delta
+// functions at the bins of given peak energies, for lines that are narrower than the knot
+// spacing. All basis functions are nonnegative, so nonnegative coefficients give
+// nonnegative parameters.
+class SplineBasis{
+public:
+	SplineBasis(const UInt_t binning, const Double_t knot_spacing, const vector<Double_t> &peak_energies, const Int_t binstart, const Int_t binstop);
+	~SplineBasis(){};
+
+	size_t getNFunctions() const { return functions.size(); };
+
+	// Design matrix D(j, k) = sum_i B(i, k)*rema(i, j), i.e. the response to the basis
+	// function k in bin j, for j = 0 ... nbins. It is stored as design[K*j + k].
+	// The response matrix is given by an array in the layout of a TH2F or a
+	// ResponseMatrix, with rows of row_length elements.
+	void getDesignMatrix(const Float_t *rema_array, const size_t row_length, vector<Double_t> &design) const;
+
+	// params(i) = sum_k B(i, k)*c(k)
+	void expand(const Double_t *coefficients, TH1F &params) const;
+	// Standard deviation and optionally the correlation matrix of the parameters for a
+	// covariance matrix of the coefficients
+	void expandCovariance(const TMatrixDSym &coefficient_covariance, TH1F &params_uncertainty, TMatrixDSym *params_correlation) const;
+	// Coefficients that approximate the given parameters, as start values of a fit
+	void project(const TH1F &params, vector<Double_t> &coefficients) const;
+
+private:
+	struct Function{
+		Int_t first_bin;
+		vector<Double_t> weights;
+		Bool_t is_peak;
+	};
+
+	Double_t cubicBSpline(const Double_t u) const;
+
+	const UInt_t BINNING;
+	const Int_t bin_start;
+	const Int_t bin_stop;
+	const Int_t n_bins;
+	vector<Function> functions;
+	// Indices and weights of the functions that are nonzero in each bin of the fit range
+	vector<vector<pair<size_t, Double_t> > > bin_functions;
+};
+
+#endif
@@ -34,11 +34,19 @@ public:
 	void getUncertainty(const TH1F &params, const TH2F &rema, TH1F &simulation_statistical_uncertainty, const Int_t binstart, const Int_t binstop); // Version of Uncertainty::getUncertainty() which does not calculate the statistical uncertainty of the spectrum.
 	void getUncertainty(const TH1F &params, const TH1F &spectrum, const TH2F &rema, TH1F &simulation_statistical_uncertainty, TH1F &spectrum_statistical_uncertainty, const Int_t binstart, const Int_t binstop);
 
+	// Exact variance of the top-down parameters (see Fitter::topdown()) if the bins of the
+	// spectrum are Poisson distributed with the given mean values.
+	void getTopDownVariance(const TH1F &spectrum, const TH2F &rema, TH1F &topdown_variance, const Int_t binstart, const Int_t binstop);
+
 	void getTotalUncertainty(vector<TH1F*> &uncertainties, TH1F &total_uncertainty);
 
 	void getLowerAndUpperLimit(const TH1F &spectrum, const TH1F &uncertainty, TH1F &uncertainty_low, TH1F &uncertainty_up, Bool_t no_zeros);
 
 private:
+	// Fused implementation of both versions of getUncertainty(). The spectrum and its
+	// uncertainty are optional.
+	void getStatisticalUncertainty(const TH1F &params, const TH1F *spectrum, const TH2F &rema, TH1F &simulation_statistical_uncertainty, TH1F *spectrum_statistical_uncertainty, const Int_t binstart, const Int_t binstop);
+
 	const UInt_t BINNING;
 };
 
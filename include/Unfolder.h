@@ -0,0 +1,143 @@
+/*
+    This file is part of Horst.
+
+    Horst is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Horst is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Horst.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef UNFOLDER_H
+#define UNFOLDER_H 1
+
+#include <TH1.h>
+#include <TH2.h>
+#include <TROOT.h>
+
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "Config.h"
+#include "Fitter.h"
+#include "Resolution.h"
+
+using std::pair;
+using std::unique_ptr;
+using std::vector;
+
+// Options of Unfolder::unfold(). The fit range is given in bins of the original spectrum,
+// like the '-l' and '-r' options of horst.
+struct UnfoldingOptions{
+	UInt_t left = 0;
+	UInt_t right = NBINS;
+	// Number of Monte-Carlo (MC) iterations for the uncertainty of the fit. 0 means no MC.
+	UInt_t uncertainty_mc = 0;
+	UInt_t seed = 1;
+	// Only fluctuate the spectrum in the MC iterations, not the response matrix
+	Bool_t use_mc_fast = false;
+};
+
+// Results of Unfolder::unfold(). Each vector has one entry per bin of the rebinned
+// spectrum, the first entry corresponds to bin 1.
+struct UnfoldingResult{
+	vector<Double_t> spectrum;
+	vector<Double_t> topdown_params;
+	vector<Double_t> fit_params;
+	vector<Double_t> fit_result;
+	vector<Double_t> fit_FEP;
+	vector<Double_t> fit_total_uncertainty;
+	vector<Double_t> spectrum_reconstructed;
+	vector<Double_t> reconstruction_uncertainty;
+	vector<Double_t> reconstruction_uncertainty_low;
+	vector<Double_t> reconstruction_uncertainty_up;
+	UInt_t mc_iterations = 0;
+
+	// Names (the same as in the output of horst) and values of all histograms above
+	vector<pair<TString, const vector<Double_t>*> > getHistograms() const {
+		return {
+			{"spectrum", &spectrum},
+			{"topdown_params", &topdown_params},
+			{"fit_params", &fit_params},
+			{"fit_result", &fit_result},
+			{"fit_FEP", &fit_FEP},
+			{"fit_total_uncertainty", &fit_total_uncertainty},
+			{"spectrum_reconstructed", &spectrum_reconstructed},
+			{"reconstruction_uncertainty", &reconstruction_uncertainty},
+			{"reconstruction_uncertainty_low", &reconstruction_uncertainty_low},
+			{"reconstruction_uncertainty_up", &reconstruction_uncertainty_up}
+		};
+	};
+};
+
+// Reconstruction of spectra with a response matrix that stays in memory. This is the
+// same procedure as in horst (top-down start parameters, fit, optional MC uncertainty,
+// reconstruction), but without any file I/O or output, so that a long-running process
+// can unfold many spectra without reading the matrix again.
+// The matrix is rebinned, and the detector resolution is folded into it, once in the
+// constructor. The Fitter is kept as long as the fit range does not change.
+// No histogram is attached to the current ROOT directory, so that several Unfolders
+// can be used next to each other and next to open files.
+class Unfolder{
+public:
+	// The response matrix and the number of simulated particles with NBINS bins, for
+	// example from InputFileReader::readMatrix()
+	Unfolder(const TH2F &response_matrix, const TH1F &n_simulated_particles, const UInt_t binning);
+	// Same, with the parameters of a detector resolution (see Resolution::setParameters())
+	Unfolder(const TH2F &response_matrix, const TH1F &n_simulated_particles, const UInt_t binning, const vector<Double_t> &resolution_params);
+	~Unfolder(){};
+
+	// Unfold a spectrum with NBINS bins
+	void unfold(const vector<Double_t> &spectrum, const UnfoldingOptions &options, UnfoldingResult &result);
+	// Same for a spectrum that changed since the last call, for example because more counts
+	// were recorded. The top-down unfolding is linear in the spectrum, so only the change
+	// is unfolded and added to the previous top-down parameters. This skips the bins above
+	// the highest nonzero bin of the change, so a change confined to low bins is cheap, while
+	// any other change costs as much as a complete top-down unfolding. The fit starts from the
+	// previous fit parameters plus the top-down parameters of the change, which is close to
+	// the new minimum if the change is small. Without a previous call with the same fit
+	// range, this is the same as unfold().
+	void update(const vector<Double_t> &spectrum, const UnfoldingOptions &options, UnfoldingResult &result);
+
+	// Write all histograms of a result to a ROOT file, with the same names as horst
+	Bool_t writeResult(const UnfoldingResult &result, const TString outputfilename) const;
+
+	UInt_t getBinning() const { return BINNING; };
+	Int_t getNBins() const { return nbins; };
+
+private:
+	void run(const vector<Double_t> &spectrum, const UnfoldingOptions &options, UnfoldingResult &result, const Bool_t incremental);
+	void toVector(const TH1F &histogram, vector<Double_t> &values) const;
+
+	const UInt_t BINNING;
+	const Int_t nbins;
+	const Double_t max_bin;
+
+	TH2F response_matrix;
+	TH2F folded_response_matrix;
+	TH1F n_simulated_particles;
+	TH1F response_matrix_diagonal;
+	Bool_t fold_resolution;
+	Resolution resolution;
+
+	unique_ptr<Fitter> fitter;
+	Int_t fitter_binstart;
+	Int_t fitter_binstop;
+
+	// State of the last call for update(). The top-down parameters are stored before the
+	// negative ones are removed, so that they stay a linear function of the spectrum.
+	Bool_t has_previous;
+	TH1F previous_spectrum;
+	TH1F previous_topdown_params;
+	TH1F previous_fit_params;
+};
+
+#endif
@@ -0,0 +1,116 @@
+/*
+    This file is part of Horst.
+
+    Horst is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Horst is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Horst.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef UNFOLDINGSERVER_H
+#define UNFOLDINGSERVER_H 1
+
+#include <TROOT.h>
+
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Unfolder.h"
+
+using std::list;
+using std::shared_ptr;
+using std::string;
+using std::vector;
+
+// Daemon mode of horst ('--serve' option). Unfolding jobs are received over a local Unix
+// domain socket and executed by a pool of worker threads. The rebinned response matrices
+// are kept in memory in the form of Unfolders, so that a matrix is read only once as long
+// as it is used regularly. The least recently used Unfolder is removed as soon as more than
+// cache_size of them are loaded. A matrix or resolution file whose modification time or
+// size changed since it was loaded, for example because makematrix rewrote it, is loaded
+// again.
+//
+// A job is a sequence of lines 'KEY VALUE', terminated by a line 'end':
+//	matrix MATRIXFILENAME		response matrix (required)
+//	binning BINNING			rebinning factor (default: 10)
+//	resolution_file RESOLUTIONFILE	detector resolution folded into the matrix (default: none)
+//	left LEFT, right RIGHT		fit range in bins of the original spectrum (default: 0 and NBINS)
+//	uncertainty_mc NRANDOM		number of MC iterations (default: 0)
+//	uncertainty_mc_fast NRANDOM	same, without fluctuations of the response matrix
+//	seed SEED			random number seed (default: 1)
+//	spectrum SPECTRUMFILE		spectrum in a text file, or in a ROOT file if spectrum_name is given
+//	spectrum_name SPECTRUM		name of the TH1F in SPECTRUMFILE
+//	bins CONTENT_1 ... CONTENT_NBINS	the spectrum itself, instead of 'spectrum'
+//	output OUTPUTFILENAME		write the results to a ROOT file instead of returning them
+// A line 'shutdown' instead of a job stops the server after all running jobs are finished.
+//
+// The answer starts with a line 'ok' or 'error MESSAGE'. After 'ok' follows either a line
+// 'output OUTPUTFILENAME', or one line 'NAME CONTENT_1 ... CONTENT_N' for each result of
+// the Unfolder (see UnfoldingResult), and finally a line 'end'.
+class UnfoldingServer{
+public:
+	UnfoldingServer(const TString socket_path, const UInt_t n_workers, const UInt_t cache_size);
+	~UnfoldingServer(){};
+
+	// Accept connections until a 'shutdown' request is received
+	void run();
+
+private:
+	struct Job{
+		TString matrixfile = "";
+		UInt_t binning = 10;
+		TString resolution_file = "";
+		UInt_t left = 0;
+		UInt_t right = NBINS;
+		UInt_t uncertainty_mc = 0;
+		Bool_t use_mc_fast = false;
+		UInt_t seed = 1;
+		TString spectrumfile = "";
+		TString spectrumname = "";
+		vector<Double_t> bins;
+		TString outputfile = "";
+	};
+
+	// An Unfolder can only process one job at a time
+	struct CacheEntry{
+		string key;
+		shared_ptr<Unfolder> unfolder;
+		std::mutex mutex;
+	};
+
+	void work();
+	void handleConnection(const int connection);
+	Bool_t parseJob(const vector<string> &lines, Job &job, string &error) const;
+	Bool_t runJob(const Job &job, string &answer, string &error);
+	shared_ptr<CacheEntry> getUnfolder(const Job &job);
+
+	const TString socket_path;
+	const UInt_t n_workers;
+	const UInt_t cache_size;
+	int server_socket;
+
+	std::mutex queue_mutex;
+	std::condition_variable connection_queued;
+	std::deque<int> connections;
+	Bool_t stopping;
+
+	// Most recently used entries first
+	std::mutex cache_mutex;
+	list<shared_ptr<CacheEntry> > cache;
+};
+
+#endif
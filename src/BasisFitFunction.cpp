@@ -0,0 +1,32 @@
+/*
+    This file is part of Horst.
+
+    Horst is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Horst is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Horst.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <cmath>
+
+#include "BasisFitFunction.h"
+
+Double_t BasisFitFunction::operator()(Double_t *x, Double_t *p){
+	const size_t bin = (size_t) floor(x[0]*inverse_BINNING);
+	const Double_t *design_bin = &design[n_functions*bin];
+
+	Double_t bin_content = 0.;
+	for(size_t k = 0; k < n_functions; ++k){
+		bin_content += p[k]*design_bin[k];
+	}
+
+	return bin_content;
+}
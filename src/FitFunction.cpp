@@ -15,40 +15,55 @@
     along with Horst.  If not, see <https://www.gnu.org/licenses/>.
 */
 
+#include <algorithm>
+
 #include "FitFunction.h"
 #include "Config.h"
 
 Double_t FitFunction::operator()(Double_t *x, Double_t *p){
 	Int_t bin = (Int_t) floor(x[0]*inverse_BINNING);
-	Double_t bin_content = 0.;
-
-	for(Int_t i = bin_stop; i >= bin; --i){
-		bin_content += p[i]*response_matrix.GetBinContent(i, bin);
+	if(bin < 0 || bin >= n_rows){
+		return 0.;
 	}
 
-	return bin_content;
-}
+	// Energies below bin - upper_band do not contribute to the bin
+	const Int_t first_parameter = bin - upper_band - bin_start > 0 ? bin - upper_band - bin_start : 0;
 
-Double_t FitFunction::getSimulationStatisticalUncertainty(const Int_t bin, const TH1F &params) {
-	Double_t bin_content = 0.;
+	// The contributions of all energies to the bin are contiguous. Four independent partial
+	// sums allow the compiler to vectorize the dot product.
+	const Float_t *contributions = &block[(size_t) n_parameters*(size_t) bin];
+	Double_t sum[4] = {0., 0., 0., 0.};
 
-	for(Int_t i = bin_stop; i > bin; --i){
-		bin_content += params.GetBinContent(i)*response_matrix.GetBinContent(i, bin);
+	Int_t k = first_parameter;
+	for(; k + 4 <= n_parameters; k += 4){
+		for(Int_t l = 0; l < 4; ++l){
+			sum[l] += p[k + l]*contributions[k + l];
+		}
+	}
+	for(; k < n_parameters; ++k){
+		sum[0] += p[k]*contributions[k];
 	}
 
-	return sqrt(bin_content);
+	return (sum[0] + sum[1]) + (sum[2] + sum[3]);
 }
 
-Double_t FitFunction::getSpectrumStatisticalUncertainty(const Int_t bin, const TH1F &params, const TH1F &spectrum) {
-	Double_t bin_content = 0.;
-	Double_t spectrum_bin_content = 1.;
+void FitFunction::setBlock(const Float_t *rema_array, const size_t row_length, const Int_t nbins){
+
+	n_rows = nbins + 1;
+	block.resize((size_t) n_parameters*(size_t) n_rows);
+	upper_band = 0;
 
-	for(Int_t i = bin_stop; i >= bin; --i){
-		spectrum_bin_content = spectrum.GetBinContent(i);
-		if(spectrum_bin_content > 0.){	// Ignore bins with negative values (should not be in the original spectrum anyway) or zero content.
-			bin_content += params.GetBinContent(i)*params.GetBinContent(i)*1./spectrum_bin_content*response_matrix.GetBinContent(i, bin)*response_matrix.GetBinContent(i, bin);
+	for(Int_t j = 0; j < n_rows; ++j){
+		const Float_t *rema_j = &rema_array[row_length*(size_t) j + (size_t) bin_start];
+		Float_t *block_j = &block[(size_t) n_parameters*(size_t) j];
+		std::copy(rema_j, rema_j + n_parameters, block_j);
+
+		// The lowest energy with a contribution to bin j determines the number of diagonals
+		for(Int_t k = 0; k < n_parameters && bin_start + k < j - upper_band; ++k){
+			if(block_j[k] != 0.f){
+				upper_band = j - bin_start - k;
+				break;
+			}
 		}
 	}
-
-	return sqrt(bin_content);
 }
@@ -15,10 +15,12 @@
     along with Horst.  If not, see <https://www.gnu.org/licenses/>.
 */
 
+#include <algorithm>
 #include <iostream>
 #include <vector>
 
 #include <TFitResult.h>
+#include <TList.h>
 
 #include "Config.h"
 #include "Fitter.h"
@@ -27,86 +29,215 @@ using std::cout;
 using std::endl;
 using std::vector;
 
+Fitter::Fitter(const TH2F &rema, const UInt_t binning, Int_t binstart, Int_t binstop):BINNING(binning), bin_start(binstart), bin_stop(binstop), fitFunction(rema, binning, binstart, binstop), chi2(-1.), basisFitFunction(binning), basis_fitf(nullptr){
+	// Pass the fit function as a pointer, so that TF1 does not evaluate a copy and
+	// setResponseMatrix() in fit() has an effect.
+	// The TF1 is removed from the global list of functions, and the fits below use the
+	// pointer instead of the name. Otherwise, several Fitters would share the function
+	// that was created last.
+	// Only the bins in the fit range have a parameter. Minuit would still carry fixed
+	// parameters through every iteration.
+	fitf = new TF1("fitf", &fitFunction, 0., (Double_t) NBINS-1., fitFunction.getNParameters());
+	gROOT->GetListOfFunctions()->Remove(fitf);
+}
+
 void Fitter::topdown(const TH1F &spectrum, const TH2F &rema, TH1F &params, Int_t binstart, Int_t binstop){
 
-	TH1F topdown_unfolded_spectrum("topdown_unfolded_spectrum", "Unfolded_Spectrum_TopDown", (Int_t) NBINS/ (Int_t) BINNING, 0., (Double_t) NBINS - 1);
+	const Int_t nbins = (Int_t) NBINS/((Int_t) BINNING);
+	const Spectrum spectrum_values(spectrum);
+	Spectrum params_values(nbins);
 
-	Double_t parameter = 0.;
-	for(Int_t i = 0; i <= (Int_t) NBINS/((Int_t) BINNING); ++i){
-		topdown_unfolded_spectrum.SetBinContent(i, spectrum.GetBinContent(i));
-		params.SetBinContent(i, 0.);
+	solveTopDown(spectrum_values.data(), rema.GetArray(), (size_t) rema.GetNbinsX() + 2, params_values.data(), binstart, binstop);
+
+	for(Int_t i = 0; i <= nbins; ++i){
+		params.SetBinContent(i, params_values[i]);
 	}
+}
 
+void Fitter::solveTopDown(const Double_t *spectrum, const Float_t *rema, const size_t row_length, Double_t *params, const Int_t binstart, const Int_t binstop) const {
+
+	// Parameter i is what remains of bin i of the spectrum after the response to all
+	// energies m > i in the fit range has been subtracted, divided by rema(i, i).
+	// The contributions rema(m, i) of these energies to bin i are contiguous, so every
+	// parameter is a dot product of two contiguous vectors. Four independent partial sums
+	// allow the compiler to vectorize it.
+	// The parameters above the highest nonzero one are zero, so the dot products end there,
+	// and empty bins at the upper end of the spectrum are skipped. This makes the unfolding
+	// of a change of the spectrum that is confined to low bins cheap (see Unfolder::update()).
+	Int_t last_nonzero = binstart - 1;
 	for(Int_t i = binstop; i >= binstart; --i){
-		parameter = topdown_unfolded_spectrum.GetBinContent(i)/rema.GetBinContent(i, i);
-		params.SetBinContent(i, parameter);
+		if(i > last_nonzero && spectrum[i] == 0.){
+			params[i] = 0.;
+			continue;
+		}
 
-		for(Int_t j = binstop - 1; j >= 0; --j){
-			topdown_unfolded_spectrum.SetBinContent(j, topdown_unfolded_spectrum.GetBinContent(j) - parameter*rema.GetBinContent(i, j));
+		const Float_t *rema_i = &rema[row_length*(size_t) i];
+		Double_t sum[4] = {0., 0., 0., 0.};
+
+		Int_t m = i + 1;
+		for(; m + 3 <= last_nonzero; m += 4){
+			for(Int_t k = 0; k < 4; ++k){
+				sum[k] += params[m + k]*rema_i[m + k];
+			}
+		}
+		for(; m <= last_nonzero; ++m){
+			sum[0] += params[m]*rema_i[m];
+		}
+
+		params[i] = (spectrum[i] - ((sum[0] + sum[1]) + (sum[2] + sum[3])))/rema_i[i];
+		if(i > last_nonzero && params[i] != 0.){
+			last_nonzero = i;
 		}
 	}
 }
 
 void Fitter::fit(TH1F &spectrum, const TH2F &rema, const TH1F &start_params, TH1F &params, TH1F &fit_uncertainty, Int_t binstart, Int_t binstop, const Bool_t verbose, const Bool_t correlation, TMatrixDSym &correlation_matrix){
 
-	fitFunction.setResponseMatrix(rema);
+	if(basis_fitf != nullptr){
+		fitBasis(spectrum, rema.GetArray(), (size_t) rema.GetNbinsX() + 2, start_params, params, &fit_uncertainty, binstart, binstop, verbose, correlation ? &correlation_matrix : nullptr);
+		return;
+	}
 
-	Double_t fit_upper_limit = 10.*start_params.GetMaximum();
+	fitFunction.setResponseMatrix(rema);
+	setStartParameters(start_params, binstart, binstop);
 
-	for(Int_t i = 0; i <= start_params.GetNbinsX(); ++i){
-		if(i < binstart || i >= binstop){
-			fitf->FixParameter(i, 0.);
-		} else{
-			fitf->SetParameter(i, start_params.GetBinContent(i));
-			fitf->SetParLimits(i, 0., fit_upper_limit);
-		}
+	TString fit_options = correlation ? "S0N" : "0N";
+	if(!verbose){
+		fit_options += "Q";
 	}
-
-	TFitResultPtr fit_result;
-	if(verbose){
-		if(correlation){
-			fit_result = spectrum.Fit("fitf", "S0N", "", (UInt_t) binstart*BINNING, (UInt_t) binstop*BINNING);
-			correlation_matrix = fit_result->GetCorrelationMatrix();
-		} else{
-			spectrum.Fit("fitf", "0N", "", (UInt_t) binstart*BINNING, (UInt_t) binstop*BINNING);
-		}
-	} else{
-		if(correlation){
-			fit_result = spectrum.Fit("fitf", "S0QN", "", (UInt_t) binstart*BINNING, (UInt_t) binstop*BINNING);
-			correlation_matrix = fit_result->GetCorrelationMatrix();
-		} else{
-			spectrum.Fit("fitf", "0QN", "", (UInt_t) binstart*BINNING, (UInt_t) binstop*BINNING);
+	TFitResultPtr fit_result = spectrum.Fit(fitf, fit_options, "", (UInt_t) binstart*BINNING, (UInt_t) binstop*BINNING);
+
+	if(correlation){
+		// The correlation matrix keeps one row for each bin, with zeros outside of the fit range
+		const TMatrixDSym parameter_correlation = fit_result->GetCorrelationMatrix();
+		const Int_t nbins = (Int_t) NBINS/ (Int_t) BINNING;
+		const Int_t n_parameters = fitFunction.getNParameters();
+		correlation_matrix.ResizeTo(nbins, nbins);
+		correlation_matrix = 0.;
+		for(Int_t k = 0; k < n_parameters; ++k){
+			for(Int_t l = 0; l < n_parameters; ++l){
+				correlation_matrix(bin_start + k, bin_start + l) = parameter_correlation(k, l);
+			}
 		}
 	}
 
 	chi2 = fitf->GetChisquare();
 
-	for(Int_t i = 1; i <= start_params.GetNbinsX(); ++i){
-		params.SetBinContent(i, fitf->GetParameter(i-1));
-		fit_uncertainty.SetBinContent(i, fitf->GetParError(i-1));
-	}
+	getParameters(params, &fit_uncertainty);
 }
 
 void Fitter::fit(TH1F &spectrum, const TH2F &rema, const TH1F &start_params, TH1F &params, Int_t binstart, Int_t binstop){
 
+	if(basis_fitf != nullptr){
+		fitBasis(spectrum, rema.GetArray(), (size_t) rema.GetNbinsX() + 2, start_params, params, nullptr, binstart, binstop, false, nullptr);
+		return;
+	}
+
 	fitFunction.setResponseMatrix(rema);
+	setStartParameters(start_params, binstart, binstop);
+
+	spectrum.Fit(fitf, "0QN", "", (UInt_t) binstart*BINNING, (UInt_t) binstop*BINNING);
+
+	getParameters(params, nullptr);
+}
+
+void Fitter::fit(TH1F &spectrum, const ResponseMatrix &rema, const TH1F &start_params, TH1F &params, Int_t binstart, Int_t binstop){
+
+	if(basis_fitf != nullptr){
+		fitBasis(spectrum, rema.getContributions(0), (size_t) rema.getNBins() + 2, start_params, params, nullptr, binstart, binstop, false, nullptr);
+		return;
+	}
+
+	fitFunction.setResponseMatrix(rema);
+	setStartParameters(start_params, binstart, binstop);
+
+	spectrum.Fit(fitf, "0QN", "", (UInt_t) binstart*BINNING, (UInt_t) binstop*BINNING);
+
+	getParameters(params, nullptr);
+}
+
+void Fitter::setStartParameters(const TH1F &start_params, const Int_t binstart, const Int_t binstop){
+
+	if(binstart != bin_start || binstop != bin_stop){
+		cout << __FILE__ << ":" << __LINE__ << ": " << __FUNCTION__ << "(): "<< "Error: The fit range [" << binstart << ", " << binstop << ") differs from the range [" << bin_start << ", " << bin_stop << ") of the Fitter. Aborting ..." << endl;
+		abort();
+	}
 
 	Double_t fit_upper_limit = 10.*start_params.GetMaximum();
 
-	for(Int_t i = 0; i <= start_params.GetNbinsX(); ++i){
-		if(i < binstart || i >= binstop){
-			fitf->FixParameter(i, 0.);
-		} else{
-			fitf->SetParameter(i, start_params.GetBinContent(i));
-			fitf->SetParLimits(i, 0., fit_upper_limit);
+	for(Int_t k = 0; k < fitFunction.getNParameters(); ++k){
+		fitf->SetParameter(k, start_params.GetBinContent(bin_start + k));
+		fitf->SetParLimits(k, 0., fit_upper_limit);
+		// The parameter errors of the previous fit would be used as initial step sizes.
+		// Reset them, so that the result of a fit does not depend on the fits before.
+		fitf->SetParError(k, 0.);
+	}
+}
+
+void Fitter::getParameters(TH1F &params, TH1F *fit_uncertainty) const {
+
+	for(Int_t i = 0; i <= params.GetNbinsX() + 1; ++i){
+		params.SetBinContent(i, 0.);
+		if(fit_uncertainty != nullptr){
+			fit_uncertainty->SetBinContent(i, 0.);
 		}
+	}
 
+	for(Int_t k = 0; k < fitFunction.getNParameters(); ++k){
+		params.SetBinContent(bin_start + k, fitf->GetParameter(k));
+		if(fit_uncertainty != nullptr){
+			fit_uncertainty->SetBinContent(bin_start + k, fitf->GetParError(k));
+		}
 	}
+}
+
+void Fitter::setBasis(const SplineBasis &spline_basis){
+
+	basis.reset(new SplineBasis(spline_basis));
+
+	delete basis_fitf;
+	basis_fitf = new TF1("basis_fitf", &basisFitFunction, 0., (Double_t) NBINS-1., (Int_t) basis->getNFunctions());
+	gROOT->GetListOfFunctions()->Remove(basis_fitf);
+}
+
+void Fitter::fitBasis(TH1F &spectrum, const Float_t *rema_array, const size_t row_length, const TH1F &start_params, TH1F &params, TH1F *fit_uncertainty, Int_t binstart, Int_t binstop, const Bool_t verbose, TMatrixDSym *correlation_matrix){
+
+	// The response to each basis function is calculated once per matrix, so that an
+	// evaluation of the fit function costs K instead of NBINS/BINNING operations.
+	const Int_t n_functions = (Int_t) basis->getNFunctions();
+	vector<Double_t> design;
+	basis->getDesignMatrix(rema_array, row_length, design);
+	basisFitFunction.setDesignMatrix(design, (size_t) n_functions);
 
-	spectrum.Fit("fitf", "0QN", "", (UInt_t) binstart*BINNING, (UInt_t) binstop*BINNING);
+	vector<Double_t> start_coefficients;
+	basis->project(start_params, start_coefficients);
+	const Double_t fit_upper_limit = 10.*(*std::max_element(start_coefficients.begin(), start_coefficients.end()));
 
-	for(Int_t i = 1; i <= start_params.GetNbinsX(); ++i){
-		params.SetBinContent(i, fitf->GetParameter(i-1));
+	for(Int_t k = 0; k < n_functions; ++k){
+		basis_fitf->SetParameter(k, start_coefficients[(size_t) k]);
+		basis_fitf->SetParLimits(k, 0., fit_upper_limit);
+		basis_fitf->SetParError(k, 0.);
+	}
+
+	TString fit_options = fit_uncertainty != nullptr ? "S0N" : "0N";
+	if(!verbose){
+		fit_options += "Q";
+	}
+	TFitResultPtr fit_result = spectrum.Fit(basis_fitf, fit_options, "", (UInt_t) binstart*BINNING, (UInt_t) binstop*BINNING);
+
+	chi2 = basis_fitf->GetChisquare();
+	basis->expand(basis_fitf->GetParameters(), params);
+
+	if(fit_uncertainty != nullptr){
+		TMatrixDSym covariance(n_functions);
+		if(fit_result.Get() != nullptr){
+			covariance = fit_result->GetCovarianceMatrix();
+		} else{
+			for(Int_t k = 0; k < n_functions; ++k){
+				covariance(k, k) = basis_fitf->GetParError(k)*basis_fitf->GetParError(k);
+			}
+		}
+		basis->expandCovariance(covariance, *fit_uncertainty, correlation_matrix);
 	}
 }
 
@@ -125,7 +256,7 @@ void Fitter::fittedSpectrum(const TH1F &params, const TH2F &rema, TH1F &fitted_s
 	Double_t bin = 0.;
 	for(Int_t i = 1; i <= (Int_t) NBINS/ (Int_t) BINNING; ++i){
 		bin = (Double_t) i*BINNING;
-		fitted_spectrum.SetBinContent(i, fitFunction(&bin, &parameters[0]));
+		fitted_spectrum.SetBinContent(i, fitFunction(&bin, &parameters[(size_t) bin_start]));
 	}
 }
 
@@ -0,0 +1,168 @@
+/*
+    This file is part of Horst.
+
+    Horst is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Horst is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Horst.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <TFile.h>
+#include <TVectorD.h>
+
+#include <iostream>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "Config.h"
+#include "FoldedMatrixCache.h"
+#include "Resolution.h"
+
+using std::cout;
+using std::endl;
+
+// Parameters of the 64-bit FNV-1a hash
+const ULong64_t FNV_OFFSET_BASIS = 14695981039346656037ULL;
+const ULong64_t FNV_PRIME = 1099511628211ULL;
+
+ULong64_t hashBytes(const void *data, const size_t n, ULong64_t hash){
+	const unsigned char *bytes = (const unsigned char*) data;
+	for(size_t k = 0; k < n; ++k){
+		hash ^= (ULong64_t) bytes[k];
+		hash *= FNV_PRIME;
+	}
+	return hash;
+}
+
+void FoldedMatrixCache::get(const TH2F &rema, const Int_t first_bin, const Int_t last_bin, const UInt_t binning, const vector<Double_t> &resolution_params, TH2F &folded_rema){
+
+	const vector<Double_t> key = getKey(binning, resolution_params);
+	const TString filename = prefix + TString::Format("%016llx.root", (unsigned long long) hashBytes(&key[0], key.size()*sizeof(Double_t), FNV_OFFSET_BASIS));
+
+	vector<ULong64_t> row_hashes;
+	hashRows(rema, row_hashes);
+
+	if(access(filename.Data(), F_OK) == 0 && read(filename, key, first_bin, last_bin, row_hashes, folded_rema)){
+		cout << "> Read resolution-folded response matrix from cache file " << filename << endl;
+		return;
+	}
+
+	cout << "> Folding detector resolution into response matrix ..." << endl;
+	Resolution resolution(binning);
+	resolution.setParameters(resolution_params);
+	resolution.foldMatrix(rema, folded_rema);
+
+	write(filename, key, first_bin, last_bin, row_hashes, folded_rema);
+	cout << "> Wrote resolution-folded response matrix to cache file " << filename << endl;
+}
+
+vector<Double_t> FoldedMatrixCache::getKey(const UInt_t binning, const vector<Double_t> &resolution_params) const {
+
+	vector<Double_t> key = {(Double_t) NBINS, (Double_t) binning, GAUSSIAN_BLUR_WINDOW};
+	key.insert(key.end(), resolution_params.begin(), resolution_params.end());
+
+	return key;
+}
+
+void FoldedMatrixCache::hashRows(const TH2F &rema, vector<ULong64_t> &row_hashes) const {
+
+	// Only the regular bins, since the underflow and overflow bins are not used.
+	// The elements of a row are not contiguous, so the hashes of all rows are
+	// updated together while the array is read in order.
+	const Int_t nbins = rema.GetNbinsX();
+	const Float_t *rema_array = rema.GetArray();
+	const size_t row_length = (size_t) nbins + 2;
+
+	row_hashes.assign(row_length, FNV_OFFSET_BASIS);
+	for(Int_t j = 1; j <= rema.GetNbinsY(); ++j){
+		const Float_t *contributions = &rema_array[row_length*(size_t) j];
+		for(Int_t i = 1; i <= nbins; ++i){
+			row_hashes[(size_t) i] = hashBytes(&contributions[i], sizeof(Float_t), row_hashes[(size_t) i]);
+		}
+	}
+}
+
+Bool_t FoldedMatrixCache::read(const TString filename, const vector<Double_t> &key, const Int_t first_bin, const Int_t last_bin, const vector<ULong64_t> &row_hashes, TH2F &folded_rema) const {
+
+	TFile cachefile(filename);
+	const TVectorD *saved_key = (TVectorD*) cachefile.Get("key");
+	const TVectorD *saved_rows = (TVectorD*) cachefile.Get("rows");
+	const TVectorD *saved_row_hashes = (TVectorD*) cachefile.Get("row_hashes");
+	const TH2F *saved_folded_rema = (TH2F*) cachefile.Get("rema_folded");
+
+	if(cachefile.IsZombie() || saved_key == nullptr || saved_rows == nullptr || saved_row_hashes == nullptr || saved_folded_rema == nullptr || saved_rows->GetNrows() != 2){
+		cout << __FILE__ << ":" << __LINE__ << ": " << __FUNCTION__ << "(): "<< "Warning: Cache file " << filename << " is incomplete and will be replaced." << endl;
+		return false;
+	}
+
+	Bool_t match = saved_key->GetNrows() == (Int_t) key.size() && saved_folded_rema->GetNbinsX() == folded_rema.GetNbinsX() && saved_folded_rema->GetNbinsY() == folded_rema.GetNbinsY();
+	for(Int_t i = 0; match && i < saved_key->GetNrows(); ++i){
+		match = (*saved_key)[i] == key[(size_t) i];
+	}
+	if(!match){
+		cout << __FILE__ << ":" << __LINE__ << ": " << __FUNCTION__ << "(): "<< "Warning: Cache file " << filename << " belongs to a different binning or resolution and will be replaced." << endl;
+		return false;
+	}
+
+	// The hashes are split into two numbers that can be represented exactly as Double_t
+	const Int_t saved_first_bin = (Int_t) (*saved_rows)[0];
+	const Int_t saved_last_bin = (Int_t) (*saved_rows)[1];
+	match = saved_first_bin <= first_bin && saved_last_bin >= last_bin && saved_row_hashes->GetNrows() == 2*(saved_last_bin - saved_first_bin + 1);
+	for(Int_t i = first_bin; match && i <= last_bin; ++i){
+		const Int_t k = 2*(i - saved_first_bin);
+		match = (*saved_row_hashes)[k] == (Double_t) (row_hashes[(size_t) i] >> 32) && (*saved_row_hashes)[k + 1] == (Double_t) (row_hashes[(size_t) i] & 0xffffffffULL);
+	}
+	if(!match){
+		cout << "> Cache file " << filename << " does not contain the rows " << first_bin << " to " << last_bin << " of this matrix and will be replaced." << endl;
+		return false;
+	}
+
+	const Float_t *saved_array = saved_folded_rema->GetArray();
+	Float_t *folded_array = folded_rema.GetArray();
+	const size_t row_length = (size_t) folded_rema.GetNbinsX() + 2;
+	for(size_t j = 0; j < row_length; ++j){
+		for(Int_t i = 0; i < (Int_t) row_length; ++i){
+			folded_array[row_length*j + (size_t) i] = i >= first_bin && i <= last_bin ? saved_array[row_length*j + (size_t) i] : 0.f;
+		}
+	}
+
+	cachefile.Close();
+
+	return true;
+}
+
+void FoldedMatrixCache::write(const TString filename, const vector<Double_t> &key, const Int_t first_bin, const Int_t last_bin, const vector<ULong64_t> &row_hashes, const TH2F &folded_rema) const {
+
+	// The cache is optional, so a failure to write it is not fatal
+	const TString temporary_filename = filename + ".tmp";
+	TFile cachefile(temporary_filename, "RECREATE");
+	if(cachefile.IsZombie()){
+		cout << __FILE__ << ":" << __LINE__ << ": " << __FUNCTION__ << "(): "<< "Warning: Could not create cache file " << temporary_filename << "." << endl;
+		return;
+	}
+
+	const vector<Double_t> rows = {(Double_t) first_bin, (Double_t) last_bin};
+	vector<Double_t> saved_row_hashes;
+	for(Int_t i = first_bin; i <= last_bin; ++i){
+		saved_row_hashes.push_back((Double_t) (row_hashes[(size_t) i] >> 32));
+		saved_row_hashes.push_back((Double_t) (row_hashes[(size_t) i] & 0xffffffffULL));
+	}
+
+	TVectorD((Int_t) key.size(), &key[0]).Write("key");
+	TVectorD((Int_t) rows.size(), &rows[0]).Write("rows");
+	TVectorD((Int_t) saved_row_hashes.size(), &saved_row_hashes[0]).Write("row_hashes");
+	folded_rema.Write("rema_folded");
+	cachefile.Close();
+
+	if(rename(temporary_filename.Data(), filename.Data()) != 0){
+		cout << __FILE__ << ":" << __LINE__ << ": " << __FUNCTION__ << "(): "<< "Warning: Could not rename " << temporary_filename << " to " << filename << "." << endl;
+	}
+}
@@ -40,6 +40,10 @@ void convertDirectory(TDirectory* f, TString filename,
         if (f->GetListOfKeys()->At(i)->IsFolder()) {
             TDirectory* dir = (TDirectory*)f->GetDirectory(
                 f->GetListOfKeys()->At(i)->GetName());
+            // Folders that are not directories, like the TTree of MC samples in horst output files
+            if (dir == nullptr) {
+                continue;
+            }
             prefixstream << prefix << f->GetListOfKeys()->At(i)->GetName() << "_";
             convertDirectory(dir,
                     filename, calibrationfilename, (TString)prefixstream.str(), BINNING);
@@ -49,6 +53,11 @@ void convertDirectory(TDirectory* f, TString filename,
         }
 		TString histogramname = f->GetListOfKeys()->At(i)->GetName();
 
+		// Skip objects which are not histograms, for example the number of MC iterations or the sampling scheme in horst output files
+		if(!f->Get(histogramname)->InheritsFrom("TH1")){
+			continue;
+		}
+
 		cout << "Converting histogram " << histogramname << " ..." << endl;
 
 		// Write two-column spectrum
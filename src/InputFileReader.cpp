@@ -17,6 +17,7 @@
 
 #include <TFile.h>
 #include <TH1.h>
+#include <TTree.h>
 
 #include <bits/stdc++.h>
 #include <iostream>
@@ -63,49 +64,19 @@ void InputFileReader::fillMatrix(const vector<TString> &filenames, const vector<
 	cout << "> Creating matrix ..." << endl;
 
 	Int_t interp1_sim, interp2_sim;
-	Double_t interp1_dist, interp2_dist;
 	Double_t interp1_weight, interp2_weight;
 
-	Double_t dist;
-	Int_t n_energies = (Int_t) energies.size();
-	Int_t simulationBin;
 	TAxis* ReMaXAxis = response_matrix.GetXaxis();
-	TAxis* ReMaYAxis = response_matrix.GetYaxis();
 
 	for(Int_t i = 1; i <= (Int_t) NBINS; ++i){
-		// Find two reference points for interpolation
-		interp1_sim = 0;
-		interp2_sim = NBINS;
-		interp1_dist = (Double_t) NBINS * -1.;
-		interp2_dist = (Double_t) NBINS;
-
-		// Do not calculate the absolute value of dist immediately, because it will be
-		// used later to shift the simulation in the right direction
-		for(Int_t simNo = 0; simNo < n_energies; ++simNo){
-			dist = energies[(long unsigned int) simNo] - ReMaXAxis->GetBinCenter(i);
-			if (dist < 0 && dist > interp1_dist) {
-				interp1_sim = simNo;
-				interp1_dist = dist;
-			} else if (dist > 0 && dist < interp2_dist) {
-				interp2_sim = simNo;
-				interp2_dist = dist;
-			}
-		}
-
-		if (interp1_dist == NBINS * -1. || interp2_dist == NBINS || (n_particles[(long unsigned int) interp1_sim] != n_particles[(long unsigned int) interp2_sim]) ) {
-			if (fabs(interp1_dist) > fabs(interp2_dist)) {
-				interp1_sim = interp2_sim;
-				interp1_dist = interp2_dist;
-			}
+		getInterpolation(energies, n_particles, ReMaXAxis->GetBinCenter(i), interp1_sim, interp1_weight, interp2_sim, interp2_weight);
 
+		if (interp2_sim < 0) {
 			printf("Bin: %d (%.1f keV), using %s (%.1f keV).\n", i, ReMaXAxis->GetBinCenter(i),
 				filenames[(long unsigned int) interp1_sim].Data(), energies[(long unsigned int) interp1_sim]);
 
 			fillMatrixWeighted(filenames, energies, n_particles, histname, response_matrix, n_simulated_particles, i, interp1_sim, 1.0);
 		} else {
-			interp1_weight = 1 - fabs(interp1_dist) / (fabs(interp1_dist) + fabs(interp2_dist));
-			interp2_weight = 1 - fabs(interp2_dist) / (fabs(interp1_dist) + fabs(interp2_dist));
-
 			printf("Bin: %d (%.1f keV), using %s (%.1f keV, weight = %.2f) and %s (%.1f keV, weight = %.2f).\n", i, ReMaXAxis->GetBinCenter(i),
 				filenames[(long unsigned int) interp1_sim].Data(), energies[(long unsigned int) interp1_sim], interp1_weight,
 				filenames[(long unsigned int) interp2_sim].Data(), energies[(long unsigned int) interp2_sim], interp2_weight);
@@ -113,9 +84,46 @@ void InputFileReader::fillMatrix(const vector<TString> &filenames, const vector<
 			fillMatrixWeighted(filenames, energies, n_particles, histname, response_matrix, n_simulated_particles, i, interp1_sim, interp1_weight);
 			fillMatrixWeighted(filenames, energies, n_particles, histname, response_matrix, n_simulated_particles, i, interp2_sim, interp2_weight);
 		}
+	}
+}
 
+void InputFileReader::getInterpolation(const vector<Double_t> &energies, const vector<Double_t> &n_particles, const Double_t energy, Int_t &interp1_sim, Double_t &interp1_weight, Int_t &interp2_sim, Double_t &interp2_weight) const {
+	// Find two reference points for interpolation
+	interp1_sim = 0;
+	interp2_sim = NBINS;
+	Double_t interp1_dist = (Double_t) NBINS * -1.;
+	Double_t interp2_dist = (Double_t) NBINS;
 
+	Double_t dist;
+	Int_t n_energies = (Int_t) energies.size();
 
+	// Do not calculate the absolute value of dist immediately, because it will be
+	// used later to shift the simulation in the right direction
+	for(Int_t simNo = 0; simNo < n_energies; ++simNo){
+		dist = energies[(long unsigned int) simNo] - energy;
+		if (dist < 0 && dist > interp1_dist) {
+			interp1_sim = simNo;
+			interp1_dist = dist;
+		} else if (dist > 0 && dist < interp2_dist) {
+			interp2_sim = simNo;
+			interp2_dist = dist;
+		}
+	}
+
+	// If there is no simulation on one side of the energy, or if the two simulations
+	// have different statistics, use only the closest simulation. This is indicated
+	// by a negative interp2_sim.
+	if (interp1_dist == NBINS * -1. || interp2_dist == NBINS || (n_particles[(long unsigned int) interp1_sim] != n_particles[(long unsigned int) interp2_sim]) ) {
+		if (fabs(interp1_dist) > fabs(interp2_dist)) {
+			interp1_sim = interp2_sim;
+			interp1_dist = interp2_dist;
+		}
+		interp1_weight = 1.;
+		interp2_sim = -1;
+		interp2_weight = 0.;
+	} else {
+		interp1_weight = 1 - fabs(interp1_dist) / (fabs(interp1_dist) + fabs(interp2_dist));
+		interp2_weight = 1 - fabs(interp2_dist) / (fabs(interp1_dist) + fabs(interp2_dist));
 	}
 }
 
@@ -154,6 +162,35 @@ void InputFileReader::fillMatrixWeighted(const vector<TString> &filenames, const
 	inputFile->Close();
 }
 
+void InputFileReader::readSimulations(const vector<TString> &filenames, const TString histname, vector<vector<Double_t> > &simulations, vector<Double_t> &axis_minimum, vector<Double_t> &axis_maximum){
+
+	cout << "> Reading " << filenames.size() << " simulations ..." << endl;
+
+	TH1F *hist = nullptr;
+
+	for(auto filename: filenames){
+		TFile *inputFile = new TFile(filename);
+
+		if(gDirectory->FindKey(histname)){
+			hist = (TH1F*) gDirectory->Get(histname);
+		} else{
+			cout << __FILE__ << ":" << __FUNCTION__ << "():" << __LINE__ << ": Error: No TH1F object called '" << histname << "' found in '" << filename << "'. Aborting ..." << endl; 
+			abort();
+		}
+
+		// Including underflow and overflow bin
+		vector<Double_t> contents((size_t) hist->GetNbinsX() + 2);
+		for(Int_t i = 0; i <= hist->GetNbinsX() + 1; ++i){
+			contents[(size_t) i] = hist->GetBinContent(i);
+		}
+		simulations.push_back(contents);
+		axis_minimum.push_back(hist->GetXaxis()->GetXmin());
+		axis_maximum.push_back(hist->GetXaxis()->GetXmax());
+
+		inputFile->Close();
+	}
+}
+
 void InputFileReader::updateMatrix(const vector<TString> &old_filenames, const vector<Double_t> &old_energies, const vector<Double_t> &old_n_particles, const TH2F &old_response_matrix, const vector<TString> &new_filenames, const vector<Double_t> &new_energies, const vector<Double_t> &new_n_particles, const TString histname, TH2F &response_matrix, TH1F &n_simulated_particles){
 	cout << "> Updating matrix ..." << endl;
 
@@ -233,11 +270,33 @@ void InputFileReader::updateMatrix(const vector<TString> &old_filenames, const v
 	}
 }
 
-void InputFileReader::writeMatrix(TH2F &response_matrix, TH1F &n_simulated_particles, TString outputfilename) const {
+void InputFileReader::writeMatrix(TH2F &response_matrix, TH1F &n_simulated_particles, TString outputfilename, const Bool_t write_rows) const {
 	TFile *outputFile = new TFile(outputfilename, "RECREATE");	
 
 	response_matrix.Write();
 	n_simulated_particles.Write();
+
+	if(write_rows){
+		// The tree belongs to outputFile and is deleted by Close()
+		TTree *rema_rows = new TTree("rema_rows", "Rows of the Response Matrix");
+		Int_t n_columns = 0;
+		vector<Float_t> row(NBINS, 0.);
+		rema_rows->Branch("n_columns", &n_columns, "n_columns/I");
+		rema_rows->Branch("row", &row[0], "row[n_columns]/F");
+		rema_rows->SetAutoFlush(ROWS_PER_CHUNK);
+
+		for(Int_t i = 1; i <= (Int_t) NBINS; ++i){
+			n_columns = 0;
+			for(Int_t j = 1; j <= (Int_t) NBINS; ++j){
+				row[j - 1] = (Float_t) response_matrix.GetBinContent(i, j);
+				if(row[j - 1] != 0.)
+					n_columns = j;
+			}
+			rema_rows->Fill();
+		}
+		rema_rows->Write();
+	}
+
 	outputFile->Close();
 
 	cout << "> Wrote matrix to file " << outputfilename << endl;
@@ -261,6 +320,79 @@ void InputFileReader::readMatrix(TH2F &response_matrix, TH1F &n_simulated_partic
 		}
 	}
 
+	readNSimulatedParticles(n_simulated_particles, matrixfile);
+
+	inputFile->Close();
+	delete inputFile;
+}
+
+void InputFileReader::readMatrix(TH2F &response_matrix, TH1F &n_simulated_particles, const TString matrixfile, const Int_t first_row, const Int_t last_row){
+
+	if(first_row < 1 || last_row > (Int_t) NBINS || first_row > last_row){
+		cout << __FILE__ << ":" << __FUNCTION__ << "():" << __LINE__ << ": Error: Invalid range of rows [" << first_row << ", " << last_row << "]. Aborting ..." << endl;
+		abort();
+	}
+
+	const Int_t nbins = response_matrix.GetNbinsX();
+	if(response_matrix.GetNbinsY() != nbins || (Int_t) NBINS % nbins != 0){
+		cout << __FILE__ << ":" << __FUNCTION__ << "():" << __LINE__ << ": Error: Response matrix with " << nbins << " x " << response_matrix.GetNbinsY() << " bins can not hold a rebinned " << NBINS << " x " << NBINS << " matrix. Aborting ..." << endl;
+		abort();
+	}
+	const Int_t binning = (Int_t) NBINS / nbins;
+
+	response_matrix.Reset();
+
+	TFile *inputFile = new TFile(matrixfile); 
+
+	if(gDirectory->FindKey("rema_rows")){
+		TTree *rema_rows = (TTree*) gDirectory->Get("rema_rows");
+		if(rema_rows->GetEntries() != (Long64_t) NBINS){
+			cout << __FILE__ << ":" << __FUNCTION__ << "():" << __LINE__ << ": Error: 'rema_rows' in '" << matrixfile << "' has " << rema_rows->GetEntries() << " rows instead of " << NBINS << ". Aborting ..." << endl;
+			abort();
+		}
+
+		Int_t n_columns = 0;
+		vector<Float_t> row(NBINS, 0.);
+		rema_rows->SetBranchAddress("n_columns", &n_columns);
+		rema_rows->SetBranchAddress("row", &row[0]);
+
+		// Prefetch only the chunks that contain the requested rows
+		rema_rows->SetCacheSize(CACHE_SIZE);
+		rema_rows->SetCacheEntryRange(first_row - 1, last_row);
+		rema_rows->AddBranchToCache("*", true);
+
+		for(Int_t i = first_row; i <= last_row; ++i){
+			rema_rows->GetEntry(i - 1);
+			const Int_t last_column = n_columns < last_row ? n_columns : last_row;
+			for(Int_t j = 1; j <= last_column; ++j){
+				if(row[j - 1] != 0.)
+					response_matrix.AddBinContent(response_matrix.GetBin((i - 1)/binning + 1, (j - 1)/binning + 1), row[j - 1]);
+			}
+		}
+	} else if(gDirectory->FindKey("rema")){
+		cout << "> No 'rema_rows' found in '" << matrixfile << "', reading the full matrix ..." << endl;
+		TH2F *rema = (TH2F*) gDirectory->Get("rema");
+
+		for(Int_t i = first_row; i <= last_row; ++i){
+			for(Int_t j = 1; j <= last_row; ++j){
+				const Double_t content = rema->GetBinContent(i, j);
+				if(content != 0.)
+					response_matrix.AddBinContent(response_matrix.GetBin((i - 1)/binning + 1, (j - 1)/binning + 1), content);
+			}
+		}
+	} else{
+		cout << __FILE__ << ":" << __FUNCTION__ << "():" << __LINE__ << ": Error: No TH2F object called 'rema' found in '" << matrixfile << "'. Aborting ..." << endl;
+		abort();
+	}
+
+	readNSimulatedParticles(n_simulated_particles, matrixfile);
+
+	inputFile->Close();
+	delete inputFile;
+}
+
+void InputFileReader::readNSimulatedParticles(TH1F &n_simulated_particles, const TString matrixfile){
+
 	TH1F *n_particles = nullptr;
 	
 	if(gDirectory->FindKey("n_simulated_particles")){
@@ -272,8 +404,6 @@ void InputFileReader::readMatrix(TH2F &response_matrix, TH1F &n_simulated_partic
 	for(Int_t i = 1; i <= (Int_t) NBINS; ++i){
 		n_simulated_particles.SetBinContent(i, n_particles->GetBinContent(i));
 	}
-
-	inputFile->Close();
 }
 
 void InputFileReader::readMatrix(TH2F &response_matrix, const TString matrixfile){
@@ -295,6 +425,7 @@ void InputFileReader::readMatrix(TH2F &response_matrix, const TString matrixfile
 	}
 
 	inputFile->Close();
+	delete inputFile;
 }
 
 const std::string WHITESPACE = " \n\r\t\f\v";
@@ -340,14 +471,25 @@ void InputFileReader::readTxtSpectrum(TH1F &spectrum, const TString spectrumfile
 
 void InputFileReader::readROOTSpectrum(TH1F &spectrum, const TString spectrumfile, const TString spectrumname){
 	
-	TFile file;
-	file.Open(spectrumfile, "READ");
+	// Close the file again, since tsroh reads many spectra in batch mode
+	TFile *file = TFile::Open(spectrumfile, "READ");
+	if(!file || file->IsZombie()){
+		cout << __FILE__ << ":" << __LINE__ << ": " << __FUNCTION__ << "(): "<< "Error: File " << spectrumfile << " could not be opened. Aborting ..." << endl;
+		abort();
+	}
 
-	TH1F *spec= (TH1F*) gDirectory->Get(spectrumname);
+	TH1F *spec= (TH1F*) file->Get(spectrumname);
+	if(!spec){
+		cout << __FILE__ << ":" << __LINE__ << ": " << __FUNCTION__ << "(): "<< "Error: Spectrum " << spectrumname << " not found in file " << spectrumfile << ". Aborting ..." << endl;
+		abort();
+	}
 
 	for(Int_t i = 0; i <= (Int_t) NBINS; ++i){
 		spectrum.SetBinContent(i, spec->GetBinContent(i));
 	}
+
+	file->Close();
+	delete file;
 }
 
 void InputFileReader::writeCorrelationMatrix(TMatrixDSym &correlation_matrix, TString outputfilename) const {
@@ -379,7 +521,52 @@ void InputFileReader::readDoubleParameters(vector<Double_t> &params, const TStri
 		getline(file, line);
 		sst.str(line);
 		while(sst >> parameter)
-			params.push_back((UInt_t) atoi(parameter.c_str()));
+			params.push_back(atof(parameter.c_str()));
+		file.close();
+	} else{
+		cout << "Error: File " << inputfilename << " could not be opened." << endl;
+	}
+}
+
+void InputFileReader::readDoubleTable(vector<vector<Double_t> > &table, const TString inputfilename){
+
+	cout << "> Reading input file " << inputfilename << " ..." << endl;
+
+	ifstream file;
+	file.open(inputfilename);
+	string line, parameter;
+	stringstream sst;
+
+	if(file.is_open()){
+		while(getline(file, line)){
+			if (trim(line).length() == 0 || trim(line).at(0) == '#') // Ignore empty lines or comments
+				continue;
+			table.push_back(vector<Double_t>());
+			sst.str(line);
+			while(sst >> parameter)
+				table.back().push_back(atof(parameter.c_str()));
+			sst.clear();
+		}
+		file.close();
+	} else{
+		cout << "Error: File " << inputfilename << " could not be opened." << endl;
+	}
+}
+
+void InputFileReader::readFileList(vector<TString> &filenames, const TString inputfilename){
+
+	cout << "> Reading input file " << inputfilename << " ..." << endl;
+
+	ifstream file;
+	file.open(inputfilename);
+	string line;
+
+	if(file.is_open()){
+		while(getline(file, line)){
+			if (trim(line).length() == 0 || trim(line).at(0) == '#') // Ignore empty lines or comments
+				continue;
+			filenames.push_back(trim(line).c_str());
+		}
 		file.close();
 	} else{
 		cout << "Error: File " << inputfilename << " could not be opened." << endl;
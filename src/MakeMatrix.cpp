@@ -23,6 +23,7 @@
 #include <argp.h>
 
 #include "Config.h"
+#include "FoldedMatrixCache.h"
 #include "InputFileReader.h"
 
 using std::cout;
@@ -35,17 +36,26 @@ struct Arguments{
 	TString old_inputfile = "";
 	TString histname = "hpge0";
 	TString outputfile = "output.root";
+	TString resolution_file = "";
+	UInt_t binning = 10;
 
 	Bool_t update = false;
+	Bool_t rows = false;
 };
 
 static char doc[] = "makematrix, Create a response matrix from a series of simulations of the detector response";
 static char args_doc[] = "INPUTFILENAME";
 
+// Key of options without a short version
+const int OPTION_ROWS = 256;
+
 static struct argp_option options[] = {
 	{"histname", 'n', "HISTNAME", 0, "Name of histogram for detector response (default: 'hpge0')", 0},
 	{"outputfile", 'o', "OUTPUTFILENAME", 0, "Name of output file (default: 'output.root')", 0},
 	{"old_inputfile", 'u', "OLD_INPUTFILENAME", 0, "Add new response simulations to an existing matrix. The previous input file must be given as a reference, so that 'makematrix' knows how to add the new simulations.", 0},
+	{"resolution_file", 'R', "RESOLUTIONFILE", 0, "Also fold the detector resolution from RESOLUTIONFILE into the matrix, rebinned with the '-b' option, and store it in the cache that is used by the '--resolution_file' option of horst. (default: none)", 0},
+	{"binning", 'b', "BINNING", 0, "Rebinning factor for the resolution-folded matrix of the '-R' option (default: 10)", 0},
+	{"rows", OPTION_ROWS, 0, 0, "Also store each row of the matrix as an entry of the TTree 'rema_rows', so that horst reads only the rows of its fit range instead of the full matrix. This roughly doubles the size of the output file. (default: false)", 0},
 	{ 0, 0, 0, 0, 0, 0 }
 };
 
@@ -57,6 +67,9 @@ static int parse_opt(int key, char *arg, struct argp_state *state){
 		case 'o': arguments->outputfile = arg; break;
 		case 'n': arguments->histname= arg; break;
 		case 'u': arguments->update=true; arguments->old_inputfile=arg; break;
+		case 'R': arguments->resolution_file = arg; break;
+		case 'b': arguments->binning = (UInt_t) atoi(arg); break;
+		case OPTION_ROWS: arguments->rows = true; break;
 		case ARGP_KEY_END:
 			if(state->arg_num == 0){
 				argp_usage(state);
@@ -105,11 +118,27 @@ int main(int argc, char* argv[]){
 		inputFileReader.readInputFile(arguments.inputfile, filenames, energies, n_simulated_particles);
 
 		inputFileReader.updateMatrix(old_filenames, old_energies, old_n_simulated_particles, old_response_matrix, filenames, energies, n_simulated_particles, arguments.histname, response_matrix, n_particles);
-		inputFileReader.writeMatrix(response_matrix, n_particles, arguments.outputfile);
+		inputFileReader.writeMatrix(response_matrix, n_particles, arguments.outputfile, arguments.rows);
 
 	} else{
 		inputFileReader.readInputFile(arguments.inputfile, filenames, energies, n_simulated_particles);
 		inputFileReader.fillMatrix(filenames, energies, n_simulated_particles, arguments.histname, response_matrix, n_particles);
-		inputFileReader.writeMatrix(response_matrix, n_particles, arguments.outputfile);
+		inputFileReader.writeMatrix(response_matrix, n_particles, arguments.outputfile, arguments.rows);
+	}
+
+	// Fill the cache of horst with all rows of the rebinned matrix. They are read in the same
+	// way as by horst, so that the hashes of the rows agree.
+	if(arguments.resolution_file != ""){
+		vector<Double_t> resolution_params;
+		inputFileReader.readDoubleParameters(resolution_params, arguments.resolution_file);
+
+		const Int_t nbins = (Int_t) NBINS/(Int_t) arguments.binning;
+		TH2F rebinned_response_matrix("rebinned_rema", "Rebinned Response_Matrix", nbins, 0., (Double_t) (NBINS - 1), nbins, 0., (Double_t) (NBINS - 1));
+		TH1F rebinned_n_particles("rebinned_n_simulated_particles", "Initial simulated particles", NBINS, 0., (Double_t) NBINS);
+		inputFileReader.readMatrix(rebinned_response_matrix, rebinned_n_particles, arguments.outputfile, 1, (Int_t) NBINS);
+
+		TH2F folded_response_matrix("rema_folded", "Response Matrix with Detector Resolution", nbins, 0., (Double_t) (NBINS - 1), nbins, 0., (Double_t) (NBINS - 1));
+		FoldedMatrixCache foldedMatrixCache(arguments.outputfile);
+		foldedMatrixCache.get(rebinned_response_matrix, 1, nbins, arguments.binning, resolution_params, folded_response_matrix);
 	}
 }
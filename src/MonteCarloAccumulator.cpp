@@ -0,0 +1,445 @@
+/*
+    This file is part of Horst.
+
+    Horst is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Horst is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Horst.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <cmath>
+#include <iostream>
+#include <limits>
+
+#include "Config.h"
+#include "MonteCarloAccumulator.h"
+
+using std::cout;
+using std::endl;
+
+MonteCarloAccumulator::MonteCarloAccumulator(const UInt_t binning, const Int_t binstart, const Int_t binstop):
+	BINNING(binning),
+	bin_start(binstart),
+	bin_stop(binstop),
+	n_samples(0),
+	mean((size_t) (binstop - binstart + 1), 0.),
+	m2((size_t) (binstop - binstart + 1), 0.),
+	m3((size_t) (binstop - binstart + 1), 0.),
+	m4((size_t) (binstop - binstart + 1), 0.),
+	sketches((size_t) (binstop - binstart + 1), QuantileSketch(MC_QUANTILE_ACCURACY, MC_QUANTILE_MAX_BUCKETS)),
+	use_control_variate(false),
+	use_antithetic_pairs(false),
+	n_pairs(0)
+{}
+
+void MonteCarloAccumulator::setControlVariate(const TH1F &expectation, const TH1F &variance){
+	const size_t n = mean.size();
+
+	use_control_variate = true;
+	control_expectation.resize(n);
+	control_variance.resize(n);
+	control_mean.assign(n, 0.);
+	control_m2.assign(n, 0.);
+	control_comoment.assign(n, 0.);
+
+	for(size_t index = 0; index < n; ++index){
+		control_expectation[index] = expectation.GetBinContent(bin_start + (Int_t) index);
+		control_variance[index] = variance.GetBinContent(bin_start + (Int_t) index);
+	}
+}
+
+void MonteCarloAccumulator::setAntitheticPairs(const TH1F &reference){
+	const size_t n = mean.size();
+
+	use_antithetic_pairs = true;
+	n_pairs = 0;
+	pair_reference.resize(n);
+	pair_first.assign(n, 0.);
+	pair_mean_1.assign(n, 0.);
+	pair_mean_2.assign(n, 0.);
+	pair_m2_1.assign(n, 0.);
+	pair_m2_2.assign(n, 0.);
+	pair_comoment.assign(n, 0.);
+
+	for(size_t index = 0; index < n; ++index){
+		pair_reference[index] = reference.GetBinContent(bin_start + (Int_t) index);
+	}
+}
+
+void MonteCarloAccumulator::addSample(const TH1F &histogram, const TH1F *control){
+	++n_samples;
+
+	// Online update of the central moments, see
+	// T. B. Terriberry, Computing Higher-Order Moments Online (2008).
+	// The higher moments have to be updated first, because they depend on the old values
+	// of the lower ones.
+	Double_t value = 0.;
+	Double_t delta = 0.;
+	Double_t delta_n = 0.;
+	Double_t delta_n2 = 0.;
+	Double_t term1 = 0.;
+	const Double_t n = (Double_t) n_samples;
+	const Double_t inverse_n_samples = 1./n;
+	Double_t control_value = 0.;
+	Double_t control_delta = 0.;
+	Double_t z = 0.;
+	Double_t z_1 = 0.;
+	Double_t delta_1 = 0.;
+	Double_t delta_2 = 0.;
+
+	// Second sample of an antithetic pair
+	const Bool_t complete_pair = use_antithetic_pairs && n_samples % 2 == 0;
+	if(complete_pair){
+		++n_pairs;
+	}
+	const Double_t inverse_n_pairs = complete_pair ? 1./(Double_t) n_pairs : 0.;
+
+	for(Int_t i = bin_start; i <= bin_stop; ++i){
+		const size_t index = (size_t) (i - bin_start);
+
+		value = histogram.GetBinContent(i);
+		delta = value - mean[index];
+		delta_n = delta*inverse_n_samples;
+		delta_n2 = delta_n*delta_n;
+		term1 = delta*delta_n*(n - 1.);
+
+		mean[index] += delta_n;
+		m4[index] += term1*delta_n2*(n*n - 3.*n + 3.) + 6.*delta_n2*m2[index] - 4.*delta_n*m3[index];
+		m3[index] += term1*delta_n*(n - 2.) - 3.*delta_n*m2[index];
+		m2[index] += term1;
+
+		sketches[index].add(value);
+
+		if(control != nullptr){
+			control_value = control->GetBinContent(i);
+			control_delta = control_value - control_mean[index];
+			control_mean[index] += control_delta*inverse_n_samples;
+			control_m2[index] += control_delta*(control_value - control_mean[index]);
+			control_comoment[index] += control_delta*(value - mean[index]);
+		}
+
+		if(use_antithetic_pairs){
+			z = (value - pair_reference[index])*(value - pair_reference[index]);
+			if(complete_pair){
+				z_1 = pair_first[index];
+				delta_1 = z_1 - pair_mean_1[index];
+				delta_2 = z - pair_mean_2[index];
+				pair_mean_1[index] += delta_1*inverse_n_pairs;
+				pair_mean_2[index] += delta_2*inverse_n_pairs;
+				pair_m2_1[index] += delta_1*(z_1 - pair_mean_1[index]);
+				pair_m2_2[index] += delta_2*(z - pair_mean_2[index]);
+				pair_comoment[index] += delta_1*(z - pair_mean_2[index]);
+			} else{
+				pair_first[index] = z;
+			}
+		}
+	}
+}
+
+void MonteCarloAccumulator::add(const TH1F &histogram){
+	if(use_control_variate){
+		cout << __FILE__ << ":" << __LINE__ << ": " << __FUNCTION__ << "(): "<< "Error: No control variable given. Aborting ..." << endl;
+		abort();
+	}
+	addSample(histogram, nullptr);
+}
+
+void MonteCarloAccumulator::add(const TH1F &histogram, const TH1F &control){
+	if(!use_control_variate){
+		cout << __FILE__ << ":" << __LINE__ << ": " << __FUNCTION__ << "(): "<< "Error: Expectation value and variance of control variable not set. Aborting ..." << endl;
+		abort();
+	}
+	addSample(histogram, &control);
+}
+
+void MonteCarloAccumulator::merge(const MonteCarloAccumulator &accumulator){
+	if(accumulator.n_samples == 0){
+		return;
+	}
+
+	const Double_t n_a = (Double_t) n_samples;
+	const Double_t n_b = (Double_t) accumulator.n_samples;
+	const Double_t n = n_a + n_b;
+	Double_t delta = 0.;
+	Double_t delta2 = 0.;
+	Double_t control_delta = 0.;
+
+	for(size_t index = 0; index < mean.size(); ++index){
+		delta = accumulator.mean[index] - mean[index];
+		delta2 = delta*delta;
+
+		m4[index] += accumulator.m4[index] + delta2*delta2*n_a*n_b*(n_a*n_a - n_a*n_b + n_b*n_b)/(n*n*n)
+			+ 6.*delta2*(n_a*n_a*accumulator.m2[index] + n_b*n_b*m2[index])/(n*n)
+			+ 4.*delta*(n_a*accumulator.m3[index] - n_b*m3[index])/n;
+		m3[index] += accumulator.m3[index] + delta2*delta*n_a*n_b*(n_a - n_b)/(n*n)
+			+ 3.*delta*(n_a*accumulator.m2[index] - n_b*m2[index])/n;
+		m2[index] += accumulator.m2[index] + delta2*n_a*n_b/n;
+
+		if(use_control_variate){
+			control_delta = accumulator.control_mean[index] - control_mean[index];
+			control_comoment[index] += accumulator.control_comoment[index] + control_delta*delta*n_a*n_b/n;
+			control_m2[index] += accumulator.control_m2[index] + control_delta*control_delta*n_a*n_b/n;
+			control_mean[index] += control_delta*n_b/n;
+		}
+
+		mean[index] += delta*n_b/n;
+
+		sketches[index].merge(accumulator.sketches[index]);
+	}
+
+	if(use_antithetic_pairs && accumulator.n_pairs > 0){
+		const Double_t n_pairs_a = (Double_t) n_pairs;
+		const Double_t n_pairs_b = (Double_t) accumulator.n_pairs;
+		const Double_t n_pairs_total = n_pairs_a + n_pairs_b;
+		Double_t delta_1 = 0.;
+		Double_t delta_2 = 0.;
+
+		for(size_t index = 0; index < mean.size(); ++index){
+			delta_1 = accumulator.pair_mean_1[index] - pair_mean_1[index];
+			delta_2 = accumulator.pair_mean_2[index] - pair_mean_2[index];
+			pair_m2_1[index] += accumulator.pair_m2_1[index] + delta_1*delta_1*n_pairs_a*n_pairs_b/n_pairs_total;
+			pair_m2_2[index] += accumulator.pair_m2_2[index] + delta_2*delta_2*n_pairs_a*n_pairs_b/n_pairs_total;
+			pair_comoment[index] += accumulator.pair_comoment[index] + delta_1*delta_2*n_pairs_a*n_pairs_b/n_pairs_total;
+			pair_mean_1[index] += delta_1*n_pairs_b/n_pairs_total;
+			pair_mean_2[index] += delta_2*n_pairs_b/n_pairs_total;
+		}
+		n_pairs += accumulator.n_pairs;
+	}
+
+	n_samples += accumulator.n_samples;
+}
+
+void MonteCarloAccumulator::reset(){
+	n_samples = 0;
+	mean.assign(mean.size(), 0.);
+	m2.assign(m2.size(), 0.);
+	m3.assign(m3.size(), 0.);
+	m4.assign(m4.size(), 0.);
+	for(auto &sketch: sketches){
+		sketch.reset();
+	}
+
+	if(use_control_variate){
+		control_mean.assign(control_mean.size(), 0.);
+		control_m2.assign(control_m2.size(), 0.);
+		control_comoment.assign(control_comoment.size(), 0.);
+	}
+
+	if(use_antithetic_pairs){
+		n_pairs = 0;
+		pair_first.assign(pair_first.size(), 0.);
+		pair_mean_1.assign(pair_mean_1.size(), 0.);
+		pair_mean_2.assign(pair_mean_2.size(), 0.);
+		pair_m2_1.assign(pair_m2_1.size(), 0.);
+		pair_m2_2.assign(pair_m2_2.size(), 0.);
+		pair_comoment.assign(pair_comoment.size(), 0.);
+	}
+}
+
+void MonteCarloAccumulator::serialize(vector<Double_t> &buffer) const {
+	// The header is used to check that the buffer is deserialized by an accumulator with
+	// the same configuration.
+	buffer.push_back((Double_t) bin_start);
+	buffer.push_back((Double_t) bin_stop);
+	buffer.push_back(use_control_variate ? 1. : 0.);
+	buffer.push_back(use_antithetic_pairs ? 1. : 0.);
+	buffer.push_back((Double_t) n_samples);
+	buffer.push_back((Double_t) n_pairs);
+
+	buffer.insert(buffer.end(), mean.begin(), mean.end());
+	buffer.insert(buffer.end(), m2.begin(), m2.end());
+	buffer.insert(buffer.end(), m3.begin(), m3.end());
+	buffer.insert(buffer.end(), m4.begin(), m4.end());
+
+	if(use_control_variate){
+		buffer.insert(buffer.end(), control_mean.begin(), control_mean.end());
+		buffer.insert(buffer.end(), control_m2.begin(), control_m2.end());
+		buffer.insert(buffer.end(), control_comoment.begin(), control_comoment.end());
+	}
+
+	if(use_antithetic_pairs){
+		buffer.insert(buffer.end(), pair_first.begin(), pair_first.end());
+		buffer.insert(buffer.end(), pair_mean_1.begin(), pair_mean_1.end());
+		buffer.insert(buffer.end(), pair_mean_2.begin(), pair_mean_2.end());
+		buffer.insert(buffer.end(), pair_m2_1.begin(), pair_m2_1.end());
+		buffer.insert(buffer.end(), pair_m2_2.begin(), pair_m2_2.end());
+		buffer.insert(buffer.end(), pair_comoment.begin(), pair_comoment.end());
+	}
+
+	for(auto &sketch: sketches){
+		sketch.serialize(buffer);
+	}
+}
+
+void MonteCarloAccumulator::deserialize(const vector<Double_t> &buffer){
+	if(buffer.size() < 6 || (Int_t) buffer[0] != bin_start || (Int_t) buffer[1] != bin_stop || (buffer[2] == 1.) != use_control_variate || (buffer[3] == 1.) != use_antithetic_pairs){
+		cout << __FILE__ << ":" << __LINE__ << ": " << __FUNCTION__ << "(): "<< "Error: Saved Monte-Carlo results do not match the current fit range or sampling scheme. Aborting ..." << endl;
+		abort();
+	}
+
+	const size_t n = mean.size();
+	size_t position = 4;
+	n_samples = (UInt_t) buffer[position++];
+	n_pairs = (UInt_t) buffer[position++];
+
+	for(vector<Double_t> *moment: {&mean, &m2, &m3, &m4}){
+		moment->assign(buffer.begin() + (long) position, buffer.begin() + (long) (position + n));
+		position += n;
+	}
+
+	if(use_control_variate){
+		for(vector<Double_t> *moment: {&control_mean, &control_m2, &control_comoment}){
+			moment->assign(buffer.begin() + (long) position, buffer.begin() + (long) (position + n));
+			position += n;
+		}
+	}
+
+	if(use_antithetic_pairs){
+		for(vector<Double_t> *moment: {&pair_first, &pair_mean_1, &pair_mean_2, &pair_m2_1, &pair_m2_2, &pair_comoment}){
+			moment->assign(buffer.begin() + (long) position, buffer.begin() + (long) (position + n));
+			position += n;
+		}
+	}
+
+	for(auto &sketch: sketches){
+		sketch.deserialize(buffer, position);
+	}
+}
+
+void MonteCarloAccumulator::getMean(TH1F &mc_mean) const {
+	size_t index = 0;
+
+	for(Int_t i = 1; i <= (Int_t) NBINS / (Int_t) BINNING; ++i){
+		if(i < bin_start || i > bin_stop){
+			mc_mean.SetBinContent(i, 0.);
+		} else{
+			index = (size_t) (i - bin_start);
+			if(use_control_variate && control_m2[index] > 0.){
+				mc_mean.SetBinContent(i, mean[index] - control_comoment[index]/control_m2[index]*(control_mean[index] - control_expectation[index]));
+			} else{
+				mc_mean.SetBinContent(i, mean[index]);
+			}
+		}
+	}
+}
+
+void MonteCarloAccumulator::getStandardDeviation(TH1F &mc_standard_deviation) const {
+	for(Int_t i = 1; i <= (Int_t) NBINS / (Int_t) BINNING; ++i){
+		if(i < bin_start || i > bin_stop || n_samples == 0){
+			mc_standard_deviation.SetBinContent(i, 0.);
+		} else{
+			mc_standard_deviation.SetBinContent(i, sqrt(getVariance((size_t) (i - bin_start))));
+		}
+	}
+}
+
+void MonteCarloAccumulator::getQuantile(TH1F &mc_quantile, const Double_t q) const {
+	for(Int_t i = 1; i <= (Int_t) NBINS / (Int_t) BINNING; ++i){
+		if(i < bin_start || i > bin_stop){
+			mc_quantile.SetBinContent(i, 0.);
+		} else{
+			mc_quantile.SetBinContent(i, sketches[(size_t) (i - bin_start)].getQuantile(q));
+		}
+	}
+}
+
+Double_t MonteCarloAccumulator::getMaximumRelativeStandardError() const {
+	// At least four samples are needed for an estimate of the fourth moment
+	if(n_samples < 4){
+		return std::numeric_limits<Double_t>::max();
+	}
+
+	// The variance of the sample variance s^2 is approximately
+	//	Var(s^2) = (mu_4 - (n-3)/(n-1)*sigma^4)/n,
+	// and the standard error of the standard deviation follows from error propagation:
+	//	SE(s) = sqrt(Var(s^2))/(2*s).
+	// For a normal distribution, SE(s)/s is approximately 1/sqrt(2n).
+	// Variance-reduction methods modify Var(s^2) by the factor n/n_eff (see getEffectiveSampleSize()).
+	// Bins without any variation (for example fixed parameters) are ignored.
+	const Double_t n = (Double_t) n_samples;
+	Double_t variance = 0.;
+	Double_t variance_of_variance = 0.;
+	Double_t relative_standard_error = 0.;
+	Double_t maximum_relative_standard_error = 0.;
+
+	for(size_t index = 0; index < mean.size(); ++index){
+		if(m2[index] <= 0.){
+			continue;
+		}
+		variance = m2[index]/n;
+		variance_of_variance = (m4[index]/n - (n - 3.)/(n - 1.)*variance*variance)/n;
+		if(variance_of_variance < 0.){
+			variance_of_variance = 0.;
+		}
+		relative_standard_error = sqrt(variance_of_variance*getVarianceReductionFactor(index))/(2.*variance);
+		if(relative_standard_error > maximum_relative_standard_error){
+			maximum_relative_standard_error = relative_standard_error;
+		}
+	}
+
+	return maximum_relative_standard_error;
+}
+
+Double_t MonteCarloAccumulator::getEffectiveSampleSize() const {
+	// Smallest effective sample size of all bins in the fit range that show any variation
+	Double_t effective_sample_size = (Double_t) n_samples;
+	Double_t bin_effective_sample_size = 0.;
+	Bool_t first_bin = true;
+
+	for(size_t index = 0; index < mean.size(); ++index){
+		if(m2[index] <= 0.){
+			continue;
+		}
+		bin_effective_sample_size = (Double_t) n_samples/getVarianceReductionFactor(index);
+		if(first_bin || bin_effective_sample_size < effective_sample_size){
+			effective_sample_size = bin_effective_sample_size;
+			first_bin = false;
+		}
+	}
+
+	return effective_sample_size;
+}
+
+Double_t MonteCarloAccumulator::getVariance(const size_t index) const {
+	const Double_t n = (Double_t) n_samples;
+	Double_t variance = m2[index]/n;
+
+	if(use_control_variate && control_m2[index] > 0.){
+		const Double_t beta = control_comoment[index]/control_m2[index];
+		variance -= beta*beta*(control_m2[index]/n - control_variance[index]);
+		if(variance < 0.){
+			variance = 0.;
+		}
+	}
+
+	return variance;
+}
+
+Double_t MonteCarloAccumulator::getVarianceReductionFactor(const size_t index) const {
+	Double_t factor = 1.;
+	Double_t rho = 0.;
+
+	if(use_control_variate && control_m2[index] > 0. && m2[index] > 0.){
+		rho = control_comoment[index]*control_comoment[index]/(control_m2[index]*m2[index]); // rho^2
+		factor *= 1. - rho*rho;
+	}
+	if(use_antithetic_pairs && n_pairs > 1 && pair_m2_1[index] > 0. && pair_m2_2[index] > 0.){
+		rho = pair_comoment[index]/sqrt(pair_m2_1[index]*pair_m2_2[index]);
+		factor *= 1. + rho;
+	}
+
+	// Do not claim more than an improvement by a factor of n_samples
+	if(factor < 1./(Double_t) n_samples){
+		factor = 1./(Double_t) n_samples;
+	}
+
+	return factor;
+}
@@ -0,0 +1,121 @@
+/*
+    This file is part of Horst.
+
+    Horst is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Horst is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Horst.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <TFile.h>
+#include <TVectorD.h>
+
+#include <iostream>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "Config.h"
+#include "MonteCarloCheckpoint.h"
+
+using std::cout;
+using std::endl;
+
+MonteCarloCheckpoint::MonteCarloCheckpoint(const TString outputfilename, const Double_t interval):
+	filename(outputfilename + ".checkpoint"),
+	INTERVAL(interval)
+{
+	time(&last_write);
+}
+
+Bool_t MonteCarloCheckpoint::exists() const {
+	return access(filename.Data(), F_OK) == 0;
+}
+
+Bool_t MonteCarloCheckpoint::due() const {
+	time_t now;
+	time(&now);
+	return difftime(now, last_write) >= INTERVAL;
+}
+
+void MonteCarloCheckpoint::write(const UInt_t next_block, const UInt_t mc_iterations, const Bool_t converged, const vector<Double_t> &run_info, const TH1F &fit_params, const MonteCarloAccumulator &accumulator){
+
+	const TString temporary_filename = filename + ".tmp";
+	TFile checkpointfile(temporary_filename, "RECREATE");
+	if(checkpointfile.IsZombie()){
+		cout << __FILE__ << ":" << __LINE__ << ": " << __FUNCTION__ << "(): "<< "Error: Could not create checkpoint file " << temporary_filename << ". Aborting ..." << endl;
+		abort();
+	}
+
+	const Double_t state[3] = {(Double_t) next_block, (Double_t) mc_iterations, converged ? 1. : 0.};
+	TVectorD(3, state).Write("state");
+	TVectorD((Int_t) run_info.size(), &run_info[0]).Write("run_info");
+	fit_params.Write("fit_params");
+
+	vector<Double_t> buffer;
+	accumulator.serialize(buffer);
+	TVectorD((Int_t) buffer.size(), &buffer[0]).Write("accumulator");
+
+	checkpointfile.Close();
+
+	if(rename(temporary_filename.Data(), filename.Data()) != 0){
+		cout << __FILE__ << ":" << __LINE__ << ": " << __FUNCTION__ << "(): "<< "Error: Could not rename " << temporary_filename << " to " << filename << ". Aborting ..." << endl;
+		abort();
+	}
+
+	time(&last_write);
+}
+
+void MonteCarloCheckpoint::read(UInt_t &next_block, UInt_t &mc_iterations, Bool_t &converged, const vector<Double_t> &run_info, const TH1F &fit_params, MonteCarloAccumulator &accumulator){
+
+	TFile checkpointfile(filename);
+	const TVectorD *state = (TVectorD*) checkpointfile.Get("state");
+	const TVectorD *saved_run_info = (TVectorD*) checkpointfile.Get("run_info");
+	const TH1F *saved_fit_params = (TH1F*) checkpointfile.Get("fit_params");
+	const TVectorD *saved_accumulator = (TVectorD*) checkpointfile.Get("accumulator");
+
+	if(checkpointfile.IsZombie() || state == nullptr || saved_run_info == nullptr || saved_fit_params == nullptr || saved_accumulator == nullptr){
+		cout << __FILE__ << ":" << __LINE__ << ": " << __FUNCTION__ << "(): "<< "Error: Checkpoint file " << filename << " is incomplete. Aborting ..." << endl;
+		abort();
+	}
+
+	Bool_t match = saved_run_info->GetNrows() == (Int_t) run_info.size();
+	for(Int_t i = 0; match && i < saved_run_info->GetNrows(); ++i){
+		match = (*saved_run_info)[i] == run_info[(size_t) i];
+	}
+	if(!match){
+		cout << __FILE__ << ":" << __LINE__ << ": " << __FUNCTION__ << "(): "<< "Error: Checkpoint file " << filename << " was created with different options. Aborting ..." << endl;
+		abort();
+	}
+
+	// The fit parameters must be identical, otherwise the input has changed
+	for(Int_t i = 0; i <= fit_params.GetNbinsX() + 1; ++i){
+		if(saved_fit_params->GetBinContent(i) != fit_params.GetBinContent(i)){
+			cout << __FILE__ << ":" << __LINE__ << ": " << __FUNCTION__ << "(): "<< "Error: Fit parameters differ from checkpoint file " << filename << ". Was the input changed? Aborting ..." << endl;
+			abort();
+		}
+	}
+
+	next_block = (UInt_t) (*state)[0];
+	mc_iterations = (UInt_t) (*state)[1];
+	converged = (*state)[2] == 1.;
+
+	accumulator.deserialize(vector<Double_t>(saved_accumulator->GetMatrixArray(), saved_accumulator->GetMatrixArray() + saved_accumulator->GetNrows()));
+
+	checkpointfile.Close();
+
+	time(&last_write);
+}
+
+void MonteCarloCheckpoint::remove(){
+	if(exists() && ::remove(filename.Data()) != 0){
+		cout << __FILE__ << ":" << __LINE__ << ": " << __FUNCTION__ << "(): "<< "Warning: Could not delete checkpoint file " << filename << "." << endl;
+	}
+}
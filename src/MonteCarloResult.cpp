@@ -0,0 +1,118 @@
+/*
+    This file is part of Horst.
+
+    Horst is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Horst is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Horst.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <TNamed.h>
+#include <TParameter.h>
+
+#include "Config.h"
+#include "MonteCarloResult.h"
+
+MonteCarloResult::MonteCarloResult(const UInt_t binning):
+	BINNING(binning),
+	uncertainty(binning),
+	reconstructor(binning),
+	mc_fit_params_mean("mc_fit_params_mean", "MC Fit Parameters", (Int_t) NBINS / (Int_t) binning, 0., (Double_t) NBINS - 1.),
+	mc_fit_params_uncertainty("mc_fit_params_uncertainty", "MC Fit Parameters Uncertainty", (Int_t) NBINS / (Int_t) binning, 0., (Double_t) NBINS - 1.),
+	mc_fit_total_uncertainty("mc_fit_total_uncertainty", "MC Fit Total Uncertainty", (Int_t) NBINS / (Int_t) binning, 0., (Double_t) NBINS - 1.),
+	mc_fit_params_quantile_low("mc_fit_params_quantile_low", "MC Fit Parameters 16% Quantile", (Int_t) NBINS / (Int_t) binning, 0., (Double_t) NBINS - 1.),
+	mc_fit_params_quantile_up("mc_fit_params_quantile_up", "MC Fit Parameters 84% Quantile", (Int_t) NBINS / (Int_t) binning, 0., (Double_t) NBINS - 1.),
+	mc_fit_FEP("mc_fit_FEP", "MC Fit FEP", (Int_t) NBINS / (Int_t) binning, 0., (Double_t) NBINS - 1.),
+	mc_fit_FEP_uncertainty("mc_fit_FEP_uncertainty", "MC Fit FEP Uncertainty", (Int_t) NBINS / (Int_t) binning, 0., (Double_t) NBINS - 1.),
+	mc_FEP_uncertainty_low("mc_FEP_uncertainty_low", "MC Fit FEP Uncertainty lower Limit", (Int_t) NBINS / (Int_t) binning, 0., (Double_t) NBINS - 1.),
+	mc_FEP_uncertainty_up("mc_FEP_uncertainty_up", "MC Fit FEP Uncertainty upper Limit", (Int_t) NBINS / (Int_t) binning, 0., (Double_t) NBINS - 1.),
+	mc_FEP_quantile_low("mc_FEP_quantile_low", "MC Fit FEP 16% Quantile", (Int_t) NBINS / (Int_t) binning, 0., (Double_t) NBINS - 1.),
+	mc_FEP_quantile_up("mc_FEP_quantile_up", "MC Fit FEP 84% Quantile", (Int_t) NBINS / (Int_t) binning, 0., (Double_t) NBINS - 1.),
+	mc_spectrum_reconstructed("mc_spectrum_reconstructed", "MC Reconstructed Spectrum", (Int_t) NBINS / (Int_t) binning, 0., (Double_t) NBINS - 1.),
+	mc_reconstruction_uncertainty("mc_reconstruction_uncertainty", "MC Reconstruction Uncertainty", (Int_t) NBINS / (Int_t) binning, 0., (Double_t) NBINS - 1.),
+	mc_reconstruction_uncertainty_low("mc_reconstruction_uncertainty_low", "MC Reconstruction Uncertainty lower Limit", (Int_t) NBINS / (Int_t) binning, 0., (Double_t) NBINS - 1.),
+	mc_reconstruction_uncertainty_up("mc_reconstruction_uncertainty_up", "MC Reconstruction Uncertainty upper Limit", (Int_t) NBINS / (Int_t) binning, 0., (Double_t) NBINS - 1.),
+	mc_reconstruction_quantile_low("mc_reconstruction_quantile_low", "MC Reconstruction 16% Quantile", (Int_t) NBINS / (Int_t) binning, 0., (Double_t) NBINS - 1.),
+	mc_reconstruction_quantile_up("mc_reconstruction_quantile_up", "MC Reconstruction 84% Quantile", (Int_t) NBINS / (Int_t) binning, 0., (Double_t) NBINS - 1.),
+	mc_iterations(0),
+	mc_relative_standard_error(0.),
+	mc_effective_sample_size(0.),
+	mc_sampling_scheme("plain")
+{}
+
+void MonteCarloResult::evaluate(const MonteCarloAccumulator &accumulator, TH1F &fit_algorithm_uncertainty, const TH1F &rema_diagonal, const TH1F &n_simulated_particles, const Double_t relative_standard_error, const TString sampling_scheme){
+
+	mc_iterations = (Int_t) accumulator.getNSamples();
+	mc_relative_standard_error = relative_standard_error;
+	mc_effective_sample_size = accumulator.getEffectiveSampleSize();
+	mc_sampling_scheme = sampling_scheme;
+
+	accumulator.getMean(mc_fit_params_mean);
+	accumulator.getStandardDeviation(mc_fit_params_uncertainty);
+	// Asymmetric uncertainty band. Since the FEP and the reconstructed spectrum are
+	// obtained from the parameters by multiplication with a positive number, their
+	// quantiles follow directly from the quantiles of the parameters.
+	accumulator.getQuantile(mc_fit_params_quantile_low, MC_QUANTILE_LOW);
+	accumulator.getQuantile(mc_fit_params_quantile_up, MC_QUANTILE_UP);
+
+	// Use the fit uncertainty from a single fit as an estimate for the uncertainty
+	// of the fitting algorithm
+	vector<TH1F*> uncertainties;
+	uncertainties.push_back(&fit_algorithm_uncertainty);
+	uncertainties.push_back(&mc_fit_params_uncertainty);
+	uncertainty.getTotalUncertainty(uncertainties, mc_fit_total_uncertainty);
+
+	fittedFEP(mc_fit_params_mean, rema_diagonal, mc_fit_FEP);
+	fittedFEP(mc_fit_params_uncertainty, rema_diagonal, mc_fit_FEP_uncertainty);
+	uncertainty.getLowerAndUpperLimit(mc_fit_FEP, mc_fit_FEP_uncertainty, mc_FEP_uncertainty_low, mc_FEP_uncertainty_up, true);
+	fittedFEP(mc_fit_params_quantile_low, rema_diagonal, mc_FEP_quantile_low);
+	fittedFEP(mc_fit_params_quantile_up, rema_diagonal, mc_FEP_quantile_up);
+
+	reconstructor.reconstruct(mc_fit_params_mean, n_simulated_particles, mc_spectrum_reconstructed);
+	reconstructor.reconstruct(mc_fit_total_uncertainty, n_simulated_particles, mc_reconstruction_uncertainty);
+	uncertainty.getLowerAndUpperLimit(mc_spectrum_reconstructed, mc_reconstruction_uncertainty, mc_reconstruction_uncertainty_low, mc_reconstruction_uncertainty_up, true);
+	reconstructor.reconstruct(mc_fit_params_quantile_low, n_simulated_particles, mc_reconstruction_quantile_low);
+	reconstructor.reconstruct(mc_fit_params_quantile_up, n_simulated_particles, mc_reconstruction_quantile_up);
+}
+
+void MonteCarloResult::write(){
+	mc_fit_params_mean.Write();
+	mc_fit_params_uncertainty.Write();
+	mc_fit_params_quantile_low.Write();
+	mc_fit_params_quantile_up.Write();
+	mc_fit_total_uncertainty.Write();
+
+	mc_fit_FEP.Write();
+	mc_fit_FEP_uncertainty.Write();
+	mc_FEP_uncertainty_low.Write();
+	mc_FEP_uncertainty_up.Write();
+	mc_FEP_quantile_low.Write();
+	mc_FEP_quantile_up.Write();
+
+	mc_spectrum_reconstructed.Write();
+	mc_reconstruction_uncertainty.Write();
+	mc_reconstruction_uncertainty_low.Write();
+	mc_reconstruction_uncertainty_up.Write();
+	mc_reconstruction_quantile_low.Write();
+	mc_reconstruction_quantile_up.Write();
+
+	TParameter<Int_t>("mc_iterations", mc_iterations).Write();
+	TParameter<Double_t>("mc_relative_standard_error", mc_relative_standard_error).Write();
+	TNamed("mc_sampling_scheme", mc_sampling_scheme.Data()).Write();
+	TParameter<Double_t>("mc_effective_sample_size", mc_effective_sample_size).Write();
+}
+
+void MonteCarloResult::fittedFEP(const TH1F &params, const TH1F &rema_diagonal, TH1F &fitted_FEP) const {
+	// Same as Fitter::fittedFEP()
+	for(Int_t i = 1; i <= (Int_t) NBINS/ (Int_t) BINNING; ++i){
+		fitted_FEP.SetBinContent(i, params.GetBinContent(i)*rema_diagonal.GetBinContent(i));
+	}
+}
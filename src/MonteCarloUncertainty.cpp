@@ -15,37 +15,67 @@
     along with Horst.  If not, see <https://www.gnu.org/licenses/>.
 */
 
-#include <vector>
-
 #include "Math/DistFunc.h"
 
+#include <iostream>
+
 #include "Config.h"
+#include "InputFileReader.h"
 #include "MonteCarloUncertainty.h"
 
 #define USE_POISSON 1
 
-using std::vector;
+using std::cout;
+using std::endl;
 
 using ROOT::Math::normal_cdf;
 using ROOT::Math::normal_quantile;
 
-void MonteCarloUncertainty::evaluateMeanAndStd(TH1F &mc_mean, TH1F &mc_standard_deviation, const vector<TH1F*> &mc_histograms, const Int_t binstart, const Int_t binstop){
-	const UInt_t nrandom = (UInt_t) mc_histograms.size();
+void MonteCarloUncertainty::setSamplingScheme(const SamplingScheme scheme, const Int_t binstart, const Int_t binstop){
+	sampling_scheme = scheme;
+	n_spectrum_samples = 0;
+	antithetic_iteration = NO_ANTITHETIC_ITERATION;
 
-	vector<Double_t> values(nrandom, 0.);
+	delete sobol_sequence;
+	sobol_sequence = nullptr;
+	if(sampling_scheme == SOBOL_SAMPLING){
+		sobol_sequence = new SobolSequence((size_t) (binstop - binstart + 1), *random_generator);
+	}
+}
 
-	for(UInt_t i = 1; i <= NBINS / BINNING; ++i){
-		if(i < (UInt_t) binstart || i > (UInt_t) binstop){
-			mc_mean.SetBinContent((Int_t) i, 0.);
-			mc_standard_deviation.SetBinContent((Int_t) i, 0.);
-		} else{
-			for(UInt_t j = 0; j < nrandom; ++j){
-				values[j] = mc_histograms[j]->GetBinContent((Int_t) i);
-			}
+void MonteCarloUncertainty::setIteration(const UInt_t iteration){
+	random_generator->SetSeed(getIterationSeed(iteration));
+	poisson_sampler.clearBuffer();
 
-			Double_t mean = get_mean(values);
-			mc_mean.SetBinContent((Int_t) i, mean);
-			mc_standard_deviation.SetBinContent((Int_t) i, get_stdev(values, mean));
+	n_spectrum_samples = iteration;
+	if(sobol_sequence != nullptr){
+		sobol_sequence->setIndex(iteration);
+	}
+}
+
+UInt_t MonteCarloUncertainty::getIterationSeed(const UInt_t iteration) const {
+	// Mix the seed and the iteration index with the SplitMix64 finalizer, so that the
+	// seeds of neighboring iterations and of different user seeds are uncorrelated.
+	ULong64_t z = (((ULong64_t) SEED << 32) | (ULong64_t) iteration) + 0x9e3779b97f4a7c15ull;
+	z = (z ^ (z >> 30))*0xbf58476d1ce4e5b9ull;
+	z = (z ^ (z >> 27))*0x94d049bb133111ebull;
+	z = z ^ (z >> 31);
+
+	// TRandom3::SetSeed(0) would choose a random seed
+	const UInt_t iteration_seed = (UInt_t) (z ^ (z >> 32));
+	return iteration_seed == 0 ? 1 : iteration_seed;
+}
+
+void MonteCarloUncertainty::getExpectedSpectrum(TH1F &expected_spectrum, const TH1F &spectrum, const Int_t binstart, const Int_t binstop) const {
+	// Expectation value of the spectra created by apply_fluctuations()
+	Double_t mean = 0.;
+
+	for(Int_t i = 0; i <= (Int_t) NBINS / (Int_t) BINNING; ++i){
+		if(i < binstart || i > binstop){
+			expected_spectrum.SetBinContent(i, spectrum.GetBinContent(i));
+		} else{
+			mean = round(spectrum.GetBinContent(i));
+			expected_spectrum.SetBinContent(i, mean > 0. ? mean : 0.);
 		}
 	}
 }
@@ -61,67 +91,234 @@ void MonteCarloUncertainty::apply_fluctuations(TH1F &modified_spectrum, const TH
 	// In the history of 'horst', the normal distribution was used first.
 	// However, it was decided to switch to the more general Poissonian distribution.
 	// The old implementation is kept here and it can be switched on using the preprocessor variable USE_POISSON
-	Double_t mu = 0.;
+	//
+	// Bins outside the fit range do not influence the fit. They keep their original content.
 #ifndef USE_POISSON
+	Double_t mu = 0.;
 	Double_t sigma = 0.;
-#endif
 
 	for(Int_t i = 1; i <= (Int_t) NBINS / (Int_t) BINNING; ++i){
 
 		mu = spectrum.GetBinContent(i);
 		
-		if(i < binstart || i > binstop){
+		if(i < binstart || i > binstop || mu == 0.){
 			modified_spectrum.SetBinContent(i, mu);
-		}
-		if(mu == 0.){
-			modified_spectrum.SetBinContent(i, 0.);
 		} else{
-#ifndef USE_POISSON
 			sigma = sqrt(mu);
 			modified_spectrum.SetBinContent(i, get_positive_random_normal(mu, sigma));
+		}
+	}
 #endif
 #ifdef USE_POISSON
-			modified_spectrum.SetBinContent(i, get_random_poisson((Int_t) round(mu)));
+	const Float_t *spectrum_array = spectrum.GetArray();
+	const size_t n = (size_t) (binstop - binstart + 1);
+
+	mean_buffer.resize(n);
+	sample_buffer.resize(n);
+
+	for(size_t i = 0; i < n; ++i){
+		mean_buffer[i] = round(spectrum_array[(size_t) binstart + i]);
+	}
+
+	if(sampling_scheme == PLAIN_SAMPLING){
+		poisson_sampler.sample(*random_generator, &mean_buffer[0], &sample_buffer[0], n);
+	} else{
+		uniform_buffer.resize(n);
+		if(sampling_scheme == SOBOL_SAMPLING){
+			sobol_sequence->next(&uniform_buffer[0]);
+		} else if(n_spectrum_samples % 2 == 0){
+			random_generator->RndmArray((Int_t) n, &uniform_buffer[0]);
+			antithetic_iteration = n_spectrum_samples;
+		} else{
+			// Second spectrum of an antithetic pair. If the first one was not sampled by this
+			// object, recreate its uniform random numbers, which were the first ones drawn
+			// in that iteration.
+			if(antithetic_iteration == NO_ANTITHETIC_ITERATION || antithetic_iteration != n_spectrum_samples - 1){
+				TRandom3 partner_random_generator(getIterationSeed(n_spectrum_samples - 1));
+				partner_random_generator.RndmArray((Int_t) n, &uniform_buffer[0]);
+			}
+			for(size_t i = 0; i < n; ++i){
+				uniform_buffer[i] = 1. - uniform_buffer[i];
+			}
+			// The buffer now holds the mirrored numbers
+			antithetic_iteration = NO_ANTITHETIC_ITERATION;
+		}
+		poisson_sampler.sampleInverse(&mean_buffer[0], &uniform_buffer[0], &sample_buffer[0], n);
+	}
+	++n_spectrum_samples;
+
+	// Same as SetBinContent() for each bin, but without the checks of the bin index
+	Float_t *modified_spectrum_array = modified_spectrum.GetArray();
+	for(Int_t i = 1; i <= (Int_t) NBINS / (Int_t) BINNING; ++i){
+		if(i < binstart || i > binstop){
+			modified_spectrum_array[i] = spectrum_array[i];
+		} else{
+			modified_spectrum_array[i] = (Float_t) sample_buffer[(size_t) (i - binstart)];
+		}
+	}
 #endif
+}
+
+void MonteCarloUncertainty::apply_fluctuations(ResponseMatrix &modified_response_matrix, const ResponseMatrix &response_matrix, const Int_t binstart, const Int_t binstop){
+	// For a fixed second index j, the elements (i, j) are contiguous in memory.
+	const size_t n = (size_t) (binstop - binstart + 1);
+
+	mean_buffer.resize(n*n);
+	sample_buffer.resize(n*n);
+
+	for(Int_t j = binstart; j <= binstop; ++j){
+		const Float_t *column = response_matrix.getContributions(j) + binstart;
+		Double_t *mean = &mean_buffer[(size_t) (j - binstart)*n];
+		for(size_t i = 0; i < n; ++i){
+			mean[i] = round(column[i]);
+		}
+	}
+
+	poisson_sampler.sample(*random_generator, &mean_buffer[0], &sample_buffer[0], n*n);
+
+	for(Int_t j = binstart; j <= binstop; ++j){
+		Float_t *column = modified_response_matrix.getContributions(j) + binstart;
+		const Double_t *sample = &sample_buffer[(size_t) (j - binstart)*n];
+		for(size_t i = 0; i < n; ++i){
+			column[i] = (Float_t) sample[i];
 		}
 	}
 }
 
-void MonteCarloUncertainty::apply_fluctuations(TH2F &modified_response_matrix, const TH2F &response_matrix, const Int_t binstart, const Int_t binstop){
-	Double_t mu = 0.;
+void MonteCarloUncertainty::setSimulations(const vector<vector<Double_t> > &sims, const vector<Double_t> &axis_minimum, const vector<Double_t> &axis_maximum, const vector<Double_t> &energies, const vector<Double_t> &n_particles, const TH2F &response_matrix, const Int_t binstart, const Int_t binstop){
+
+	simulations = sims;
+	fluctuated_simulations = sims;
+	simulation_axis_minimum = axis_minimum;
+	simulation_axis_maximum = axis_maximum;
+	simulation_energies = energies;
 
-	for(Int_t i = binstart; i <= binstop; ++i){
-		for(Int_t j = binstart; j <= binstop; ++j){
-			mu = response_matrix.GetBinContent(i, j);
-			if(mu == 0.){
-				modified_response_matrix.SetBinContent(i, j, 0.);
-			} else{
-				modified_response_matrix.SetBinContent(i, j, get_random_poisson((Int_t) round(mu)));
+	// Use the same axis as makematrix to find the energy of a row
+	InputFileReader inputFileReader(1);
+	TAxis matrix_axis((Int_t) NBINS, 0., (Double_t) NBINS);
+
+	first_row = (binstart > 1 ? binstart - 1 : 0)*(Int_t) BINNING + 1;
+	const Int_t last_row = binstop*(Int_t) BINNING;
+
+	row_simulation_1.clear();
+	row_simulation_2.clear();
+	row_weight_1.clear();
+	row_weight_2.clear();
+	vector<Bool_t> is_used(simulations.size(), false);
+	Int_t sim1, sim2;
+	Double_t weight1, weight2;
+
+	for(Int_t i = first_row; i <= last_row; ++i){
+		inputFileReader.getInterpolation(energies, n_particles, matrix_axis.GetBinCenter(i), sim1, weight1, sim2, weight2);
+		row_simulation_1.push_back(sim1);
+		row_weight_1.push_back(weight1);
+		row_simulation_2.push_back(sim2);
+		row_weight_2.push_back(weight2);
+		is_used[(size_t) sim1] = true;
+		if(sim2 >= 0){
+			is_used[(size_t) sim2] = true;
+		}
+	}
+
+	used_simulations.clear();
+	for(size_t i = 0; i < is_used.size(); ++i){
+		if(is_used[i]){
+			used_simulations.push_back(i);
+		}
+	}
+
+	// Check whether the simulations reproduce the response matrix
+	ResponseMatrix rebuilt_response_matrix(response_matrix.GetNbinsX());
+	fillMatrixFromSimulations(simulations, rebuilt_response_matrix, binstart, binstop);
+
+	Double_t max_deviation = 0.;
+	for(Int_t i = (binstart > 1 ? binstart : 1); i <= binstop; ++i){
+		for(Int_t j = (binstart > 1 ? binstart : 1); j <= i; ++j){
+			if(response_matrix.GetBinContent(i, j) > 0.){
+				max_deviation = fmax(max_deviation, fabs(rebuilt_response_matrix(i, j)/response_matrix.GetBinContent(i, j) - 1.));
 			}
 		}
 	}
+	if(max_deviation > 1e-3){
+		cout << "Warning: The simulations do not reproduce the response matrix in the fit range (maximum relative deviation: " << max_deviation << "). Was the matrix created from the same makematrix input file?" << endl;
+	}
 }
 
-Double_t MonteCarloUncertainty::get_positive_random_normal(Double_t mu, Double_t sigma) const {
-	return normal_quantile(random_generator->Uniform(normal_cdf(-mu/sigma), 1.), sigma) + mu;
-}
+void MonteCarloUncertainty::apply_simulation_fluctuations(ResponseMatrix &modified_response_matrix, const Int_t binstart, const Int_t binstop){
 
-Double_t MonteCarloUncertainty::get_random_poisson(Int_t mean) const {
-	return random_generator->Poisson(mean);
-}
+	for(auto s: used_simulations){
+		const size_t n = simulations[s].size();
 
-Double_t MonteCarloUncertainty::get_mean(vector<Double_t> &values) const {
-	Double_t sum = 0.;
-	for(auto v: values)
-		sum += v;
+		mean_buffer.resize(n);
+		for(size_t i = 0; i < n; ++i){
+			mean_buffer[i] = round(simulations[s][i]);
+		}
+		poisson_sampler.sample(*random_generator, &mean_buffer[0], &fluctuated_simulations[s][0], n);
+	}
 
-	return sum / (Double_t) values.size();
+	fillMatrixFromSimulations(fluctuated_simulations, modified_response_matrix, binstart, binstop);
 }
 
-Double_t MonteCarloUncertainty::get_stdev(vector<Double_t> &values, Double_t mean) const {
-	Double_t sum = 0.;
-	for(auto v: values)
-		sum += (v - mean)*(v - mean);
+void MonteCarloUncertainty::fillMatrixFromSimulations(const vector<vector<Double_t> > &simulation_contents, ResponseMatrix &modified_response_matrix, const Int_t binstart, const Int_t binstop){
+	// Rebuild the rows of the matrix in the fit range in the same way as
+	// InputFileReader::fillMatrixWeighted() and rebin them on the fly.
+	// Only the lower triangle of the fit range is needed by the fit.
+	TAxis matrix_axis((Int_t) NBINS, 0., (Double_t) NBINS);
+
+	const Int_t first_rebinned_row = binstart > 1 ? binstart : 1;
+	const Int_t first_column = (first_rebinned_row - 1)*(Int_t) BINNING + 1;
+
+	for(Int_t j = first_rebinned_row; j <= binstop; ++j){
+		Float_t *column = modified_response_matrix.getContributions(j);
+		for(Int_t i = first_rebinned_row; i <= binstop; ++i){
+			column[i] = 0.f;
+		}
+	}
+
+	row_buffer.resize(NBINS + 1);
+
+	for(Int_t rebinned_row = first_rebinned_row; rebinned_row <= binstop; ++rebinned_row){
+		const Int_t last_column = rebinned_row*(Int_t) BINNING;
+
+		for(Int_t i = (rebinned_row - 1)*(Int_t) BINNING + 1; i <= last_column; ++i){
+			const size_t row_index = (size_t) (i - first_row);
+			for(Int_t j = first_column; j <= last_column; ++j){
+				row_buffer[(size_t) j] = 0.;
+			}
+
+			for(Int_t k = 0; k < 2; ++k){
+				const Int_t sim = k == 0 ? row_simulation_1[row_index] : row_simulation_2[row_index];
+				if(sim < 0){
+					continue;
+				}
+				const Double_t weight = k == 0 ? row_weight_1[row_index] : row_weight_2[row_index];
+				const vector<Double_t> &simulation = simulation_contents[(size_t) sim];
+				const Int_t simulation_nbins = (Int_t) simulation.size() - 2;
+				const Double_t xmin = simulation_axis_minimum[(size_t) sim];
+				const Double_t inverse_width = (Double_t) simulation_nbins/(simulation_axis_maximum[(size_t) sim] - xmin);
+				const Double_t shift = simulation_energies[(size_t) sim] - matrix_axis.GetBinCenter(i);
+
+				for(Int_t j = first_column; j <= last_column; ++j){
+					// utr simulations have their axis in MeV.
+					// Same as TAxis::FindBin() for a fixed bin width.
+					const Double_t x = 0.001*(shift + matrix_axis.GetBinCenter(j));
+					if(x < xmin){
+						continue;
+					}
+					const Int_t simulation_bin = 1 + (Int_t) ((x - xmin)*inverse_width);
+					if(simulation_bin <= simulation_nbins){
+						row_buffer[(size_t) j] += weight*simulation[(size_t) simulation_bin];
+					}
+				}
+			}
+
+			for(Int_t j = first_column; j <= last_column; ++j){
+				modified_response_matrix(rebinned_row, (j - 1)/(Int_t) BINNING + 1) += (Float_t) row_buffer[(size_t) j];
+			}
+		}
+	}
+}
 
-	return sqrt(sum / (Double_t) values.size());
+Double_t MonteCarloUncertainty::get_positive_random_normal(Double_t mu, Double_t sigma) const {
+	return normal_quantile(random_generator->Uniform(normal_cdf(-mu/sigma), 1.), sigma) + mu;
 }
@@ -0,0 +1,125 @@
+/*
+    This file is part of Horst.
+
+    Horst is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Horst is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Horst.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <TDirectory.h>
+
+#include <iostream>
+#include <vector>
+
+#include "Config.h"
+#include "Fitter.h"
+#include "MultilevelFitter.h"
+
+using std::cout;
+using std::endl;
+using std::vector;
+
+MultilevelFitter::MultilevelFitter(const UInt_t binning, const UInt_t levels):
+	BINNING(binning),
+	n_levels(levels)
+{
+	if(n_levels == 0){
+		cout << __FILE__ << ":" << __LINE__ << ": " << __FUNCTION__ << "(): "<< "Error: At least one coarser level is needed. Aborting ..." << endl;
+		abort();
+	}
+	if(NBINS % (BINNING << n_levels) != 0){
+		cout << __FILE__ << ":" << __LINE__ << ": " << __FUNCTION__ << "(): "<< "Error: NBINS = " << NBINS << " is not a multiple of the coarsest binning factor " << (BINNING << n_levels) << ". Aborting ..." << endl;
+		abort();
+	}
+}
+
+void MultilevelFitter::getStartParameters(const TH1F &spectrum, const TH2F &rema, const UInt_t left, const UInt_t right, TH1F &start_params){
+
+	// The histograms of the coarse levels are temporary
+	TDirectory::TContext context(nullptr);
+
+	const Double_t max_bin = (Double_t) NBINS - 1.;
+
+	// Level 0 is the requested binning, level k has the binning factor 2^k*BINNING
+	vector<TH1F> spectra;
+	vector<TH2F> matrices;
+	spectra.reserve(n_levels + 1);
+	matrices.reserve(n_levels + 1);
+	spectra.push_back(spectrum);
+	matrices.push_back(rema);
+	for(UInt_t level = 1; level <= n_levels; ++level){
+		const Int_t nbins = (Int_t) NBINS/(Int_t) (BINNING << level);
+		spectra.push_back(TH1F("multilevel_spectrum", "Spectrum at a coarser Binning", nbins, 0., max_bin));
+		matrices.push_back(TH2F("multilevel_rema", "Response Matrix at a coarser Binning", nbins, 0., max_bin, nbins, 0., max_bin));
+		coarsen(spectra[level - 1], spectra[level]);
+		coarsen(matrices[level - 1], matrices[level]);
+	}
+
+	TH1F params;
+	for(UInt_t level = n_levels; level >= 1; --level){
+		const UInt_t binning = BINNING << level;
+		const Int_t nbins = (Int_t) NBINS/(Int_t) binning;
+		const Int_t binstart = (Int_t) left/(Int_t) binning;
+		const Int_t binstop = (Int_t) right/(Int_t) binning;
+
+		TH1F level_start_params("multilevel_start_params", "Start Parameters at a coarser Binning", nbins, 0., max_bin);
+		TH1F level_params("multilevel_params", "Fit Parameters at a coarser Binning", nbins, 0., max_bin);
+
+		Fitter fitter(matrices[level], binning, binstart, binstop);
+		if(level == n_levels){
+			fitter.topdown(spectra[level], matrices[level], level_start_params, binstart, binstop);
+			fitter.remove_negative(level_start_params);
+		} else{
+			prolongate(params, level_start_params);
+		}
+
+		cout << "> Fit spectrum at binning " << binning << " (" << binstop - binstart << " parameters) ..." << endl;
+		fitter.fit(spectra[level], matrices[level], level_start_params, level_params, binstart, binstop);
+		params = level_params;
+	}
+
+	prolongate(params, start_params);
+}
+
+void MultilevelFitter::coarsen(const TH1F &spectrum, TH1F &coarse_spectrum) const {
+
+	for(Int_t i = 1; i <= coarse_spectrum.GetNbinsX(); ++i){
+		coarse_spectrum.SetBinContent(i, spectrum.GetBinContent(2*i - 1) + spectrum.GetBinContent(2*i));
+	}
+}
+
+void MultilevelFitter::coarsen(const TH2F &rema, TH2F &coarse_rema) const {
+
+	// Sum the cells in blocks of 2 x 2. Row j of the TH2F array, i.e. the contributions of all
+	// energies to the detected bin j, is contiguous.
+	const Int_t coarse_nbins = coarse_rema.GetNbinsX();
+	const Float_t *rema_array = rema.GetArray();
+	Float_t *coarse_array = coarse_rema.GetArray();
+	const size_t row_length = (size_t) rema.GetNbinsX() + 2;
+	const size_t coarse_row_length = (size_t) coarse_nbins + 2;
+
+	for(Int_t j = 1; j <= coarse_nbins; ++j){
+		const Float_t *rema_row_1 = &rema_array[row_length*(size_t) (2*j - 1)];
+		const Float_t *rema_row_2 = &rema_array[row_length*(size_t) (2*j)];
+		Float_t *coarse_row = &coarse_array[coarse_row_length*(size_t) j];
+		for(Int_t i = 1; i <= coarse_nbins; ++i){
+			coarse_row[i] = (rema_row_1[2*i - 1] + rema_row_1[2*i]) + (rema_row_2[2*i - 1] + rema_row_2[2*i]);
+		}
+	}
+}
+
+void MultilevelFitter::prolongate(const TH1F &coarse_params, TH1F &params) const {
+
+	for(Int_t i = 1; i <= params.GetNbinsX(); ++i){
+		params.SetBinContent(i, coarse_params.GetBinContent((i + 1)/2));
+	}
+}
@@ -0,0 +1,213 @@
+/*
+    This file is part of Horst.
+
+    Horst is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Horst is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Horst.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <TDirectory.h>
+#include <TVectorD.h>
+
+#include <iostream>
+
+#include "Config.h"
+#include "OutputSession.h"
+
+using std::cout;
+using std::endl;
+
+OutputSession::OutputSession(const TString filename, const TString option):
+	sample_tree(nullptr),
+	sample_iteration(0),
+	sample_nbins(0),
+	buffers(OUTPUT_QUEUE_SIZE),
+	n_writing(0),
+	stop(false)
+{
+	// Needed for ROOT I/O in more than one thread
+	ROOT::EnableThreadSafety();
+
+	file = new TFile(filename, option);
+	if(file->IsZombie()){
+		cout << __FILE__ << ":" << __LINE__ << ": " << __FUNCTION__ << "(): "<< "Error: Could not open output file " << filename << ". Aborting ..." << endl;
+		abort();
+	}
+	// Do not attach new histograms to the output file
+	gROOT->cd();
+
+	for(auto &buffer: buffers){
+		free_buffers.push_back(&buffer);
+	}
+
+	writer = std::thread(&OutputSession::writeBuffers, this);
+}
+
+OutputSession::~OutputSession(){
+	close();
+}
+
+void OutputSession::write(const TString directory, const TString name, const vector<Double_t> &values){
+	Buffer *buffer = acquire();
+
+	buffer->type = VECTOR;
+	buffer->directory = directory;
+	buffer->name = name;
+	buffer->values = values;
+
+	queueBuffer(buffer);
+}
+
+void OutputSession::openSamples(const TString directory, const vector<TString> &quantities, const Int_t nbins, const Long64_t n_samples){
+	TDirectory *sample_directory = getDirectory(directory);
+
+	sample_nbins = nbins;
+	sample_values.assign(quantities.size(), vector<Float_t>((size_t) nbins, 0.));
+
+	sample_tree = (TTree*) sample_directory->Get("mc_samples");
+	if(sample_tree == nullptr){
+		if(n_samples != 0){
+			cout << __FILE__ << ":" << __LINE__ << ": " << __FUNCTION__ << "(): "<< "Error: MC samples not found in output file " << file->GetName() << ". Aborting ..." << endl;
+			abort();
+		}
+		sample_directory->cd();
+		sample_tree = new TTree("mc_samples", "MC Samples");
+		sample_tree->Branch("iteration", &sample_iteration, "iteration/i");
+		for(size_t q = 0; q < quantities.size(); ++q){
+			sample_tree->Branch(quantities[q], &sample_values[q][0], TString::Format("%s[%d]/F", quantities[q].Data(), nbins));
+		}
+		gROOT->cd();
+	} else{
+		if(sample_tree->GetEntries() != n_samples){
+			cout << __FILE__ << ":" << __LINE__ << ": " << __FUNCTION__ << "(): "<< "Error: Output file " << file->GetName() << " contains " << sample_tree->GetEntries() << " MC samples instead of " << n_samples << ". Aborting ..." << endl;
+			abort();
+		}
+		sample_tree->SetBranchAddress("iteration", &sample_iteration);
+		for(size_t q = 0; q < quantities.size(); ++q){
+			sample_tree->SetBranchAddress(quantities[q], &sample_values[q][0]);
+		}
+	}
+
+	// The header of the tree is only written by sync(), so that the tree in the file
+	// always corresponds to a checkpoint.
+	sample_tree->SetAutoSave(0);
+}
+
+void OutputSession::writeSample(const UInt_t iteration, const vector<const Float_t*> &values){
+	Buffer *buffer = acquire();
+
+	buffer->type = SAMPLE;
+	buffer->iteration = iteration;
+	buffer->values.resize(values.size()*(size_t) sample_nbins);
+	for(size_t q = 0; q < values.size(); ++q){
+		for(size_t i = 0; i < (size_t) sample_nbins; ++i){
+			buffer->values[q*(size_t) sample_nbins + i] = values[q][i];
+		}
+	}
+
+	queueBuffer(buffer);
+}
+
+void OutputSession::sync(){
+	std::unique_lock<std::mutex> lock(mutex);
+	buffer_released.wait(lock, [this]{ return queue.empty() && n_writing == 0; });
+
+	// Save the lists of keys of all directories and the header of the TTree of MC samples,
+	// which are otherwise only written when the file is closed.
+	file->Write(0, TObject::kOverwrite);
+	file->Flush();
+}
+
+void OutputSession::close(){
+	if(file == nullptr){
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stop = true;
+		buffer_queued.notify_one();
+	}
+	writer.join();
+
+	if(sample_tree != nullptr){
+		sample_tree->GetDirectory()->cd();
+		sample_tree->Write(0, TObject::kOverwrite);
+	}
+	file->Close();
+	delete file;
+	file = nullptr;
+}
+
+OutputSession::Buffer* OutputSession::acquire(){
+	std::unique_lock<std::mutex> lock(mutex);
+	buffer_released.wait(lock, [this]{ return !free_buffers.empty(); });
+
+	Buffer *buffer = free_buffers.back();
+	free_buffers.pop_back();
+	return buffer;
+}
+
+void OutputSession::queueBuffer(Buffer *buffer){
+	std::lock_guard<std::mutex> lock(mutex);
+	queue.push_back(buffer);
+	buffer_queued.notify_one();
+}
+
+TDirectory* OutputSession::getDirectory(const TString directory){
+	TDirectory *result = file->GetDirectory(directory);
+	if(result == nullptr){
+		cout << __FILE__ << ":" << __LINE__ << ": " << __FUNCTION__ << "(): "<< "Error: Directory " << directory << " does not exist in output file " << file->GetName() << ". Aborting ..." << endl;
+		abort();
+	}
+	return result;
+}
+
+void OutputSession::writeBuffers(){
+	std::unique_lock<std::mutex> lock(mutex);
+
+	while(true){
+		buffer_queued.wait(lock, [this]{ return stop || !queue.empty(); });
+		if(queue.empty()){
+			// stop was requested and everything is written
+			return;
+		}
+
+		Buffer *buffer = queue.front();
+		queue.pop_front();
+		++n_writing;
+
+		lock.unlock();
+		writeBuffer(*buffer);
+		lock.lock();
+
+		--n_writing;
+		free_buffers.push_back(buffer);
+		buffer_released.notify_all();
+	}
+}
+
+void OutputSession::writeBuffer(const Buffer &buffer){
+	if(buffer.type == SAMPLE){
+		for(size_t q = 0; q < sample_values.size(); ++q){
+			for(size_t i = 0; i < (size_t) sample_nbins; ++i){
+				sample_values[q][i] = (Float_t) buffer.values[q*(size_t) sample_nbins + i];
+			}
+		}
+		sample_iteration = buffer.iteration;
+		sample_tree->Fill();
+		return;
+	}
+
+	getDirectory(buffer.directory)->cd();
+	TVectorD((Int_t) buffer.values.size(), &buffer.values[0]).Write(buffer.name, TObject::kOverwrite);
+}
@@ -0,0 +1,191 @@
+/*
+    This file is part of Horst.
+
+    Horst is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Horst is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Horst.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <cmath>
+
+#include "Math/DistFunc.h"
+#include <TMath.h>
+
+#include "Config.h"
+#include "PoissonSampler.h"
+
+const size_t UNIFORM_BUFFER_SIZE = 4096;
+
+PoissonSampler::PoissonSampler():
+	uniforms(UNIFORM_BUFFER_SIZE, 0.),
+	uniform_position(UNIFORM_BUFFER_SIZE)
+{
+	// Tabulate the CDF of the Poisson distribution for integer mean values below
+	// POISSON_PTRS_THRESHOLD until the probabilities become negligible.
+	cdf_table.resize((size_t) POISSON_PTRS_THRESHOLD);
+	for(size_t mean = 1; mean < (size_t) POISSON_PTRS_THRESHOLD; ++mean){
+		Double_t probability = exp(-(Double_t) mean);
+		Double_t cdf = probability;
+		cdf_table[mean].push_back(cdf);
+		for(Double_t k = 1.; k <= (Double_t) mean || probability > 1e-17; k += 1.){
+			probability *= (Double_t) mean/k;
+			cdf += probability;
+			cdf_table[mean].push_back(cdf);
+		}
+	}
+}
+
+void PoissonSampler::sample(TRandom3 &random_generator, const Double_t *mean, Double_t *result, const size_t n){
+
+	small_cells.clear();
+	large_cells.clear();
+
+	for(size_t i = 0; i < n; ++i){
+		if(mean[i] <= 0.){
+			result[i] = 0.;
+		} else if(mean[i] < POISSON_PTRS_THRESHOLD){
+			small_cells.push_back(i);
+		} else{
+			large_cells.push_back(i);
+		}
+	}
+
+	for(auto i: small_cells){
+		result[i] = invert(mean[i], nextUniform(random_generator));
+	}
+
+	// Calculate the constants of the PTRS algorithm in a separate loop without branches
+	// so that the compiler can vectorize it.
+	const size_t n_large = large_cells.size();
+	ptrs_mean.resize(n_large);
+	ptrs_a.resize(n_large);
+	ptrs_b.resize(n_large);
+	ptrs_log_inverse_alpha.resize(n_large);
+	ptrs_vr.resize(n_large);
+	ptrs_log_mean.resize(n_large);
+
+	for(size_t k = 0; k < n_large; ++k){
+		ptrs_mean[k] = mean[large_cells[k]];
+	}
+	for(size_t k = 0; k < n_large; ++k){
+		ptrs_b[k] = 0.931 + 2.53*sqrt(ptrs_mean[k]);
+		ptrs_a[k] = -0.059 + 0.02483*ptrs_b[k];
+		ptrs_log_inverse_alpha[k] = log(1.1239 + 1.1328/(ptrs_b[k] - 3.4));
+		ptrs_vr[k] = 0.9277 - 3.6224/(ptrs_b[k] - 2.);
+		ptrs_log_mean[k] = log(ptrs_mean[k]);
+	}
+
+	for(size_t k = 0; k < n_large; ++k){
+		result[large_cells[k]] = ptrs(random_generator, k);
+	}
+}
+
+void PoissonSampler::sampleInverse(const Double_t *mean, const Double_t *uniform, Double_t *result, const size_t n) const {
+	for(size_t i = 0; i < n; ++i){
+		if(mean[i] <= 0.){
+			result[i] = 0.;
+		} else if(mean[i] < POISSON_PTRS_THRESHOLD){
+			result[i] = invert(mean[i], uniform[i]);
+		} else{
+			result[i] = quantile(mean[i], uniform[i]);
+		}
+	}
+}
+
+Double_t PoissonSampler::nextUniform(TRandom3 &random_generator){
+	if(uniform_position == UNIFORM_BUFFER_SIZE){
+		random_generator.RndmArray((Int_t) UNIFORM_BUFFER_SIZE, &uniforms[0]);
+		uniform_position = 0;
+	}
+
+	return uniforms[uniform_position++];
+}
+
+Double_t PoissonSampler::invert(const Double_t mean, const Double_t uniform) const {
+	const size_t table_index = (size_t) mean;
+
+	if((Double_t) table_index == mean){
+		const vector<Double_t> &cdf = cdf_table[table_index];
+		size_t k = 0;
+		while(k < cdf.size() - 1 && uniform > cdf[k]){
+			++k;
+		}
+		return (Double_t) k;
+	}
+
+	Double_t probability = exp(-mean);
+	Double_t cdf = probability;
+	Double_t k = 0.;
+	while(uniform > cdf && probability > 0.){
+		k += 1.;
+		probability *= mean/k;
+		cdf += probability;
+	}
+
+	return k;
+}
+
+Double_t PoissonSampler::ptrs(TRandom3 &random_generator, const size_t cell){
+	const Double_t mean = ptrs_mean[cell];
+	const Double_t a = ptrs_a[cell];
+	const Double_t b = ptrs_b[cell];
+
+	Double_t u, v, us, k;
+
+	while(true){
+		u = nextUniform(random_generator) - 0.5;
+		v = nextUniform(random_generator);
+		us = 0.5 - fabs(u);
+		k = floor((2.*a/us + b)*u + mean + 0.43);
+
+		// Squeeze: accept immediately without evaluating the density
+		if(us >= 0.07 && v <= ptrs_vr[cell]){
+			return k;
+		}
+		if(k < 0. || (us < 0.013 && v > us)){
+			continue;
+		}
+		if(log(v) + ptrs_log_inverse_alpha[cell] - log(a/(us*us) + b) <= -mean + k*ptrs_log_mean[cell] - lgamma(k + 1.)){
+			return k;
+		}
+	}
+}
+
+Double_t PoissonSampler::quantile(const Double_t mean, const Double_t uniform) const {
+	// Start the search at the Cornish-Fisher approximation of the quantile, which is usually
+	// off by at most one, and evaluate the exact CDF there using the regularized incomplete
+	// gamma function: P(X <= k) = 1 - P(k+1, mean).
+	const Double_t z = ROOT::Math::normal_quantile(uniform, 1.);
+	Double_t k = floor(mean + sqrt(mean)*z + (z*z - 1.)/6. + 0.5);
+	if(k < 0.){
+		k = 0.;
+	}
+
+	Double_t cdf = 1. - TMath::Gamma(k + 1., mean);
+	Double_t probability = exp(-mean + k*log(mean) - lgamma(k + 1.));
+
+	if(uniform > cdf){
+		while(uniform > cdf && probability > 0.){
+			k += 1.;
+			probability *= mean/k;
+			cdf += probability;
+		}
+	} else{
+		while(k > 0. && uniform <= cdf - probability){
+			cdf -= probability;
+			probability *= k/mean;
+			k -= 1.;
+		}
+	}
+
+	return k;
+}
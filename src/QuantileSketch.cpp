@@ -0,0 +1,176 @@
+/*
+    This file is part of Horst.
+
+    Horst is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Horst is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Horst.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <cmath>
+
+#include "QuantileSketch.h"
+
+// Values with a smaller absolute value are counted as zeros. This avoids
+// arbitrarily large negative keys for denormalized numbers.
+const Double_t MIN_INDEXABLE_VALUE = 1e-300;
+
+QuantileSketch::QuantileSketch(const Double_t relative_accuracy, const UInt_t maximum_buckets):
+	gamma((1. + relative_accuracy)/(1. - relative_accuracy)),
+	inverse_log_gamma(1./log(gamma)),
+	max_buckets(maximum_buckets),
+	positive_min_key(0),
+	negative_min_key(0),
+	zero_count(0),
+	count(0)
+{}
+
+void QuantileSketch::add(const Double_t value){
+	if(value > MIN_INDEXABLE_VALUE){
+		addToStore(positive_store, positive_min_key, getKey(value), 1);
+	} else if(value < -MIN_INDEXABLE_VALUE){
+		addToStore(negative_store, negative_min_key, getKey(-value), 1);
+	} else{
+		++zero_count;
+	}
+	++count;
+}
+
+void QuantileSketch::merge(const QuantileSketch &sketch){
+	for(size_t i = 0; i < sketch.positive_store.size(); ++i){
+		if(sketch.positive_store[i]){
+			addToStore(positive_store, positive_min_key, sketch.positive_min_key + (Int_t) i, sketch.positive_store[i]);
+		}
+	}
+	for(size_t i = 0; i < sketch.negative_store.size(); ++i){
+		if(sketch.negative_store[i]){
+			addToStore(negative_store, negative_min_key, sketch.negative_min_key + (Int_t) i, sketch.negative_store[i]);
+		}
+	}
+	zero_count += sketch.zero_count;
+	count += sketch.count;
+}
+
+void QuantileSketch::reset(){
+	positive_store.clear();
+	negative_store.clear();
+	positive_min_key = 0;
+	negative_min_key = 0;
+	zero_count = 0;
+	count = 0;
+}
+
+void QuantileSketch::serialize(vector<Double_t> &buffer) const {
+	buffer.push_back((Double_t) positive_min_key);
+	buffer.push_back((Double_t) negative_min_key);
+	buffer.push_back((Double_t) zero_count);
+	buffer.push_back((Double_t) count);
+	buffer.push_back((Double_t) positive_store.size());
+	buffer.push_back((Double_t) negative_store.size());
+	for(auto n: positive_store){
+		buffer.push_back((Double_t) n);
+	}
+	for(auto n: negative_store){
+		buffer.push_back((Double_t) n);
+	}
+}
+
+void QuantileSketch::deserialize(const vector<Double_t> &buffer, size_t &position){
+	positive_min_key = (Int_t) buffer[position++];
+	negative_min_key = (Int_t) buffer[position++];
+	zero_count = (ULong64_t) buffer[position++];
+	count = (ULong64_t) buffer[position++];
+	positive_store.resize((size_t) buffer[position++]);
+	negative_store.resize((size_t) buffer[position++]);
+	for(size_t i = 0; i < positive_store.size(); ++i){
+		positive_store[i] = (ULong64_t) buffer[position++];
+	}
+	for(size_t i = 0; i < negative_store.size(); ++i){
+		negative_store[i] = (ULong64_t) buffer[position++];
+	}
+}
+
+Double_t QuantileSketch::getQuantile(const Double_t quantile) const {
+	if(count == 0){
+		return 0.;
+	}
+
+	const Double_t rank = quantile*(Double_t) (count - 1);
+	ULong64_t n = 0;
+
+	// Negative values, starting with the largest absolute value
+	for(size_t i = negative_store.size(); i > 0; --i){
+		n += negative_store[i - 1];
+		if((Double_t) n > rank){
+			return -getValue(negative_min_key + (Int_t) i - 1);
+		}
+	}
+
+	n += zero_count;
+	if((Double_t) n > rank){
+		return 0.;
+	}
+
+	for(size_t i = 0; i < positive_store.size(); ++i){
+		n += positive_store[i];
+		if((Double_t) n > rank){
+			return getValue(positive_min_key + (Int_t) i);
+		}
+	}
+
+	return getValue(positive_min_key + (Int_t) positive_store.size() - 1);
+}
+
+Int_t QuantileSketch::getKey(const Double_t value) const {
+	return (Int_t) ceil(log(value)*inverse_log_gamma);
+}
+
+Double_t QuantileSketch::getValue(const Int_t key) const {
+	return 2.*pow(gamma, (Double_t) key)/(gamma + 1.);
+}
+
+void QuantileSketch::addToStore(vector<ULong64_t> &store, Int_t &min_key, const Int_t key, const ULong64_t n){
+
+	if(store.empty()){
+		store.push_back(n);
+		min_key = key;
+		return;
+	}
+
+	Int_t max_key = min_key + (Int_t) store.size() - 1;
+
+	if(key < min_key){
+		// If the store would exceed max_buckets, the value is counted
+		// in the lowest bucket that is still allowed.
+		const Int_t lowest_key = key > max_key - (Int_t) max_buckets + 1 ? key : max_key - (Int_t) max_buckets + 1;
+		store.insert(store.begin(), (size_t) (min_key - lowest_key), 0);
+		min_key = lowest_key;
+		store[0] += n;
+		return;
+	} else if(key > max_key){
+		store.resize(store.size() + (size_t) (key - max_key), 0);
+		max_key = key;
+
+		// Collapse the lowest buckets into the lowest remaining one
+		if(store.size() > max_buckets){
+			const size_t n_collapse = store.size() - max_buckets;
+			ULong64_t collapsed = 0;
+			for(size_t i = 0; i <= n_collapse; ++i){
+				collapsed += store[i];
+			}
+			store.erase(store.begin(), store.begin() + (long) n_collapse);
+			store[0] = collapsed;
+			min_key += (Int_t) n_collapse;
+		}
+	}
+
+	store[(size_t) (key - min_key)] += n;
+}
@@ -17,9 +17,22 @@
 
 #include <TRandom3.h>
 
+#include <algorithm>
+#include <thread>
+
 #include "Config.h"
 #include "Reconstructor.h"
 
+using std::fill;
+using std::min;
+using std::thread;
+
+// Number of spectra that are folded with a single pass over the response matrix, each
+// of them as two vectors: the response spectrum and the spectrum normalized to the
+// full-energy peak (FEP)
+const size_t FOLD_BLOCK_SIZE = 8;
+const size_t FOLD_VECTORS = 2*FOLD_BLOCK_SIZE;
+
 void Reconstructor::reconstruct(const TH1F &params, const TH1F &n_simulated_particles, TH1F &reconstructed_spectrum){
 
 	for(Int_t i = 1; i <= (Int_t) NBINS/((Int_t) BINNING); ++i){
@@ -29,53 +42,117 @@ void Reconstructor::reconstruct(const TH1F &params, const TH1F &n_simulated_part
 
 void Reconstructor::uncertainty(const TH1F &total_uncertainty, const TH2F &rema, const TH1F &n_simulated_particles, TH1F &reconstruction_uncertainty){
 
+	// horst reads only the rows of the fit range from the matrix file, so the diagonal
+	// is zero outside of it. The parameters there are zero, and so is their uncertainty.
+	Double_t diagonal = 0.;
 	for(Int_t i = 1; i <= (Int_t) NBINS/((Int_t) BINNING); ++i){
-		reconstruction_uncertainty.SetBinContent(i, total_uncertainty.GetBinContent(i)*n_simulated_particles.GetBinContent(i)/rema.GetBinContent(i, i));
+		diagonal = rema.GetBinContent(i, i);
+		reconstruction_uncertainty.SetBinContent(i, diagonal > 0. ? total_uncertainty.GetBinContent(i)*n_simulated_particles.GetBinContent(i)/diagonal : 0.);
 	}
 }
 
-void Reconstructor::addResponse(const TH1F &spectrum, const TH1F &inverse_n_simulated_particles, const TH2F &rema, TH1F &response_spectrum){
-	
-	Double_t factor = 1.;
+void Reconstructor::uncertainty(const TH1F &total_uncertainty, const TH1F &rema_diagonal, const TH1F &n_simulated_particles, TH1F &reconstruction_uncertainty){
 
+	// See above
+	Double_t diagonal = 0.;
 	for(Int_t i = 1; i <= (Int_t) NBINS/((Int_t) BINNING); ++i){
-		response_spectrum.SetBinContent(i, 0.);
+		diagonal = rema_diagonal.GetBinContent(i);
+		reconstruction_uncertainty.SetBinContent(i, diagonal > 0. ? total_uncertainty.GetBinContent(i)*n_simulated_particles.GetBinContent(i)/diagonal : 0.);
 	}
+}
 
-	for(Int_t i = 1; i <= (Int_t) NBINS/((Int_t) BINNING); ++i){
-		factor = spectrum.GetBinContent(i)*inverse_n_simulated_particles.GetBinContent(i);
+void Reconstructor::addResponse(const TH1F &spectrum, const TH1F &inverse_n_simulated_particles, const TH2F &rema, TH1F &response_spectrum){
 
-		for(Int_t j = i; j > 0; --j){
-			response_spectrum.SetBinContent(j, response_spectrum.GetBinContent(j) + factor*rema.GetBinContent(i, j));
-		}
+	const Int_t nbins = (Int_t) NBINS/((Int_t) BINNING);
+	vector<Double_t> factor((size_t) nbins + 1, 0.);
+	vector<Double_t> folded((size_t) nbins + 1, 0.);
+
+	for(Int_t i = 1; i <= nbins; ++i){
+		factor[(size_t) i] = spectrum.GetBinContent(i)*inverse_n_simulated_particles.GetBinContent(i);
+	}
+
+	fold(rema, factor, folded);
+
+	for(Int_t j = 1; j <= nbins; ++j){
+		response_spectrum.SetBinContent(j, folded[(size_t) j]);
 	}
 }
 
 void Reconstructor::addResponse(const TH1F &spectrum, const TH1F &inverse_n_simulated_particles, const TH2F &rema, TH1F &response_spectrum, TH1F &response_spectrum_FEP){
-	
-	Double_t factor = 1.;
-	Double_t factor_without_efficiency = 1.;
 
-	for(Int_t i = 1; i <= (Int_t) NBINS/((Int_t) BINNING); ++i){
-		response_spectrum.SetBinContent(i, 0.);
+	const Int_t nbins = (Int_t) NBINS/((Int_t) BINNING);
+	vector<Double_t> factor((size_t) nbins + 1, 0.);
+	vector<Double_t> factor_without_efficiency((size_t) nbins + 1, 0.);
+	vector<Double_t> folded((size_t) nbins + 1, 0.);
+	vector<Double_t> folded_FEP((size_t) nbins + 1, 0.);
+
+	for(Int_t i = 1; i <= nbins; ++i){
+		factor[(size_t) i] = spectrum.GetBinContent(i)*inverse_n_simulated_particles.GetBinContent(i);
+		factor_without_efficiency[(size_t) i] = spectrum.GetBinContent(i)/rema.GetBinContent(i, i);
 	}
 
-	for(Int_t i = 1; i <= (Int_t) NBINS/((Int_t) BINNING); ++i){
-		factor = spectrum.GetBinContent(i)*inverse_n_simulated_particles.GetBinContent(i);
-		factor_without_efficiency = spectrum.GetBinContent(i)/rema.GetBinContent(i,i);
+	fold(rema, factor, factor_without_efficiency, folded, folded_FEP);
 
-		for(Int_t j = i; j > 0; --j){
-			response_spectrum.SetBinContent(j, response_spectrum.GetBinContent(j) + factor*rema.GetBinContent(i, j));
-			response_spectrum_FEP.SetBinContent(j, response_spectrum_FEP.GetBinContent(j) + factor_without_efficiency*rema.GetBinContent(i,j));
+	for(Int_t j = 1; j <= nbins; ++j){
+		response_spectrum.SetBinContent(j, folded[(size_t) j]);
+		response_spectrum_FEP.SetBinContent(j, folded_FEP[(size_t) j]);
+	}
+}
+
+void Reconstructor::addResponse(const vector<TH1F> &spectra, const TH1F &inverse_n_simulated_particles, const TH2F &rema, vector<TH1F> &response_spectra, vector<TH1F> &response_spectra_FEP){
+
+	const Int_t nbins = (Int_t) NBINS/((Int_t) BINNING);
+	const size_t n_spectra = spectra.size();
+
+	// An incomplete last block is filled up with zeros.
+	auto fold_spectra = [&](const size_t first, const size_t last){
+		vector<Double_t> factor(FOLD_VECTORS*(size_t) (nbins + 1), 0.);
+		vector<Double_t> folded(FOLD_VECTORS*(size_t) (nbins + 1), 0.);
+
+		for(size_t block_start = first; block_start < last; block_start += FOLD_BLOCK_SIZE){
+			const size_t block_size = min(FOLD_BLOCK_SIZE, last - block_start);
+			if(block_size < FOLD_BLOCK_SIZE){
+				fill(factor.begin(), factor.end(), 0.);
+			}
+
+			for(Int_t i = 1; i <= nbins; ++i){
+				for(size_t k = 0; k < block_size; ++k){
+					const TH1F &spectrum = spectra[block_start + k];
+					factor[FOLD_VECTORS*(size_t) i + 2*k] = spectrum.GetBinContent(i)*inverse_n_simulated_particles.GetBinContent(i);
+					factor[FOLD_VECTORS*(size_t) i + 2*k + 1] = spectrum.GetBinContent(i)/rema.GetBinContent(i, i);
+				}
+			}
+
+			foldBlock(rema, factor, folded);
+
+			for(size_t k = 0; k < block_size; ++k){
+				for(Int_t j = 1; j <= nbins; ++j){
+					response_spectra[block_start + k].SetBinContent(j, folded[FOLD_VECTORS*(size_t) j + 2*k]);
+					response_spectra_FEP[block_start + k].SetBinContent(j, folded[FOLD_VECTORS*(size_t) j + 2*k + 1]);
+				}
+			}
 		}
+	};
+
+	const size_t n_used_threads = min((size_t) n_threads, n_spectra);
+	if(n_used_threads <= 1){
+		fold_spectra(0, n_spectra);
+		return;
+	}
+
+	vector<thread> threads;
+	for(size_t t = 0; t < n_used_threads; ++t){
+		threads.push_back(thread(fold_spectra, n_spectra*t/n_used_threads, n_spectra*(t + 1)/n_used_threads));
+	}
+	for(auto &t: threads){
+		t.join();
 	}
 }
 
-void Reconstructor::addRealisticResponse(const TH1F &spectrum, const TH1F &inverse_n_simulated_particles, const TH2F &rema, TH1F &response_spectrum, TH1F &response_spectrum_FEP){
+void Reconstructor::addRealisticResponse(TRandom3 &random_generator, const TH1F &spectrum, const TH1F &inverse_n_simulated_particles, const TH2F &rema, TH1F &response_spectrum, TH1F &response_spectrum_FEP){
 
 	Double_t factor = 1.;
 	Double_t factor_without_efficiency = 1.;
-	TRandom3 rand;
 
 	for(Int_t i = 1; i <= (Int_t) NBINS/((Int_t) BINNING); ++i){
 		response_spectrum.SetBinContent(i, 0.);
@@ -86,8 +163,105 @@ void Reconstructor::addRealisticResponse(const TH1F &spectrum, const TH1F &inver
 		factor_without_efficiency = spectrum.GetBinContent(i)/rema.GetBinContent(i, i);
 
 		for(Int_t j = i; j > 0; --j){
-			response_spectrum.SetBinContent(j, response_spectrum.GetBinContent(j) + rand.Poisson(factor*rema.GetBinContent(i, j)));
-			response_spectrum_FEP.SetBinContent(j, response_spectrum_FEP.GetBinContent(j) + rand.Poisson(factor_without_efficiency*rema.GetBinContent(i, j)));
+			response_spectrum.SetBinContent(j, response_spectrum.GetBinContent(j) + random_generator.Poisson(factor*rema.GetBinContent(i, j)));
+			response_spectrum_FEP.SetBinContent(j, response_spectrum_FEP.GetBinContent(j) + random_generator.Poisson(factor_without_efficiency*rema.GetBinContent(i, j)));
+		}
+	}
+}
+
+void Reconstructor::fold(const TH2F &rema, const vector<Double_t> &factor, vector<Double_t> &folded) const {
+
+	const Double_t *factors[1] = {&factor[0]};
+	Double_t *foldeds[1] = {&folded[0]};
+
+	foldVectors<1>(rema, factors, foldeds);
+}
+
+void Reconstructor::fold(const TH2F &rema, const vector<Double_t> &factor_1, const vector<Double_t> &factor_2, vector<Double_t> &folded_1, vector<Double_t> &folded_2) const {
+
+	const Double_t *factors[2] = {&factor_1[0], &factor_2[0]};
+	Double_t *foldeds[2] = {&folded_1[0], &folded_2[0]};
+
+	foldVectors<2>(rema, factors, foldeds);
+}
+
+template<size_t N_VECTORS>
+void Reconstructor::foldVectors(const TH2F &rema, const Double_t *const *factor, Double_t *const *folded) const {
+
+	const Int_t nbins = (Int_t) NBINS/((Int_t) BINNING);
+	const Float_t *rema_array = rema.GetArray();
+	const size_t row_length = (size_t) rema.GetNbinsX() + 2;
+
+	// Bin j of the folded spectrum only receives contributions from bins i >= j of the
+	// input spectrum. In the storage of the TH2F, the cells (i, j) with i = j ... nbins
+	// are contiguous, so every output bin is a dot product of two contiguous vectors.
+	// Four independent partial sums per output allow the compiler to vectorize the
+	// loop and make the result independent of the number of threads.
+	auto fold_bins = [&](const UInt_t first_bin){
+		for(Int_t j = (Int_t) first_bin; j <= nbins; j += (Int_t) n_threads){
+			const Float_t *rema_j = &rema_array[row_length*(size_t) j];
+			Double_t sum[N_VECTORS][4] = {{0.}};
+
+			size_t i = (size_t) j;
+			for(; i + 3 <= (size_t) nbins; i += 4){
+				for(size_t v = 0; v < N_VECTORS; ++v){
+					for(size_t k = 0; k < 4; ++k){
+						sum[v][k] += factor[v][i + k]*rema_j[i + k];
+					}
+				}
+			}
+			for(; i <= (size_t) nbins; ++i){
+				for(size_t v = 0; v < N_VECTORS; ++v){
+					sum[v][0] += factor[v][i]*rema_j[i];
+				}
+			}
+
+			for(size_t v = 0; v < N_VECTORS; ++v){
+				folded[v][(size_t) j] = (sum[v][0] + sum[v][1]) + (sum[v][2] + sum[v][3]);
+			}
+		}
+	};
+
+	// The output bins are distributed round-robin, because the length of the dot
+	// products decreases with j.
+	if(n_threads == 1){
+		fold_bins(1);
+		return;
+	}
+
+	vector<thread> threads;
+	for(UInt_t t = 1; t <= n_threads; ++t){
+		threads.push_back(thread(fold_bins, t));
+	}
+	for(auto &t: threads){
+		t.join();
+	}
+}
+
+void Reconstructor::foldBlock(const TH2F &rema, const vector<Double_t> &factor, vector<Double_t> &folded) const {
+
+	const Int_t nbins = (Int_t) NBINS/((Int_t) BINNING);
+	const Float_t *rema_array = rema.GetArray();
+	const size_t row_length = (size_t) rema.GetNbinsX() + 2;
+
+	// Every matrix element is loaded once and multiplied with the factors of all vectors.
+	// The factors of a bin are contiguous and the number of vectors is a compile-time
+	// constant, so the innermost loop is vectorized over the vectors and the sums stay
+	// in registers.
+	for(Int_t j = 1; j <= nbins; ++j){
+		const Float_t *rema_j = &rema_array[row_length*(size_t) j];
+		Double_t sum[FOLD_VECTORS] = {0.};
+
+		for(Int_t i = j; i <= nbins; ++i){
+			const Double_t rema_ij = (Double_t) rema_j[i];
+			const Double_t *factor_i = &factor[FOLD_VECTORS*(size_t) i];
+			for(size_t k = 0; k < FOLD_VECTORS; ++k){
+				sum[k] += rema_ij*factor_i[k];
+			}
+		}
+
+		for(size_t k = 0; k < FOLD_VECTORS; ++k){
+			folded[FOLD_VECTORS*(size_t) j + k] = sum[k];
 		}
 	}
 }
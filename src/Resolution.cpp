@@ -15,54 +15,296 @@
     along with Horst.  If not, see <https://www.gnu.org/licenses/>.
 */
 
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
 #include "Math/DistFunc.h"
 
 #include "Config.h"
 #include "Resolution.h"
 
+using std::cout;
+using std::copy;
+using std::endl;
+using std::fill;
+
 using ROOT::Math::normal_pdf;
 
-void Resolution::gaussianBlur(const TH1F &spectrum, const vector<Double_t> params, TH1F &blurred_spectrum){
+// The rows of a response matrix are not contiguous in memory. foldMatrix() copies
+// ROW_BLOCK_SIZE rows at once, so that it reads and writes contiguous runs of
+// ROW_BLOCK_SIZE elements.
+const size_t ROW_BLOCK_SIZE = 16;
+
+// In-place radix-2 FFT of a sequence whose length is a power of 2. The inverse transform
+// is not normalized.
+void fft(vector<complex<Double_t> > &data, const Bool_t inverse){
+
+	const size_t n = data.size();
+
+	for(size_t i = 1, j = 0; i < n; ++i){
+		size_t bit = n >> 1;
+		for(; j & bit; bit >>= 1){
+			j ^= bit;
+		}
+		j ^= bit;
+		if(i < j){
+			std::swap(data[i], data[j]);
+		}
+	}
+
+	for(size_t length = 2; length <= n; length <<= 1){
+		const Double_t angle = (inverse ? 2. : -2.)*M_PI/(Double_t) length;
+		const complex<Double_t> unit_root(cos(angle), sin(angle));
+		for(size_t start = 0; start < n; start += length){
+			complex<Double_t> w(1., 0.);
+			for(size_t k = 0; k < length/2; ++k){
+				const complex<Double_t> even = data[start + k];
+				const complex<Double_t> odd = w*data[start + k + length/2];
+				data[start + k] = even + odd;
+				data[start + k + length/2] = even - odd;
+				w *= unit_root;
+			}
+		}
+	}
+}
+
+void Resolution::setParameters(const vector<Double_t> &params){
 
 	// Correction that is necessary because the integration does not use the full range
 	// of the normal distribution which is ]-infinity, infinity[, but
 	// [-GAUSSIAN_BLUR_WINDOW*SIGMA, GAUSSIAN_BLUR_WINDOW*SIGMA]
 	// where SIGMA is the (energy-dependent) standard deviation of the normal
 	// distribution.
-	Double_t finite_width_correction = 1./(erf(GAUSSIAN_BLUR_WINDOW));
-	Double_t inverse_BINNING = 1./ (Double_t) BINNING;
+	const Double_t finite_width_correction = 1./(erf(GAUSSIAN_BLUR_WINDOW));
+	const Double_t inverse_BINNING = 1./ (Double_t) BINNING;
+	const Int_t max_bin = (Int_t) NBINS/((Int_t) BINNING);
 
-	Int_t max_bin = (Int_t) NBINS/((Int_t) BINNING);
-	Int_t resolution = 1;
-	Int_t blur_window_start = 1;
-	Int_t blur_window_stop = max_bin;
+	if(params.empty()){
+		cout << __FILE__ << ":" << __LINE__ << ": " << __FUNCTION__ << "(): "<< "Error: No resolution parameters given. Aborting ..." << endl;
+		abort();
+	}
+	const Double_t p_constant = params[0];
+	const Double_t p_square_root = params.size() > 1 ? params[1] : 0.;
 
-	Double_t bin_content = 0.;
-	
+	kernels.clear();
+	segments.clear();
+	max_half_width = 0;
+
+	Int_t resolution = 0;
 	for(Int_t i = 1; i <= max_bin; ++i){
-		blurred_spectrum.SetBinContent(i, 0.);
+		resolution = (Int_t) round(sqrt_resolution_model((Double_t) i*BINNING, p_constant, p_square_root)*inverse_BINNING);
+		if(resolution < 0){
+			cout << __FILE__ << ":" << __LINE__ << ": " << __FUNCTION__ << "(): "<< "Error: Negative resolution in bin " << i << ". Aborting ..." << endl;
+			abort();
+		}
+
+		if(segments.empty() || segments.back().resolution != resolution){
+			Segment segment;
+			segment.first_bin = i;
+			segment.resolution = resolution;
+			segment.half_width = (Int_t) (GAUSSIAN_BLUR_WINDOW*resolution);
+			segment.fft_size = 0;
+			segments.push_back(segment);
+		}
+		segments.back().last_bin = i;
 	}
 
-	for(Int_t i = 1; i <= max_bin; ++i){
-		resolution = (Int_t) round(sqrt_resolution_model((Double_t) i*BINNING, params[0], params[1])*inverse_BINNING);
-		blur_window_start = i - GAUSSIAN_BLUR_WINDOW*resolution;
-		if(blur_window_start < 1){
-			blur_window_start = 1;
+	for(auto &segment: segments){
+		const Int_t h = segment.half_width;
+		if(h > max_half_width){
+			max_half_width = h;
 		}
-		blur_window_stop = i + GAUSSIAN_BLUR_WINDOW*resolution;
-		if(blur_window_stop > max_bin){
-			blur_window_stop = max_bin;
+
+		if(kernels.find(segment.resolution) == kernels.end()){
+			vector<Double_t> kernel(2*(size_t) h + 1);
+			if(segment.resolution == 0){
+				// The normal distribution is not defined for a width of zero
+				kernel[0] = 1.;
+			} else{
+				for(Int_t d = -h; d <= h; ++d){
+					kernel[(size_t) (d + h)] = normal_pdf((Double_t) d, segment.resolution, 0.)*finite_width_correction;
+				}
+			}
+			kernels[segment.resolution] = kernel;
 		}
 
-		bin_content = 0.;
-		for(Int_t j = blur_window_start; j <= blur_window_stop; ++j){
-			bin_content += spectrum.GetBinContent(j)*normal_pdf((Double_t) i-j, resolution, 0.);
+		// The FFT needs a size of at least length + 4h, where length is the length of the
+		// segment, plus the window on both sides, plus the kernel
+		const size_t kernel_length = 2*(size_t) h + 1;
+		const size_t segment_length = (size_t) (segment.last_bin - segment.first_bin + 1);
+		if(kernel_length >= BLUR_FFT_MIN_KERNEL_LENGTH && segment_length >= kernel_length){
+			segment.fft_size = 1;
+			while(segment.fft_size < segment_length + 4*(size_t) h){
+				segment.fft_size <<= 1;
+			}
+			segment.fft_kernel.assign(segment.fft_size, complex<Double_t>(0., 0.));
+			const vector<Double_t> &kernel = kernels[segment.resolution];
+			for(size_t k = 0; k < kernel_length; ++k){
+				segment.fft_kernel[k] = kernel[k];
+			}
+			fft(segment.fft_kernel, false);
 		}
-		blurred_spectrum.SetBinContent(i, bin_content);
 	}
+}
 
-	for(Int_t i = 1; i <= max_bin; ++i){
-		blurred_spectrum.SetBinContent(i, blurred_spectrum.GetBinContent(i)*finite_width_correction);
+void Resolution::blur(const TH1F &spectrum, TH1F &blurred_spectrum) const {
+
+	const Spectrum spectrum_values(spectrum);
+	Spectrum blurred_values;
+	blur(spectrum_values, blurred_values);
+
+	for(Int_t i = 1; i <= blurred_values.getNBins(); ++i){
+		blurred_spectrum.SetBinContent(i, blurred_values[i]);
+	}
+}
+
+void Resolution::blur(const Spectrum &spectrum, Spectrum &blurred_spectrum) const {
+
+	const Int_t max_bin = (Int_t) NBINS/((Int_t) BINNING);
+	if(spectrum.getNBins() < max_bin){
+		cout << __FILE__ << ":" << __LINE__ << ": " << __FUNCTION__ << "(): "<< "Error: The spectrum has " << spectrum.getNBins() << " instead of " << max_bin << " bins. Aborting ..." << endl;
+		abort();
+	}
+	if(blurred_spectrum.getNBins() != max_bin){
+		blurred_spectrum = Spectrum(max_bin);
+	}
+
+	// Bin j of the spectrum is stored at padded_spectrum[j + max_half_width]. The bins
+	// outside of [1, max_bin] are zero, so that the windows do not need to be truncated.
+	vector<Double_t> padded_spectrum((size_t) (max_bin + 1 + 2*max_half_width), 0.);
+	copy(spectrum.data() + 1, spectrum.data() + 1 + max_bin, padded_spectrum.begin() + 1 + max_half_width);
+
+	vector<Double_t> result((size_t) max_bin + 1, 0.);
+	blurPadded(padded_spectrum, result);
+
+	copy(result.begin() + 1, result.end(), blurred_spectrum.data() + 1);
+}
+
+void Resolution::foldMatrix(const TH2F &rema, TH2F &folded_rema) const {
+
+	const ResponseMatrix rema_values(rema);
+	ResponseMatrix folded_values;
+	foldMatrix(rema_values, folded_values);
+	folded_values.toHistogram(folded_rema);
+}
+
+void Resolution::foldMatrix(const ResponseMatrix &rema, ResponseMatrix &folded_rema) const {
+
+	const Int_t max_bin = (Int_t) NBINS/((Int_t) BINNING);
+	if(rema.getNBins() != max_bin){
+		cout << __FILE__ << ":" << __LINE__ << ": " << __FUNCTION__ << "(): "<< "Error: The response matrix has " << rema.getNBins() << " instead of " << max_bin << " bins. Aborting ..." << endl;
+		abort();
+	}
+	if(folded_rema.getNBins() != max_bin){
+		folded_rema = ResponseMatrix(max_bin);
+	}
+
+	// Row i of the matrix is the detected spectrum for the energy i, which is blurred
+	// like any other spectrum. Since the kernels only cover a window around each bin, the
+	// cost is proportional to the number of matrix elements times the window size.
+	// For a detected bin j, the elements of a block of rows are contiguous.
+	vector<vector<Double_t> > padded_rows(ROW_BLOCK_SIZE, vector<Double_t>((size_t) (max_bin + 1 + 2*max_half_width), 0.));
+	vector<vector<Double_t> > results(ROW_BLOCK_SIZE, vector<Double_t>((size_t) max_bin + 1, 0.));
+	vector<Bool_t> empty(ROW_BLOCK_SIZE);
+
+	for(Int_t block_start = 1; block_start <= max_bin; block_start += (Int_t) ROW_BLOCK_SIZE){
+		const size_t n_rows = std::min(ROW_BLOCK_SIZE, (size_t) (max_bin - block_start + 1));
+
+		fill(empty.begin(), empty.end(), true);
+		for(Int_t j = 1; j <= max_bin; ++j){
+			const Float_t *contributions = rema.getContributions(j) + block_start;
+			for(size_t b = 0; b < n_rows; ++b){
+				padded_rows[b][(size_t) (j + max_half_width)] = contributions[b];
+				empty[b] = empty[b] && contributions[b] == 0.f;
+			}
+		}
+
+		for(size_t b = 0; b < n_rows; ++b){
+			if(empty[b]){
+				fill(results[b].begin(), results[b].end(), 0.);
+			} else{
+				blurPadded(padded_rows[b], results[b]);
+			}
+		}
+
+		for(Int_t k = 1; k <= max_bin; ++k){
+			Float_t *folded_contributions = folded_rema.getContributions(k) + block_start;
+			for(size_t b = 0; b < n_rows; ++b){
+				folded_contributions[b] = (Float_t) results[b][(size_t) k];
+			}
+		}
+	}
+}
+
+void Resolution::blurPadded(const vector<Double_t> &padded_spectrum, vector<Double_t> &result) const {
+	for(auto &segment: segments){
+		if(segment.fft_size == 0){
+			blurDirect(segment, padded_spectrum, result);
+		} else{
+			blurFFT(segment, padded_spectrum, result);
+		}
+	}
+}
+
+void Resolution::gaussianBlur(const TH1F &spectrum, const vector<Double_t> params, TH1F &blurred_spectrum){
+	setParameters(params);
+	blur(spectrum, blurred_spectrum);
+}
+
+void Resolution::blurDirect(const Segment &segment, const vector<Double_t> &padded_spectrum, vector<Double_t> &result) const {
+
+	const vector<Double_t> &kernel = kernels.at(segment.resolution);
+	const size_t kernel_length = kernel.size();
+
+	// Four independent partial sums allow the compiler to vectorize the dot products
+	for(Int_t i = segment.first_bin; i <= segment.last_bin; ++i){
+		const Double_t *window = &padded_spectrum[(size_t) (i + max_half_width - segment.half_width)];
+		Double_t sum[4] = {0., 0., 0., 0.};
+
+		size_t k = 0;
+		for(; k + 4 <= kernel_length; k += 4){
+			for(size_t l = 0; l < 4; ++l){
+				sum[l] += window[k + l]*kernel[k + l];
+			}
+		}
+		for(; k < kernel_length; ++k){
+			sum[0] += window[k]*kernel[k];
+		}
+
+		result[(size_t) i] = (sum[0] + sum[1]) + (sum[2] + sum[3]);
+	}
+}
+
+void Resolution::blurFFT(const Segment &segment, const vector<Double_t> &padded_spectrum, vector<Double_t> &result) const {
+
+	const Int_t h = segment.half_width;
+	const size_t input_length = (size_t) (segment.last_bin - segment.first_bin + 1 + 2*h);
+	const Double_t *input = &padded_spectrum[(size_t) (segment.first_bin + max_half_width - h)];
+
+	vector<complex<Double_t> > data(segment.fft_size, complex<Double_t>(0., 0.));
+	Double_t max_input = 0.;
+	for(size_t k = 0; k < input_length; ++k){
+		data[k] = input[k];
+		if(fabs(input[k]) > max_input){
+			max_input = fabs(input[k]);
+		}
+	}
+
+	fft(data, false);
+	for(size_t k = 0; k < segment.fft_size; ++k){
+		data[k] *= segment.fft_kernel[k];
+	}
+	fft(data, true);
+
+	// Output bin i is element i - first_bin + 2h of the full convolution.
+	// The rounding errors of the FFT are of the order of the machine precision times the
+	// largest input. They are set to zero, because empty bins should stay empty.
+	const Double_t inverse_size = 1./(Double_t) segment.fft_size;
+	const Double_t threshold = BLUR_FFT_ZERO_THRESHOLD*max_input;
+	for(Int_t i = segment.first_bin; i <= segment.last_bin; ++i){
+		const Double_t value = data[(size_t) (i - segment.first_bin + 2*h)].real()*inverse_size;
+		result[(size_t) i] = fabs(value) > threshold ? value : 0.;
 	}
 }
 
@@ -0,0 +1,45 @@
+/*
+    This file is part of Horst.
+
+    Horst is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Horst is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Horst.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <iostream>
+
+#include "ResponseMatrix.h"
+
+using std::cout;
+using std::endl;
+
+void ResponseMatrix::fromHistogram(const TH2F &histogram){
+	if(histogram.GetNbinsX() != histogram.GetNbinsY()){
+		cout << __FILE__ << ":" << __LINE__ << ": " << __FUNCTION__ << "(): "<< "Error: Response matrix " << histogram.GetName() << " is not square. Aborting ..." << endl;
+		abort();
+	}
+
+	nbins = histogram.GetNbinsX();
+	row_length = (size_t) nbins + 2;
+	elements.resize(row_length*row_length);
+	const Float_t *array = histogram.GetArray();
+	std::copy(array, array + elements.size(), elements.begin());
+}
+
+void ResponseMatrix::toHistogram(TH2F &histogram) const {
+	if(histogram.GetNbinsX() != nbins || histogram.GetNbinsY() != nbins){
+		cout << __FILE__ << ":" << __LINE__ << ": " << __FUNCTION__ << "(): "<< "Error: Histogram " << histogram.GetName() << " does not have " << nbins << " x " << nbins << " bins. Aborting ..." << endl;
+		abort();
+	}
+	std::copy(elements.begin(), elements.end(), histogram.GetArray());
+}
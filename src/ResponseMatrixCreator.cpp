@@ -15,21 +15,25 @@
     along with Horst.  If not, see <https://www.gnu.org/licenses/>.
 */
 
+#include <fstream>
 #include <iostream>
 #include <sstream>
 
 #include "TFile.h"
 
 #include "ConfigTest.h"
+#include "InputFileReader.h"
 #include "ResponseMatrixCreator.h"
 
 using std::cout;
 using std::endl;
+using std::ofstream;
 using std::stringstream;
 
 void ResponseMatrixCreator::createResponseMatrix(TH2F &response_matrix, TH1F &n_simulated_particles, const string option, const string outputfile_prefix){
 	if(option == "escape"){
 		createResponseMatrixWithEscapePeaks(response_matrix, n_simulated_particles, escape_params);
+		writeEscapeSimulation(escape_params, outputfile_prefix);
 	} 
 	else if(option == "efficiency"){
 		createResponseMatrixWithEfficiency(response_matrix, n_simulated_particles, efficiency_params);
@@ -42,10 +46,37 @@ void ResponseMatrixCreator::createResponseMatrix(TH2F &response_matrix, TH1F &n_
 	ofname << outputfile_prefix << "_response_matrix.root";
 	cout << "Writing test response_matrix to '" << ofname.str() << "' ..." << endl;
 
-	TFile response_matrixfile(ofname.str().c_str(), "RECREATE");
-	n_simulated_particles.Write();
-	response_matrix.Write();
-	response_matrixfile.Close();
+	// Written like the matrices of makematrix, including the rows for the windowed reader
+	InputFileReader inputFileReader(1);
+	inputFileReader.writeMatrix(response_matrix, n_simulated_particles, ofname.str(), true);
+}
+
+void ResponseMatrixCreator::writeEscapeSimulation(const vector<Double_t> params, const string outputfile_prefix){
+	// The response of the escape model does not depend on the energy, so makematrix
+	// creates the same matrix from a single simulation at the highest energy.
+	// Like utr simulations, the histogram has its axis in MeV.
+	TH1F response("response", "Simulated Response", NBINS, 0., 0.001*(Double_t) NBINS);
+	response.SetBinContent(NBINS, params[1]*params[0]);
+	response.SetBinContent((Int_t) (NBINS - params[3]), params[2]*params[0]);
+	response.SetBinContent((Int_t) (NBINS - params[5]), params[4]*params[0]);
+
+	stringstream simulationfilename;
+	simulationfilename << outputfile_prefix << "_simulation.root";
+	cout << "Writing test simulation to '" << simulationfilename.str() << "' ..." << endl;
+
+	TFile simulationfile(simulationfilename.str().c_str(), "RECREATE");
+	response.Write();
+	simulationfile.Close();
+
+	// Input file of makematrix
+	stringstream inputfilename;
+	inputfilename << TEST_DIR << outputfile_prefix << "_simulations.txt";
+	cout << "Writing input file " << inputfilename.str() << " ..." << endl;
+
+	ofstream inputfile(inputfilename.str().c_str());
+	// The energy is the center of the highest bin, so that the shifted simulation is read at bin centers
+	inputfile << TString::Format("%s\t%.1f\t%.0f", simulationfilename.str().c_str(), (Double_t) NBINS - 0.5, params[0]) << endl;
+	inputfile.close();
 }
 
 void ResponseMatrixCreator::createResponseMatrixWithEscapePeaks(TH2F &response_matrix, TH1F &n_simulated_particles, vector<Double_t> params){
@@ -0,0 +1,188 @@
+/*
+    This file is part of Horst.
+
+    Horst is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Horst is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Horst.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <cmath>
+#include <iostream>
+
+#include "Config.h"
+#include "ResponseSampler.h"
+
+using std::cout;
+using std::endl;
+
+const size_t UNIFORM_BUFFER_SIZE = 4096;
+
+ResponseSampler::ResponseSampler(const TH2F &rema, const UInt_t binning):
+	nbins((Int_t) NBINS/((Int_t) binning)),
+	first_bin((size_t) nbins + 1, 1),
+	row_offset((size_t) nbins + 2, 0),
+	row_sum((size_t) nbins + 1, 0.),
+	rema_diagonal((size_t) nbins + 1, 0.),
+	mean((size_t) nbins + 1, 0.),
+	n_events((size_t) nbins + 1, 0.),
+	uniforms(UNIFORM_BUFFER_SIZE, 0.),
+	uniform_position(UNIFORM_BUFFER_SIZE)
+{
+	// Leading cells without entries, for example below the threshold of the detector,
+	// are not stored.
+	for(Int_t i = 1; i <= nbins; ++i){
+		first_bin[(size_t) i] = i + 1;
+		for(Int_t j = 1; j <= i; ++j){
+			if(rema.GetBinContent(i, j) > 0.){
+				first_bin[(size_t) i] = j;
+				break;
+			}
+		}
+		row_offset[(size_t) i + 1] = row_offset[(size_t) i] + (size_t) (i + 1 - first_bin[(size_t) i]);
+	}
+
+	alias_probability.resize(row_offset[(size_t) nbins + 1]);
+	alias.resize(row_offset[(size_t) nbins + 1]);
+
+	vector<Double_t> weight;
+	for(Int_t i = 1; i <= nbins; ++i){
+		weight.clear();
+		for(Int_t j = first_bin[(size_t) i]; j <= i; ++j){
+			if(rema.GetBinContent(i, j) < 0.){
+				cout << __FILE__ << ":" << __LINE__ << ": " << __FUNCTION__ << "(): "<< "Error: Negative entry in bin (" << i << ", " << j << ") of the response matrix. Aborting ..." << endl;
+				abort();
+			}
+			weight.push_back(rema.GetBinContent(i, j));
+			row_sum[(size_t) i] += weight.back();
+		}
+		rema_diagonal[(size_t) i] = rema.GetBinContent(i, i);
+
+		if(row_sum[(size_t) i] > 0.){
+			buildAliasTable(i, weight);
+		}
+	}
+}
+
+void ResponseSampler::addRealisticResponse(TRandom3 &random_generator, const TH1F &spectrum, const TH1F &inverse_n_simulated_particles, TH1F &response_spectrum, TH1F &response_spectrum_FEP){
+
+	vector<Double_t> result((size_t) nbins + 1, 0.);
+
+	// Number of detected events for each bin of the incident spectrum, including the
+	// detection efficiency
+	for(Int_t i = 1; i <= nbins; ++i){
+		mean[(size_t) i] = spectrum.GetBinContent(i)*inverse_n_simulated_particles.GetBinContent(i)*row_sum[(size_t) i];
+	}
+	poissonSampler.sample(random_generator, &mean[1], &n_events[1], (size_t) nbins);
+
+	for(Int_t i = 1; i <= nbins; ++i){
+		distributeEvents(random_generator, i, n_events[(size_t) i], result);
+	}
+	for(Int_t j = 1; j <= nbins; ++j){
+		response_spectrum.SetBinContent(j, result[(size_t) j]);
+		result[(size_t) j] = 0.;
+	}
+
+	// Same for the spectrum normalized to the full-energy peak (FEP)
+	for(Int_t i = 1; i <= nbins; ++i){
+		mean[(size_t) i] = rema_diagonal[(size_t) i] > 0. ? spectrum.GetBinContent(i)/rema_diagonal[(size_t) i]*row_sum[(size_t) i] : 0.;
+	}
+	poissonSampler.sample(random_generator, &mean[1], &n_events[1], (size_t) nbins);
+
+	for(Int_t i = 1; i <= nbins; ++i){
+		distributeEvents(random_generator, i, n_events[(size_t) i], result);
+	}
+	for(Int_t j = 1; j <= nbins; ++j){
+		response_spectrum_FEP.SetBinContent(j, result[(size_t) j]);
+	}
+}
+
+void ResponseSampler::buildAliasTable(const Int_t row, const vector<Double_t> &weight){
+
+	// Vose's variant of the algorithm, which is numerically stable (M. D. Vose, IEEE
+	// Transactions on Software Engineering 17, 972 (1991))
+	const size_t n_cells = weight.size();
+	const size_t offset = row_offset[(size_t) row];
+
+	vector<Double_t> scaled_probability(n_cells);
+	vector<size_t> small;
+	vector<size_t> large;
+
+	for(size_t k = 0; k < n_cells; ++k){
+		scaled_probability[k] = weight[k]/row_sum[(size_t) row]*(Double_t) n_cells;
+		if(scaled_probability[k] < 1.){
+			small.push_back(k);
+		} else{
+			large.push_back(k);
+		}
+	}
+
+	while(!small.empty() && !large.empty()){
+		const size_t s = small.back();
+		const size_t l = large.back();
+		small.pop_back();
+
+		alias_probability[offset + s] = (Float_t) scaled_probability[s];
+		alias[offset + s] = (UInt_t) first_bin[(size_t) row] + (UInt_t) l;
+
+		scaled_probability[l] -= 1. - scaled_probability[s];
+		if(scaled_probability[l] < 1.){
+			large.pop_back();
+			small.push_back(l);
+		}
+	}
+
+	// Remaining cells have a probability of 1 up to rounding errors
+	for(auto k: large){
+		alias_probability[offset + k] = 1.;
+		alias[offset + k] = (UInt_t) first_bin[(size_t) row] + (UInt_t) k;
+	}
+	for(auto k: small){
+		alias_probability[offset + k] = 1.;
+		alias[offset + k] = (UInt_t) first_bin[(size_t) row] + (UInt_t) k;
+	}
+}
+
+void ResponseSampler::distributeEvents(TRandom3 &random_generator, const Int_t row, const Double_t n_events, vector<Double_t> &result){
+
+	const size_t n_cells = row_offset[(size_t) row + 1] - row_offset[(size_t) row];
+	if(n_cells == 0 || n_events <= 0.){
+		return;
+	}
+
+	const Float_t *probability = &alias_probability[row_offset[(size_t) row]];
+	const UInt_t *row_alias = &alias[row_offset[(size_t) row]];
+
+	// A single uniform random number selects both the cell (integer part) and whether
+	// the cell or its alias is taken (fractional part).
+	for(Double_t event = 0.; event < n_events; event += 1.){
+		const Double_t u = nextUniform(random_generator)*(Double_t) n_cells;
+		size_t k = (size_t) u;
+		if(k == n_cells){
+			k = n_cells - 1;
+		}
+
+		if(u - (Double_t) k < (Double_t) probability[k]){
+			result[(size_t) first_bin[(size_t) row] + k] += 1.;
+		} else{
+			result[row_alias[k]] += 1.;
+		}
+	}
+}
+
+Double_t ResponseSampler::nextUniform(TRandom3 &random_generator){
+	if(uniform_position == UNIFORM_BUFFER_SIZE){
+		random_generator.RndmArray((Int_t) UNIFORM_BUFFER_SIZE, &uniforms[0]);
+		uniform_position = 0;
+	}
+
+	return uniforms[uniform_position++];
+}
@@ -0,0 +1,226 @@
+/*
+    This file is part of Horst.
+
+    Horst is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Horst is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Horst.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <iostream>
+
+#include "SobolSequence.h"
+
+using std::cout;
+using std::endl;
+
+// Number of bits of the integer representation of the coordinates. This limits the
+// number of distinct points to 2^SOBOL_BITS.
+const UInt_t SOBOL_BITS = 32;
+
+SobolSequence::SobolSequence(const size_t dimension, TRandom3 &random_generator):
+	DIMENSION(dimension),
+	index(0),
+	direction_numbers(dimension*SOBOL_BITS, 0),
+	shift(dimension, 0),
+	state(dimension, 0)
+{
+	vector<UInt_t> polynomials;
+	if(DIMENSION > 1){
+		findPrimitivePolynomials(DIMENSION - 1, polynomials);
+	}
+
+	vector<UInt_t> m(SOBOL_BITS + 1, 0);
+
+	for(size_t d = 0; d < DIMENSION; ++d){
+		UInt_t *v = &direction_numbers[d*SOBOL_BITS];
+
+		if(d == 0){
+			// First dimension: van der Corput sequence in base 2
+			for(UInt_t k = 1; k <= SOBOL_BITS; ++k){
+				m[k] = 1;
+			}
+		} else{
+			const UInt_t polynomial = polynomials[d - 1];
+			const UInt_t degree = getDegree(polynomial);
+
+			// Random odd initial direction numbers m_k < 2^k ...
+			for(UInt_t k = 1; k <= degree && k <= SOBOL_BITS; ++k){
+				m[k] = 2*random_generator.Integer(1u << (k - 1)) + 1;
+			}
+			// ... and the recurrence relation defined by the polynomial
+			// x^s + a_1 x^(s-1) + ... + a_(s-1) x + 1 for the following ones:
+			// m_k = 2 a_1 m_(k-1) ^ 4 a_2 m_(k-2) ^ ... ^ 2^s m_(k-s) ^ m_(k-s)
+			for(UInt_t k = degree + 1; k <= SOBOL_BITS; ++k){
+				m[k] = m[k - degree] ^ (m[k - degree] << degree);
+				for(UInt_t l = 1; l < degree; ++l){
+					if((polynomial >> (degree - l)) & 1u){
+						m[k] ^= m[k - l] << l;
+					}
+				}
+			}
+		}
+
+		for(UInt_t k = 1; k <= SOBOL_BITS; ++k){
+			v[k - 1] = m[k] << (SOBOL_BITS - k);
+		}
+
+		shift[d] = (random_generator.Integer(1u << 16) << 16) | random_generator.Integer(1u << 16);
+	}
+}
+
+void SobolSequence::next(Double_t *point){
+	if(index >> SOBOL_BITS){
+		cout << __FILE__ << ":" << __LINE__ << ": " << __FUNCTION__ << "(): "<< "Error: Sobol sequence exhausted after " << index << " points. Aborting ..." << endl;
+		abort();
+	}
+
+	// Map the integers to the center of the corresponding intervals, so that the coordinates
+	// are never exactly 0 or 1.
+	const Double_t scale = 1./4294967296.;
+	for(size_t d = 0; d < DIMENSION; ++d){
+		point[d] = ((Double_t) (state[d] ^ shift[d]) + 0.5)*scale;
+	}
+
+	// Point n+1 is obtained from point n by flipping the direction number that belongs to
+	// the lowest zero bit of n.
+	ULong64_t n = index;
+	UInt_t c = 0;
+	while(n & 1){
+		n >>= 1;
+		++c;
+	}
+	if(c < SOBOL_BITS){
+		for(size_t d = 0; d < DIMENSION; ++d){
+			state[d] ^= direction_numbers[d*SOBOL_BITS + c];
+		}
+	}
+	++index;
+}
+
+void SobolSequence::setIndex(const ULong64_t new_index){
+	// In Gray-code order, point n is the XOR of the direction numbers that belong to the
+	// set bits of n ^ (n >> 1).
+	const ULong64_t gray_code = new_index ^ (new_index >> 1);
+
+	if(new_index >> SOBOL_BITS){
+		cout << __FILE__ << ":" << __LINE__ << ": " << __FUNCTION__ << "(): "<< "Error: Sobol sequence has no point with index " << new_index << ". Aborting ..." << endl;
+		abort();
+	}
+
+	for(size_t d = 0; d < DIMENSION; ++d){
+		state[d] = 0;
+		for(UInt_t k = 0; k < SOBOL_BITS; ++k){
+			if((gray_code >> k) & 1){
+				state[d] ^= direction_numbers[d*SOBOL_BITS + k];
+			}
+		}
+	}
+	index = new_index;
+}
+
+void SobolSequence::findPrimitivePolynomials(const size_t n_polynomials, vector<UInt_t> &polynomials) const {
+	// Polynomials over GF(2) are stored as bit patterns, i.e. bit k is the coefficient
+	// of x^k. Only polynomials with a constant term can be primitive.
+	for(UInt_t degree = 1; degree < SOBOL_BITS; ++degree){
+		for(UInt_t polynomial = (1u << degree) | 1u; polynomial < (2u << degree); polynomial += 2){
+			if(isPrimitive(polynomial, degree)){
+				polynomials.push_back(polynomial);
+				if(polynomials.size() == n_polynomials){
+					return;
+				}
+			}
+		}
+	}
+}
+
+Bool_t SobolSequence::isPrimitive(const UInt_t polynomial, const UInt_t degree) const {
+	// A polynomial of degree s is primitive if the order of x modulo the polynomial is
+	// exactly 2^s - 1, i.e. x^(2^s - 1) == 1 and x^((2^s - 1)/q) != 1 for all prime
+	// factors q of 2^s - 1.
+	const ULong64_t order = (1ull << degree) - 1;
+
+	if(powerOfX(order, polynomial, degree) != 1u){
+		return false;
+	}
+
+	ULong64_t remainder = order;
+	for(ULong64_t q = 2; q*q <= remainder; ++q){
+		if(remainder % q == 0){
+			if(powerOfX(order/q, polynomial, degree) == 1u){
+				return false;
+			}
+			while(remainder % q == 0){
+				remainder /= q;
+			}
+		}
+	}
+	if(remainder > 1 && remainder < order){
+		if(powerOfX(order/remainder, polynomial, degree) == 1u){
+			return false;
+		}
+	}
+
+	return true;
+}
+
+UInt_t SobolSequence::powerOfX(const ULong64_t exponent, const UInt_t polynomial, const UInt_t degree) const {
+	// Square-and-multiply in GF(2)[x]/polynomial
+	const ULong64_t modulus = (ULong64_t) polynomial;
+	const ULong64_t top = 1ull << degree;
+
+	ULong64_t result = 1;
+	ULong64_t base = degree == 1 ? 2 ^ modulus : 2; // x mod polynomial
+	ULong64_t product, a, b;
+
+	for(ULong64_t e = exponent; e > 0; e >>= 1){
+		if(e & 1){
+			product = 0;
+			a = result;
+			b = base;
+			while(b){
+				if(b & 1){
+					product ^= a;
+				}
+				b >>= 1;
+				a <<= 1;
+				if(a & top){
+					a ^= modulus;
+				}
+			}
+			result = product;
+		}
+		product = 0;
+		a = base;
+		b = base;
+		while(b){
+			if(b & 1){
+				product ^= a;
+			}
+			b >>= 1;
+			a <<= 1;
+			if(a & top){
+				a ^= modulus;
+			}
+		}
+		base = product;
+	}
+
+	return (UInt_t) result;
+}
+
+UInt_t SobolSequence::getDegree(const UInt_t polynomial) const {
+	UInt_t degree = 0;
+	while(polynomial >> (degree + 1)){
+		++degree;
+	}
+	return degree;
+}
@@ -0,0 +1,54 @@
+/*
+    This file is part of Horst.
+
+    Horst is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Horst is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Horst.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <iostream>
+
+#include "Spectrum.h"
+
+using std::cout;
+using std::endl;
+
+void Spectrum::reset(){
+	std::fill(bin_contents.begin(), bin_contents.end(), 0.);
+}
+
+Double_t Spectrum::getMaximum() const {
+	// Like TH1::GetMaximum(), without the underflow and overflow bins
+	if(nbins == 0){
+		return 0.;
+	}
+	return *std::max_element(bin_contents.begin() + 1, bin_contents.begin() + 1 + nbins);
+}
+
+void Spectrum::fromHistogram(const TH1 &histogram){
+	nbins = histogram.GetNbinsX();
+	bin_contents.resize((size_t) nbins + 2);
+	for(Int_t i = 0; i <= nbins + 1; ++i){
+		bin_contents[(size_t) i] = histogram.GetBinContent(i);
+	}
+}
+
+void Spectrum::toHistogram(TH1 &histogram) const {
+	if(histogram.GetNbinsX() != nbins){
+		cout << __FILE__ << ":" << __LINE__ << ": " << __FUNCTION__ << "(): "<< "Error: Histogram " << histogram.GetName() << " has " << histogram.GetNbinsX() << " instead of " << nbins << " bins. Aborting ..." << endl;
+		abort();
+	}
+	for(Int_t i = 0; i <= nbins + 1; ++i){
+		histogram.SetBinContent(i, bin_contents[(size_t) i]);
+	}
+}
@@ -0,0 +1,211 @@
+/*
+    This file is part of Horst.
+
+    Horst is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Horst is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Horst.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+#include "Config.h"
+#include "SplineBasis.h"
+
+using std::cout;
+using std::endl;
+using std::max;
+
+SplineBasis::SplineBasis(const UInt_t binning, const Double_t knot_spacing, const vector<Double_t> &peak_energies, const Int_t binstart, const Int_t binstop):
+	BINNING(binning),
+	bin_start(binstart),
+	bin_stop(binstop),
+	n_bins((Int_t) NBINS/(Int_t) binning)
+{
+	const Double_t spacing = knot_spacing/(Double_t) BINNING;
+	if(spacing < 1.){
+		cout << __FILE__ << ":" << __LINE__ << ": " << __FUNCTION__ << "(): "<< "Error: The knot spacing " << knot_spacing << " is smaller than the binning factor " << BINNING << ". Aborting ..." << endl;
+		abort();
+	}
+	if(bin_stop <= bin_start){
+		cout << __FILE__ << ":" << __LINE__ << ": " << __FUNCTION__ << "(): "<< "Error: The fit range is empty. Aborting ..." << endl;
+		abort();
+	}
+
+	// The support of B-spline k is [t_k, t_k + 4*spacing) with t_k = binstart + (k - 3)*spacing.
+	// The first three and the last functions only partly overlap the fit range, so that
+	// the functions sum to 1 everywhere in the fit range.
+	for(Int_t k = 0; binstart + (Double_t) (k - 3)*spacing < (Double_t) binstop; ++k){
+		const Double_t knot = binstart + (Double_t) (k - 3)*spacing;
+		const Int_t first_bin = max(binstart, (Int_t) ceil(knot));
+		const Int_t last_bin = std::min(binstop - 1, (Int_t) ceil(knot + 4.*spacing) - 1);
+
+		Function function;
+		function.first_bin = first_bin;
+		function.is_peak = false;
+		for(Int_t i = first_bin; i <= last_bin; ++i){
+			function.weights.push_back(cubicBSpline(((Double_t) i - knot)/spacing));
+		}
+		if(!function.weights.empty()){
+			functions.push_back(function);
+		}
+	}
+
+	vector<Int_t> peak_bins;
+	for(auto energy: peak_energies){
+		const Int_t bin = (Int_t) energy/(Int_t) BINNING;
+		if(bin < binstart || bin >= binstop){
+			cout << "Warning: The peak at " << energy << " is outside of the fit range and is ignored." << endl;
+			continue;
+		}
+		if(std::find(peak_bins.begin(), peak_bins.end(), bin) != peak_bins.end()){
+			continue;
+		}
+		peak_bins.push_back(bin);
+		functions.push_back({bin, {1.}, true});
+	}
+
+	bin_functions.resize((size_t) (binstop - binstart));
+	for(size_t k = 0; k < functions.size(); ++k){
+		for(size_t m = 0; m < functions[k].weights.size(); ++m){
+			bin_functions[(size_t) (functions[k].first_bin - binstart) + m].push_back({k, functions[k].weights[m]});
+		}
+	}
+}
+
+Double_t SplineBasis::cubicBSpline(const Double_t u) const {
+	// Uniform cubic B-spline with the knots 0, 1, 2, 3, 4
+	if(u < 0. || u >= 4.){
+		return 0.;
+	}
+	if(u < 1.){
+		return u*u*u/6.;
+	}
+	if(u < 2.){
+		return (((-3.*u + 12.)*u - 12.)*u + 4.)/6.;
+	}
+	if(u < 3.){
+		return (((3.*u - 24.)*u + 60.)*u - 44.)/6.;
+	}
+	return (4. - u)*(4. - u)*(4. - u)/6.;
+}
+
+void SplineBasis::getDesignMatrix(const Float_t *rema_array, const size_t row_length, vector<Double_t> &design) const {
+
+	// Row j of the array, i.e. the contributions of all energies to the bin j, is
+	// contiguous, and so is the support of each basis function in it.
+	const size_t n_functions = functions.size();
+
+	design.assign(n_functions*((size_t) n_bins + 1), 0.);
+	for(Int_t j = 0; j <= n_bins; ++j){
+		const Float_t *rema_j = &rema_array[row_length*(size_t) j];
+		Double_t *design_j = &design[n_functions*(size_t) j];
+		for(size_t k = 0; k < n_functions; ++k){
+			const Float_t *rema_jk = &rema_j[functions[k].first_bin];
+			const vector<Double_t> &weights = functions[k].weights;
+			Double_t sum = 0.;
+			for(size_t m = 0; m < weights.size(); ++m){
+				sum += weights[m]*rema_jk[m];
+			}
+			design_j[k] = sum;
+		}
+	}
+}
+
+void SplineBasis::expand(const Double_t *coefficients, TH1F &params) const {
+
+	for(Int_t i = 0; i <= params.GetNbinsX() + 1; ++i){
+		params.SetBinContent(i, 0.);
+	}
+	for(Int_t i = bin_start; i < bin_stop; ++i){
+		Double_t sum = 0.;
+		for(auto const &function: bin_functions[(size_t) (i - bin_start)]){
+			sum += function.second*coefficients[function.first];
+		}
+		params.SetBinContent(i, sum);
+	}
+}
+
+void SplineBasis::expandCovariance(const TMatrixDSym &coefficient_covariance, TH1F &params_uncertainty, TMatrixDSym *params_correlation) const {
+
+	// Cov(params(i), params(j)) = sum_{k, l} B(i, k)*B(j, l)*Cov(c(k), c(l)), where only a
+	// few functions are nonzero in each bin
+	auto covariance = [&](const Int_t i, const Int_t j){
+		Double_t sum = 0.;
+		for(auto const &function_i: bin_functions[(size_t) (i - bin_start)]){
+			for(auto const &function_j: bin_functions[(size_t) (j - bin_start)]){
+				sum += function_i.second*function_j.second*coefficient_covariance((Int_t) function_i.first, (Int_t) function_j.first);
+			}
+		}
+		return sum;
+	};
+
+	vector<Double_t> variance((size_t) n_bins + 1, 0.);
+	for(Int_t i = 0; i <= params_uncertainty.GetNbinsX() + 1; ++i){
+		params_uncertainty.SetBinContent(i, 0.);
+	}
+	for(Int_t i = bin_start; i < bin_stop; ++i){
+		variance[(size_t) i] = covariance(i, i);
+		params_uncertainty.SetBinContent(i, sqrt(max(variance[(size_t) i], 0.)));
+	}
+
+	if(params_correlation != nullptr){
+		// Same indices as the correlation matrix of the fit with one parameter per bin
+		params_correlation->ResizeTo(n_bins, n_bins);
+		*params_correlation = 0.;
+		for(Int_t i = bin_start; i < bin_stop; ++i){
+			for(Int_t j = bin_start; j <= i; ++j){
+				if(variance[(size_t) i] <= 0. || variance[(size_t) j] <= 0.){
+					continue;
+				}
+				const Double_t correlation = covariance(i, j)/sqrt(variance[(size_t) i]*variance[(size_t) j]);
+				(*params_correlation)(i, j) = correlation;
+				(*params_correlation)(j, i) = correlation;
+			}
+		}
+	}
+}
+
+void SplineBasis::project(const TH1F &params, vector<Double_t> &coefficients) const {
+
+	// Each B-spline coefficient is the weighted mean of the parameters in its support, which
+	// reproduces constant and linear parameters. The delta functions receive what the
+	// B-splines miss at the peak.
+	coefficients.assign(functions.size(), 0.);
+	for(size_t k = 0; k < functions.size(); ++k){
+		if(functions[k].is_peak){
+			continue;
+		}
+		Double_t sum = 0.;
+		Double_t weight_sum = 0.;
+		for(size_t m = 0; m < functions[k].weights.size(); ++m){
+			sum += functions[k].weights[m]*max(params.GetBinContent(functions[k].first_bin + (Int_t) m), 0.);
+			weight_sum += functions[k].weights[m];
+		}
+		coefficients[k] = weight_sum > 0. ? sum/weight_sum : 0.;
+	}
+
+	for(size_t k = 0; k < functions.size(); ++k){
+		if(!functions[k].is_peak){
+			continue;
+		}
+		const Int_t bin = functions[k].first_bin;
+		Double_t smooth = 0.;
+		for(auto const &function: bin_functions[(size_t) (bin - bin_start)]){
+			if(!functions[function.first].is_peak){
+				smooth += function.second*coefficients[function.first];
+			}
+		}
+		coefficients[k] = max(params.GetBinContent(bin) - smooth, 0.);
+	}
+}
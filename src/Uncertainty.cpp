@@ -16,32 +16,116 @@
 */
 
 #include "Config.h"
-#include "FitFunction.h"
+#include "Spectrum.h"
 #include "Uncertainty.h"
 
 void Uncertainty::getUncertainty(const TH1F &params, const TH2F &rema, TH1F &simulation_statistical_uncertainty, const Int_t binstart, const Int_t binstop){
-	FitFunction fitFunction("rema_stat", rema, BINNING, binstart, binstop);
+	getStatisticalUncertainty(params, nullptr, rema, simulation_statistical_uncertainty, nullptr, binstart, binstop);
+}
 
-	for(Int_t i = 1; i <= (Int_t) NBINS/ (Int_t) BINNING; ++i){
-		if(i < binstart || i > binstop){
-			simulation_statistical_uncertainty.SetBinContent(i, 0.);
-		} else{
-			simulation_statistical_uncertainty.SetBinContent(i, fitFunction.getSimulationStatisticalUncertainty(i, params));
+void Uncertainty::getUncertainty(const TH1F &params, const TH1F &spectrum, const TH2F &rema, TH1F &simulation_statistical_uncertainty, TH1F &spectrum_statistical_uncertainty, const Int_t binstart, const Int_t binstop){
+	getStatisticalUncertainty(params, &spectrum, rema, simulation_statistical_uncertainty, &spectrum_statistical_uncertainty, binstart, binstop);
+}
+
+void Uncertainty::getStatisticalUncertainty(const TH1F &params, const TH1F *spectrum, const TH2F &rema, TH1F &simulation_statistical_uncertainty, TH1F *spectrum_statistical_uncertainty, const Int_t binstart, const Int_t binstop){
+	// The uncertainties of bin j are sums over the matrix elements rema(i, j) with
+	// j <= i <= binstop:
+	//	simulation: sum_{i > j} params(i)*rema(i, j)
+	//	spectrum:   sum_{i >= j} params(i)^2/spectrum(i)*rema(i, j)^2
+	// The weights of the rows i are calculated once. For a fixed j, the matrix elements are
+	// contiguous in the internal array of the TH2F (index i + (nx + 2)*j), so both sums
+	// are obtained in a single pass over the matrix, without a copy of it.
+	// The terms are added in the same order as in the original implementation, from
+	// i = binstop down to i = j, so that the results do not change.
+	const Float_t *rema_array = rema.GetArray();
+	const size_t row_length = (size_t) rema.GetNbinsX() + 2;
+
+	vector<Double_t> simulation_weight((size_t) binstop + 1, 0.);
+	vector<Double_t> spectrum_weight((size_t) binstop + 1, 0.);
+	Double_t spectrum_bin_content = 0.;
+
+	for(Int_t i = binstart; i <= binstop; ++i){
+		simulation_weight[(size_t) i] = params.GetBinContent(i);
+		if(spectrum != nullptr){
+			spectrum_bin_content = spectrum->GetBinContent(i);
+			if(spectrum_bin_content > 0.){	// Ignore bins with negative values (should not be in the original spectrum anyway) or zero content.
+				spectrum_weight[(size_t) i] = params.GetBinContent(i)*params.GetBinContent(i)*1./spectrum_bin_content;
+			}
+		}
+	}
+
+	Double_t simulation_sum = 0.;
+	Double_t spectrum_sum = 0.;
+
+	for(Int_t j = 1; j <= (Int_t) NBINS/ (Int_t) BINNING; ++j){
+		if(j < binstart || j > binstop){
+			simulation_statistical_uncertainty.SetBinContent(j, 0.);
+			if(spectrum_statistical_uncertainty != nullptr){
+				spectrum_statistical_uncertainty->SetBinContent(j, 0.);
+			}
+			continue;
+		}
+
+		const Float_t *rema_j = &rema_array[row_length*(size_t) j];
+		simulation_sum = 0.;
+		spectrum_sum = 0.;
+		for(size_t i = (size_t) binstop; i > (size_t) j; --i){
+			simulation_sum += simulation_weight[i]*rema_j[i];
+			spectrum_sum += spectrum_weight[i]*rema_j[i]*rema_j[i];
+		}
+		spectrum_sum += spectrum_weight[(size_t) j]*rema_j[j]*rema_j[j];
+
+		simulation_statistical_uncertainty.SetBinContent(j, sqrt(simulation_sum));
+		if(spectrum_statistical_uncertainty != nullptr){
+			spectrum_statistical_uncertainty->SetBinContent(j, sqrt(spectrum_sum));
 		}
 	}
 }
 
-void Uncertainty::getUncertainty(const TH1F &params, const TH1F &spectrum, const TH2F &rema, TH1F &simulation_statistical_uncertainty, TH1F &spectrum_statistical_uncertainty, const Int_t binstart, const Int_t binstop){
-	FitFunction fitFunction("rema_unc", rema, BINNING, binstart, binstop);
+void Uncertainty::getTopDownVariance(const TH1F &spectrum, const TH2F &rema, TH1F &topdown_variance, const Int_t binstart, const Int_t binstop){
+	// The top-down algorithm solves the triangular system
+	//	spectrum(j) = sum_{i = j}^{binstop} params(i)*rema(i, j),	binstart <= j <= binstop,
+	// so the parameters are a linear function params = T*spectrum, where only the elements
+	// T(i, k) with k >= i are nonzero. Since T is the inverse of the system matrix, row i of
+	// T solves
+	//	sum_{m = i}^{k} T(i, m)*rema(k, m) = delta_ik,	k >= i.
+	// For independent Poisson-distributed bins, Var(params(i)) = sum_k T(i, k)^2 * spectrum(k).
+	// The rows are calculated one after another and never stored, so the memory is O(n) for
+	// n bins in the fit range, while the time is O(n^3). After T(i, m) is known, it is
+	// subtracted from the remaining equations k > m, whose elements rema(k, m) are contiguous
+	// like in getStatisticalUncertainty().
+	const Float_t *rema_array = rema.GetArray();
+	const size_t row_length = (size_t) rema.GetNbinsX() + 2;
+	const Spectrum spectrum_values(spectrum);
+	const size_t n = (size_t) (binstop - binstart + 1);
+	// Right-hand side of the equations for row i of T, minus the terms that are already known
+	vector<Double_t> remainder(n, 0.);
+	Double_t t_m = 0.;
+	Double_t variance = 0.;
 
-	for(Int_t i = 1; i <= (Int_t) NBINS/ (Int_t) BINNING; ++i){
-		if(i < binstart || i > binstop){
-			simulation_statistical_uncertainty.SetBinContent(i, 0.);
-			spectrum_statistical_uncertainty.SetBinContent(i, 0.);
-		} else{
-			simulation_statistical_uncertainty.SetBinContent(i, fitFunction.getSimulationStatisticalUncertainty(i, params));
-			spectrum_statistical_uncertainty.SetBinContent(i, fitFunction.getSpectrumStatisticalUncertainty(i, params, spectrum));
+	for(Int_t i = 0; i <= (Int_t) NBINS/ (Int_t) BINNING; ++i){
+		topdown_variance.SetBinContent(i, 0.);
+	}
+
+	for(size_t i = 0; i < n; ++i){
+		remainder[i] = 1.;
+		for(size_t k = i + 1; k < n; ++k){
+			remainder[k] = 0.;
+		}
+
+		variance = 0.;
+		for(size_t m = i; m < n; ++m){
+			const Float_t *rema_m = &rema_array[row_length*((size_t) binstart + m) + (size_t) binstart];
+			t_m = remainder[m]/rema_m[m];
+			if(t_m == 0.){
+				continue;
+			}
+			variance += t_m*t_m*spectrum_values[binstart + (Int_t) m];
+			for(size_t k = m + 1; k < n; ++k){
+				remainder[k] -= t_m*rema_m[k];
+			}
 		}
+		topdown_variance.SetBinContent(binstart + (Int_t) i, variance);
 	}
 }
 
@@ -0,0 +1,298 @@
+/*
+    This file is part of Horst.
+
+    Horst is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Horst is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Horst.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <TDirectory.h>
+#include <TFile.h>
+#include <TMatrixDSym.h>
+
+#include <algorithm>
+#include <iostream>
+
+#include "MonteCarloAccumulator.h"
+#include "MonteCarloResult.h"
+#include "MonteCarloUncertainty.h"
+#include "Reconstructor.h"
+#include "ResponseMatrix.h"
+#include "Uncertainty.h"
+#include "Unfolder.h"
+
+using std::cout;
+using std::endl;
+
+Unfolder::Unfolder(const TH2F &rema, const TH1F &n_simulated, const UInt_t binning):
+	Unfolder(rema, n_simulated, binning, vector<Double_t>())
+{}
+
+Unfolder::Unfolder(const TH2F &rema, const TH1F &n_simulated, const UInt_t binning, const vector<Double_t> &resolution_params):
+	BINNING(binning),
+	nbins((Int_t) NBINS/(Int_t) binning),
+	max_bin((Double_t) (NBINS - 1)),
+	fold_resolution(!resolution_params.empty()),
+	resolution(binning),
+	fitter_binstart(-1),
+	fitter_binstop(-1),
+	has_previous(false)
+{
+	// Histograms created in this scope are not attached to any directory
+	TDirectory::TContext context(nullptr);
+
+	if(rema.GetNbinsX() != (Int_t) NBINS || rema.GetNbinsY() != (Int_t) NBINS || n_simulated.GetNbinsX() != (Int_t) NBINS){
+		cout << __FILE__ << ":" << __LINE__ << ": " << __FUNCTION__ << "(): "<< "Error: The response matrix and the number of simulated particles must have " << NBINS << " bins. Aborting ..." << endl;
+		abort();
+	}
+
+	// Sum the cells of the original matrix in blocks of BINNING x BINNING, like TH2::Rebin2D(),
+	// but without a copy of the original matrix.
+	response_matrix = TH2F("rema", "Response_Matrix", nbins, 0., max_bin, nbins, 0., max_bin);
+	const Float_t *rema_array = rema.GetArray();
+	Float_t *rebinned_array = response_matrix.GetArray();
+	const size_t row_length = (size_t) NBINS + 2;
+	const size_t rebinned_row_length = (size_t) nbins + 2;
+
+	vector<Double_t> row((size_t) nbins + 1);
+	for(Int_t j = 1; j <= nbins; ++j){
+		std::fill(row.begin(), row.end(), 0.);
+		for(Int_t original_j = (j - 1)*(Int_t) BINNING + 1; original_j <= j*(Int_t) BINNING; ++original_j){
+			const Float_t *rema_row = &rema_array[row_length*(size_t) original_j];
+			for(Int_t i = 1; i <= nbins; ++i){
+				for(Int_t original_i = (i - 1)*(Int_t) BINNING + 1; original_i <= i*(Int_t) BINNING; ++original_i){
+					row[(size_t) i] += rema_row[original_i];
+				}
+			}
+		}
+		for(Int_t i = 1; i <= nbins; ++i){
+			rebinned_array[rebinned_row_length*(size_t) j + (size_t) i] = (Float_t) row[(size_t) i];
+		}
+	}
+
+	n_simulated_particles = TH1F("n_simulated_particles", "Number of simulated particles per bin", nbins, 0., max_bin);
+	response_matrix_diagonal = TH1F("response_matrix_diagonal", "Diagonal of the Response Matrix", nbins, 0., max_bin);
+	for(Int_t i = 1; i <= nbins; ++i){
+		Double_t sum = 0.;
+		for(Int_t original_i = (i - 1)*(Int_t) BINNING + 1; original_i <= i*(Int_t) BINNING; ++original_i){
+			sum += n_simulated.GetBinContent(original_i);
+		}
+		n_simulated_particles.SetBinContent(i, sum);
+		response_matrix_diagonal.SetBinContent(i, response_matrix.GetBinContent(i, i));
+	}
+
+	// As in horst, the fits use the matrix with the resolution folded in, while the FEP,
+	// the efficiency and the uncertainty of the simulations refer to the original matrix.
+	if(fold_resolution){
+		resolution.setParameters(resolution_params);
+		folded_response_matrix = TH2F("rema_folded", "Response Matrix with Detector Resolution", nbins, 0., max_bin, nbins, 0., max_bin);
+		resolution.foldMatrix(response_matrix, folded_response_matrix);
+	}
+
+	previous_spectrum = TH1F("previous_spectrum", "Previous Spectrum", nbins, 0., max_bin);
+	previous_topdown_params = TH1F("previous_topdown_params", "Previous TopDown Parameters", nbins, 0., max_bin);
+	previous_fit_params = TH1F("previous_fit_params", "Previous Fit Parameters", nbins, 0., max_bin);
+}
+
+void Unfolder::unfold(const vector<Double_t> &spectrum_values, const UnfoldingOptions &options, UnfoldingResult &result){
+	run(spectrum_values, options, result, false);
+}
+
+void Unfolder::update(const vector<Double_t> &spectrum_values, const UnfoldingOptions &options, UnfoldingResult &result){
+	run(spectrum_values, options, result, true);
+}
+
+void Unfolder::run(const vector<Double_t> &spectrum_values, const UnfoldingOptions &options, UnfoldingResult &result, const Bool_t incremental){
+
+	TDirectory::TContext context(nullptr);
+
+	if(spectrum_values.size() != (size_t) NBINS){
+		cout << __FILE__ << ":" << __LINE__ << ": " << __FUNCTION__ << "(): "<< "Error: The spectrum has " << spectrum_values.size() << " bins instead of " << NBINS << ". Aborting ..." << endl;
+		abort();
+	}
+
+	const Int_t binstart = (Int_t) options.left / (Int_t) BINNING;
+	const Int_t binstop = (Int_t) options.right / (Int_t) BINNING;
+
+	const TH2F &fit_matrix = fold_resolution ? folded_response_matrix : response_matrix;
+
+	// The fit function depends on the fit range
+	if(!fitter || binstart != fitter_binstart || binstop != fitter_binstop){
+		fitter.reset(new Fitter(fit_matrix, BINNING, binstart, binstop));
+		fitter_binstart = binstart;
+		fitter_binstop = binstop;
+		has_previous = false;
+	}
+
+	Reconstructor reconstructor(BINNING);
+	Uncertainty uncertainty(BINNING);
+
+	TH1F spectrum("spectrum", "Input Spectrum", nbins, 0., max_bin);
+	for(Int_t i = 1; i <= nbins; ++i){
+		Double_t sum = 0.;
+		for(size_t original_i = (size_t) (i - 1)*BINNING; original_i < (size_t) i*BINNING; ++original_i){
+			sum += spectrum_values[original_i];
+		}
+		spectrum.SetBinContent(i, sum);
+	}
+
+	TH1F topdown_params("topdown_params", "TopDown Parameters", nbins, 0., max_bin);
+	TH1F fit_params("fit_params", "Fit Parameters", nbins, 0., max_bin);
+	TH1F fit_result("fit_result", "Fit Result", nbins, 0., max_bin);
+	TH1F fit_FEP("fit_FEP", "Fit FEP", nbins, 0., max_bin);
+	TH1F fit_algorithm_uncertainty("fit_algorithm_uncertainty", "Fit Algorithm Uncertainty", nbins, 0., max_bin);
+	TH1F fit_algorithm_FEP_uncertainty("fit_algorithm_FEP_uncertainty", "Fit Algorithm FEP Uncertainty", nbins, 0., max_bin);
+	TH1F fit_simulation_uncertainty("fit_simulation_uncertainty", "Fit Simulation Uncertainty", nbins, 0., max_bin);
+	TH1F fit_spectrum_uncertainty("fit_spectrum_uncertainty", "Spectrum Uncertainty", nbins, 0., max_bin);
+	TH1F fit_total_uncertainty("fit_total_uncertainty", "Total Uncertainty", nbins, 0., max_bin);
+	TH1F spectrum_reconstructed("spectrum_reconstructed", "Reconstructed Spectrum", nbins, 0., max_bin);
+	TH1F reconstruction_uncertainty("reconstruction_uncertainty", "Reconstruction Uncertainty", nbins, 0., max_bin);
+	TH1F reconstruction_uncertainty_low("reconstruction_uncertainty_low", "Reconstruction Uncertainty lower Limit", nbins, 0., max_bin);
+	TH1F reconstruction_uncertainty_up("reconstruction_uncertainty_up", "Reconstruction Uncertainty upper Limit", nbins, 0., max_bin);
+	TMatrixDSym correlation_matrix;
+
+	/************ Top-down start parameters and fit *************/
+
+	TH1F start_params("start_params", "Start Parameters", nbins, 0., max_bin);
+
+	if(incremental && has_previous){
+		TH1F spectrum_change("spectrum_change", "Spectrum Change", nbins, 0., max_bin);
+		TH1F topdown_change("topdown_change", "TopDown Parameters of Spectrum Change", nbins, 0., max_bin);
+		for(Int_t i = 1; i <= nbins; ++i){
+			spectrum_change.SetBinContent(i, spectrum.GetBinContent(i) - previous_spectrum.GetBinContent(i));
+		}
+
+		fitter->topdown(spectrum_change, fit_matrix, topdown_change, binstart, binstop);
+
+		for(Int_t i = 1; i <= nbins; ++i){
+			topdown_params.SetBinContent(i, previous_topdown_params.GetBinContent(i) + topdown_change.GetBinContent(i));
+			start_params.SetBinContent(i, previous_fit_params.GetBinContent(i) + topdown_change.GetBinContent(i));
+		}
+	} else{
+		fitter->topdown(spectrum, fit_matrix, topdown_params, binstart, binstop);
+		for(Int_t i = 1; i <= nbins; ++i){
+			start_params.SetBinContent(i, topdown_params.GetBinContent(i));
+		}
+	}
+	toVector(topdown_params, result.topdown_params);
+	fitter->remove_negative(start_params);
+
+	fitter->fit(spectrum, fit_matrix, start_params, fit_params, fit_algorithm_uncertainty, binstart, binstop, false, false, correlation_matrix);
+
+	for(Int_t i = 1; i <= nbins; ++i){
+		previous_spectrum.SetBinContent(i, spectrum.GetBinContent(i));
+		previous_topdown_params.SetBinContent(i, topdown_params.GetBinContent(i));
+		previous_fit_params.SetBinContent(i, fit_params.GetBinContent(i));
+	}
+	has_previous = true;
+
+	fitter->fittedFEP(fit_params, response_matrix, fit_FEP);
+	fitter->fittedSpectrum(fit_params, fit_matrix, fit_result);
+
+	reconstructor.reconstruct(fit_params, n_simulated_particles, spectrum_reconstructed);
+
+	/************ Uncertainties *************/
+
+	vector<TH1F*> uncertainties;
+	MonteCarloResult monteCarloResult(BINNING);
+	result.mc_iterations = 0;
+
+	if(options.uncertainty_mc > 0){
+		MonteCarloUncertainty monteCarloUncertainty(BINNING, options.seed);
+		MonteCarloAccumulator mc_fit_params_accumulator(BINNING, binstart, binstop);
+
+		TH1F mc_spectrum("mc_spectrum", "MC Spectrum", nbins, 0., max_bin);
+		TH1F mc_fit_params("mc_fit_params", "MC Fit Parameters", nbins, 0., max_bin);
+		ResponseMatrix mc_response_matrix;
+		ResponseMatrix mc_matrix;
+		ResponseMatrix mc_folded_matrix;
+		if(!options.use_mc_fast){
+			mc_response_matrix.fromHistogram(response_matrix);
+			mc_matrix = ResponseMatrix(nbins);
+			if(fold_resolution){
+				mc_folded_matrix = ResponseMatrix(nbins);
+			}
+		}
+
+		for(UInt_t i = 0; i < options.uncertainty_mc; ++i){
+			monteCarloUncertainty.setIteration(i);
+			monteCarloUncertainty.apply_fluctuations(mc_spectrum, spectrum, binstart, binstop);
+
+			if(options.use_mc_fast){
+				fitter->fit(mc_spectrum, fit_matrix, fit_params, mc_fit_params, binstart, binstop);
+			} else{
+				monteCarloUncertainty.apply_fluctuations(mc_matrix, mc_response_matrix, binstart, binstop);
+				if(fold_resolution){
+					resolution.foldMatrix(mc_matrix, mc_folded_matrix);
+					fitter->fit(mc_spectrum, mc_folded_matrix, fit_params, mc_fit_params, binstart, binstop);
+				} else{
+					fitter->fit(mc_spectrum, mc_matrix, fit_params, mc_fit_params, binstart, binstop);
+				}
+			}
+			mc_fit_params_accumulator.add(mc_fit_params);
+		}
+
+		monteCarloResult.evaluate(mc_fit_params_accumulator, fit_algorithm_uncertainty, response_matrix_diagonal, n_simulated_particles, mc_fit_params_accumulator.getMaximumRelativeStandardError(), "plain");
+		result.mc_iterations = mc_fit_params_accumulator.getNSamples();
+
+		uncertainties.push_back(&fit_algorithm_uncertainty);
+		uncertainties.push_back(monteCarloResult.getFitParamsUncertainty());
+	}
+
+	uncertainty.getUncertainty(fit_params, spectrum, response_matrix, fit_simulation_uncertainty, fit_spectrum_uncertainty, binstart, binstop);
+	fitter->fittedFEP(fit_algorithm_uncertainty, response_matrix, fit_algorithm_FEP_uncertainty);
+	uncertainties.push_back(&fit_algorithm_FEP_uncertainty);
+	uncertainties.push_back(&fit_simulation_uncertainty);
+	uncertainties.push_back(&fit_spectrum_uncertainty);
+	uncertainty.getTotalUncertainty(uncertainties, fit_total_uncertainty);
+
+	reconstructor.uncertainty(fit_total_uncertainty, response_matrix, n_simulated_particles, reconstruction_uncertainty);
+
+	uncertainty.getLowerAndUpperLimit(spectrum_reconstructed, reconstruction_uncertainty, reconstruction_uncertainty_low, reconstruction_uncertainty_up, true);
+
+	toVector(spectrum, result.spectrum);
+	toVector(fit_params, result.fit_params);
+	toVector(fit_result, result.fit_result);
+	toVector(fit_FEP, result.fit_FEP);
+	toVector(fit_total_uncertainty, result.fit_total_uncertainty);
+	toVector(spectrum_reconstructed, result.spectrum_reconstructed);
+	toVector(reconstruction_uncertainty, result.reconstruction_uncertainty);
+	toVector(reconstruction_uncertainty_low, result.reconstruction_uncertainty_low);
+	toVector(reconstruction_uncertainty_up, result.reconstruction_uncertainty_up);
+}
+
+void Unfolder::toVector(const TH1F &histogram, vector<Double_t> &values) const {
+	values.resize((size_t) nbins);
+	for(Int_t i = 1; i <= nbins; ++i){
+		values[(size_t) (i - 1)] = histogram.GetBinContent(i);
+	}
+}
+
+Bool_t Unfolder::writeResult(const UnfoldingResult &result, const TString outputfilename) const {
+
+	TDirectory::TContext context(nullptr);
+	TFile outputfile(outputfilename, "RECREATE");
+	if(outputfile.IsZombie()){
+		return false;
+	}
+
+	for(auto const &histogram: result.getHistograms()){
+		TH1F hist(histogram.first, histogram.first, nbins, 0., max_bin);
+		for(Int_t i = 1; i <= nbins; ++i){
+			hist.SetBinContent(i, (*histogram.second)[(size_t) (i - 1)]);
+		}
+		outputfile.WriteTObject(&hist);
+	}
+
+	outputfile.Close();
+	return true;
+}
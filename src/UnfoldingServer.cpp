@@ -0,0 +1,425 @@
+/*
+    This file is part of Horst.
+
+    Horst is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Horst is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Horst.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <Math/MinimizerOptions.h>
+#include <TDirectory.h>
+#include <TH1.h>
+#include <TH2.h>
+
+#include <errno.h>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "Config.h"
+#include "InputFileReader.h"
+#include "UnfoldingServer.h"
+
+using std::cout;
+using std::endl;
+using std::make_shared;
+using std::stringstream;
+using std::thread;
+
+// Read a line from a socket. Characters after the line are kept in 'pending' for the next call.
+static Bool_t readLine(const int connection, string &pending, string &line){
+	char buffer[4096];
+	size_t end_of_line;
+	while((end_of_line = pending.find('\n')) == string::npos){
+		const ssize_t n_read = read(connection, buffer, sizeof(buffer));
+		if(n_read < 0 && errno == EINTR){
+			continue;
+		}
+		if(n_read <= 0){
+			return false;
+		}
+		pending.append(buffer, (size_t) n_read);
+	}
+	line = pending.substr(0, end_of_line);
+	pending.erase(0, end_of_line + 1);
+	return true;
+}
+
+// Write to a socket without SIGPIPE, which would stop the server if the client has already
+// closed the connection
+static void writeAll(const int connection, const string &text){
+	size_t n_written = 0;
+	while(n_written < text.size()){
+		const ssize_t n = send(connection, text.data() + n_written, text.size() - n_written, MSG_NOSIGNAL);
+		if(n < 0 && errno == EINTR){
+			continue;
+		}
+		if(n <= 0){
+			return;
+		}
+		n_written += (size_t) n;
+	}
+}
+
+// Modification time and size of a file, so that a file which is rewritten in place is
+// loaded again. Like fileState() in horst.cpp.
+static string fileState(const TString filename){
+	struct stat file_stat;
+	if(stat(filename, &file_stat) != 0){
+		return "missing";
+	}
+	return std::to_string(file_stat.st_mtim.tv_sec) + "." + std::to_string(file_stat.st_mtim.tv_nsec) + " " + std::to_string(file_stat.st_size);
+}
+
+UnfoldingServer::UnfoldingServer(const TString path, const UInt_t workers, const UInt_t size):
+	socket_path(path),
+	n_workers(workers > 0 ? workers : 1),
+	cache_size(size > 0 ? size : 1),
+	server_socket(-1),
+	stopping(false)
+{}
+
+void UnfoldingServer::run(){
+
+	ROOT::EnableThreadSafety();
+	// TMinuit, the default minimizer of ROOT, uses a global instance. The results of Minuit2
+	// differ from those of TMinuit within the tolerance of the fit, see the '--workers' option.
+	if(n_workers > 1){
+		ROOT::Math::MinimizerOptions::SetDefaultMinimizer("Minuit2");
+	}
+
+	struct sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if((size_t) socket_path.Length() >= sizeof(address.sun_path)){
+		cout << __FILE__ << ":" << __LINE__ << ": " << __FUNCTION__ << "(): "<< "Error: Socket path " << socket_path << " is too long. Aborting ..." << endl;
+		abort();
+	}
+	strncpy(address.sun_path, socket_path.Data(), sizeof(address.sun_path) - 1);
+
+	// Remove the socket of a previous server
+	unlink(socket_path.Data());
+
+	server_socket = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(server_socket < 0 || bind(server_socket, (struct sockaddr*) &address, sizeof(address)) < 0 || listen(server_socket, SOMAXCONN) < 0){
+		cout << __FILE__ << ":" << __LINE__ << ": " << __FUNCTION__ << "(): "<< "Error: Socket " << socket_path << " could not be opened (" << strerror(errno) << "). Aborting ..." << endl;
+		abort();
+	}
+
+	cout << "> Waiting for jobs on socket " << socket_path << " (" << n_workers << " workers, up to " << cache_size << " matrices in memory) ..." << endl;
+
+	vector<thread> workers;
+	for(UInt_t i = 0; i < n_workers; ++i){
+		workers.push_back(thread(&UnfoldingServer::work, this));
+	}
+
+	while(true){
+		const int connection = accept(server_socket, nullptr, nullptr);
+		if(connection < 0){
+			if(errno == EINTR){
+				continue;
+			}
+			std::lock_guard<std::mutex> lock(queue_mutex);
+			if(!stopping){
+				cout << __FILE__ << ":" << __LINE__ << ": " << __FUNCTION__ << "(): "<< "Error: Connection could not be accepted (" << strerror(errno) << "). Stopping ..." << endl;
+				stopping = true;
+			}
+			break;
+		}
+
+		std::lock_guard<std::mutex> lock(queue_mutex);
+		connections.push_back(connection);
+		connection_queued.notify_one();
+	}
+
+	// The workers finish the connections in the queue before they stop
+	connection_queued.notify_all();
+	for(auto &worker: workers){
+		worker.join();
+	}
+
+	close(server_socket);
+	unlink(socket_path.Data());
+	cout << "> Stopped server on socket " << socket_path << endl;
+}
+
+void UnfoldingServer::work(){
+	while(true){
+		int connection;
+		{
+			std::unique_lock<std::mutex> lock(queue_mutex);
+			connection_queued.wait(lock, [this]{ return stopping || !connections.empty(); });
+			if(connections.empty()){
+				return;
+			}
+			connection = connections.front();
+			connections.pop_front();
+		}
+
+		handleConnection(connection);
+		close(connection);
+	}
+}
+
+void UnfoldingServer::handleConnection(const int connection){
+
+	vector<string> lines;
+	string pending = "";
+	string line = "";
+	Bool_t complete = false;
+
+	while(readLine(connection, pending, line)){
+		if(line == "end"){
+			complete = true;
+			break;
+		}
+		if(line == "shutdown"){
+			writeAll(connection, "ok\nend\n");
+			{
+				std::lock_guard<std::mutex> lock(queue_mutex);
+				stopping = true;
+			}
+			connection_queued.notify_all();
+			// Makes accept() in run() return
+			shutdown(server_socket, SHUT_RDWR);
+			return;
+		}
+		lines.push_back(line);
+	}
+
+	// The client closed the connection before the job was complete
+	if(!complete){
+		return;
+	}
+
+	Job job;
+	string answer = "";
+	string error = "";
+	if(parseJob(lines, job, error) && runJob(job, answer, error)){
+		writeAll(connection, "ok\n" + answer + "end\n");
+	} else{
+		cout << "\t> Job failed: " << error << endl;
+		writeAll(connection, "error " + error + "\n");
+	}
+}
+
+Bool_t UnfoldingServer::parseJob(const vector<string> &lines, Job &job, string &error) const {
+
+	for(auto const &line: lines){
+		stringstream stream(line);
+		string key = "";
+		stream >> key;
+
+		if(key == "" || key.at(0) == '#'){
+			continue;
+		}
+
+		if(key == "bins"){
+			Double_t content;
+			job.bins.clear();
+			while(stream >> content){
+				job.bins.push_back(content);
+			}
+			continue;
+		}
+
+		string value = "";
+		stream >> value;
+		if(value == ""){
+			error = "No value given for '" + key + "'";
+			return false;
+		}
+
+		if(key == "matrix"){
+			job.matrixfile = value;
+		} else if(key == "binning"){
+			job.binning = (UInt_t) atoi(value.c_str());
+		} else if(key == "resolution_file"){
+			job.resolution_file = value;
+		} else if(key == "left"){
+			job.left = (UInt_t) atoi(value.c_str());
+		} else if(key == "right"){
+			job.right = (UInt_t) atoi(value.c_str());
+		} else if(key == "uncertainty_mc"){
+			job.uncertainty_mc = (UInt_t) atoi(value.c_str());
+		} else if(key == "uncertainty_mc_fast"){
+			job.uncertainty_mc = (UInt_t) atoi(value.c_str());
+			job.use_mc_fast = true;
+		} else if(key == "seed"){
+			job.seed = (UInt_t) atoi(value.c_str());
+		} else if(key == "spectrum"){
+			job.spectrumfile = value;
+		} else if(key == "spectrum_name"){
+			job.spectrumname = value;
+		} else if(key == "output"){
+			job.outputfile = value;
+		} else{
+			error = "Unknown key '" + key + "'";
+			return false;
+		}
+	}
+
+	if(job.matrixfile == ""){
+		error = "No matrix given";
+		return false;
+	}
+	if(job.binning == 0 || job.binning > NBINS){
+		error = "Invalid binning";
+		return false;
+	}
+	if(job.right <= job.left || job.right > NBINS){
+		error = "Invalid fit range";
+		return false;
+	}
+	if((job.spectrumfile == "") == job.bins.empty()){
+		error = "Exactly one of 'spectrum' and 'bins' must be given";
+		return false;
+	}
+	if(!job.bins.empty() && job.bins.size() != (size_t) NBINS){
+		error = "'bins' must contain " + std::to_string(NBINS) + " values";
+		return false;
+	}
+
+	return true;
+}
+
+Bool_t UnfoldingServer::runJob(const Job &job, string &answer, string &error){
+
+	// Most input errors abort the whole process in InputFileReader, so check at least
+	// whether the files exist.
+	for(auto const &filename: {job.matrixfile, job.resolution_file, job.spectrumfile}){
+		if(filename != "" && access(filename.Data(), R_OK) != 0){
+			error = string("File ") + filename.Data() + " cannot be read";
+			return false;
+		}
+	}
+
+	shared_ptr<CacheEntry> entry = getUnfolder(job);
+
+	vector<Double_t> spectrum_values = job.bins;
+	if(spectrum_values.empty()){
+		TDirectory::TContext context(nullptr);
+		TH1F spectrum("spectrum", "Input Spectrum", NBINS, 0., (Double_t) NBINS - 1.);
+		InputFileReader inputFileReader(job.binning);
+		if(job.spectrumname != ""){
+			inputFileReader.readROOTSpectrum(spectrum, job.spectrumfile, job.spectrumname);
+		} else{
+			inputFileReader.readTxtSpectrum(spectrum, job.spectrumfile);
+		}
+		spectrum_values.resize(NBINS);
+		for(Int_t i = 1; i <= (Int_t) NBINS; ++i){
+			spectrum_values[(size_t) (i - 1)] = spectrum.GetBinContent(i);
+		}
+	}
+
+	UnfoldingOptions options;
+	options.left = job.left;
+	options.right = job.right;
+	options.uncertainty_mc = job.uncertainty_mc;
+	options.use_mc_fast = job.use_mc_fast;
+	options.seed = job.seed;
+
+	UnfoldingResult result;
+	{
+		std::lock_guard<std::mutex> lock(entry->mutex);
+		entry->unfolder->unfold(spectrum_values, options, result);
+	}
+
+	if(job.outputfile != ""){
+		if(!entry->unfolder->writeResult(result, job.outputfile)){
+			error = string("Output file ") + job.outputfile.Data() + " could not be written";
+			return false;
+		}
+		answer = string("output ") + job.outputfile.Data() + "\n";
+	} else{
+		stringstream stream;
+		stream << std::setprecision(10);
+		for(auto const &histogram: result.getHistograms()){
+			stream << histogram.first;
+			for(auto const value: *histogram.second){
+				stream << " " << value;
+			}
+			stream << "\n";
+		}
+		answer = stream.str();
+	}
+
+	return true;
+}
+
+shared_ptr<UnfoldingServer::CacheEntry> UnfoldingServer::getUnfolder(const Job &job){
+
+	// The path must be the first line of the key, see the message about removed matrices
+	const string path = string(job.matrixfile.Data()) + "\n";
+	const string matrix_version = path + fileState(job.matrixfile) + "\n";
+	string key = matrix_version + std::to_string(job.binning);
+	if(job.resolution_file != ""){
+		key += "\n" + string(job.resolution_file.Data()) + "\n" + fileState(job.resolution_file);
+	}
+
+	shared_ptr<CacheEntry> entry;
+	std::unique_lock<std::mutex> entry_lock;
+	{
+		std::lock_guard<std::mutex> lock(cache_mutex);
+		for(auto it = cache.begin(); it != cache.end(); ){
+			if((*it)->key == key){
+				cache.splice(cache.begin(), cache, it);
+				return cache.front();
+			}
+			// Unfolders of an older version of the same matrix file are not used any more
+			if((*it)->key.compare(0, path.size(), path) == 0 && (*it)->key.compare(0, matrix_version.size(), matrix_version) != 0){
+				cout << "> Removing outdated matrix " << job.matrixfile << " from memory" << endl;
+				it = cache.erase(it);
+				continue;
+			}
+			++it;
+		}
+
+		// The new entry is locked until the Unfolder is created. Other jobs for the same
+		// matrix wait for it in runJob() instead of loading the matrix again.
+		entry = make_shared<CacheEntry>();
+		entry->key = key;
+		entry_lock = std::unique_lock<std::mutex>(entry->mutex);
+		cache.push_front(entry);
+
+		// Jobs that still use a removed Unfolder keep it alive until they are finished
+		while(cache.size() > cache_size){
+			cout << "> Removing matrix " << TString(cache.back()->key.substr(0, cache.back()->key.find('\n'))) << " from memory" << endl;
+			cache.pop_back();
+		}
+	}
+
+	// Load the matrix without holding the lock of the cache, so that the jobs for other
+	// matrices are not delayed
+	cout << "> Loading matrix " << job.matrixfile << " with binning " << job.binning << " ..." << endl;
+
+	TDirectory::TContext context(nullptr);
+	TH2F response_matrix("rema", "Response_Matrix", NBINS, 0., (Double_t) (NBINS - 1), NBINS, 0., (Double_t) (NBINS - 1));
+	TH1F n_simulated_particles("n_simulated_particles", "Number of simulated particles per bin", NBINS, 0., (Double_t) (NBINS - 1));
+
+	InputFileReader inputFileReader(job.binning);
+	inputFileReader.readMatrix(response_matrix, n_simulated_particles, job.matrixfile);
+
+	vector<Double_t> resolution_params;
+	if(job.resolution_file != ""){
+		inputFileReader.readDoubleParameters(resolution_params, job.resolution_file);
+	}
+
+	entry->unfolder = make_shared<Unfolder>(response_matrix, n_simulated_particles, job.binning, resolution_params);
+
+	return entry;
+}
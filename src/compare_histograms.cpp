@@ -0,0 +1,113 @@
+/*
+    This file is part of Horst.
+
+    Horst is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Horst is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Horst.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <TDirectory.h>
+#include <TFile.h>
+#include <TH1.h>
+#include <TKey.h>
+#include <TList.h>
+#include <TROOT.h>
+
+#include <iostream>
+
+using std::cout;
+using std::endl;
+
+// Compare all histograms in DIRECTORY of FILE1 whose names begin with PREFIX to the
+// histograms with the same names in FILE2. The bin contents and errors, including the
+// underflow and overflow bins, must be exactly the same. Used by the tests to check that
+// results which are claimed to be identical, like those of an interrupted and resumed MC
+// run, really are bit for bit.
+// The program returns a nonzero exit code if a histogram is missing or differs.
+int main(int argc, char* argv[]){
+
+	if(argc != 4 && argc != 5){
+		cout << "Usage: " << argv[0] << " FILE1 FILE2 DIRECTORY [PREFIX]. Use '/' as DIRECTORY for the top level of the files." << endl;
+		return 2;
+	}
+	const TString directoryname = argv[3];
+	const TString prefix = argc == 5 ? argv[4] : "";
+
+	TFile file_1(argv[1]);
+	TFile file_2(argv[2]);
+	if(file_1.IsZombie() || file_2.IsZombie()){
+		cout << "Error: Could not open " << argv[1] << " or " << argv[2] << "." << endl;
+		return 1;
+	}
+
+	TDirectory *directory_1 = directoryname == "/" ? &file_1 : file_1.GetDirectory(directoryname);
+	TDirectory *directory_2 = directoryname == "/" ? &file_2 : file_2.GetDirectory(directoryname);
+	if(directory_1 == nullptr || directory_2 == nullptr){
+		cout << "Error: Directory " << directoryname << " not found in " << argv[1] << " or " << argv[2] << "." << endl;
+		return 1;
+	}
+
+	Bool_t identical = true;
+	UInt_t n_compared = 0;
+
+	for(Int_t i = 0; i < directory_1->GetNkeys(); ++i){
+		const TString name = directory_1->GetListOfKeys()->At(i)->GetName();
+		if(!name.BeginsWith(prefix)){
+			continue;
+		}
+		// Skip objects which are not histograms, like the TTree of MC samples
+		if(!directory_1->Get(name)->InheritsFrom("TH1")){
+			continue;
+		}
+		const TH1 *histogram_1 = (TH1*) directory_1->Get(name);
+
+		TObject *object_2 = directory_2->Get(name);
+		if(object_2 == nullptr || !object_2->InheritsFrom("TH1")){
+			cout << "  FAILED " << name << ": not found in " << argv[2] << endl;
+			identical = false;
+			continue;
+		}
+		const TH1 *histogram_2 = (TH1*) object_2;
+		if(histogram_1->GetNcells() != histogram_2->GetNcells()){
+			cout << "  FAILED " << name << ": " << histogram_1->GetNcells() << " and " << histogram_2->GetNcells() << " bins" << endl;
+			identical = false;
+			continue;
+		}
+
+		Int_t n_different = 0;
+		Int_t first_different = -1;
+		for(Int_t bin = 0; bin < histogram_1->GetNcells(); ++bin){
+			if(histogram_1->GetBinContent(bin) != histogram_2->GetBinContent(bin) || histogram_1->GetBinError(bin) != histogram_2->GetBinError(bin)){
+				if(n_different == 0){
+					first_different = bin;
+				}
+				++n_different;
+			}
+		}
+
+		if(n_different > 0){
+			cout.precision(17);
+			cout << "  FAILED " << name << ": " << n_different << " bins differ, first bin " << first_different << ": " << histogram_1->GetBinContent(first_different) << " and " << histogram_2->GetBinContent(first_different) << endl;
+			identical = false;
+		} else{
+			cout << "  ok     " << name << endl;
+		}
+		++n_compared;
+	}
+
+	if(n_compared == 0){
+		cout << "Error: No histograms found in directory " << directoryname << " of " << argv[1] << "." << endl;
+		return 1;
+	}
+
+	return identical ? 0 : 1;
+}
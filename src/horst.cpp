@@ -20,38 +20,72 @@
 #include <TF1.h>
 #include <TFile.h>
 #include <TMatrixDSym.h>
+#include <TParameter.h>
 #include <TROOT.h>
 #include <TStyle.h>
+#include <TVectorD.h>
 
 #include <argp.h>
 #include <iostream>
+#include <stdio.h>
 #include <stdlib.h>
 #include <sstream>
+#include <sys/stat.h>
 #include <time.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <memory>
+#include <thread>
 
 #include "Config.h"
 #include "Fitter.h"
+#include "FoldedMatrixCache.h"
 #include "InputFileReader.h"
+#include "MonteCarloAccumulator.h"
+#include "MonteCarloCheckpoint.h"
+#include "MonteCarloResult.h"
 #include "MonteCarloUncertainty.h"
+#include "MultilevelFitter.h"
+#include "OutputSession.h"
 #include "Reconstructor.h"
+#include "Resolution.h"
+#include "ResponseMatrix.h"
+#include "SplineBasis.h"
 #include "Uncertainty.h"
+#include "Unfolder.h"
+#include "UnfoldingServer.h"
 
 using std::cout;
 using std::endl;
 using std::vector;
 using std::stringstream;
+using std::unique_ptr;
 
 struct Arguments{
 	UInt_t binning = 10;
 	TString spectrumfile = "";
 	TString spectrumname = "";
 	TString matrixfile = "";
+	TString resolution_file = "";
+	vector<Double_t> resolution_params;
 	UInt_t uncertainty_mc = 10;
+	Double_t mc_tolerance = 0.;
+	UInt_t mc_min_iterations = MC_MIN_ITERATIONS;
+	TString mc_sampling = "plain";
+	Bool_t control_variate = false;
+	UInt_t shard = 1;
+	UInt_t n_shards = 1;
+	Bool_t resume = false;
+	Double_t checkpoint_interval = MC_CHECKPOINT_INTERVAL;
+	UInt_t stop_after = 0;
 	UInt_t seed = 1;
 	Bool_t use_mc = false;
 	Bool_t use_mc_fast = false;
+	TString simulationfile = "";
+	TString simulation_histname = "hpge0";
+	Bool_t use_simulations = false;
 	Bool_t write_mc = false;
-	Bool_t write_mc_only = false;
 	TString correlation_matrix_filename = "";
 	TString outputfile = "output.root";
 	UInt_t left = 0;
@@ -62,18 +96,56 @@ struct Arguments{
 	Bool_t tfile = false;
 	Bool_t verbose = false;
 	Bool_t correlation = false;
+	TString socket_path = "";
+	UInt_t n_workers = 1;
+	UInt_t cache_size = 4;
+	Bool_t watch = false;
+	Double_t watch_interval = 1.;
+	UInt_t watch_updates = 0;
+	UInt_t multilevel = 0;
+	Double_t knot_spacing = 0.;
+	TString peakfile = "";
 };
 
 static char doc[] = "Horst, Histogram original reconstruction spectrum tool";
 static char args_doc[] = "INPUTFILENAME";
 
+// Key of options without a short version
+const int OPTION_RESUME = 256;
+const int OPTION_RESOLUTION_FILE = 257;
+const int OPTION_SERVE = 258;
+const int OPTION_WORKERS = 259;
+const int OPTION_CACHE = 260;
+const int OPTION_WATCH = 261;
+const int OPTION_WATCH_INTERVAL = 262;
+const int OPTION_WATCH_UPDATES = 263;
+const int OPTION_MULTILEVEL = 264;
+const int OPTION_SPLINE = 265;
+const int OPTION_PEAKS = 266;
+const int OPTION_CHECKPOINT_INTERVAL = 267;
+const int OPTION_STOP_AFTER = 268;
+
 static struct argp_option options[] = {
 	{"binning", 'b', "BINNING", 0, "a) Without '-t' option: Rebinning factor for input spectrum and response matrix (default: 10)\nb) With '-t' option   : Rebinning factor for response matrix (default: 10)", 0},
 	{"matrixfile", 'm', "MATRIXFILENAME", 0, "Name of file that contains the response matrix (default: none, i.e. this option must be set by the user)", 0},
+	{"resolution_file", OPTION_RESOLUTION_FILE, "RESOLUTIONFILE", 0, "Fit the spectrum with a response matrix into which a finite detector resolution is folded. RESOLUTIONFILE contains the whitespace-separated resolution parameters in the same format as for tsroh. The folded matrix is cached in a file next to MATRIXFILENAME, so that it is calculated only once for the same matrix, binning and resolution. The FEP, the efficiency and the simulation uncertainty still refer to the original matrix. (default: none, i.e. do not fold a resolution into the matrix)", 0},
 	{"uncertainty_mc", 'u', "NRANDOM", 0, "Determine uncertainty using a Monte-Carlo (MC) method to include correlations. NRANDOM is the number of MC iterations (default: 10).", 0},
 	{"uncertainty_mc_fast", 'U', "NRANDOM", 0, "Similar to '-u' option, but do not vary the response matrix when estimating the statistical uncertainty. This option can be used to disentangle the statistical uncertainty introduced by the input spectrum and the response matrix. Overrides the '-u' option if both are set. NRANDOM is the number of MC iterations (default: 10).", 0},
-	{"write_mc", 'w', 0, 0, "Write MC-generated spectra and reconstructed spectra. This option is ignored if '-u' option is not used. (default: false)", 0},
-	{"write_mc_only", 'W', 0, 0, "Similar to '-w' option, but does not evaluate MC results afterwards (i.e. leaves calculation of mean value and uncertainties to the user). The advantage compared to the '-w' option is that horst does not have to keep all MC spectra in memory until the end of the program execution, potentially saving a lot of RAM. MC spectra are dumped to file immediately. (default: false)", 0},
+	{"mc_tolerance", 'T', "TOLERANCE", 0, "Stop the MC uncertainty estimation ('-u' or '-U' option) as soon as the estimated relative standard error of the standard deviation of every fit parameter in the fit range is smaller than TOLERANCE. In this case, NRANDOM is the maximum number of MC iterations. For normally distributed fit parameters, the relative standard error is approximately 1/sqrt(2*n) after n iterations, i.e. TOLERANCE == 0.05 requires about 200 iterations. (default: 0, i.e. always execute NRANDOM iterations)", 0},
+	{"mc_min", 'M', "NMIN", 0, "Minimum number of MC iterations if the '-T' option is used (default: 100)", 0},
+	{"mc_sampling", 'R', "SCHEME", 0, "Sampling scheme for the fluctuations of the spectrum in the MC uncertainty estimation: 'plain' (independent pseudo-random numbers), 'antithetic' (pairs of mirrored fluctuations, reduces the variance of the MC mean value) or 'sobol' (quasi-random numbers from a randomized Sobol sequence). (default: 'plain')", 0},
+	{"control_variate", 'C', 0, 0, "Reduce the variance of the MC uncertainty estimate with a control variate: the top-down unfolding of each fluctuated spectrum, whose mean value and variance are known exactly. The exact variance takes a time proportional to the third power of the number of bins in the fit range, for example several minutes for 10000 bins. (default: false)", 0},
+	{"mc_shard", 'K', "K/N", 0, "Split the MC uncertainty estimation into N independent processes (shards) and execute only the K-th of them (1 <= K <= N). The MC iterations are divided into blocks of 10 iterations, and shard K processes the blocks K-1, K-1+N, K-1+2N, .... Instead of the final MC results, the output file contains the partial results of these blocks, which can be combined by horst_merge. The merged result is identical to a single run with the same options. Cannot be combined with the '-T' option. (default: 1/1, i.e. a single process)", 0},
+	{"multilevel", OPTION_MULTILEVEL, "NLEVELS", 0, "Coarse-to-fine fit: before the fit with the binning factor BINNING, fit the spectrum with the binning factors 2^NLEVELS*BINNING, ..., 4*BINNING, 2*BINNING. The coarsest fit starts from the top-down parameters, and every other fit starts from the result of the previous one. The coarse spectra and matrices are obtained from the rebinned ones. NBINS must be a multiple of 2^NLEVELS*BINNING. Reduces the number of iterations of the fit with many parameters. (default: 0, i.e. start the fit from the top-down parameters)", 0},
+	{"spline", OPTION_SPLINE, "KNOTSPACING", 0, "Describe the parameters in the fit range by uniform cubic B-splines with the knot spacing KNOTSPACING (in units of the original bins) and fit their coefficients instead of one parameter per bin. This reduces the number of free parameters by about KNOTSPACING/BINNING for smooth spectra. The results are still given for each bin. Also applies to the fits of the MC uncertainty estimation. (default: 0, i.e. one parameter per bin)", 0},
+	{"peaks", OPTION_PEAKS, "PEAKFILE", 0, "With '--spline': add a delta function to the basis at each of the whitespace-separated energies in PEAKFILE, for lines that are narrower than the knot spacing (default: none)", 0},
+	{"resume", OPTION_RESUME, 0, 0, "Continue an interrupted MC uncertainty estimation from the checkpoint file OUTPUTFILENAME.checkpoint, which is written regularly during the MC iterations and deleted at the end of the run. All other options must be the same as in the interrupted run. The result is identical to an uninterrupted run. If there is no checkpoint file, horst starts from the beginning. (default: false)", 0},
+	{"checkpoint_interval", OPTION_CHECKPOINT_INTERVAL, "SECONDS", 0, "Minimum time between two checkpoints of the MC iterations. The checkpoint is written at the end of the first block of MC iterations after this time. 0 writes a checkpoint after every block. (default: 60)", 0},
+	{"stop_after", OPTION_STOP_AFTER, "NBLOCKS", 0, "Stop the MC uncertainty estimation after NBLOCKS blocks of iterations, write a checkpoint and exit without the final results, so that the run can be continued with '--resume'. Useful to split a long run over several jobs with a time limit. (default: 0, i.e. never stop)", 0},
+	{"simulations", 'S', "SIMULATIONFILE", 0, "Fluctuate the simulations from which the response matrix was created, instead of the single matrix elements, when estimating the uncertainty with the '-u' option. SIMULATIONFILE is the input file that was used to create the response matrix with makematrix. The affected rows of the matrix are rebuilt from the fluctuated simulations in each MC iteration, which preserves the correlations between matrix elements that originate from the same simulation. Ignored if the '-U' option is used. (default: none, i.e. fluctuate the matrix elements)", 0},
+	{"histname", 'n', "HISTNAME", 0, "Name of the histogram in the simulation files given by the '-S' option (default: 'hpge0')", 0},
+	{"write_mc", 'w', 0, 0, "Write MC-generated spectra and reconstructed spectra. They are stored in the TTree 'monte_carlo/mc_samples', with one entry per MC iteration and one array branch per quantity. This option is ignored if '-u' option is not used. (default: false)", 0},
+	{"write_mc_only", 'W', 0, 0, "Same as '-w' option. Kept for backwards compatibility: MC results are evaluated on the fly, so horst never needs to keep the MC spectra in memory. (default: false)", 0},
 	{"outputfile", 'o', "OUTPUTFILENAME", 0, "Name of output file (default: output.root).", 0},
 	{"left", 'l', "LEFT", 0, "Left limit of fit range (default: 0).", 0},
 	{"right", 'r', "RIGHT", 0, "Right limit of fit range (default: NBINS)", 0},
@@ -84,6 +156,12 @@ static struct argp_option options[] = {
 	{"correlation", 'c', "CORRELATIONFILENAME", 0, "Write the correlation matrix of the fit to the specified output file. If the '-u' option is used, only one correlation matrix will be written, although NRANDOM fits are executed. (default: none, i.e. do not write write correlation file)", 0},
 	{"seed", 's', "SEED", 0, "Set the random number seed (default: 1. This ensures that a call of Horst with the same arguments gives the same results.)", 0},
 	{"verbose", 'v', 0, 0, "Enable ROOT to print verbose information about the fitting process (default: false)", 0},
+	{"serve", OPTION_SERVE, "SOCKET", 0, "Daemon mode: do not process INPUTFILENAME, but wait for unfolding jobs on the Unix domain socket SOCKET and keep the rebinned response matrices in memory. A job contains the spectrum (file or bin contents), the matrix file and the options. The results are written to a file or sent back. See include/UnfoldingServer.h for the protocol and horst_client for a client. All other options are ignored. (default: none)", 0},
+	{"workers", OPTION_WORKERS, "WORKERS", 0, "Number of jobs that are processed in parallel in daemon mode. TMinuit, the default minimizer, cannot run in several threads, so with more than one worker the fits use Minuit2, and the results differ from those of a plain horst run within the tolerance of the fit. (default: 1)", 0},
+	{"cache", OPTION_CACHE, "NMATRICES", 0, "Maximum number of rebinned response matrices that are kept in memory in daemon mode (default: 4)", 0},
+	{"watch", OPTION_WATCH, 0, 0, "Online mode: keep running and unfold INPUTFILENAME again whenever it changes, for example because a data acquisition adds counts to it. Only the change of the spectrum is unfolded with the top-down algorithm, and the fit starts from the previous result. The main results are written to OUTPUTFILENAME after every update. Supports the options for the spectrum, the matrix, the binning, the fit range, the resolution and '-u'/'-U' with plain sampling. Other options of the fit and the MC uncertainty estimation are rejected. (default: false)", 0},
+	{"watch_interval", OPTION_WATCH_INTERVAL, "SECONDS", 0, "Time between two checks of INPUTFILENAME in online mode. A change is processed when the file did not change for one more interval, so that half-written files are not read. (default: 1)", 0},
+	{"watch_updates", OPTION_WATCH_UPDATES, "NUPDATES", 0, "Stop the online mode after NUPDATES unfolded spectra (default: 0, i.e. never)", 0},
 	{ 0, 0, 0, 0, 0, 0}
 };
 
@@ -94,10 +172,26 @@ static int parse_opt(int key, char *arg, struct argp_state *state){
 		case ARGP_KEY_ARG: arguments->spectrumfile = arg; break;
 		case 'b': arguments->binning= (UInt_t) atoi(arg); break;
 		case 'm': arguments->matrixfile= arg; break;
+		case OPTION_RESOLUTION_FILE: arguments->resolution_file = arg; break;
 		case 'u': arguments->use_mc = true; arguments->uncertainty_mc = (UInt_t) atoi(arg); break;
 		case 'U': arguments->use_mc_fast = true; arguments->use_mc = true; arguments->uncertainty_mc = (UInt_t) atoi(arg); break;
+		case 'T': arguments->mc_tolerance = atof(arg); break;
+		case 'M': arguments->mc_min_iterations = (UInt_t) atoi(arg); break;
+		case 'R': arguments->mc_sampling = arg; break;
+		case 'C': arguments->control_variate = true; break;
+		case 'K':
+			if(sscanf(arg, "%u/%u", &arguments->shard, &arguments->n_shards) != 2 || arguments->shard < 1 || arguments->shard > arguments->n_shards){
+				cout << "Error: Invalid shard '" << arg << "', expected K/N with 1 <= K <= N. Aborting ..." << endl;
+				abort();
+			}
+			break;
+		case OPTION_RESUME: arguments->resume = true; break;
+		case OPTION_CHECKPOINT_INTERVAL: arguments->checkpoint_interval = atof(arg); break;
+		case OPTION_STOP_AFTER: arguments->stop_after = (UInt_t) atoi(arg); break;
+		case 'S': arguments->use_simulations = true; arguments->simulationfile = arg; break;
+		case 'n': arguments->simulation_histname = arg; break;
 		case 'w': arguments->write_mc = true; break;
-		case 'W': arguments->write_mc = true; arguments->write_mc_only = true; break;
+		case 'W': arguments->write_mc = true; break;
 		case 'o': arguments->outputfile = arg; break;
 		case 'l': arguments->left= (UInt_t) atoi(arg); break;
 		case 'L': arguments->limitfile = arg; arguments->limits_from_file= true; break;
@@ -107,7 +201,20 @@ static int parse_opt(int key, char *arg, struct argp_state *state){
 		case 'c': arguments->correlation = true; arguments->correlation_matrix_filename = arg; break;
 		case 's': arguments->seed = (UInt_t) atoi(arg); break;
 		case 'v': arguments->verbose = true; break;
+		case OPTION_SERVE: arguments->socket_path = arg; break;
+		case OPTION_WORKERS: arguments->n_workers = (UInt_t) atoi(arg); break;
+		case OPTION_CACHE: arguments->cache_size = (UInt_t) atoi(arg); break;
+		case OPTION_WATCH: arguments->watch = true; break;
+		case OPTION_WATCH_INTERVAL: arguments->watch_interval = atof(arg); break;
+		case OPTION_WATCH_UPDATES: arguments->watch_updates = (UInt_t) atoi(arg); break;
+		case OPTION_MULTILEVEL: arguments->multilevel = (UInt_t) atoi(arg); break;
+		case OPTION_SPLINE: arguments->knot_spacing = atof(arg); break;
+		case OPTION_PEAKS: arguments->peakfile = arg; break;
 		case ARGP_KEY_END:
+			// In daemon mode, the spectrum and the matrix are given by the jobs
+			if(arguments->socket_path != ""){
+				break;
+			}
 			if(state->arg_num == 0){
 				argp_usage(state);
 			}
@@ -115,6 +222,65 @@ static int parse_opt(int key, char *arg, struct argp_state *state){
 				cout << "Error: No matrix file given. Aborting ..." << endl;
 				abort();
 			}
+			if(arguments->n_shards > 1 && arguments->mc_tolerance > 0.){
+				cout << "Error: The '-K' and '-T' options cannot be combined, because the shards do not know about each other. Aborting ..." << endl;
+				abort();
+			}
+			if(arguments->mc_sampling != "plain" && arguments->mc_sampling != "antithetic" && arguments->mc_sampling != "sobol"){
+				cout << "Error: Unknown sampling scheme '" << arguments->mc_sampling << "'. Aborting ..." << endl;
+				abort();
+			}
+			// The online mode only supports the options of the Unfolder (see UnfoldingOptions)
+			if(arguments->watch){
+				vector<TString> unsupported;
+				if(arguments->multilevel > 0){
+					unsupported.push_back("--multilevel");
+				}
+				if(arguments->knot_spacing > 0.){
+					unsupported.push_back("--spline");
+				}
+				if(arguments->peakfile != ""){
+					unsupported.push_back("--peaks");
+				}
+				if(arguments->mc_sampling != "plain"){
+					unsupported.push_back("-R");
+				}
+				if(arguments->control_variate){
+					unsupported.push_back("-C");
+				}
+				if(arguments->use_simulations){
+					unsupported.push_back("-S");
+				}
+				if(arguments->mc_tolerance > 0.){
+					unsupported.push_back("-T");
+				}
+				if(arguments->n_shards > 1){
+					unsupported.push_back("-K");
+				}
+				if(arguments->resume){
+					unsupported.push_back("--resume");
+				}
+				if(arguments->stop_after > 0){
+					unsupported.push_back("--stop_after");
+				}
+				if(arguments->write_mc){
+					unsupported.push_back("-w/-W");
+				}
+				if(arguments->correlation){
+					unsupported.push_back("-c");
+				}
+				if(arguments->interactive_mode){
+					unsupported.push_back("-i");
+				}
+				if(!unsupported.empty()){
+					cout << "Error: The following options cannot be combined with '--watch':";
+					for(auto const &option: unsupported){
+						cout << " '" << option << "'";
+					}
+					cout << ". Aborting ..." << endl;
+					abort();
+				}
+			}
 			break;
 		default: return ARGP_ERR_UNKNOWN;
 	}
@@ -123,6 +289,137 @@ static int parse_opt(int key, char *arg, struct argp_state *state){
 
 static struct argp argp = { options, parse_opt, args_doc, doc, 0, 0, 0};
 
+// Delete all objects in a directory whose names do not begin with one of the given prefixes
+void removeObjects(TDirectory *directory, const vector<TString> &keep){
+	vector<TString> names;
+	for(Int_t i = 0; i < directory->GetNkeys(); ++i){
+		names.push_back(directory->GetListOfKeys()->At(i)->GetName());
+	}
+
+	for(auto name: names){
+		Bool_t keep_object = false;
+		for(auto prefix: keep){
+			keep_object = keep_object || name.BeginsWith(prefix);
+		}
+		if(!keep_object){
+			directory->Delete(name + ";*");
+		}
+	}
+}
+
+// Modification time and size of a file, to detect changes without reading it
+static Bool_t fileState(const TString filename, struct timespec &modification_time, off_t &size){
+	struct stat file_stat;
+	if(stat(filename, &file_stat) != 0){
+		return false;
+	}
+	modification_time = file_stat.st_mtim;
+	size = file_stat.st_size;
+	return true;
+}
+
+// Online mode: unfold the spectrum file whenever it changes
+static int watchSpectrum(const Arguments &arguments, InputFileReader &inputFileReader){
+
+	TDirectory::TContext context(nullptr);
+
+	vector<Double_t> resolution_params;
+	if(arguments.resolution_file != ""){
+		inputFileReader.readDoubleParameters(resolution_params, arguments.resolution_file);
+	}
+
+	// The full matrix is only needed until it is rebinned by the Unfolder
+	unique_ptr<Unfolder> unfolder;
+	{
+		TH2F response_matrix("rema", "Response_Matrix", NBINS, 0., (Double_t) (NBINS - 1), NBINS, 0., (Double_t) (NBINS - 1));
+		TH1F n_simulated_particles("n_simulated_particles", "Number of simulated particles per bin", NBINS, 0., (Double_t) (NBINS - 1));
+		cout << "> Reading matrix file " << arguments.matrixfile << " ..." << endl;
+		inputFileReader.readMatrix(response_matrix, n_simulated_particles, arguments.matrixfile);
+		unfolder.reset(new Unfolder(response_matrix, n_simulated_particles, arguments.binning, resolution_params));
+	}
+
+	UnfoldingOptions options;
+	options.left = arguments.left;
+	options.right = arguments.right;
+	options.uncertainty_mc = arguments.use_mc ? arguments.uncertainty_mc : 0;
+	options.use_mc_fast = arguments.use_mc_fast;
+	options.seed = arguments.seed;
+
+	TH1F spectrum("spectrum", "Input Spectrum", (Int_t) NBINS, 0., (Double_t) NBINS - 1.);
+	vector<Double_t> spectrum_values(NBINS, 0.);
+	vector<Double_t> previous_spectrum_values;
+	UnfoldingResult result;
+
+	const TString temporary_outputfile = arguments.outputfile + ".tmp";
+	const auto interval = std::chrono::duration<Double_t>(arguments.watch_interval);
+
+	struct timespec processed_time = {0, 0}, last_time = {0, 0}, current_time;
+	off_t processed_size = -1, last_size = -1, current_size;
+	Bool_t first_check = true;
+	UInt_t n_updates = 0;
+
+	cout << "> Watching spectrum file " << arguments.spectrumfile << " ..." << endl;
+	while(arguments.watch_updates == 0 || n_updates < arguments.watch_updates){
+
+		if(!first_check){
+			std::this_thread::sleep_for(interval);
+		}
+
+		if(!fileState(arguments.spectrumfile, current_time, current_size)){
+			first_check = false;
+			last_size = -1;
+			continue;
+		}
+
+		const Bool_t stable = current_size == last_size && current_time.tv_sec == last_time.tv_sec && current_time.tv_nsec == last_time.tv_nsec;
+		const Bool_t processed = current_size == processed_size && current_time.tv_sec == processed_time.tv_sec && current_time.tv_nsec == processed_time.tv_nsec;
+		last_time = current_time;
+		last_size = current_size;
+
+		// The file is read when it did not change since the last check. At startup, there is
+		// no last check, so the file is assumed to be complete.
+		if(processed || (!stable && !first_check)){
+			first_check = false;
+			continue;
+		}
+		first_check = false;
+		processed_time = current_time;
+		processed_size = current_size;
+
+		const auto change_detected = std::chrono::steady_clock::now();
+
+		spectrum.Reset();
+		if(arguments.tfile){
+			inputFileReader.readROOTSpectrum(spectrum, arguments.spectrumfile, arguments.spectrumname);
+		} else{
+			inputFileReader.readTxtSpectrum(spectrum, arguments.spectrumfile);
+		}
+		for(Int_t i = 1; i <= (Int_t) NBINS; ++i){
+			spectrum_values[(size_t) (i - 1)] = spectrum.GetBinContent(i);
+		}
+
+		// Only the time stamp changed
+		if(spectrum_values == previous_spectrum_values){
+			continue;
+		}
+
+		unfolder->update(spectrum_values, options, result);
+		previous_spectrum_values = spectrum_values;
+
+		// Readers of the output file never see a half-written file
+		if(!unfolder->writeResult(result, temporary_outputfile) || rename(temporary_outputfile, arguments.outputfile) != 0){
+			cout << __FILE__ << ":" << __LINE__ << ": " << __FUNCTION__ << "(): "<< "Error: Output file " << arguments.outputfile << " could not be written. Aborting ..." << endl;
+			abort();
+		}
+		++n_updates;
+
+		const Double_t latency = std::chrono::duration<Double_t>(std::chrono::steady_clock::now() - change_detected).count();
+		cout << "> Update " << n_updates << ": wrote " << arguments.outputfile << " after " << latency << " s" << endl;
+	}
+
+	return 0;
+}
+
 int main(int argc, char* argv[]){
 
 	time_t start, stop;
@@ -133,6 +430,12 @@ int main(int argc, char* argv[]){
 	Arguments arguments;
 	argp_parse(&argp, argc, argv, 0, 0, &arguments);
 
+	if(arguments.socket_path != ""){
+		UnfoldingServer unfoldingServer(arguments.socket_path, arguments.n_workers, arguments.cache_size);
+		unfoldingServer.run();
+		return 0;
+	}
+
 	/************ Initialize auxiliary classes *************/
 
 	InputFileReader inputFileReader(arguments.binning);
@@ -143,6 +446,10 @@ int main(int argc, char* argv[]){
 		arguments.right = limits[1];
 	}
 
+	if(arguments.watch){
+		return watchSpectrum(arguments, inputFileReader);
+	}
+
 	const Int_t nbins = (Int_t) NBINS / (Int_t) arguments.binning;
 	const Double_t max_bin = (Double_t) NBINS - 1.;
 	const Int_t binstart = (Int_t) arguments.left / (Int_t) arguments.binning; 
@@ -159,7 +466,8 @@ int main(int argc, char* argv[]){
 	// Input
 	TH1F spectrum = TH1F("spectrum", "Input Spectrum",  (Int_t) NBINS, 0., max_bin);
 	TH1F n_simulated_particles("n_simulated_particles", "Number of simulated particles per bin", NBINS, 0., max_bin);
-	TH2F response_matrix("rema", "Response_Matrix", NBINS, 0., (Double_t) (NBINS - 1), NBINS, 0., max_bin);
+	// The matrix is rebinned while it is read
+	TH2F response_matrix("rema", "Response_Matrix", nbins, 0., (Double_t) (NBINS - 1), nbins, 0., max_bin);
 
 	// TopDown algorithm
 
@@ -173,6 +481,7 @@ int main(int argc, char* argv[]){
 
 	// Fit
 	TH1F fit_params("fit_params", "Fit Parameters", nbins, 0., max_bin);
+	TH1F multilevel_params("multilevel_params", "Start Parameters from Fits at coarser Binnings", nbins, 0., max_bin);
 	TH1F fit_result("fit_result", "Fit Result", nbins, 0., max_bin); 
 	TH1F fit_algorithm_uncertainty("fit_algorithm_uncertainty", "Fit Algorithm Uncertainty", nbins, 0., max_bin);
 	TH1F fit_algorithm_FEP_uncertainty("fit_algorithm_FEP_uncertainty", "Fit Algorithm FEP Uncertainty", nbins, 0., max_bin);
@@ -189,17 +498,30 @@ int main(int argc, char* argv[]){
 	TH1F reconstruction_uncertainty_up("reconstruction_uncertainty_up", "Reconstruction Uncertainty upper Limit", nbins, 0., max_bin);
 
 	// Monte-Carlo Uncertainty
-	vector<TH1F*> mc_spectra;
-	vector<TH1F*> mc_fit_params_samples;
-	vector<TH1F*> mc_FEP_samples;
-	vector<TH1F*> mc_reconstruction_samples;
-
-	TH2F mc_matrix;
-	TH1F mc_fit_params, mc_fit_params_mean, mc_fit_params_uncertainty, mc_fit_total_uncertainty;
-	TH1F mc_fit_FEP, mc_fit_FEP_uncertainty;
-	TH1F mc_FEP_uncertainty_low, mc_FEP_uncertainty_up;
-	TH1F mc_spectrum_reconstructed, mc_reconstruction_uncertainty;
-	TH1F mc_reconstruction_uncertainty_low, mc_reconstruction_uncertainty_up;
+	// The histograms of a single MC iteration are created only once and reused in every
+	// iteration. They are detached from the current directory.
+	// The fluctuated matrices are not histograms, because they are never written to the
+	// output file. The response matrix is converted only once for them.
+	ResponseMatrix mc_response_matrix;
+	ResponseMatrix mc_matrix;
+	ResponseMatrix mc_folded_matrix;
+	TH1F mc_spectrum("mc_spectrum", "MC Spectrum", nbins, 0., max_bin);
+	TH1F mc_fit_params("mc_fit_params", "MC Fit Parameters", nbins, 0., max_bin);
+	TH1F mc_FEP("mc_FEP", "MC FEP", nbins, 0., max_bin);
+	TH1F mc_reconstructed_spectrum("mc_reconstructed_spectrum", "MC Reconstructed Spectrum", nbins, 0., max_bin);
+	TH1F mc_topdown_params;
+	for(auto histogram: {&mc_spectrum, &mc_fit_params, &mc_FEP, &mc_reconstructed_spectrum}){
+		histogram->SetDirectory(nullptr);
+	}
+	TH1F mc_control_expectation, mc_control_variance;
+
+	MonteCarloAccumulator mc_fit_params_accumulator(arguments.binning, binstart, binstop);
+	MonteCarloAccumulator mc_block_accumulator(arguments.binning, binstart, binstop);
+	MonteCarloResult monteCarloResult(arguments.binning);
+	UInt_t mc_iterations = 0;
+	Double_t mc_relative_standard_error = 0.;
+	// True if the MC iterations were stopped by the '--stop_after' option
+	Bool_t mc_stopped = false;
 
 	/************ Start ROOT application *************/
 
@@ -220,13 +542,49 @@ int main(int argc, char* argv[]){
 	}
 	spectrum.Rebin( (Int_t) arguments.binning);
 
-	cout << "> Reading matrix file " << arguments.matrixfile << " ..." << endl;
-	inputFileReader.readMatrix(response_matrix, n_simulated_particles, arguments.matrixfile);
-	cout << "> Rebinning response matrix ..." << endl;
-	response_matrix.Rebin2D((Int_t) arguments.binning, (Int_t) arguments.binning);
+	// Only the rows of the fit range are read. Since the response to a given energy
+	// is restricted to lower energies, their columns above the fit range are not needed either.
+	// The fits of --multilevel start at the bin LEFT/(2^NLEVELS*BINNING) of the coarsest
+	// binning, which may begin below binstart.
+	const Int_t coarsest_binning = (Int_t) (arguments.binning << arguments.multilevel);
+	const Int_t coarsest_binstart = (Int_t) arguments.left / coarsest_binning;
+	const Int_t first_row = coarsest_binstart > 1 ? (coarsest_binstart - 1)*coarsest_binning + 1 : 1;
+	const Int_t last_row = binstop < nbins ? binstop*(Int_t) arguments.binning : (Int_t) NBINS;
+	cout << "> Reading rows " << first_row << " to " << last_row << " of matrix file " << arguments.matrixfile << " ..." << endl;
+	inputFileReader.readMatrix(response_matrix, n_simulated_particles, arguments.matrixfile, first_row, last_row);
 	n_simulated_particles.Rebin((Int_t) arguments.binning);
 
-	Fitter fitter(response_matrix, arguments.binning, binstart, binstop);
+	TH1F response_matrix_diagonal("response_matrix_diagonal", "Diagonal of the Response Matrix", nbins, 0., max_bin);
+	for(Int_t i = 1; i <= nbins; ++i){
+		response_matrix_diagonal.SetBinContent(i, response_matrix.GetBinContent(i, i));
+	}
+
+	// If a detector resolution is given, the fits use the matrix with the resolution folded in.
+	// The FEP, the efficiency and the uncertainty of the simulations refer to the original matrix.
+	Resolution resolution(arguments.binning);
+	TH2F folded_response_matrix;
+	const Bool_t fold_resolution = arguments.resolution_file != "";
+	if(fold_resolution){
+		inputFileReader.readDoubleParameters(arguments.resolution_params, arguments.resolution_file);
+		resolution.setParameters(arguments.resolution_params);
+
+		folded_response_matrix = TH2F("rema_folded", "Response Matrix with Detector Resolution", nbins, 0., max_bin, nbins, 0., max_bin);
+		folded_response_matrix.SetDirectory(nullptr);
+		FoldedMatrixCache foldedMatrixCache(arguments.matrixfile);
+		foldedMatrixCache.get(response_matrix, (first_row - 1)/(Int_t) arguments.binning + 1, last_row/(Int_t) arguments.binning, arguments.binning, arguments.resolution_params, folded_response_matrix);
+	}
+	const TH2F &fit_matrix = fold_resolution ? folded_response_matrix : response_matrix;
+
+	Fitter fitter(fit_matrix, arguments.binning, binstart, binstop);
+	if(arguments.knot_spacing > 0.){
+		vector<Double_t> peak_energies;
+		if(arguments.peakfile != ""){
+			inputFileReader.readDoubleParameters(peak_energies, arguments.peakfile);
+		}
+		SplineBasis splineBasis(arguments.binning, arguments.knot_spacing, peak_energies, binstart, binstop);
+		cout << "> Fit " << splineBasis.getNFunctions() << " coefficients of B-splines with a knot spacing of " << arguments.knot_spacing << (peak_energies.empty() ? "" : " and peaks") << " instead of " << binstop - binstart << " parameters" << endl;
+		fitter.setBasis(splineBasis);
+	}
 
 	/************ Create output file *****************/
 
@@ -235,23 +593,34 @@ int main(int argc, char* argv[]){
 	stringstream outputfilename;
 	outputfilename << arguments.outputfile;
 
-	TFile *outputfile = new TFile(outputfilename.str().c_str(), "RECREATE");
+	// When an interrupted run is continued, keep the MC results that were written during the
+	// MC iterations, but remove everything that may have been written at the end of the run.
+	MonteCarloCheckpoint checkpoint(arguments.outputfile, arguments.checkpoint_interval);
+	const Bool_t resume = arguments.use_mc && arguments.resume && checkpoint.exists();
 
-	TDirectory *td_mc = nullptr;
-	TDirectory *td_mc_spectra = nullptr;
-	TDirectory *td_mc_fit_parameters = nullptr;
-	TDirectory *td_mc_FEP = nullptr;
-	TDirectory *td_mc_reconstructed = nullptr;
+	// The output file stays open until the end. The MC results are written in the background.
+	OutputSession outputSession(outputfilename.str().c_str(), resume ? "UPDATE" : "RECREATE");
+	TFile *outputfile = outputSession.getFile();
 
-	outputfile->Close();
+	if(resume){
+		removeObjects(outputfile, {"monte_carlo"});
+		if(outputfile->GetDirectory("monte_carlo") != nullptr){
+			removeObjects(outputfile->GetDirectory("monte_carlo"), {"mc_samples", "blocks"});
+		}
+		if(outputfile->GetDirectory("monte_carlo/blocks") != nullptr){
+			removeObjects(outputfile->GetDirectory("monte_carlo/blocks"), {"block_"});
+		}
+	}
+
+	TDirectory *td_mc = nullptr;
 
 	/************ Use Top-Down unfolding to get start parameters *************/
 
 	cout << "> Unfold spectrum using top-down algorithm ..." << endl;
-	fitter.topdown(spectrum, response_matrix, topdown_params, binstart, binstop);
+	fitter.topdown(spectrum, fit_matrix, topdown_params, binstart, binstop);
 
 	fitter.fittedFEP(topdown_params, response_matrix, topdown_FEP);
-	fitter.fittedSpectrum(topdown_params, response_matrix, topdown_fit);
+	fitter.fittedSpectrum(topdown_params, fit_matrix, topdown_fit);
 
 	reconstructor.reconstruct(topdown_params, n_simulated_particles, topdown_spectrum_reconstructed);
 
@@ -266,165 +635,227 @@ int main(int argc, char* argv[]){
 
 	/************ Fit *************/
 
-	cout << "> Fit spectrum using TopDown parameters as start parameters ..." << endl;
+	const TH1F *start_params = &topdown_params;
+	if(arguments.multilevel > 0){
+		cout << "> Fit spectrum at " << arguments.multilevel << " coarser binnings to get start parameters ..." << endl;
+		MultilevelFitter multilevelFitter(arguments.binning, arguments.multilevel);
+		multilevelFitter.getStartParameters(spectrum, fit_matrix, arguments.left, arguments.right, multilevel_params);
+		start_params = &multilevel_params;
+		cout << "> Fit spectrum using the parameters of the coarser binning as start parameters ..." << endl;
+	} else{
+		cout << "> Fit spectrum using TopDown parameters as start parameters ..." << endl;
+	}
 
-	fitter.fit(spectrum, response_matrix, topdown_params, fit_params, fit_algorithm_uncertainty, binstart, binstop, arguments.verbose, arguments.correlation, correlation_matrix);
+	fitter.fit(spectrum, fit_matrix, *start_params, fit_params, fit_algorithm_uncertainty, binstart, binstop, arguments.verbose, arguments.correlation, correlation_matrix);
 
 	fitter.print_fitresult();
 
 	fitter.fittedFEP(fit_params, response_matrix, fit_FEP);
-	fitter.fittedSpectrum(fit_params, response_matrix, fit_result);
+	fitter.fittedSpectrum(fit_params, fit_matrix, fit_result);
 
 	reconstructor.reconstruct(fit_params, n_simulated_particles, spectrum_reconstructed);
 
 	if(arguments.use_mc){
 		// Create directories in TFile for MC output
 
-		outputfile = new TFile(outputfilename.str().c_str(), "UPDATE");
-		td_mc = outputfile->mkdir("monte_carlo");
-		td_mc_spectra = td_mc->mkdir("spectra");
-		td_mc_fit_parameters = td_mc->mkdir("fit_parameters");
-		td_mc_FEP = td_mc->mkdir("fep");
-		td_mc_reconstructed = td_mc->mkdir("reconstructed");
-		outputfile->Close();
+		td_mc = outputfile->mkdir("monte_carlo", "", true);
+		if(arguments.n_shards > 1){
+			td_mc->mkdir("blocks", "", true);
+		}
 
 		cout << "> Using Monte-Carlo algorithm to determine fit uncertainty (NRANDOM == " << arguments.uncertainty_mc << ")" << endl;
+		if(arguments.n_shards > 1){
+			cout << "\t> Processing shard " << arguments.shard << " of " << arguments.n_shards << endl;
+		}
+		if(arguments.mc_tolerance > 0.){
+			cout << "\t> Stopping as soon as the relative standard error of the MC uncertainty is below " << arguments.mc_tolerance << " (NMIN == " << arguments.mc_min_iterations << ")" << endl;
+		}
 
-		stringstream histname("");
+		vector<Double_t> block_buffer;
 		if(!arguments.use_mc_fast){
-			mc_matrix = TH2F("modified_response_matrix", "MC ResponseMatrix", nbins, 0., max_bin, nbins, 0., max_bin);
+			mc_matrix = ResponseMatrix(nbins);
+			if(!arguments.use_simulations){
+				mc_response_matrix.fromHistogram(response_matrix);
+			}
+			if(fold_resolution){
+				mc_folded_matrix = ResponseMatrix(nbins);
+			}
 		}
 
-		mc_fit_params = TH1F ("mc_fit_params", "MC Fit Parameters", nbins, 0., max_bin);
-
-		// If the '-W' option is used, always write new MC spectra to the 0-th entry of the
-		// vectors mc_spectra, mc_FEP_samples and mc_reconstruction_samples to save memory
-		if(arguments.write_mc_only){
-			mc_spectra.push_back(new TH1F(histname.str().c_str(), histname.str().c_str(), nbins,  0., max_bin));
-			mc_FEP_samples.push_back(new TH1F(histname.str().c_str(), histname.str().c_str(), nbins, 0., max_bin));
-			mc_reconstruction_samples.push_back(new TH1F(histname.str().c_str(), histname.str().c_str(), nbins, 0., max_bin));
-			mc_fit_params_samples.push_back(new TH1F(histname.str().c_str(), histname.str().c_str(), nbins, 0., max_bin));
+		if(!arguments.use_mc_fast && arguments.use_simulations){
+			vector<TString> simulation_filenames;
+			vector<Double_t> simulation_energies;
+			vector<Double_t> simulation_n_particles;
+			vector<vector<Double_t> > simulations;
+			vector<Double_t> simulation_axis_minimum;
+			vector<Double_t> simulation_axis_maximum;
+
+			inputFileReader.readInputFile(arguments.simulationfile, simulation_filenames, simulation_energies, simulation_n_particles);
+			inputFileReader.readSimulations(simulation_filenames, arguments.simulation_histname, simulations, simulation_axis_minimum, simulation_axis_maximum);
+			monteCarloUncertainty.setSimulations(simulations, simulation_axis_minimum, simulation_axis_maximum, simulation_energies, simulation_n_particles, response_matrix, binstart, binstop);
 		}
 
-		UInt_t j = 0;
+		if(arguments.mc_sampling == "antithetic"){
+			monteCarloUncertainty.setSamplingScheme(ANTITHETIC_SAMPLING, binstart, binstop);
+			mc_fit_params_accumulator.setAntitheticPairs(fit_params);
+			mc_block_accumulator.setAntitheticPairs(fit_params);
+		} else if(arguments.mc_sampling == "sobol"){
+			monteCarloUncertainty.setSamplingScheme(SOBOL_SAMPLING, binstart, binstop);
+		}
 
-		for(UInt_t i = 0; i < arguments.uncertainty_mc; ++i){
+		if(arguments.control_variate){
+			// The top-down parameters are a linear function of the spectrum, so their
+			// expectation value and variance for the fluctuated spectra are known exactly.
+			TH1F mc_expected_spectrum("mc_expected_spectrum", "MC Expected Spectrum", nbins, 0., max_bin);
+			mc_control_expectation = TH1F("mc_control_expectation", "MC Control Variate Expectation", nbins, 0., max_bin);
+			mc_control_variance = TH1F("mc_control_variance", "MC Control Variate Variance", nbins, 0., max_bin);
+
+			monteCarloUncertainty.getExpectedSpectrum(mc_expected_spectrum, spectrum, binstart, binstop);
+			fitter.topdown(mc_expected_spectrum, fit_matrix, mc_control_expectation, binstart, binstop);
+			if((UInt_t) (binstop - binstart + 1) > CONTROL_VARIATE_WARNING_BINS){
+				cout << "\t> Warning: The variance of the control variate for " << binstop - binstart + 1 << " bins in the fit range takes a time proportional to the third power of the number of bins. Use a larger binning factor or a smaller fit range if this is too slow." << endl;
+			}
+			uncertainty.getTopDownVariance(mc_expected_spectrum, fit_matrix, mc_control_variance, binstart, binstop);
+			mc_fit_params_accumulator.setControlVariate(mc_control_expectation, mc_control_variance);
+			mc_block_accumulator.setControlVariate(mc_control_expectation, mc_control_variance);
 
-			// If '-W' option is used, do not push back new entries, but work with the 0-th element
-			if(arguments.write_mc_only){
-				histname << "mc_spectrum_" << i;
-				mc_spectra[0] = new TH1F(histname.str().c_str(), histname.str().c_str(), nbins,  0., max_bin);
-				histname.str("");
-				histname << "mc_FEP_" << i;
-				mc_FEP_samples[0] = new TH1F(histname.str().c_str(), histname.str().c_str(), nbins, 0., max_bin);
+			mc_topdown_params = TH1F("mc_topdown_params", "MC TopDown Parameters", nbins, 0., max_bin);
+			mc_topdown_params.SetDirectory(nullptr);
+		}
 
-				histname.str("");
-				histname << "mc_reconstructed_spectrum_" << i;
-				mc_reconstruction_samples[0] = new TH1F(histname.str().c_str(), histname.str().c_str(), nbins, 0., max_bin);
-			} else{
-				histname << "mc_spectrum_" << i;
-				mc_spectra.push_back(new TH1F(histname.str().c_str(), histname.str().c_str(), nbins,  0., max_bin));
-				histname.str("");
-				histname << "mc_FEP_" << i;
-				mc_FEP_samples.push_back(new TH1F(histname.str().c_str(), histname.str().c_str(), nbins, 0., max_bin));
+		// The iterations are processed in blocks of MC_BLOCK_SIZE. Each block is accumulated
+		// separately and then merged into the total, always in the order of the blocks. Since
+		// each iteration has its own random number sequence (see MonteCarloUncertainty::setIteration()),
+		// the blocks can be distributed over several processes without changing the result.
+		const UInt_t n_blocks = (arguments.uncertainty_mc + MC_BLOCK_SIZE - 1)/MC_BLOCK_SIZE;
+		UInt_t first_block = 0;
+		Bool_t converged = false;
+		UInt_t n_processed_blocks = 0;
+
+		// Options that change the MC results. The checkpoint may only be used by a run
+		// with the same options.
+		vector<Double_t> run_info = {(Double_t) arguments.uncertainty_mc, (Double_t) arguments.seed, (Double_t) arguments.binning, (Double_t) binstart, (Double_t) binstop, (Double_t) MC_BLOCK_SIZE, (Double_t) arguments.shard, (Double_t) arguments.n_shards, arguments.mc_tolerance, (Double_t) arguments.mc_min_iterations, arguments.use_mc_fast ? 1. : 0., arguments.use_simulations ? 1. : 0., arguments.control_variate ? 1. : 0., arguments.mc_sampling == "antithetic" ? 1. : (arguments.mc_sampling == "sobol" ? 2. : 0.)};
+		run_info.insert(run_info.end(), arguments.resolution_params.begin(), arguments.resolution_params.end());
+
+		if(resume){
+			checkpoint.read(first_block, mc_iterations, converged, run_info, fit_params, mc_fit_params_accumulator);
+			cout << "\t> Resuming from checkpoint file " << checkpoint.getFileName() << " after " << mc_iterations << " iterations" << endl;
+		}
 
-				histname.str("");
-				histname << "mc_reconstructed_spectrum_" << i;
-				mc_reconstruction_samples.push_back(new TH1F(histname.str().c_str(), histname.str().c_str(), nbins, 0., max_bin));
+		if(arguments.write_mc){
+			outputSession.openSamples("monte_carlo", {"spectrum", "fit_params", "FEP", "reconstructed_spectrum"}, nbins, mc_iterations);
+		}
 
-				j = i;
+		for(UInt_t block = first_block; block < n_blocks && !converged; ++block){
+			if(block % arguments.n_shards != arguments.shard - 1){
+				continue;
 			}
 
-			monteCarloUncertainty.apply_fluctuations(*mc_spectra[j], spectrum, nbins, binstop);
-
-			histname.str("");
-			histname << "mc_fit_params_" << i;
-			mc_fit_params = TH1F(histname.str().c_str(), histname.str().c_str(), nbins,  0., max_bin);
-
-			if(arguments.use_mc_fast){
-				fitter.fit(*mc_spectra[j], response_matrix, fit_params, mc_fit_params, binstart, binstop);
-			} else{
-				monteCarloUncertainty.apply_fluctuations(mc_matrix, response_matrix, binstart, binstop);
-				fitter.fit(*mc_spectra[j], mc_matrix, fit_params, mc_fit_params, binstart, binstop);
+			for(UInt_t i = block*MC_BLOCK_SIZE; i < (block + 1)*MC_BLOCK_SIZE && i < arguments.uncertainty_mc; ++i){
+
+				monteCarloUncertainty.setIteration(i);
+
+				monteCarloUncertainty.apply_fluctuations(mc_spectrum, spectrum, binstart, binstop);
+
+				if(arguments.use_mc_fast){
+					fitter.fit(mc_spectrum, fit_matrix, fit_params, mc_fit_params, binstart, binstop);
+				} else{
+					if(arguments.use_simulations){
+						monteCarloUncertainty.apply_simulation_fluctuations(mc_matrix, binstart, binstop);
+					} else{
+						monteCarloUncertainty.apply_fluctuations(mc_matrix, mc_response_matrix, binstart, binstop);
+					}
+					if(fold_resolution){
+						resolution.foldMatrix(mc_matrix, mc_folded_matrix);
+						fitter.fit(mc_spectrum, mc_folded_matrix, fit_params, mc_fit_params, binstart, binstop);
+					} else{
+						fitter.fit(mc_spectrum, mc_matrix, fit_params, mc_fit_params, binstart, binstop);
+					}
+				}
+
+				if(arguments.control_variate){
+					fitter.topdown(mc_spectrum, fit_matrix, mc_topdown_params, binstart, binstop);
+					mc_block_accumulator.add(mc_fit_params, mc_topdown_params);
+				} else{
+					mc_block_accumulator.add(mc_fit_params);
+				}
+				++mc_iterations;
+
+				if(i % MC_UPDATE_INTERVAL == 0 && i > 0)
+					cout << "\t> Processed " << i << " Monte-Carlo iterations" << endl;
+
+				if(arguments.write_mc){
+					reconstructor.reconstruct(mc_fit_params, n_simulated_particles, mc_reconstructed_spectrum);
+					fitter.fittedFEP(mc_fit_params, response_matrix, mc_FEP);
+
+					// Skip the underflow bin
+					outputSession.writeSample(i, {mc_spectrum.GetArray() + 1, mc_fit_params.GetArray() + 1, mc_FEP.GetArray() + 1, mc_reconstructed_spectrum.GetArray() + 1});
+				}
 			}
 
-			if(arguments.write_mc_only){
-				mc_fit_params_samples[0] = &mc_fit_params;
+			if(arguments.n_shards > 1){
+				// Save the partial result of the block for horst_merge
+				block_buffer.clear();
+				mc_block_accumulator.serialize(block_buffer);
+				outputSession.write("monte_carlo/blocks", TString::Format("block_%u", block), block_buffer);
+			} else{
+				mc_fit_params_accumulator.merge(mc_block_accumulator);
 			}
-			else{
-				mc_fit_params_samples.push_back(&mc_fit_params);
+			mc_block_accumulator.reset();
+
+			if(arguments.mc_tolerance > 0. && mc_iterations >= arguments.mc_min_iterations){
+				mc_relative_standard_error = mc_fit_params_accumulator.getMaximumRelativeStandardError();
+				cout << "\t> Relative standard error of MC uncertainty after " << mc_iterations << " iterations: " << mc_relative_standard_error << endl;
+				if(mc_relative_standard_error < arguments.mc_tolerance){
+					converged = true;
+				}
 			}
 
-			reconstructor.reconstruct(mc_fit_params, n_simulated_particles, *mc_reconstruction_samples[j]);
-			fitter.fittedFEP(mc_fit_params, response_matrix, *mc_FEP_samples[j]);
-			histname.str("");
-
-			if(i % MC_UPDATE_INTERVAL == 0 && i > 0)
-				cout << "\t> Processed " << i << " Monte-Carlo iterations" << endl;
-
-			if(arguments.write_mc){
-				outputfile = new TFile(outputfilename.str().c_str(), "UPDATE");
-
-				td_mc_spectra = (TDirectory*) outputfile->Get("monte_carlo/spectra");
-				td_mc_spectra->cd();
-				mc_spectra[j]->Write();
-
-				td_mc_fit_parameters = (TDirectory*) outputfile->Get("monte_carlo/fit_parameters");
-				td_mc_fit_parameters->cd();
-				mc_fit_params_samples[j]->Write();
+			++n_processed_blocks;
+			mc_stopped = arguments.stop_after > 0 && n_processed_blocks >= arguments.stop_after && block + 1 < n_blocks && !converged;
 
-				td_mc_FEP = (TDirectory*) outputfile->Get("monte_carlo/fep");
-				td_mc_FEP->cd();
-				mc_FEP_samples[j]->Write();
-
-				td_mc_reconstructed = (TDirectory*) outputfile->Get("monte_carlo/reconstructed");
-				td_mc_reconstructed->cd();
-				mc_reconstruction_samples[j]->Write();
-
-				outputfile->Close();
+			if(checkpoint.due() || mc_stopped){
+				// The results of all iterations before the checkpoint must be in the output file
+				outputSession.sync();
+				checkpoint.write(block + 1, mc_iterations, converged, run_info, fit_params, mc_fit_params_accumulator);
+			}
+			if(mc_stopped){
+				break;
 			}
 		}
-		cout << "\t> Processed " << arguments.uncertainty_mc << " Monte-Carlo iterations" << endl;
+		if(mc_stopped){
+			outputSession.close();
+			cout << "\t> Stopped after " << mc_iterations << " Monte-Carlo iterations. Continue with the option '--resume'." << endl;
+
+			time(&stop);
+			cout << "> Execution time: " << stop - start << " seconds" << endl;
+			return 0;
+		}
+		mc_relative_standard_error = mc_fit_params_accumulator.getMaximumRelativeStandardError();
+		cout << "\t> Processed " << mc_iterations << " Monte-Carlo iterations" << endl;
+		if(arguments.mc_tolerance > 0. && mc_relative_standard_error >= arguments.mc_tolerance){
+			cout << "\t> Warning: Relative standard error of MC uncertainty (" << mc_relative_standard_error << ") did not reach the tolerance after NRANDOM == " << arguments.uncertainty_mc << " iterations." << endl;
+		}
 	}
 	/************ Uncertainties *************/
 
 	vector<TH1F*> uncertainties;
 
+	TString mc_sampling_scheme = arguments.mc_sampling;
+	if(arguments.control_variate){
+		mc_sampling_scheme += "+control_variate";
+	}
+
 	// Uncertainty of Monte-Carlo method
-	if(arguments.use_mc && !arguments.write_mc_only){
+	// If the MC iterations are distributed over several processes, this is done by horst_merge.
+	if(arguments.use_mc && arguments.n_shards == 1){
 
 		cout << "> Evaluating Monte-Carlo results ..." << endl;
 
-		mc_fit_params_mean = TH1F("mc_fit_params_mean", "MC Fit Parameters", nbins, 0., max_bin);
-		mc_fit_params_uncertainty = TH1F("mc_fit_params_uncertainty", "MC Fit Parameters Uncertainty", nbins, 0., max_bin);
-		mc_fit_total_uncertainty = TH1F("mc_fit_total_uncertainty", "MC Fit Total Uncertainty", nbins, 0., max_bin);
-
-		mc_fit_FEP = TH1F("mc_fit_FEP", "MC Fit FEP", nbins, 0., max_bin);
-		mc_fit_FEP_uncertainty = TH1F("mc_fit_FEP_uncertainty", "MC Fit FEP Uncertainty", nbins, 0., max_bin);
-		mc_FEP_uncertainty_low = TH1F("mc_FEP_uncertainty_low", "MC Fit FEP Uncertainty lower Limit", nbins, 0., max_bin);
-		mc_FEP_uncertainty_up = TH1F("mc_FEP_uncertainty_up", "MC Fit FEP Uncertainty upper Limit", nbins, 0., max_bin);
-
-		mc_spectrum_reconstructed = TH1F("mc_spectrum_reconstructed", "MC Reconstructed Spectrum", nbins, 0., max_bin);
-		mc_reconstruction_uncertainty = TH1F("mc_reconstruction_uncertainty", "MC Reconstruction Uncertainty", nbins, 0., max_bin);
-		mc_reconstruction_uncertainty_low = TH1F("mc_reconstruction_uncertainty_low", "MC Reconstruction Uncertainty lower Limit", nbins, 0., max_bin);
-		mc_reconstruction_uncertainty_up = TH1F("mc_reconstruction_uncertainty_up", "MC Reconstruction Uncertainty upper Limit", nbins, 0., max_bin);
-
-		monteCarloUncertainty.evaluateMeanAndStd(mc_fit_params_mean, mc_fit_params_uncertainty, mc_fit_params_samples, binstart, binstop);
+		monteCarloResult.evaluate(mc_fit_params_accumulator, fit_algorithm_uncertainty, response_matrix_diagonal, n_simulated_particles, mc_relative_standard_error, mc_sampling_scheme);
 
-		// Use the fit uncertainty from a single fit as an estimate for the uncertainty
-		// of the fitting algorithm
 		uncertainties.push_back(&fit_algorithm_uncertainty);
-		uncertainties.push_back(&mc_fit_params_uncertainty);
-		uncertainty.getTotalUncertainty(uncertainties, mc_fit_total_uncertainty);
-
-		fitter.fittedFEP(mc_fit_params_mean, response_matrix, mc_fit_FEP);
-		fitter.fittedFEP(mc_fit_params_uncertainty, response_matrix, mc_fit_FEP_uncertainty);
-		uncertainty.getLowerAndUpperLimit(mc_fit_FEP, mc_fit_FEP_uncertainty, mc_FEP_uncertainty_low, mc_FEP_uncertainty_up, true);
-
-		reconstructor.reconstruct(mc_fit_params_mean, n_simulated_particles, mc_spectrum_reconstructed);
-		reconstructor.reconstruct(mc_fit_total_uncertainty, n_simulated_particles, mc_reconstruction_uncertainty);
-		uncertainty.getLowerAndUpperLimit(mc_spectrum_reconstructed, mc_reconstruction_uncertainty, mc_reconstruction_uncertainty_low, mc_reconstruction_uncertainty_up, true);
-
+		uncertainties.push_back(monteCarloResult.getFitParamsUncertainty());
 	}
 
 	// Uncertainty of single fit
@@ -487,7 +918,8 @@ int main(int argc, char* argv[]){
 	/************ Write results to file *************/
 
 	// Write (rebinned) original spectrum
-	outputfile = new TFile(outputfilename.str().c_str(), "UPDATE");
+	outputSession.sync();
+	outputfile->cd();
 
 	spectrum.Write();
 	spectrum_reconstructed.Write();
@@ -529,30 +961,37 @@ int main(int argc, char* argv[]){
 		td_mc = (TDirectory*) outputfile->Get("monte_carlo");
 		td_mc->cd();
 
-		mc_fit_params_mean.Write();
-		mc_fit_params_uncertainty.Write();
+		if(arguments.n_shards == 1){
+			monteCarloResult.write();
+		}
 		fit_algorithm_uncertainty.Write();
 		fitter.fittedFEP(fit_algorithm_uncertainty, response_matrix, fit_algorithm_FEP_uncertainty);
 		reconstructor.reconstruct(fit_algorithm_uncertainty, n_simulated_particles, fit_algorithm_reconstruction_uncertainty);
-		mc_fit_total_uncertainty.Write();
-
-		mc_fit_FEP.Write();
-		mc_fit_FEP_uncertainty.Write();
-		mc_FEP_uncertainty_low.Write();
-		mc_FEP_uncertainty_up.Write();
-
-		if(!arguments.write_mc_only){
-			mc_spectrum_reconstructed.Write();
-			mc_reconstruction_uncertainty.Write();
-			mc_reconstruction_uncertainty_low.Write();
-			mc_reconstruction_uncertainty_up.Write();
+
+		if(arguments.n_shards > 1){
+			// Everything that horst_merge needs to check and evaluate the partial results
+			td_mc = (TDirectory*) outputfile->Get("monte_carlo/blocks");
+			td_mc->cd();
+
+			Double_t shard_info[10] = {(Double_t) arguments.shard, (Double_t) arguments.n_shards, (Double_t) arguments.uncertainty_mc, (Double_t) arguments.seed, (Double_t) MC_BLOCK_SIZE, (Double_t) arguments.binning, (Double_t) binstart, (Double_t) binstop, arguments.control_variate ? 1. : 0., arguments.mc_sampling == "antithetic" ? 1. : 0.};
+			TVectorD(10, shard_info).Write("shard_info");
+			TNamed("mc_sampling_scheme", mc_sampling_scheme.Data()).Write();
+			response_matrix_diagonal.Write();
+			if(arguments.control_variate){
+				mc_control_expectation.Write();
+				mc_control_variance.Write();
+			}
 		}
 	}
 
-	outputfile->Close();
+	outputSession.close();
 
 	cout << "> Wrote output file " << arguments.outputfile << " ..." << endl;
 
+	if(arguments.use_mc){
+		checkpoint.remove();
+	}
+
 	outputfilename.str("");
 	outputfilename << arguments.correlation_matrix_filename;
 
@@ -0,0 +1,485 @@
+/*
+    This file is part of Horst.
+
+    Horst is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Horst is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Horst.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <TFile.h>
+#include <TH1.h>
+#include <TH2.h>
+#include <TROOT.h>
+
+#include <algorithm>
+#include <argp.h>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <math.h>
+#include <sstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+#include "Config.h"
+#include "Fitter.h"
+#include "InputFileReader.h"
+#include "MonteCarloUncertainty.h"
+#include "Reconstructor.h"
+#include "Resolution.h"
+#include "ResponseMatrix.h"
+#include "Unfolder.h"
+
+using std::cout;
+using std::endl;
+using std::function;
+using std::getline;
+using std::ofstream;
+using std::ostream;
+using std::string;
+using std::stringstream;
+using std::vector;
+
+struct Arguments{
+	TString binnings = "40,20,10,5,2";
+	TString kernels = "all";
+	TString outputfile = "horst_bench.csv";
+	Double_t min_time = 0.5;
+	UInt_t n_fit_parameters = 30;
+	UInt_t n_threads = 1;
+	UInt_t seed = 0;
+};
+
+static char doc[] = "horst_bench, Measure the throughput of the main kernels of horst on synthetic data.\n\nThe number of bins is the compile-time constant NBINS divided by the rebinning factor, so the kernels are timed for every factor in the list of the '-b' option. For each kernel, a row with the exponent of the power law t ~ nbins^exponent, fitted to the times per call, is appended to the output.\n\nKernels: model, topdown, fit, addResponse, gaussianBlur, readMatrix, readMatrixWindow, mc_iteration, fillMatrix, unfold. 'readMatrix' and 'fillMatrix' always work on the full NBINS x NBINS matrix and are only timed once. 'readMatrixWindow' reads 10% of the rows of the same matrix. 'unfold' is the complete reconstruction of a spectrum by an Unfolder, which keeps the matrix in memory.";
+static char args_doc[] = "";
+
+static struct argp_option options[] = {
+	{"binnings", 'b', "BINNINGS", 0, "Comma-separated list of rebinning factors (default: '40,20,10,5,2')", 0},
+	{"kernels", 'k', "KERNELS", 0, "Comma-separated list of kernels to time (default: 'all')", 0},
+	{"outputfile", 'o', "OUTPUTFILENAME", 0, "Name of the output file in CSV format. Use '-' for the standard output. (default: 'horst_bench.csv')", 0},
+	{"time", 't', "SECONDS", 0, "Minimum time per measurement. A kernel is called repeatedly until this time has passed. (default: 0.5)", 0},
+	{"parameters", 'p', "NPARAMETERS", 0, "Number of free parameters in the 'fit', 'mc_iteration' and 'unfold' kernels. They are placed at the upper end of the spectrum. (default: 30)", 0},
+	{"threads", 'j', "THREADS", 0, "Number of threads for the 'addResponse' kernel (default: 1)", 0},
+	{"seed", 's', "SEED", 0, "Random number seed for the 'mc_iteration' kernel (default: 0)", 0},
+	{ 0, 0, 0, 0, 0, 0 }
+};
+
+static int parse_opt(int key, char *arg, struct argp_state *state){
+	struct Arguments *arguments = (struct Arguments*) state->input;
+
+	switch (key){
+		case 'b': arguments->binnings = arg; break;
+		case 'k': arguments->kernels = arg; break;
+		case 'o': arguments->outputfile = arg; break;
+		case 't': arguments->min_time = atof(arg); break;
+		case 'p': arguments->n_fit_parameters = (UInt_t) atoi(arg); break;
+		case 'j': arguments->n_threads = (UInt_t) atoi(arg); break;
+		case 's': arguments->seed = (UInt_t) atoi(arg); break;
+		case ARGP_KEY_ARG: argp_usage(state); break;
+		default: return ARGP_ERR_UNKNOWN;
+	}
+	return 0;
+}
+
+static struct argp argp = { options, parse_opt, args_doc, doc, 0, 0, 0};
+
+struct Measurement{
+	TString kernel;
+	UInt_t binning;
+	Int_t nbins;
+	UInt_t calls;
+	Double_t seconds_per_call;
+	TString work_unit;
+	Double_t work_per_call;
+};
+
+// Split a comma-separated list
+void splitList(const TString &list, vector<string> &items){
+	stringstream stream(list.Data());
+	string item;
+	while(getline(stream, item, ',')){
+		if(item != "")
+			items.push_back(item);
+	}
+}
+
+// Call the kernel until at least min_time seconds have passed and return the time per call.
+// Unless warm_up is false, the first call is not timed, so that one-time costs like the
+// allocation of buffers do not enter the measurement.
+Measurement timeKernel(const TString kernel_name, const UInt_t binning, const Int_t nbins, const TString work_unit, const Double_t work_per_call, const Double_t min_time, const Bool_t warm_up, const function<void()> &kernel){
+
+	cout << "> Timing " << kernel_name << " with " << nbins << " bins ..." << endl;
+
+	if(warm_up)
+		kernel();
+
+	const auto start = std::chrono::steady_clock::now();
+	UInt_t calls = 0;
+	Double_t elapsed = 0.;
+	do{
+		kernel();
+		++calls;
+		elapsed = std::chrono::duration<Double_t>(std::chrono::steady_clock::now() - start).count();
+	} while(elapsed < min_time);
+
+	Measurement measurement;
+	measurement.kernel = kernel_name;
+	measurement.binning = binning;
+	measurement.nbins = nbins;
+	measurement.calls = calls;
+	measurement.seconds_per_call = elapsed/calls;
+	measurement.work_unit = work_unit;
+	measurement.work_per_call = work_per_call;
+
+	return measurement;
+}
+
+// Synthetic response matrix with nbins x nbins bins and the same axes as the rebinned matrix
+// in horst. Each row contains a full-energy peak on the diagonal, whose efficiency decreases
+// with energy, a flat Compton continuum and the single- and double-escape peaks.
+void createMatrix(TH2F &rema, TH1F &n_simulated_particles, const Int_t nbins){
+	const Double_t n_simulated = 1e6;
+	const Int_t escape_bins = (Int_t) (511.*nbins/NBINS);
+
+	for(Int_t i = 1; i <= nbins; ++i){
+		n_simulated_particles.SetBinContent(i, n_simulated);
+
+		const Double_t fep = 0.3*n_simulated*exp(-2.*i/nbins);
+		const Double_t continuum = 0.5*n_simulated/i;
+
+		rema.SetBinContent(i, i, fep);
+		for(Int_t j = 1; j < i; ++j)
+			rema.SetBinContent(i, j, continuum);
+
+		if(i - 2*escape_bins > 0 && escape_bins > 0){
+			rema.SetBinContent(i, i - escape_bins, rema.GetBinContent(i, i - escape_bins) + 0.1*fep);
+			rema.SetBinContent(i, i - 2*escape_bins, rema.GetBinContent(i, i - 2*escape_bins) + 0.05*fep);
+		}
+	}
+}
+
+// Synthetic true spectrum with a flat background and equidistant peaks
+void createTrueSpectrum(TH1F &spectrum, const Int_t nbins){
+	const Int_t n_peaks = 8;
+	for(Int_t i = 1; i <= nbins; ++i){
+		Double_t content = 1e2;
+		for(Int_t k = 1; k <= n_peaks; ++k){
+			const Double_t distance = (i - (Double_t) k*nbins/(n_peaks + 1))/(0.002*nbins + 1.);
+			content += 1e5*exp(-0.5*distance*distance);
+		}
+		spectrum.SetBinContent(i, content);
+	}
+}
+
+// Synthetic simulation output of the detector response to monoenergetic particles, in the
+// format that InputFileReader::fillMatrix() expects
+void createSimulation(const TString filename, const TString histname, const Double_t energy, const Double_t n_simulated){
+	TFile file(filename, "RECREATE");
+	TH1F hist(histname, "Simulated Detector Response", (Int_t) NBINS, 0., (Double_t) NBINS);
+	const Int_t energy_bin = hist.FindBin(energy);
+
+	hist.SetBinContent(energy_bin, 0.3*n_simulated*exp(-2.*energy/NBINS));
+	for(Int_t j = 1; j < energy_bin; ++j)
+		hist.SetBinContent(j, 0.5*n_simulated/energy_bin);
+
+	hist.Write();
+	file.Close();
+}
+
+// Least-squares fit of log(t) = exponent*log(nbins) + c
+Double_t scalingExponent(const vector<Measurement> &measurements){
+	Double_t sum_x = 0., sum_y = 0., sum_xx = 0., sum_xy = 0.;
+	const Double_t n = (Double_t) measurements.size();
+
+	for(auto const &measurement: measurements){
+		const Double_t x = log((Double_t) measurement.nbins);
+		const Double_t y = log(measurement.seconds_per_call);
+		sum_x += x;
+		sum_y += y;
+		sum_xx += x*x;
+		sum_xy += x*y;
+	}
+
+	return (n*sum_xy - sum_x*sum_y)/(n*sum_xx - sum_x*sum_x);
+}
+
+int main(int argc, char* argv[]){
+
+	Arguments arguments;
+	argp_parse(&argp, argc, argv, 0, 0, &arguments);
+
+	TH1::AddDirectory(kFALSE);
+
+	vector<string> binning_list, kernel_list;
+	splitList(arguments.binnings, binning_list);
+	splitList(arguments.kernels, kernel_list);
+
+	vector<UInt_t> binnings;
+	for(auto const &binning: binning_list){
+		if(atoi(binning.c_str()) <= 0){
+			cout << __FILE__ << ":" << __LINE__ << ": " << __FUNCTION__ << "(): "<< "Error: Invalid rebinning factor '" << binning << "'. Aborting ..." << endl;
+			abort();
+		}
+		binnings.push_back((UInt_t) atoi(binning.c_str()));
+	}
+
+	auto selected = [&kernel_list](const string &kernel){
+		return std::find(kernel_list.begin(), kernel_list.end(), "all") != kernel_list.end() || std::find(kernel_list.begin(), kernel_list.end(), kernel) != kernel_list.end();
+	};
+
+	const Double_t max_bin = (Double_t) (NBINS - 1);
+	const vector<Double_t> resolution_params = {2., 0.3};
+
+	vector<Measurement> measurements;
+
+	/************ Kernels on the rebinned matrix *************/
+
+	for(auto const binning: binnings){
+		const Int_t nbins = (Int_t) NBINS/(Int_t) binning;
+		const Double_t n_matrix_elements = 0.5*nbins*(nbins + 1);
+		const Int_t n_fit_parameters = std::min((Int_t) arguments.n_fit_parameters, nbins - 1);
+		const Int_t binstart = nbins - n_fit_parameters;
+		const Int_t binstop = nbins;
+
+		TH2F response_matrix("rema", "Response_Matrix", nbins, 0., max_bin, nbins, 0., max_bin);
+		TH1F n_simulated_particles("n_simulated_particles", "Number of simulated particles per bin", nbins, 0., max_bin);
+		createMatrix(response_matrix, n_simulated_particles, nbins);
+
+		TH1F inverse_n_simulated_particles("inverse_n_simulated_particles", "Inverse Number of simulated particles per bin", nbins, 0., max_bin);
+		for(Int_t i = 1; i <= nbins; ++i)
+			inverse_n_simulated_particles.SetBinContent(i, 1./n_simulated_particles.GetBinContent(i));
+
+		TH1F true_spectrum("true_spectrum", "True Spectrum", nbins, 0., max_bin);
+		TH1F spectrum("spectrum", "Input Spectrum", nbins, 0., max_bin);
+		createTrueSpectrum(true_spectrum, nbins);
+
+		Reconstructor reconstructor(binning);
+		reconstructor.setThreads(arguments.n_threads);
+		reconstructor.addResponse(true_spectrum, inverse_n_simulated_particles, response_matrix, spectrum);
+
+		if(selected("addResponse")){
+			TH1F response_spectrum("response_spectrum", "Response Spectrum", nbins, 0., max_bin);
+			measurements.push_back(timeKernel("addResponse", binning, nbins, "matrix_elements", n_matrix_elements, arguments.min_time, true, [&](){
+				reconstructor.addResponse(true_spectrum, inverse_n_simulated_particles, response_matrix, response_spectrum);
+			}));
+		}
+
+		if(selected("gaussianBlur")){
+			Resolution resolution(binning);
+			TH1F blurred_spectrum("blurred_spectrum", "Blurred Spectrum", nbins, 0., max_bin);
+			measurements.push_back(timeKernel("gaussianBlur", binning, nbins, "bins", (Double_t) nbins, arguments.min_time, true, [&](){
+				resolution.gaussianBlur(spectrum, resolution_params, blurred_spectrum);
+			}));
+		}
+
+		TH1F topdown_params("topdown_params", "TopDown Parameters", nbins, 0., max_bin);
+
+		// Model evaluation and topdown over the whole spectrum
+		{
+			Fitter fitter(response_matrix, binning, 1, nbins);
+
+			if(selected("topdown")){
+				measurements.push_back(timeKernel("topdown", binning, nbins, "matrix_elements", n_matrix_elements, arguments.min_time, true, [&](){
+					fitter.topdown(spectrum, response_matrix, topdown_params, 1, nbins);
+				}));
+			} else{
+				fitter.topdown(spectrum, response_matrix, topdown_params, 1, nbins);
+			}
+			fitter.remove_negative(topdown_params);
+
+			if(selected("model")){
+				TH1F fitted_spectrum("fitted_spectrum", "Fitted Spectrum", nbins, 0., max_bin);
+				measurements.push_back(timeKernel("model", binning, nbins, "matrix_elements", n_matrix_elements, arguments.min_time, true, [&](){
+					fitter.fittedSpectrum(topdown_params, response_matrix, fitted_spectrum);
+				}));
+			}
+		}
+
+		if(selected("fit") || selected("mc_iteration")){
+			Fitter fitter(response_matrix, binning, binstart, binstop);
+			TH1F fit_params("fit_params", "Fit Parameters", nbins, 0., max_bin);
+
+			if(selected("fit")){
+				measurements.push_back(timeKernel("fit", binning, nbins, "fits", 1., arguments.min_time, true, [&](){
+					fitter.fit(spectrum, response_matrix, topdown_params, fit_params, binstart, binstop);
+				}));
+			}
+
+			// One iteration of the full MC uncertainty estimate, i.e. with fluctuations of the spectrum
+			// and the response matrix
+			if(selected("mc_iteration")){
+				MonteCarloUncertainty monteCarloUncertainty(binning, arguments.seed);
+				TH1F mc_spectrum("mc_spectrum", "MC Spectrum", nbins, 0., max_bin);
+				TH1F mc_fit_params("mc_fit_params", "MC Fit Parameters", nbins, 0., max_bin);
+				const ResponseMatrix mc_response_matrix(response_matrix);
+				ResponseMatrix mc_matrix(nbins);
+				fitter.fit(spectrum, response_matrix, topdown_params, fit_params, binstart, binstop);
+
+				UInt_t iteration = 0;
+				measurements.push_back(timeKernel("mc_iteration", binning, nbins, "iterations", 1., arguments.min_time, true, [&](){
+					monteCarloUncertainty.setIteration(iteration++);
+					monteCarloUncertainty.apply_fluctuations(mc_spectrum, spectrum, binstart, binstop);
+					monteCarloUncertainty.apply_fluctuations(mc_matrix, mc_response_matrix, binstart, binstop);
+					fitter.fit(mc_spectrum, mc_matrix, fit_params, mc_fit_params, binstart, binstop);
+				}));
+			}
+		}
+	}
+
+	/************ Kernels on the full matrix *************/
+
+	const Double_t n_full_matrix_elements = (Double_t) NBINS*(Double_t) NBINS;
+	InputFileReader inputFileReader(1);
+
+	if(selected("readMatrix") || selected("readMatrixWindow")){
+		const TString matrixfile = "horst_bench_matrix.root";
+		{
+			TH2F response_matrix("rema", "Response_Matrix", NBINS, 0., max_bin, NBINS, 0., max_bin);
+			TH1F n_simulated_particles("n_simulated_particles", "Number of simulated particles per bin", NBINS, 0., max_bin);
+			createMatrix(response_matrix, n_simulated_particles, (Int_t) NBINS);
+			inputFileReader.writeMatrix(response_matrix, n_simulated_particles, matrixfile, true);
+		}
+
+		TH2F response_matrix("rema", "Response_Matrix", NBINS, 0., max_bin, NBINS, 0., max_bin);
+		TH1F n_simulated_particles("n_simulated_particles", "Number of simulated particles per bin", NBINS, 0., max_bin);
+		if(selected("readMatrix")){
+			measurements.push_back(timeKernel("readMatrix", 1, (Int_t) NBINS, "matrix_elements", n_full_matrix_elements, arguments.min_time, false, [&](){
+				inputFileReader.readMatrix(response_matrix, n_simulated_particles, matrixfile);
+			}));
+		}
+
+		// A window of 10% of the rows in the middle of the matrix
+		if(selected("readMatrixWindow")){
+			const Int_t first_row = (Int_t) NBINS/2 - (Int_t) NBINS/20 + 1;
+			const Int_t last_row = (Int_t) NBINS/2 + (Int_t) NBINS/20;
+			const Double_t n_window_elements = (Double_t) (last_row - first_row + 1)*(Double_t) last_row;
+			measurements.push_back(timeKernel("readMatrixWindow", 1, (Int_t) NBINS, "matrix_elements", n_window_elements, arguments.min_time, false, [&](){
+				inputFileReader.readMatrix(response_matrix, n_simulated_particles, matrixfile, first_row, last_row);
+			}));
+		}
+
+		remove(matrixfile.Data());
+	}
+
+	if(selected("fillMatrix")){
+		const Int_t n_simulations = 10;
+		const Double_t n_simulated = 1e6;
+		const TString histname = "hpge0";
+
+		vector<TString> filenames;
+		vector<Double_t> energies;
+		vector<Double_t> n_particles;
+		for(Int_t k = 0; k < n_simulations; ++k){
+			filenames.push_back(TString::Format("horst_bench_simulation_%d.root", k));
+			energies.push_back((k + 0.5)*NBINS/n_simulations);
+			n_particles.push_back(n_simulated);
+			createSimulation(filenames.back(), histname, energies.back(), n_simulated);
+		}
+
+		TH2F response_matrix("rema", "Response_Matrix", NBINS, 0., (Double_t) NBINS, NBINS, 0., (Double_t) NBINS);
+		TH1F n_simulated_particles("n_simulated_particles", "Initial simulated particles", NBINS, 0., (Double_t) NBINS);
+		measurements.push_back(timeKernel("fillMatrix", 1, (Int_t) NBINS, "bins", (Double_t) NBINS, arguments.min_time, false, [&](){
+			inputFileReader.fillMatrix(filenames, energies, n_particles, histname, response_matrix, n_simulated_particles);
+		}));
+
+		for(auto const &filename: filenames)
+			remove(filename.Data());
+	}
+
+	// Reconstruction of a spectrum with a resident matrix. Only the construction of the
+	// Unfolder depends on the full matrix, so this is timed for each rebinning factor.
+	if(selected("unfold")){
+		TH2F response_matrix("rema", "Response_Matrix", NBINS, 0., max_bin, NBINS, 0., max_bin);
+		TH1F n_simulated_particles("n_simulated_particles", "Number of simulated particles per bin", NBINS, 0., max_bin);
+		createMatrix(response_matrix, n_simulated_particles, (Int_t) NBINS);
+
+		TH1F inverse_n_simulated_particles("inverse_n_simulated_particles", "Inverse Number of simulated particles per bin", NBINS, 0., max_bin);
+		for(Int_t i = 1; i <= (Int_t) NBINS; ++i)
+			inverse_n_simulated_particles.SetBinContent(i, 1./n_simulated_particles.GetBinContent(i));
+
+		TH1F true_spectrum("true_spectrum", "True Spectrum", NBINS, 0., max_bin);
+		TH1F spectrum("spectrum", "Input Spectrum", NBINS, 0., max_bin);
+		createTrueSpectrum(true_spectrum, (Int_t) NBINS);
+		Reconstructor reconstructor(1);
+		reconstructor.setThreads(arguments.n_threads);
+		reconstructor.addResponse(true_spectrum, inverse_n_simulated_particles, response_matrix, spectrum);
+
+		vector<Double_t> spectrum_values(NBINS);
+		for(Int_t i = 1; i <= (Int_t) NBINS; ++i)
+			spectrum_values[(size_t) (i - 1)] = spectrum.GetBinContent(i);
+
+		for(auto const binning: binnings){
+			const Int_t nbins = (Int_t) NBINS/(Int_t) binning;
+			const Int_t n_fit_parameters = std::min((Int_t) arguments.n_fit_parameters, nbins - 1);
+
+			Unfolder unfolder(response_matrix, n_simulated_particles, binning);
+			UnfoldingOptions options;
+			options.left = (UInt_t) (nbins - n_fit_parameters)*binning;
+			options.right = (UInt_t) nbins*binning;
+			UnfoldingResult result;
+
+			measurements.push_back(timeKernel("unfold", binning, nbins, "spectra", 1., arguments.min_time, true, [&](){
+				unfolder.unfold(spectrum_values, options, result);
+			}));
+		}
+	}
+
+	/************ Write results *************/
+
+	ofstream outputfile;
+	if(arguments.outputfile != "-"){
+		outputfile.open(arguments.outputfile.Data());
+		if(!outputfile.is_open()){
+			cout << __FILE__ << ":" << __LINE__ << ": " << __FUNCTION__ << "(): "<< "Error: Output file " << arguments.outputfile << " could not be opened. Aborting ..." << endl;
+			abort();
+		}
+	}
+	ostream &output = arguments.outputfile != "-" ? outputfile : cout;
+
+	output << "record,kernel,binning,nbins,calls,seconds_per_call,work_unit,work_per_call,throughput_per_second,scaling_exponent" << endl;
+	for(auto const &measurement: measurements){
+		output << "measurement," << measurement.kernel << "," << measurement.binning << "," << measurement.nbins << "," << measurement.calls << "," << measurement.seconds_per_call << "," << measurement.work_unit << "," << measurement.work_per_call << "," << measurement.work_per_call/measurement.seconds_per_call << "," << endl;
+	}
+
+	// Scaling exponents of the kernels which were timed for at least two different numbers of bins
+	vector<TString> kernel_names;
+	for(auto const &measurement: measurements){
+		if(std::find(kernel_names.begin(), kernel_names.end(), measurement.kernel) == kernel_names.end())
+			kernel_names.push_back(measurement.kernel);
+	}
+
+	for(auto const &kernel_name: kernel_names){
+		vector<Measurement> kernel_measurements;
+		for(auto const &measurement: measurements){
+			if(measurement.kernel == kernel_name)
+				kernel_measurements.push_back(measurement);
+		}
+
+		Bool_t different_nbins = false;
+		for(auto const &measurement: kernel_measurements){
+			if(measurement.nbins != kernel_measurements[0].nbins)
+				different_nbins = true;
+		}
+		if(!different_nbins)
+			continue;
+
+		output << "scaling," << kernel_name << ",,,,,,,," << scalingExponent(kernel_measurements) << endl;
+	}
+
+	if(arguments.outputfile != "-"){
+		outputfile.close();
+		cout << "> Wrote results to " << arguments.outputfile << endl;
+	}
+}
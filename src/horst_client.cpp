@@ -0,0 +1,260 @@
+/*
+    This file is part of Horst.
+
+    Horst is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Horst is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Horst.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <TH1.h>
+#include <TROOT.h>
+
+#include <argp.h>
+#include <chrono>
+#include <errno.h>
+#include <iomanip>
+#include <iostream>
+#include <limits.h>
+#include <limits>
+#include <sstream>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "Config.h"
+#include "InputFileReader.h"
+
+using std::cout;
+using std::endl;
+using std::string;
+using std::stringstream;
+
+struct Arguments{
+	TString socket_path = "";
+	TString spectrumfile = "";
+	TString spectrumname = "";
+	TString matrixfile = "";
+	TString resolution_file = "";
+	UInt_t binning = 10;
+	UInt_t left = 0;
+	UInt_t right = NBINS;
+	TString limitfile = "";
+	UInt_t uncertainty_mc = 0;
+	Bool_t use_mc_fast = false;
+	UInt_t seed = 1;
+	TString outputfile = "";
+	Bool_t inline_bins = false;
+	Bool_t shutdown = false;
+	Double_t wait = 0.;
+};
+
+static char doc[] = "horst_client, Send an unfolding job to horst in daemon mode ('horst --serve SOCKET') and print the answer.\n\nWithout the '-o' option, the results are printed as one line per histogram.";
+static char args_doc[] = "SOCKET [INPUTFILENAME]";
+
+// Key of options without a short version
+const int OPTION_RESOLUTION_FILE = 257;
+const int OPTION_SHUTDOWN = 258;
+const int OPTION_WAIT = 259;
+
+static struct argp_option options[] = {
+	{"matrixfile", 'm', "MATRIXFILENAME", 0, "Name of file that contains the response matrix (default: none, i.e. this option must be set by the user)", 0},
+	{"binning", 'b', "BINNING", 0, "Rebinning factor for input spectrum and response matrix (default: 10)", 0},
+	{"resolution_file", OPTION_RESOLUTION_FILE, "RESOLUTIONFILE", 0, "Fit with a response matrix into which the detector resolution from RESOLUTIONFILE is folded, like the option of horst (default: none)", 0},
+	{"left", 'l', "LEFT", 0, "Left limit of fit range (default: 0).", 0},
+	{"right", 'r', "RIGHT", 0, "Right limit of fit range (default: NBINS)", 0},
+	{"limit_file", 'L', "LIMITFILE", 0, "Read whitespace-separated limits from a single-line file (default: none, i.e. do not read limits from a file).", 0},
+	{"uncertainty_mc", 'u', "NRANDOM", 0, "Determine the uncertainty with NRANDOM Monte-Carlo iterations (default: 0, i.e. no MC)", 0},
+	{"uncertainty_mc_fast", 'U', "NRANDOM", 0, "Similar to '-u' option, but do not vary the response matrix (default: 0, i.e. no MC)", 0},
+	{"seed", 's', "SEED", 0, "Set the random number seed (default: 1)", 0},
+	{"tfile", 't', "SPECTRUM", 0, "Select SPECTRUM from a ROOT file called INPUTFILENAME, instead of a text file. (default: none, i.e. don't read from ROOT file)", 0},
+	{"outputfile", 'o', "OUTPUTFILENAME", 0, "Let the server write the results to OUTPUTFILENAME instead of sending them back (default: none)", 0},
+	{"inline", 'I', 0, 0, "Read the spectrum in the client and send the bin contents instead of the file name, for example if the server cannot access the file (default: false)", 0},
+	{"shutdown", OPTION_SHUTDOWN, 0, 0, "Stop the server after the running jobs instead of sending a job (default: false)", 0},
+	{"wait", OPTION_WAIT, "SECONDS", 0, "If the server is not ready yet, retry connecting to it for up to SECONDS seconds (default: 0, i.e. try only once)", 0},
+	{ 0, 0, 0, 0, 0, 0 }
+};
+
+static int parse_opt(int key, char *arg, struct argp_state *state){
+	struct Arguments *arguments = (struct Arguments*) state->input;
+
+	switch (key){
+		case ARGP_KEY_ARG:
+			if(state->arg_num == 0){
+				arguments->socket_path = arg;
+			} else if(state->arg_num == 1){
+				arguments->spectrumfile = arg;
+			} else{
+				argp_usage(state);
+			}
+			break;
+		case 'm': arguments->matrixfile = arg; break;
+		case 'b': arguments->binning = (UInt_t) atoi(arg); break;
+		case OPTION_RESOLUTION_FILE: arguments->resolution_file = arg; break;
+		case 'l': arguments->left = (UInt_t) atoi(arg); break;
+		case 'r': arguments->right = (UInt_t) atoi(arg); break;
+		case 'L': arguments->limitfile = arg; break;
+		case 'u': arguments->uncertainty_mc = (UInt_t) atoi(arg); break;
+		case 'U': arguments->uncertainty_mc = (UInt_t) atoi(arg); arguments->use_mc_fast = true; break;
+		case 's': arguments->seed = (UInt_t) atoi(arg); break;
+		case 't': arguments->spectrumname = arg; break;
+		case 'o': arguments->outputfile = arg; break;
+		case 'I': arguments->inline_bins = true; break;
+		case OPTION_SHUTDOWN: arguments->shutdown = true; break;
+		case OPTION_WAIT: arguments->wait = atof(arg); break;
+		case ARGP_KEY_END:
+			if(state->arg_num == 0 || (!arguments->shutdown && state->arg_num < 2)){
+				argp_usage(state);
+			}
+			if(!arguments->shutdown && arguments->matrixfile == ""){
+				cout << "Error: No matrix file given. Aborting ..." << endl;
+				abort();
+			}
+			break;
+		default: return ARGP_ERR_UNKNOWN;
+	}
+	return 0;
+}
+
+static struct argp argp = { options, parse_opt, args_doc, doc, 0, 0, 0};
+
+// The server may run in a different working directory
+TString absolutePath(const TString path){
+	if(path == "" || path.BeginsWith("/")){
+		return path;
+	}
+
+	char resolved_path[PATH_MAX];
+	if(realpath(path.Data(), resolved_path)){
+		return resolved_path;
+	}
+
+	// The output file does not exist yet
+	char working_directory[PATH_MAX];
+	if(getcwd(working_directory, PATH_MAX)){
+		return TString(working_directory) + "/" + path.Data();
+	}
+	return path;
+}
+
+int main(int argc, char* argv[]){
+
+	Arguments arguments;
+	argp_parse(&argp, argc, argv, 0, 0, &arguments);
+
+	TH1::AddDirectory(kFALSE);
+
+	/************ Create job *************/
+
+	stringstream job;
+	if(arguments.shutdown){
+		job << "shutdown\n";
+	} else{
+		InputFileReader inputFileReader(arguments.binning);
+		if(arguments.limitfile != ""){
+			vector<UInt_t> limits;
+			inputFileReader.readUnsignedIntParameters(limits, arguments.limitfile);
+			arguments.left = limits[0];
+			arguments.right = limits[1];
+		}
+
+		job << "matrix " << absolutePath(arguments.matrixfile) << "\n";
+		job << "binning " << arguments.binning << "\n";
+		if(arguments.resolution_file != ""){
+			job << "resolution_file " << absolutePath(arguments.resolution_file) << "\n";
+		}
+		job << "left " << arguments.left << "\n";
+		job << "right " << arguments.right << "\n";
+		if(arguments.uncertainty_mc > 0){
+			job << (arguments.use_mc_fast ? "uncertainty_mc_fast " : "uncertainty_mc ") << arguments.uncertainty_mc << "\n";
+		}
+		job << "seed " << arguments.seed << "\n";
+
+		if(arguments.inline_bins){
+			TH1F spectrum("spectrum", "Input Spectrum", NBINS, 0., (Double_t) NBINS - 1.);
+			if(arguments.spectrumname != ""){
+				inputFileReader.readROOTSpectrum(spectrum, arguments.spectrumfile, arguments.spectrumname);
+			} else{
+				inputFileReader.readTxtSpectrum(spectrum, arguments.spectrumfile);
+			}
+			// Send the bin contents without rounding, so that the daemon unfolds the same spectrum as from the file
+			job << std::setprecision(std::numeric_limits<Double_t>::max_digits10);
+			job << "bins";
+			for(Int_t i = 1; i <= (Int_t) NBINS; ++i){
+				job << " " << spectrum.GetBinContent(i);
+			}
+			job << "\n";
+		} else{
+			job << "spectrum " << absolutePath(arguments.spectrumfile) << "\n";
+			if(arguments.spectrumname != ""){
+				job << "spectrum_name " << arguments.spectrumname << "\n";
+			}
+		}
+
+		if(arguments.outputfile != ""){
+			job << "output " << absolutePath(arguments.outputfile) << "\n";
+		}
+		job << "end\n";
+	}
+
+	/************ Send job and print answer *************/
+
+	struct sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	strncpy(address.sun_path, arguments.socket_path.Data(), sizeof(address.sun_path) - 1);
+
+	// A server that was just started may not have created its socket yet (ENOENT), or a socket
+	// of a previous server may still exist (ECONNREFUSED)
+	const auto start_time = std::chrono::steady_clock::now();
+	int connection = -1;
+	while(true){
+		connection = socket(AF_UNIX, SOCK_STREAM, 0);
+		if(connection >= 0 && connect(connection, (struct sockaddr*) &address, sizeof(address)) == 0){
+			break;
+		}
+
+		const int connect_errno = errno;
+		const Double_t waited = std::chrono::duration<Double_t>(std::chrono::steady_clock::now() - start_time).count();
+		if(connection < 0 || (connect_errno != ENOENT && connect_errno != ECONNREFUSED) || waited >= arguments.wait){
+			cout << __FILE__ << ":" << __LINE__ << ": " << __FUNCTION__ << "(): "<< "Error: Could not connect to socket " << arguments.socket_path << " (" << strerror(connect_errno) << "). Aborting ..." << endl;
+			abort();
+		}
+		close(connection);
+		usleep(100000);
+	}
+
+	const string request = job.str();
+	size_t n_written = 0;
+	while(n_written < request.size()){
+		const ssize_t n = write(connection, request.data() + n_written, request.size() - n_written);
+		if(n <= 0){
+			cout << __FILE__ << ":" << __LINE__ << ": " << __FUNCTION__ << "(): "<< "Error: Could not send job (" << strerror(errno) << "). Aborting ..." << endl;
+			abort();
+		}
+		n_written += (size_t) n;
+	}
+
+	string answer = "";
+	char buffer[4096];
+	ssize_t n_read;
+	while((n_read = read(connection, buffer, sizeof(buffer))) > 0){
+		answer.append(buffer, (size_t) n_read);
+	}
+	close(connection);
+
+	cout << answer;
+
+	return answer.compare(0, 3, "ok\n") == 0 ? 0 : 1;
+}
@@ -0,0 +1,309 @@
+/*
+    This file is part of Horst.
+
+    Horst is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Horst is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Horst.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <TFile.h>
+#include <TH1.h>
+#include <TNamed.h>
+#include <TROOT.h>
+#include <TTree.h>
+#include <TVectorD.h>
+
+#include <argp.h>
+#include <iostream>
+#include <sstream>
+#include <stdlib.h>
+
+#include "Config.h"
+#include "MonteCarloAccumulator.h"
+#include "MonteCarloResult.h"
+#include "OutputSession.h"
+#include "Reconstructor.h"
+#include "Uncertainty.h"
+
+using std::cout;
+using std::endl;
+using std::vector;
+using std::stringstream;
+
+// Layout of the TVectorD 'shard_info' written by horst with the '-K' option
+enum ShardInfo{SHARD, N_SHARDS, NRANDOM, SEED, BLOCK_SIZE, BINNING, BINSTART, BINSTOP, CONTROL_VARIATE, ANTITHETIC, N_SHARD_INFO};
+
+struct Arguments{
+	vector<TString> shardfiles;
+	TString outputfile = "output.root";
+};
+
+static char doc[] = "horst_merge, combine the partial Monte-Carlo results of horst runs with the '-K' option";
+static char args_doc[] = "SHARDFILE...";
+
+static struct argp_option options[] = {
+	{"outputfile", 'o', "OUTPUTFILENAME", 0, "Name of output file (default: output.root). The output file is identical to the output of a single horst run with the same options, but without the '-K' option.", 0},
+	{ 0, 0, 0, 0, 0, 0}
+};
+
+static int parse_opt(int key, char *arg, struct argp_state *state){
+	struct Arguments *arguments = (struct Arguments*) state->input;
+
+	switch (key){
+		case ARGP_KEY_ARG: arguments->shardfiles.push_back(arg); break;
+		case 'o': arguments->outputfile = arg; break;
+		case ARGP_KEY_END:
+			if(arguments->shardfiles.size() == 0){
+				cout << "Error: No shard files given. Aborting ..." << endl;
+				abort();
+			}
+			break;
+		default: return ARGP_ERR_UNKNOWN;
+	}
+	return 0;
+}
+
+static struct argp argp = {options, parse_opt, args_doc, doc, 0, 0, 0};
+
+TObject* getObject(TDirectory *directory, const char *name){
+	TObject *object = directory->Get(name);
+	if(object == nullptr){
+		cout << __FILE__ << ":" << __LINE__ << ": " << __FUNCTION__ << "(): "<< "Error: Object '" << name << "' not found in file " << directory->GetName() << ". Was it created by horst with the '-u' and '-K' options? Aborting ..." << endl;
+		abort();
+	}
+	return object;
+}
+
+vector<Double_t> getVector(TDirectory *directory, const char *name){
+	const TVectorD *vector_d = (TVectorD*) getObject(directory, name);
+	return vector<Double_t>(vector_d->GetMatrixArray(), vector_d->GetMatrixArray() + vector_d->GetNrows());
+}
+
+int main(int argc, char* argv[]){
+
+	struct Arguments arguments;
+	argp_parse(&argp, argc, argv, 0, 0, &arguments);
+
+	const size_t n_files = arguments.shardfiles.size();
+
+	/************ Check the shards *************/
+
+	cout << "> Reading " << n_files << " shard files ..." << endl;
+
+	vector<TFile*> shardfiles(n_files, nullptr);
+	vector<vector<Double_t> > shard_info(n_files);
+	vector<TString> sampling_scheme(n_files);
+	// Index of the file for each shard
+	vector<Int_t> shard_file(n_files, -1);
+
+	for(size_t f = 0; f < n_files; ++f){
+		if(arguments.shardfiles[f] == arguments.outputfile){
+			cout << "Error: Output file " << arguments.outputfile << " is also an input file. Aborting ..." << endl;
+			abort();
+		}
+
+		shardfiles[f] = new TFile(arguments.shardfiles[f]);
+		if(shardfiles[f]->IsZombie()){
+			cout << "Error: Could not open shard file " << arguments.shardfiles[f] << ". Aborting ..." << endl;
+			abort();
+		}
+
+		shard_info[f] = getVector(shardfiles[f], "monte_carlo/blocks/shard_info");
+		sampling_scheme[f] = ((TNamed*) getObject(shardfiles[f], "monte_carlo/blocks/mc_sampling_scheme"))->GetTitle();
+
+		if(shard_info[f].size() != N_SHARD_INFO || (size_t) shard_info[f][N_SHARDS] != n_files){
+			cout << "Error: Shard file " << arguments.shardfiles[f] << " belongs to a run with " << (shard_info[f].size() == N_SHARD_INFO ? (size_t) shard_info[f][N_SHARDS] : 0) << " shards, but " << n_files << " files were given. Aborting ..." << endl;
+			abort();
+		}
+		for(size_t i = NRANDOM; i < N_SHARD_INFO; ++i){
+			if(shard_info[f][i] != shard_info[0][i] || sampling_scheme[f] != sampling_scheme[0]){
+				cout << "Error: Shard files " << arguments.shardfiles[0] << " and " << arguments.shardfiles[f] << " were created with different options. Aborting ..." << endl;
+				abort();
+			}
+		}
+
+		const size_t shard = (size_t) shard_info[f][SHARD] - 1;
+		if(shard_file[shard] != -1){
+			cout << "Error: Shard files " << arguments.shardfiles[(size_t) shard_file[shard]] << " and " << arguments.shardfiles[f] << " both contain shard " << shard + 1 << ". Aborting ..." << endl;
+			abort();
+		}
+		shard_file[shard] = (Int_t) f;
+	}
+
+	const UInt_t uncertainty_mc = (UInt_t) shard_info[0][NRANDOM];
+	const UInt_t block_size = (UInt_t) shard_info[0][BLOCK_SIZE];
+	const UInt_t binning = (UInt_t) shard_info[0][BINNING];
+	const Int_t binstart = (Int_t) shard_info[0][BINSTART];
+	const Int_t binstop = (Int_t) shard_info[0][BINSTOP];
+	const Bool_t control_variate = shard_info[0][CONTROL_VARIATE] == 1.;
+	const Bool_t antithetic = shard_info[0][ANTITHETIC] == 1.;
+
+	if(block_size != MC_BLOCK_SIZE){
+		cout << "Error: Shard files were created with a block size of " << block_size << " instead of MC_BLOCK_SIZE == " << MC_BLOCK_SIZE << ". Aborting ..." << endl;
+		abort();
+	}
+
+	/************ Create output file *************/
+
+	// The first shard contains all results of horst that do not depend on the MC iterations
+	TFile *firstfile = shardfiles[(size_t) shard_file[0]];
+	if(!TFile::Cp(firstfile->GetName(), arguments.outputfile, kFALSE)){
+		cout << "Error: Could not create output file " << arguments.outputfile << ". Aborting ..." << endl;
+		abort();
+	}
+	OutputSession outputSession(arguments.outputfile, "UPDATE");
+	TFile *outputfile = outputSession.getFile();
+
+	const UInt_t n_blocks = (uncertainty_mc + MC_BLOCK_SIZE - 1)/MC_BLOCK_SIZE;
+
+	/************ Merge the MC samples *************/
+
+	// MC samples only exist if horst was called with the '-w' option. They are copied block
+	// by block, so that they are in the same order as in a single horst process.
+	vector<TTree*> sample_trees(n_files, nullptr);
+	for(size_t f = 0; f < n_files; ++f){
+		sample_trees[f] = (TTree*) shardfiles[f]->Get("monte_carlo/mc_samples");
+	}
+
+	if(sample_trees[0] != nullptr){
+		cout << "> Merging MC samples ..." << endl;
+
+		vector<TString> quantities;
+		TObjArray *branches = sample_trees[0]->GetListOfBranches();
+		for(Int_t b = 0; b < branches->GetEntriesFast(); ++b){
+			const TString name = branches->At(b)->GetName();
+			if(name != "iteration"){
+				quantities.push_back(name);
+			}
+		}
+
+		const size_t nbins = (size_t) NBINS / (size_t) binning;
+		vector<UInt_t> iteration(n_files, 0);
+		vector<vector<vector<Float_t> > > values(n_files, vector<vector<Float_t> >(quantities.size(), vector<Float_t>(nbins, 0.)));
+		vector<vector<const Float_t*> > value_pointers(n_files);
+
+		for(size_t f = 0; f < n_files; ++f){
+			if(sample_trees[f] == nullptr){
+				cout << "Error: Shard file " << arguments.shardfiles[f] << " contains no MC samples. Were all shards created with the '-w' option? Aborting ..." << endl;
+				abort();
+			}
+			sample_trees[f]->SetBranchAddress("iteration", &iteration[f]);
+			for(size_t q = 0; q < quantities.size(); ++q){
+				sample_trees[f]->SetBranchAddress(quantities[q], &values[f][q][0]);
+				value_pointers[f].push_back(&values[f][q][0]);
+			}
+		}
+
+		((TDirectory*) getObject(outputfile, "monte_carlo"))->Delete("mc_samples;*");
+		outputSession.openSamples("monte_carlo", quantities, (Int_t) nbins, 0);
+
+		vector<Long64_t> entry(n_files, 0);
+		for(UInt_t block = 0; block < n_blocks; ++block){
+			const size_t f = (size_t) shard_file[block % n_files];
+			for(UInt_t i = block*MC_BLOCK_SIZE; i < (block + 1)*MC_BLOCK_SIZE && i < uncertainty_mc; ++i){
+				sample_trees[f]->GetEntry(entry[f]++);
+				if(iteration[f] != i){
+					cout << "Error: MC sample of iteration " << i << " not found in shard file " << arguments.shardfiles[f] << ". Aborting ..." << endl;
+					abort();
+				}
+				outputSession.writeSample(i, value_pointers[f]);
+			}
+		}
+	}
+
+	/************ Merge the blocks *************/
+
+	cout << "> Merging Monte-Carlo results (NRANDOM == " << uncertainty_mc << ") ..." << endl;
+
+	MonteCarloAccumulator mc_fit_params_accumulator(binning, binstart, binstop);
+	MonteCarloAccumulator mc_block_accumulator(binning, binstart, binstop);
+
+	if(control_variate){
+		const TH1F *mc_control_expectation = (TH1F*) getObject(outputfile, "monte_carlo/blocks/mc_control_expectation");
+		const TH1F *mc_control_variance = (TH1F*) getObject(outputfile, "monte_carlo/blocks/mc_control_variance");
+		mc_fit_params_accumulator.setControlVariate(*mc_control_expectation, *mc_control_variance);
+		mc_block_accumulator.setControlVariate(*mc_control_expectation, *mc_control_variance);
+	}
+	if(antithetic){
+		const TH1F *fit_params = (TH1F*) getObject(outputfile, "fit/fit_params");
+		mc_fit_params_accumulator.setAntitheticPairs(*fit_params);
+		mc_block_accumulator.setAntitheticPairs(*fit_params);
+	}
+
+	// Merge the blocks in the same order as a single horst process
+	for(UInt_t block = 0; block < n_blocks; ++block){
+		stringstream blockname;
+		blockname << "monte_carlo/blocks/block_" << block;
+		mc_block_accumulator.deserialize(getVector(shardfiles[(size_t) shard_file[block % n_files]], blockname.str().c_str()));
+		mc_fit_params_accumulator.merge(mc_block_accumulator);
+	}
+
+	const Double_t mc_relative_standard_error = mc_fit_params_accumulator.getMaximumRelativeStandardError();
+	cout << "\t> Merged " << mc_fit_params_accumulator.getNSamples() << " Monte-Carlo iterations" << endl;
+
+	/************ Uncertainties *************/
+
+	// Same as in horst, using the results of the first shard
+	TH1F *n_simulated_particles = (TH1F*) getObject(outputfile, "n_simulated_particles");
+	TH1F *spectrum_reconstructed = (TH1F*) getObject(outputfile, "spectrum_reconstructed");
+	TH1F *reconstruction_uncertainty = (TH1F*) getObject(outputfile, "reconstruction_uncertainty");
+	TH1F *reconstruction_uncertainty_low = (TH1F*) getObject(outputfile, "reconstruction_uncertainty_low");
+	TH1F *reconstruction_uncertainty_up = (TH1F*) getObject(outputfile, "reconstruction_uncertainty_up");
+	TH1F *response_matrix_diagonal = (TH1F*) getObject(outputfile, "monte_carlo/blocks/response_matrix_diagonal");
+
+	TH1F *fit_algorithm_uncertainty = (TH1F*) getObject(outputfile, "fit/fit_algorithm_uncertainty");
+	TH1F *fit_algorithm_FEP_uncertainty = (TH1F*) getObject(outputfile, "fit/fit_algorithm_FEP_uncertainty");
+	TH1F *fit_simulation_uncertainty = (TH1F*) getObject(outputfile, "fit/fit_simulation_uncertainty");
+	TH1F *fit_spectrum_uncertainty = (TH1F*) getObject(outputfile, "fit/fit_spectrum_uncertainty");
+	TH1F *fit_total_uncertainty = (TH1F*) getObject(outputfile, "fit/fit_total_uncertainty");
+
+	Reconstructor reconstructor(binning);
+	Uncertainty uncertainty(binning);
+	MonteCarloResult monteCarloResult(binning);
+
+	monteCarloResult.evaluate(mc_fit_params_accumulator, *fit_algorithm_uncertainty, *response_matrix_diagonal, *n_simulated_particles, mc_relative_standard_error, sampling_scheme[0]);
+
+	vector<TH1F*> uncertainties;
+	uncertainties.push_back(fit_algorithm_uncertainty);
+	uncertainties.push_back(monteCarloResult.getFitParamsUncertainty());
+	uncertainties.push_back(fit_algorithm_FEP_uncertainty);
+	uncertainties.push_back(fit_simulation_uncertainty);
+	uncertainties.push_back(fit_spectrum_uncertainty);
+	uncertainty.getTotalUncertainty(uncertainties, *fit_total_uncertainty);
+
+	reconstructor.uncertainty(*fit_total_uncertainty, *response_matrix_diagonal, *n_simulated_particles, *reconstruction_uncertainty);
+
+	uncertainty.getLowerAndUpperLimit(*spectrum_reconstructed, *reconstruction_uncertainty, *reconstruction_uncertainty_low, *reconstruction_uncertainty_up, true);
+
+	/************ Write results to file *************/
+
+	outputSession.sync();
+	outputfile->cd();
+	reconstruction_uncertainty->Write(0, TObject::kOverwrite);
+	reconstruction_uncertainty_low->Write(0, TObject::kOverwrite);
+	reconstruction_uncertainty_up->Write(0, TObject::kOverwrite);
+
+	((TDirectory*) getObject(outputfile, "fit"))->cd();
+	fit_total_uncertainty->Write(0, TObject::kOverwrite);
+
+	TDirectory *td_mc = (TDirectory*) getObject(outputfile, "monte_carlo");
+	td_mc->cd();
+	monteCarloResult.write();
+	td_mc->Delete("blocks;*");
+
+	outputSession.close();
+	for(auto shardfile: shardfiles){
+		shardfile->Close();
+	}
+
+	cout << "> Wrote output file " << arguments.outputfile << " ..." << endl;
+}
@@ -0,0 +1,231 @@
+/*
+    This file is part of Horst.
+
+    Horst is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Horst is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Horst.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <TMath.h>
+#include <TRandom3.h>
+#include <TROOT.h>
+
+#include <algorithm>
+#include <iostream>
+#include <math.h>
+#include <vector>
+
+#include "Config.h"
+#include "PoissonSampler.h"
+
+using std::cout;
+using std::endl;
+using std::vector;
+
+// Number of random numbers that are drawn for each mean value
+const size_t N_SAMPLES = 1000000;
+// Allowed deviation of the sample mean and variance, in units of their standard errors
+const Double_t N_STANDARD_ERRORS = 5.;
+// Smallest allowed p-value of the chi^2 tests of the distributions
+const Double_t MINIMUM_P_VALUE = 1e-4;
+// Smallest expected number of entries in a bin of a chi^2 test. Neighboring bins are merged
+// until they reach it.
+const Double_t MINIMUM_EXPECTED = 5.;
+// TRandom3::Poisson() is exact below this mean value and uses a normal approximation above
+const Double_t TRANDOM3_EXACT_LIMIT = 88.;
+
+// Compare the sample mean and variance of a set of Poisson-distributed random numbers to
+// the expected mean value. For a Poisson distribution, the variance of the sample mean is
+// mean/n, and the variance of the sample variance is approximately (mean + 2*mean^2)/n.
+Bool_t check(const TString method, const Double_t mean, const vector<Double_t> &result){
+	Double_t sum = 0.;
+	for(auto const &r: result){
+		sum += r;
+	}
+	const Double_t sample_mean = sum/(Double_t) result.size();
+
+	Double_t sum_of_squares = 0.;
+	for(auto const &r: result){
+		sum_of_squares += (r - sample_mean)*(r - sample_mean);
+	}
+	const Double_t sample_variance = sum_of_squares/(Double_t) (result.size() - 1);
+
+	const Double_t mean_error = sqrt(mean/(Double_t) result.size());
+	const Double_t variance_error = sqrt((mean + 2.*mean*mean)/(Double_t) result.size());
+
+	const Bool_t passed = fabs(sample_mean - mean) <= N_STANDARD_ERRORS*mean_error && fabs(sample_variance - mean) <= N_STANDARD_ERRORS*variance_error;
+
+	cout << (passed ? "  ok     " : "  FAILED ") << method << ": mean value " << mean << ", sample mean " << sample_mean << " +- " << mean_error << ", sample variance " << sample_variance << " +- " << variance_error << endl;
+
+	return passed;
+}
+
+// Histogram of the integer results in the range [minimum, minimum + counts.size()). Returns
+// false if a result is outside of the range.
+Bool_t fillHistogram(const vector<Double_t> &result, const Double_t minimum, vector<Double_t> &counts){
+	std::fill(counts.begin(), counts.end(), 0.);
+	for(auto const &r: result){
+		const Double_t bin = r - minimum;
+		if(bin < 0. || bin >= (Double_t) counts.size() || r != floor(r)){
+			return false;
+		}
+		counts[(size_t) bin] += 1.;
+	}
+	return true;
+}
+
+// Range of results that contains all but a negligible fraction of the Poisson distribution
+void getRange(const Double_t mean, Double_t &minimum, size_t &n_bins){
+	minimum = fmax(0., floor(mean - 8.*sqrt(mean) - 10.));
+	n_bins = (size_t) (ceil(mean + 8.*sqrt(mean) + 10.) - minimum) + 1;
+}
+
+// Pearson's chi^2 test of the distribution of the results against the probability mass
+// function (pmf) of the Poisson distribution
+Bool_t checkDistribution(const TString method, const Double_t mean, const vector<Double_t> &result){
+	Double_t minimum;
+	size_t n_bins;
+	getRange(mean, minimum, n_bins);
+
+	vector<Double_t> counts(n_bins, 0.);
+	if(!fillHistogram(result, minimum, counts)){
+		cout << "  FAILED " << method << ": mean value " << mean << ", result outside of [" << minimum << ", " << minimum + (Double_t) n_bins << ") or not an integer" << endl;
+		return false;
+	}
+
+	const Double_t n = (Double_t) result.size();
+	Double_t chi2 = 0.;
+	Int_t ndf = -1;
+	Double_t observed = 0., expected = 0.;
+	for(size_t i = 0; i < n_bins; ++i){
+		const Double_t k = minimum + (Double_t) i;
+		observed += counts[i];
+		expected += n*exp(-mean + k*log(mean) - lgamma(k + 1.));
+		// The remaining entries of the upper tail are added to the last bin
+		if(expected >= MINIMUM_EXPECTED && i < n_bins - 1){
+			chi2 += (observed - expected)*(observed - expected)/expected;
+			++ndf;
+			observed = 0.;
+			expected = 0.;
+		}
+	}
+	chi2 += (observed - expected)*(observed - expected)/fmax(expected, MINIMUM_EXPECTED);
+	++ndf;
+
+	const Double_t p_value = TMath::Prob(chi2, ndf);
+	const Bool_t passed = p_value >= MINIMUM_P_VALUE;
+
+	cout << (passed ? "  ok     " : "  FAILED ") << method << ": mean value " << mean << ", chi^2/ndf against the pmf " << chi2 << "/" << ndf << ", p-value " << p_value << endl;
+
+	return passed;
+}
+
+// Two-sample chi^2 test of the distribution of the results against the same number of
+// random numbers from TRandom3::Poisson(), the method that horst used before PoissonSampler
+Bool_t compareToTRandom3(const TString method, const Double_t mean, const vector<Double_t> &result, TRandom3 &random_generator){
+	Double_t minimum;
+	size_t n_bins;
+	getRange(mean, minimum, n_bins);
+
+	vector<Double_t> reference(result.size(), 0.);
+	for(auto &r: reference){
+		r = (Double_t) random_generator.Poisson(mean);
+	}
+
+	vector<Double_t> counts(n_bins, 0.), reference_counts(n_bins, 0.);
+	if(!fillHistogram(result, minimum, counts) || !fillHistogram(reference, minimum, reference_counts)){
+		cout << "  FAILED " << method << ": mean value " << mean << ", result outside of [" << minimum << ", " << minimum + (Double_t) n_bins << ")" << endl;
+		return false;
+	}
+
+	// Bins are merged until both samples have enough entries
+	Double_t chi2 = 0.;
+	Int_t ndf = 0;
+	Double_t observed = 0., reference_observed = 0.;
+	for(size_t i = 0; i < n_bins; ++i){
+		observed += counts[i];
+		reference_observed += reference_counts[i];
+		if((observed >= MINIMUM_EXPECTED && reference_observed >= MINIMUM_EXPECTED) || (i == n_bins - 1 && observed + reference_observed > 0.)){
+			chi2 += (observed - reference_observed)*(observed - reference_observed)/(observed + reference_observed);
+			++ndf;
+			observed = 0.;
+			reference_observed = 0.;
+		}
+	}
+
+	const Double_t p_value = TMath::Prob(chi2, ndf);
+	const Bool_t passed = p_value >= MINIMUM_P_VALUE;
+
+	cout << (passed ? "  ok     " : "  FAILED ") << method << ": mean value " << mean << ", chi^2/ndf against TRandom3::Poisson() " << chi2 << "/" << ndf << ", p-value " << p_value << endl;
+
+	return passed;
+}
+
+// Draw Poisson-distributed random numbers with a fixed seed for mean values that cover the
+// CDF table, the inversion for non-integer mean values and the PTRS method, and check
+// their mean and variance, and their distribution against the pmf. Below the mean value
+// where TRandom3::Poisson() becomes approximate, the distribution is also compared to
+// that of TRandom3::Poisson(). Both PoissonSampler::sample() and PoissonSampler::sampleInverse()
+// are tested. The program returns a nonzero exit code if any of the checks fails.
+int main(){
+
+	const vector<Double_t> means = {0.3, 1., 4.5, 9., POISSON_PTRS_THRESHOLD, 42., 1e3, 1e5};
+
+	TRandom3 random_generator(1);
+	TRandom3 reference_generator(2);
+	PoissonSampler poissonSampler;
+
+	vector<Double_t> mean(N_SAMPLES, 0.);
+	vector<Double_t> uniform(N_SAMPLES, 0.);
+	vector<Double_t> result(N_SAMPLES, 0.);
+
+	Bool_t passed = true;
+
+	cout << "> Checking PoissonSampler with " << N_SAMPLES << " samples per mean value ..." << endl;
+	for(auto const &m: means){
+		std::fill(mean.begin(), mean.end(), m);
+
+		poissonSampler.sample(random_generator, &mean[0], &result[0], N_SAMPLES);
+		passed = check("sample()", m, result) && passed;
+		passed = checkDistribution("sample()", m, result) && passed;
+		if(m < TRANDOM3_EXACT_LIMIT){
+			passed = compareToTRandom3("sample()", m, result, reference_generator) && passed;
+		}
+
+		random_generator.RndmArray((Int_t) N_SAMPLES, &uniform[0]);
+		poissonSampler.sampleInverse(&mean[0], &uniform[0], &result[0], N_SAMPLES);
+		passed = check("sampleInverse()", m, result) && passed;
+		passed = checkDistribution("sampleInverse()", m, result) && passed;
+		if(m < TRANDOM3_EXACT_LIMIT){
+			passed = compareToTRandom3("sampleInverse()", m, result, reference_generator) && passed;
+		}
+	}
+
+	// Cells with a mean value of zero must stay zero
+	std::fill(mean.begin(), mean.end(), 0.);
+	poissonSampler.sample(random_generator, &mean[0], &result[0], N_SAMPLES);
+	for(auto const &r: result){
+		if(r != 0.){
+			cout << "  FAILED sample(): nonzero result for a mean value of zero" << endl;
+			passed = false;
+			break;
+		}
+	}
+
+	if(!passed){
+		cout << "> PoissonSampler failed at least one check" << endl;
+		return 1;
+	}
+
+	cout << "> PoissonSampler passed all checks" << endl;
+	return 0;
+}
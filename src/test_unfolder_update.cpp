@@ -0,0 +1,122 @@
+/*
+    This file is part of Horst.
+
+    Horst is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Horst is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Horst.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <TDirectory.h>
+#include <TH1.h>
+#include <TH2.h>
+#include <TROOT.h>
+
+#include <iostream>
+#include <math.h>
+#include <vector>
+
+#include "Config.h"
+#include "InputFileReader.h"
+#include "Unfolder.h"
+
+using std::cout;
+using std::endl;
+using std::vector;
+
+// Allowed deviation of the top-down parameters, relative to their maximum absolute value.
+// The previous parameters of Unfolder::update() are stored in single precision.
+const Double_t TOLERANCE = 1e-4;
+
+void readSpectrum(InputFileReader &inputFileReader, const TString spectrumfile, const TString spectrumname, vector<Double_t> &values){
+	TH1F spectrum("spectrum", "Input Spectrum", (Int_t) NBINS, 0., (Double_t) NBINS - 1.);
+	inputFileReader.readROOTSpectrum(spectrum, spectrumfile, spectrumname);
+	values.resize(NBINS);
+	for(Int_t i = 1; i <= (Int_t) NBINS; ++i){
+		values[(size_t) (i - 1)] = spectrum.GetBinContent(i);
+	}
+}
+
+// Update an Unfolder from the spectrum 'previous' to 'current' and compare the top-down
+// parameters to those of an unfolding of 'current' from scratch.
+Bool_t check(const TString description, Unfolder &unfolder, const vector<Double_t> &previous, const vector<Double_t> &current, const UnfoldingOptions &options){
+	UnfoldingResult update_result, unfold_result;
+
+	unfolder.unfold(previous, options, update_result);
+	unfolder.update(current, options, update_result);
+	unfolder.unfold(current, options, unfold_result);
+
+	Double_t maximum = 0.;
+	for(auto const &p: unfold_result.topdown_params){
+		maximum = fmax(maximum, fabs(p));
+	}
+
+	Double_t maximum_deviation = 0.;
+	for(size_t i = 0; i < unfold_result.topdown_params.size(); ++i){
+		maximum_deviation = fmax(maximum_deviation, fabs(update_result.topdown_params[i] - unfold_result.topdown_params[i]));
+	}
+
+	const Bool_t passed = maximum > 0. && maximum_deviation <= TOLERANCE*maximum;
+
+	cout << (passed ? "  ok     " : "  FAILED ") << description << ": maximum deviation of the top-down parameters " << maximum_deviation << ", maximum top-down parameter " << maximum << endl;
+
+	return passed;
+}
+
+// Check that Unfolder::update() gives the same top-down parameters as Unfolder::unfold()
+// for a spectrum that changed in all bins, and for one that only changed in the lower half
+// of the fit range, where update() skips the bins above the change.
+// The program returns a nonzero exit code if any of the checks fails.
+int main(int argc, char* argv[]){
+
+	if(argc != 7){
+		cout << "Usage: " << argv[0] << " MATRIXFILE SPECTRUMFILE_1 SPECTRUMFILE_2 SPECTRUMNAME LIMITFILE BINNING" << endl;
+		return 2;
+	}
+	const UInt_t binning = (UInt_t) atoi(argv[6]);
+
+	TDirectory::TContext context(nullptr);
+	InputFileReader inputFileReader(binning);
+
+	vector<UInt_t> limits;
+	inputFileReader.readUnsignedIntParameters(limits, argv[5]);
+	UnfoldingOptions options;
+	options.left = limits[0];
+	options.right = limits[1];
+
+	vector<Double_t> spectrum_1, spectrum_2;
+	readSpectrum(inputFileReader, argv[2], argv[4], spectrum_1);
+	readSpectrum(inputFileReader, argv[3], argv[4], spectrum_2);
+
+	// Add counts to the lower half of the fit range only
+	vector<Double_t> spectrum_3 = spectrum_2;
+	for(UInt_t i = options.left; i < (options.left + options.right)/2; ++i){
+		spectrum_3[i] += 100.;
+	}
+
+	TH2F response_matrix("rema", "Response_Matrix", NBINS, 0., (Double_t) (NBINS - 1), NBINS, 0., (Double_t) (NBINS - 1));
+	TH1F n_simulated_particles("n_simulated_particles", "Number of simulated particles per bin", NBINS, 0., (Double_t) (NBINS - 1));
+	inputFileReader.readMatrix(response_matrix, n_simulated_particles, argv[1]);
+
+	Unfolder unfolder(response_matrix, n_simulated_particles, binning);
+
+	cout << "> Checking Unfolder::update() ..." << endl;
+	Bool_t passed = check("change of all bins", unfolder, spectrum_1, spectrum_2, options);
+	passed = check("change of low bins", unfolder, spectrum_2, spectrum_3, options) && passed;
+
+	if(!passed){
+		cout << "> Unfolder::update() failed at least one check" << endl;
+		return 1;
+	}
+
+	cout << "> Unfolder::update() passed all checks" << endl;
+	return 0;
+}
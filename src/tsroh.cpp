@@ -20,26 +20,34 @@
 #include <TStyle.h>
 #include <TFile.h>
 #include <TCanvas.h>
+#include <TRandom3.h>
 
 #include <argp.h>
+#include <functional>
 #include <iostream>
 #include <stdlib.h>
 #include <sstream>
+#include <thread>
 #include <time.h>
 
 #include "Config.h"
 #include "InputFileReader.h"
 #include "Reconstructor.h"
 #include "Resolution.h"
-#include "Fitter.h"
+#include "ResponseSampler.h"
+#include "SpectrumCreator.h"
 
 using std::cout;
 using std::endl;
 using std::vector;
 using std::stringstream;
+using std::function;
+using std::thread;
 
 struct Arguments{
 	UInt_t binning = 10;
+	UInt_t n_threads = 1;
+	UInt_t seed = 1;
 	TString spectrumfile = "";
 	TString spectrumname = "";
 	TString matrixfile = "";
@@ -50,22 +58,37 @@ struct Arguments{
 	Bool_t resolution_file_given = false;
 	Bool_t interactive_mode = false;
 	Bool_t statistics = false;
+	Bool_t event_sampling = false;
 	Bool_t tfile = false;
+	Bool_t batch = false;
+	TString family = "";
 };
 
 static char doc[] = "Tsroh, Transfer spectroscopic response on histogram";
 static char args_doc[] = "INPUTFILENAME";
 
+// Key of options without a short version
+const int OPTION_SEED = 256;
+
 static struct argp_option options[] = {
 	{"binning", 'b', "BINNING", 0, "Rebinning factor for input histograms (default: 10)", 0},
 	{"matrixfile", 'm', "MATRIXFILENAME", 0, "Name of file that contains the response matrix", 0},
 	{"outputfile", 'o', "OUTPUTFILENAME", 0, "Name of output file (default: 'output.root')", 0},
+	{"threads", 'j', "THREADS", 0, "Number of threads used to add the response to the spectrum, or to process spectra in batch mode (default: 1)", 0},
 	{"interactive_mode", 'i', 0, 0, "Interactive mode (show results in ROOT application, switched off by default)", 0},
 	{"resolution", 'r', "RESOLUTION", 0, "Set detector resolution (default: 0)", 0},
 	{"resolution_file", 'R', "RESOLUTIONFILE", 0, "Read whitespace-separated detector resolution parameters from file", 0},
 	{"statistics", 's', 0, 0, "Add statistical fluctuations to response (switched off by default)", 0},
+	{"events", 'e', 0, 0, "Add statistical fluctuations to response by sampling single events, which is faster than '-s' if the spectrum has less counts than the response matrix has bins (switched off by default)", 0},
 	{"tfile", 't', "SPECTRUM", 0, "Select SPECTRUM from a ROOT file called INPUTFILENAME, instead of a text file."
 	" Spectrum must be an object of TH1F.", 0},
+	{"batch", 'B', 0, 0, "Batch mode: INPUTFILENAME is a list of spectrum files, one per line. All spectra are processed with"
+	" the same response matrix and written to the directories 'spectrum_0', 'spectrum_1', ... of the output file.", 0},
+	{"family", 'F', "SHAPE", 0, "Batch mode for a family of test spectra with the SHAPE 'bar' or 'normal': INPUTFILENAME is a"
+	" list of the parameters 'EVENTS CENTROID WIDTH' of one spectrum per line.", 0},
+	{"seed", OPTION_SEED, "SEED", 0, "Set the random number seed for '-s' and '-e'. In batch mode, the random numbers of each spectrum are"
+	" derived from SEED and the index of the spectrum, so that the fluctuations of different spectra are independent and the"
+	" results do not depend on the number of threads. (default: 1)", 0},
 	{ 0, 0, 0, 0, 0, 0}
 };
 
@@ -77,6 +100,7 @@ static int parse_opt(int key, char *arg, struct argp_state *state){
 		case 'b': arguments->binning = (UInt_t) atoi(arg); break;
 		case 'm': arguments->matrixfile= arg; break;
 		case 'o': arguments->outputfile = arg; break;
+		case 'j': arguments->n_threads = (UInt_t) atoi(arg); break;
 		case 'i': arguments->interactive_mode= true; break;
 		case 'r': arguments->resolution_params.push_back(atof(arg));
 			  arguments->resolution_set = true;
@@ -86,7 +110,11 @@ static int parse_opt(int key, char *arg, struct argp_state *state){
 			  arguments->resolution_file_given = true;
 			  break;
 		case 's': arguments->statistics= true; break;
+		case 'e': arguments->event_sampling = true; break;
 		case 't': arguments->tfile = true; arguments->spectrumname = arg; break;
+		case 'B': arguments->batch = true; break;
+		case 'F': arguments->family = arg; break;
+		case OPTION_SEED: arguments->seed = (UInt_t) atoi(arg); break;
 		case ARGP_KEY_END:
 			if(state->arg_num == 0){
 				argp_usage(state);
@@ -95,6 +123,14 @@ static int parse_opt(int key, char *arg, struct argp_state *state){
 				cout << "Error: No matrix file given. Aborting ..." << endl;
 				abort();
 			}
+			if(arguments->family != "" && arguments->family != "bar" && arguments->family != "normal"){
+				cout << "Error: Unknown spectrum family '" << arguments->family << "'. Aborting ..." << endl;
+				abort();
+			}
+			if((arguments->batch || arguments->family != "") && arguments->interactive_mode){
+				cout << "Error: Interactive mode is not available in batch mode. Aborting ..." << endl;
+				abort();
+			}
 			break;
 		default: return ARGP_ERR_UNKNOWN;
 	}
@@ -103,6 +139,153 @@ static int parse_opt(int key, char *arg, struct argp_state *state){
 
 static struct argp argp = { options, parse_opt, args_doc, doc, 0, 0, 0};
 
+// Seed of the random number generator for spectrum k of a batch. The seed and the index are
+// mixed with the SplitMix64 finalizer like in MonteCarloUncertainty::getIterationSeed(), so
+// that the random numbers of neighboring spectra and of different seeds are uncorrelated.
+UInt_t getSpectrumSeed(const UInt_t seed, const size_t k){
+	ULong64_t z = (((ULong64_t) seed << 32) | (ULong64_t) (UInt_t) k) + 0x9e3779b97f4a7c15ull;
+	z = (z ^ (z >> 30))*0xbf58476d1ce4e5b9ull;
+	z = (z ^ (z >> 27))*0x94d049bb133111ebull;
+	z = z ^ (z >> 31);
+
+	// TRandom3::SetSeed(0) would choose a random seed
+	const UInt_t spectrum_seed = (UInt_t) (z ^ (z >> 32));
+	return spectrum_seed == 0 ? 1 : spectrum_seed;
+}
+
+// Call process(k) for k = 0 ... n - 1, distributed round-robin over n_threads threads
+void forEachSpectrum(const size_t n, const UInt_t n_threads, const function<void(const size_t)> &process){
+
+	auto process_spectra = [&](const size_t first){
+		for(size_t k = first; k < n; k += (size_t) n_threads){
+			process(k);
+		}
+	};
+
+	if(n_threads <= 1){
+		process_spectra(0);
+		return;
+	}
+
+	vector<thread> threads;
+	for(size_t t = 0; t < (size_t) n_threads; ++t){
+		threads.push_back(thread(process_spectra, t));
+	}
+	for(auto &t: threads){
+		t.join();
+	}
+}
+
+void processBatch(const Arguments &arguments, InputFileReader &inputFileReader, Reconstructor &reconstructor, Resolution &resolution, const TH2F &response_matrix, const TH1F &inverse_n_simulated_particles){
+
+	const Int_t nbins = (Int_t) NBINS/(Int_t) arguments.binning;
+
+	// The histograms of different spectra have the same names, and they are created and
+	// filled in several threads, so they must not be attached to the current directory.
+	TH1::AddDirectory(kFALSE);
+
+	/************ Read or create spectra *************/
+
+	vector<TH1F> spectra;
+	vector<TString> titles;
+
+	if(arguments.family == ""){
+		vector<TString> spectrumfiles;
+		inputFileReader.readFileList(spectrumfiles, arguments.spectrumfile);
+
+		cout << "> Reading " << spectrumfiles.size() << " spectrum files ..." << endl;
+		for(auto &spectrumfile: spectrumfiles){
+			spectra.push_back(TH1F("spectrum", "Input Spectrum", (Int_t) NBINS, 0., (Double_t) NBINS - 1));
+			if(arguments.tfile)
+				inputFileReader.readROOTSpectrum(spectra.back(), spectrumfile, arguments.spectrumname);
+			else
+				inputFileReader.readTxtSpectrum(spectra.back(), spectrumfile);
+			titles.push_back(spectrumfile);
+		}
+	} else{
+		SpectrumCreator spectrumCreator;
+		vector<vector<Double_t> > family_params;
+		inputFileReader.readDoubleTable(family_params, arguments.spectrumfile);
+
+		cout << "> Creating " << family_params.size() << " '" << arguments.family << "' spectra ..." << endl;
+		for(auto &params: family_params){
+			if(params.size() < 3){
+				cout << __FILE__ << ":" << __LINE__ << ": " << __FUNCTION__ << "(): "<< "Error: Expected 3 parameters 'EVENTS CENTROID WIDTH' per line of " << arguments.spectrumfile << ", found " << params.size() << ". Aborting ..." << endl;
+				abort();
+			}
+			spectra.push_back(TH1F("spectrum", "Input Spectrum", (Int_t) NBINS, 0., (Double_t) NBINS - 1));
+			if(arguments.family == "bar")
+				spectrumCreator.createBarSpectrum(spectra.back(), params);
+			else
+				spectrumCreator.createNormalSpectrum(spectra.back(), params);
+			titles.push_back(TString::Format("%s %g %g %g", arguments.family.Data(), params[0], params[1], params[2]));
+		}
+	}
+
+	if(arguments.binning != 1){
+		for(auto &spectrum: spectra)
+			spectrum.Rebin((Int_t) arguments.binning);
+	}
+
+	const size_t n_spectra = spectra.size();
+	vector<TH1F> high_resolution_spectra(n_spectra, TH1F("high_resolution_spectrum", "Response Spectrum if measured with perfect Resolution", nbins, 0., (Double_t) NBINS - 1));
+	vector<TH1F> response_spectra(n_spectra, TH1F("response_spectrum", "Spectrum with Response", nbins, 0., (Double_t) NBINS - 1));
+	vector<TH1F> response_spectra_FEP(n_spectra, TH1F("response_spectrum_FEP", "Spectrum with Response, normalized to FEP", nbins, 0., (Double_t) NBINS - 1));
+
+	/************ Add response to spectra *************/
+
+	cout << "> Adding response to " << n_spectra << " spectra ..." << endl;
+	if(arguments.event_sampling){
+		// The alias tables are shared by all spectra, but their buffers are not thread-safe
+		TRandom3 random_generator;
+		ResponseSampler responseSampler(response_matrix, arguments.binning);
+		for(size_t k = 0; k < n_spectra; ++k){
+			random_generator.SetSeed(getSpectrumSeed(arguments.seed, k));
+			responseSampler.addRealisticResponse(random_generator, spectra[k], inverse_n_simulated_particles, high_resolution_spectra[k], response_spectra_FEP[k]);
+		}
+	} else if(arguments.statistics){
+		forEachSpectrum(n_spectra, arguments.n_threads, [&](const size_t k){
+			TRandom3 random_generator(getSpectrumSeed(arguments.seed, k));
+			reconstructor.addRealisticResponse(random_generator, spectra[k], inverse_n_simulated_particles, response_matrix, high_resolution_spectra[k], response_spectra_FEP[k]);
+		});
+	} else{
+		reconstructor.addResponse(spectra, inverse_n_simulated_particles, response_matrix, high_resolution_spectra, response_spectra_FEP);
+	}
+
+	/************ Blur spectra with finite resolution *************/
+
+	if(arguments.resolution_set){
+		cout << "> Blurring spectra with detector response ..." << endl;
+		resolution.setParameters(arguments.resolution_params);
+		forEachSpectrum(n_spectra, arguments.n_threads, [&](const size_t k){
+			resolution.blur(high_resolution_spectra[k], response_spectra[k]);
+		});
+	} else{
+		for(size_t k = 0; k < n_spectra; ++k){
+			for(Int_t i = 1; i <= nbins; ++i){
+				response_spectra[k].SetBinContent(i, high_resolution_spectra[k].GetBinContent(i));
+			}
+		}
+	}
+
+	/************ Write results to file *************/
+
+	cout << "> Writing output file " << arguments.outputfile << " ..." << endl;
+
+	TFile outputfile(arguments.outputfile, "RECREATE");
+	for(size_t k = 0; k < n_spectra; ++k){
+		TDirectory *directory = outputfile.mkdir(TString::Format("spectrum_%zu", k), titles[k]);
+		directory->cd();
+		spectra[k].Write();
+		response_spectra_FEP[k].Write();
+		if(arguments.resolution_set)
+			high_resolution_spectra[k].Write();
+		response_spectra[k].Write();
+	}
+
+	outputfile.Close();
+}
+
 int main(int argc, char* argv[]){
 
 	time_t start, stop;
@@ -117,6 +300,7 @@ int main(int argc, char* argv[]){
 
 	InputFileReader inputFileReader(arguments.binning);
 	Reconstructor reconstructor(arguments.binning);
+	reconstructor.setThreads(arguments.n_threads);
 	Resolution resolution(arguments.binning);
 
 	/************ Initialize histograms *************/
@@ -144,19 +328,7 @@ int main(int argc, char* argv[]){
 		app = new TApplication("Reconstruction", &argc, argv);
 	}
 
-	/************ Read and rebin spectrum and response matrix *************/
-	/************ + initialize Fitter using the response matrix ***********/
-
-	cout << "> Reading spectrum file " << arguments.spectrumfile << " ..." << endl;
-	if(arguments.tfile)
-		inputFileReader.readROOTSpectrum(spectrum, arguments.spectrumfile, arguments.spectrumname);
-	else{
-		inputFileReader.readTxtSpectrum(spectrum, arguments.spectrumfile);
-	}
-	if(arguments.binning != 1){
-		cout << "> Rebinning spectrum ..." << endl;
-		spectrum.Rebin((Int_t) arguments.binning);
-	}
+	/************ Read and rebin response matrix *************/
 
 	cout << "> Reading matrix file " << arguments.matrixfile << " ..." << endl;
 	inputFileReader.readMatrix(response_matrix, n_simulated_particles, arguments.matrixfile);
@@ -169,19 +341,45 @@ int main(int argc, char* argv[]){
 	for(Int_t i = 0; i <= (Int_t) NBINS/(Int_t) arguments.binning; ++i)
 		inverse_n_simulated_particles.SetBinContent(i, 1./n_simulated_particles.GetBinContent(i));
 
-	Fitter fitter(response_matrix, arguments.binning, 0, NBINS - 1);
-
 	/************ Read resolution parameters from file  *************/
 
 	if(arguments.resolution_file_given){
 		inputFileReader.readDoubleParameters(arguments.resolution_params, arguments.resolution_file);
 	}
 
+	/************ Batch mode: process many spectra with the same matrix *************/
+
+	if(arguments.batch || arguments.family != ""){
+		processBatch(arguments, inputFileReader, reconstructor, resolution, response_matrix, inverse_n_simulated_particles);
+
+		time(&stop);
+		cout << "> Execution time: " << stop - start << " seconds" << endl;
+		return 0;
+	}
+
+	/************ Read and rebin spectrum *************/
+
+	cout << "> Reading spectrum file " << arguments.spectrumfile << " ..." << endl;
+	if(arguments.tfile)
+		inputFileReader.readROOTSpectrum(spectrum, arguments.spectrumfile, arguments.spectrumname);
+	else{
+		inputFileReader.readTxtSpectrum(spectrum, arguments.spectrumfile);
+	}
+	if(arguments.binning != 1){
+		cout << "> Rebinning spectrum ..." << endl;
+		spectrum.Rebin((Int_t) arguments.binning);
+	}
+
+
 	/************ Add response to experimental spectrum *************/
 
 	cout << "> Adding response to spectrum ..." << endl;
-	if(arguments.statistics){
-		reconstructor.addRealisticResponse(spectrum, inverse_n_simulated_particles, response_matrix, high_resolution_spectrum, response_spectrum_FEP);
+	TRandom3 random_generator(getSpectrumSeed(arguments.seed, 0));
+	if(arguments.event_sampling){
+		ResponseSampler responseSampler(response_matrix, arguments.binning);
+		responseSampler.addRealisticResponse(random_generator, spectrum, inverse_n_simulated_particles, high_resolution_spectrum, response_spectrum_FEP);
+	} else if(arguments.statistics){
+		reconstructor.addRealisticResponse(random_generator, spectrum, inverse_n_simulated_particles, response_matrix, high_resolution_spectrum, response_spectrum_FEP);
 		// Not necessary any more when sampling from Poisson distribution
 		// Even if a negative mean value parameter is given to TRandom3::Poisson()
 		// the function will simply return zero